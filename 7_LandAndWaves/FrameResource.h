@@ -57,6 +57,8 @@ public:
     // 新增1个模拟波浪的字段,借助动态顶点计数,只不过这次Uploader类的对象不再是CB数组,而是顶点数据数组
     // 每一帧都需要从CPU向波浪动态顶点缓存区 上传新的数据, 因此动态顶点缓存要被设置在帧资源里
     std::unique_ptr<UploadBuffer<Vertex>> WavesVB = nullptr;
+    // WavesVB里的数据对应的Waves版本号, 0表示还没写过; 下次只需重写这之后改动过的块
+    UINT WavesVersion = 0;
 
     // Fence value to mark commands up to this fence point.  This lets us
     // check if these frame resources are still in use by the GPU.
@@ -433,15 +433,12 @@ void LandAndWavesApp::UpdateWaves(const GameTimer& gt)
 
 	/* 使用波浪数学方程计算出的新数据来更新"波浪动态顶点缓存"*/
 	auto currWavesVB = mCurrFrameResource->WavesVB.get();// 先拿到当前帧资源内部的WavesVB的裸指针
-	for (int i = 0; i < mWaves->VertexCount(); ++i)// 遍历波浪对象的每个点
-	{
-		// 遍历到的第i个波浪点的数据 就 填充给 1个新点v
-		Vertex v;
-		v.Pos = mWaves->Position(i);
-		v.Color = XMFLOAT4(DirectX::Colors::Blue);
-		// 把第i个新点v作为数据源, 并真正拷贝到 当前这个FrameResource里的"WavesVB"里
-		currWavesVB->CopyData(i, v);
-	}
+	// 让波浪对象把新位置直接写进WavesVB映射出的内存, 不再逐点构造Vertex再CopyData
+	// 颜色固定不变, 已在BuildFrameResources里写好, 这里只写Pos; 上次写过之后没变的块跳过
+	Waves::VertexLayout layout;
+	layout.Stride = sizeof(Vertex);
+	layout.PositionOffset = offsetof(Vertex, Pos);
+	mCurrFrameResource->WavesVersion = mWaves->WriteVertices(currWavesVB->MappedData(), layout, mCurrFrameResource->WavesVersion);
 
 	/* 最后记得给 波浪专属渲染项 里Geo管理员里的顶点数据 要被这个帧资源里的顶点数据 更新并填充*/
 	mWavesRitem->Geo->VertexBufferGPU = currWavesVB->Resource();
@@ -692,6 +689,11 @@ void LandAndWavesApp::BuildFrameResources()
 		mFrameResources.push_back(std::make_unique<FrameResource>(md3dDevice.Get(),
 			1/*1个passCB*/, (UINT)mAllRitems.size()/*objctCB数量*/, mWaves->VertexCount())/*波浪里的顶点数*/
 		);
+
+		// 波浪顶点的颜色不随模拟变化, 在每个帧资源的WavesVB里只写一次
+		Vertex* waveVertices = mFrameResources.back()->WavesVB->MappedData();
+		for (int v = 0; v < mWaves->VertexCount(); ++v)
+			waveVertices[v].Color = XMFLOAT4(DirectX::Colors::Blue);
 	}
 }
 
@@ -4,16 +4,35 @@
 // Performs the calculations for the wave simulation.  After the simulation has been
 // updated, the client must copy the current solution into vertex buffers for rendering.
 // This class only does the calculations, it does not do any drawing.
+//
+// 高度场按SoA存放: 高度(y)单独占一个连续的float平面, 法线与切线也拆成各分量平面;
+// 网格点的x/z是固定的, 由行列号现算. 模板迭代与法线计算各有Scalar/SSE4/AVX2/NEON内核,
+// 构造时自动选CPU支持的最快内核, 也可用SetKernel在运行时切换.
+// 网格另按ActivityBlockSize见方划分成块, 只有波动未平息的块及其相邻块参与计算与上传.
 //***************************************************************************************
 
 #ifndef WAVES_H
 #define WAVES_H
 
+#include <cstdint>
+#include <functional>
 #include <vector>
 #include <DirectXMath.h>
 
+class ThreadPool;
+
 class Waves
 {
+public:
+	// 求解内核
+	enum class Kernel
+	{
+		Scalar,
+		SSE4,	// x86/x64, 每条指令处理4个格点
+		AVX2,	// x86/x64, 每条指令处理8个格点
+		NEON	// ARM64, 每条指令处理4个格点
+	};
+
 public:
     Waves(int m, int n, float dx, float dt, float speed, float damping);
     Waves(const Waves& rhs) = delete;
@@ -28,17 +47,129 @@ public:
 	float Depth()const;
 
 	// Returns the solution at the ith grid point.
-    const DirectX::XMFLOAT3& Position(int i)const { return mCurrSolution[i]; }
+    DirectX::XMFLOAT3 Position(int i)const;
 
 	// Returns the solution normal at the ith grid point.
-    const DirectX::XMFLOAT3& Normal(int i)const { return mNormals[i]; }
+    DirectX::XMFLOAT3 Normal(int i)const { return DirectX::XMFLOAT3(mNormalX[i], mNormalY[i], mNormalZ[i]); }
 
 	// Returns the unit tangent vector at the ith grid point in the local x-axis direction.
-    const DirectX::XMFLOAT3& TangentX(int i)const { return mTangentX[i]; }
+    DirectX::XMFLOAT3 TangentX(int i)const { return DirectX::XMFLOAT3(mTangentXx[i], mTangentXy[i], 0.0f); }
+
+	// 当前解的高度平面, 行主序, 共VertexCount()个float
+	const float* Heights()const { return mCurrSolution; }
 
+	/* WriteVertices的目标顶点布局: 各字段在顶点结构体中的字节偏移(offsetof), 不需要的字段填-1 */
+	struct VertexLayout
+	{
+		int Stride = 0;
+		int PositionOffset = -1;
+		int NormalOffset = -1;
+		int TangentXOffset = -1;
+		int TexCOffset = -1;// 纹理坐标由位置推出: [-w/2,w/2] --> [0,1]
+	};
+
+	/* 把当前解直接按layout写进调用方的顶点数组(例如UploadBuffer::MappedData()), 共VertexCount()个顶点
+	* 按块并行, 不产生中间Vertex, 也不逐顶点调用CopyData; 布局以外的字段保持不变
+	* 只写最后改动版本大于sinceVersion的块, 返回当前Version(); 调用方为每个目标缓冲区各存一个版本号,
+	* 下次写同一缓冲区时传回, 首次写入传0即写全部顶点
+	* interpolate为true时高度取InterpolatedPosition, 上一步参与计算的块总会重写 */
+	std::uint32_t WriteVertices(void* dst, const VertexLayout& layout, std::uint32_t sinceVersion = 0, bool interpolate = false)const;
+
+	// 数据版本号, 每次步进或Disturb后递增
+	std::uint32_t Version()const { return mVersion; }
+
+	/* 按固定步长推进模拟: dt累积到每个实例自己的累加器里, 每满一个步长走一步,
+	* 一次最多补跑MaxSubsteps步; 剩余不足一步的时间留到下一帧 */
 	void Update(float dt);
 	void Disturb(int i, int j, float magnitude);
 
+	// 单次Update最多补跑的步数, 默认4, 至少为1
+	void SetMaxSubsteps(int steps);
+	int GetMaxSubsteps()const { return mMaxSubsteps; }
+
+	// 累加器中剩余时间占一个步长的比例[0, 1), 用于在上一步与当前解之间插值
+	float InterpolationAlpha()const { return mAccumulator / mTimeStep; }
+
+	// 按InterpolationAlpha在上一步与当前解之间线性插值的位置, 帧率高于模拟步频时画面更平滑
+	DirectX::XMFLOAT3 InterpolatedPosition(int i)const;
+
+	// 上一次Update实际执行的步数
+	int LastSubstepCount()const { return mLastSubstepCount; }
+
+	// 以dt调用Update将会执行的步数
+	int PendingSteps(float dt)const;
+
+	// 单步耗时(秒): 最近一步, 以及指数滑动平均; 多个波面共享线程预算时,
+	// 可用PendingSteps(dt) * AverageStepCost()预估本帧开销
+	float LastStepCost()const { return mLastStepCost; }
+	float AverageStepCost()const { return mAverageStepCost; }
+
+	// 当前CPU能否运行指定内核
+	static bool IsKernelSupported(Kernel kernel);
+	// 当前CPU支持的最快内核
+	static Kernel BestKernel();
+
+	// 切换内核; CPU不支持时返回false, 保持原内核不变
+	bool SetKernel(Kernel kernel);
+	Kernel GetKernel()const { return mKernel; }
+
+	// 并行计算所用的线程池, 默认为ThreadPool::Default(); 传nullptr恢复默认
+	void SetThreadPool(ThreadPool* pool);
+
+	// 每个并行任务连续处理的行数, 0表示按线程数自动划分
+	void SetRowBlockSize(int rows) { mRowBlockSize = rows; }
+	int GetRowBlockSize()const { return mRowBlockSize; }
+
+	/* true(默认)时每步只扫描一遍网格, 在同一遍里算出新高度与法线/切线(见StepFused)
+	* false时先整体迭代高度, 再整体算法线, 即原先的两遍算法 */
+	void SetFusedUpdate(bool fused) { mFusedUpdate = fused; }
+	bool IsFusedUpdate()const { return mFusedUpdate; }
+
+	/* 单遍算法中列条带的宽度(格点数), 会被限制在[8, MaxTileWidth]
+	* 默认512列: 3行滚动窗口约6KB, 能留在L1里; 书中的网格不超过这个宽度, 整行即一个条带;
+	* 条带太窄时每行只读一小段, 硬件预取反而失效, 太宽时窗口被挤出L1 */
+	static const int DefaultTileWidth = 512;
+	static const int MaxTileWidth = 1024;
+	void SetTileWidth(int columns);
+	int GetTileWidth()const { return mTileWidth; }
+
+	/* 活跃块跟踪(默认开启): 块内上一解与当前解的|高度|有超过阈值的即为活跃块,
+	* 每步只迭代活跃块及其8邻域的块, 波传到块边时相邻块随之变为活跃;
+	* 某块及其邻块都平息后该块清零(高度0, 法线朝上)退出计算, 低于阈值的残余波动因此被截断
+	* 关闭时每步计算整个网格 */
+	static const int ActivityBlockSize = 32;
+	void SetActivityTracking(bool enable);
+	bool IsActivityTracking()const { return mActivityTracking; }
+
+	// 活跃阈值, 默认1e-4
+	void SetActivityEpsilon(float epsilon) { mActivityEpsilon = epsilon; }
+	float GetActivityEpsilon()const { return mActivityEpsilon; }
+
+	// 块的行数与列数; 第(bi, bj)块覆盖第[bi, bi+1)*ActivityBlockSize行, [bj, bj+1)*ActivityBlockSize列
+	int ActivityBlockRows()const { return mBlockRows; }
+	int ActivityBlockColumns()const { return mBlockCols; }
+
+	// 上一步实际参与计算的块
+	bool IsBlockUpdated(int blockRow, int blockCol)const { return mUpdateBlocks[blockRow*mBlockCols + blockCol] != 0; }
+	int UpdatedBlockCount()const;
+
+private:
+	using RegionFunc = std::function<void(int rowBegin, int rowEnd, int colBegin, int colEnd)>;
+
+	void Step();
+	void StepTwoPass();
+	void StepFused();
+
+	// 并行地对每个要计算的矩形区域(内部格点)调用func; 跟踪关闭时按行段划分整个网格,
+	// 开启时按块行划分, 每段连续的待计算块合成一个区域
+	void ForEachRegion(const RegionFunc& func)const;
+
+	// 由活跃块算出本步要计算的块, 并清零刚退出计算的块
+	void BeginActiveStep();
+	// 步进后重新判定参与计算的块是否活跃, 并记下它们的版本号
+	void EndActiveStep();
+	void ClearBlock(int blockRow, int blockCol);
+
 private:
     int mNumRows = 0;
     int mNumCols = 0;
@@ -54,10 +185,53 @@ private:
     float mTimeStep = 0.0f;
     float mSpatialStep = 0.0f;
 
-    std::vector<DirectX::XMFLOAT3> mPrevSolution;
-    std::vector<DirectX::XMFLOAT3> mCurrSolution;
-    std::vector<DirectX::XMFLOAT3> mNormals;
-    std::vector<DirectX::XMFLOAT3> mTangentX;
+	// 固定步长累加器
+	float mAccumulator = 0.0f;
+	int mMaxSubsteps = 4;
+	int mLastSubstepCount = 0;
+
+	// 单步耗时统计(秒)
+	float mLastStepCost = 0.0f;
+	float mAverageStepCost = 0.0f;
+
+	// 网格宽与深的一半, 用来由行列号还原x与z
+	float mHalfWidth = 0.0f;
+	float mHalfDepth = 0.0f;
+
+	Kernel mKernel = Kernel::Scalar;
+
+	ThreadPool* mThreadPool = nullptr;
+	int mRowBlockSize = 0;
+	bool mFusedUpdate = true;
+	int mTileWidth = DefaultTileWidth;
+
+	// 活跃块跟踪, 每个块一项, 行主序
+	bool mActivityTracking = true;
+	float mActivityEpsilon = 1e-4f;
+	int mBlockRows = 0;
+	int mBlockCols = 0;
+	std::vector<std::uint8_t> mActiveBlocks;// 块内仍有超过阈值的波动
+	std::vector<std::uint8_t> mUpdateBlocks;// 上一步参与计算的块(活跃块及其邻块); 其余块的高度恒为0
+	std::vector<std::uint32_t> mBlockVersions;// 块最后一次改动时的mVersion
+	std::uint32_t mVersion = 1;
+
+	/* 所有平面共用一块内存mPlaneStorage, 相邻平面的起点错开不同的字节数,
+	* 避免大网格下各平面同一下标的地址落在同一组cache set里互相挤占 */
+	std::vector<float> mPlaneStorage;
+
+	// 高度平面, 只存y; mNextSolution是单遍算法的输出平面, 每步与另两个轮换
+	float* mPrevSolution = nullptr;
+	float* mCurrSolution = nullptr;
+	float* mNextSolution = nullptr;
+
+	// 法线各分量平面
+	float* mNormalX = nullptr;
+	float* mNormalY = nullptr;
+	float* mNormalZ = nullptr;
+
+	// x方向切线的x, y分量平面; z分量恒为0
+	float* mTangentXx = nullptr;
+	float* mTangentXy = nullptr;
 };
 
-#endif // WAVES_H
\ No newline at end of file
+#endif // WAVES_H
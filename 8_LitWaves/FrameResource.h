@@ -63,6 +63,8 @@ public:
     // We cannot update a dynamic vertex buffer until the GPU is done processing
     // the commands that reference it.  So each frame needs their own.
     std::unique_ptr<UploadBuffer<Vertex>> WavesVB = nullptr;
+    // WavesVB里的数据对应的Waves版本号, 0表示还没写过; 下次只需重写这之后改动过的块
+    UINT WavesVersion = 0;
 
     // Fence value to mark commands up to this fence point.  This lets us
     // check if these frame resources are still in use by the GPU.
@@ -1,15 +1,241 @@
-//***************************************************************************************
+﻿//***************************************************************************************
 // Waves.cpp by Frank Luna (C) 2011 All Rights Reserved.
 //***************************************************************************************
 
 #include "Waves.h"
-#include <ppl.h>
+#include "../Common/CpuFeatures.h"
+#include "../Common/ThreadPool.h"
 #include <algorithm>
 #include <vector>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 
 using namespace DirectX;
 
+namespace
+{
+	// 相邻平面之间额外错开的float数(64字节)
+	const size_t PlaneStagger = 16;
+
+	/* 模板迭代的行内核: 对一行中连续count个内部格点做一步有限差分
+	* prev与mid为上一解与当前解中该行的起始格点, up/down为上下两行的同一列; mid[-1]与mid[count]可读
+	* 结果写入next, next可以与prev是同一块内存(原地更新) */
+	typedef void(*StencilRowFn)(float* next, const float* prev, const float* up, const float* mid, const float* down,
+		int count, float k1, float k2, float k3);
+
+	/* 法线/切线的行内核: 用中心差分求一行内部count个格点的单位法线与x方向单位切线 */
+	typedef void(*NormalRowFn)(const float* up, const float* mid, const float* down,
+		float* nx, float* ny, float* nz, float* tx, float* ty, int count, float twoDx);
+
+	// 各内核的加法顺序保持一致且不用FMA, 因此不同内核的结果逐位相同
+
+	void StencilRowScalar(float* next, const float* prev, const float* up, const float* mid, const float* down,
+		int count, float k1, float k2, float k3)
+	{
+		for (int j = 0; j < count; ++j) {
+			float sum = down[j] + up[j] + mid[j + 1] + mid[j - 1];
+			next[j] = k1*prev[j] + k2*mid[j] + k3*sum;
+		}
+	}
+
+	void NormalRowScalar(const float* up, const float* mid, const float* down,
+		float* nx, float* ny, float* nz, float* tx, float* ty, int count, float twoDx)
+	{
+		for (int j = 0; j < count; ++j) {
+			float l = mid[j - 1];
+			float r = mid[j + 1];
+			float t = up[j];
+			float b = down[j];
+
+			float x = l - r;
+			float z = b - t;
+			float invLen = 1.0f / sqrtf(x*x + twoDx*twoDx + z*z);
+			nx[j] = x*invLen;
+			ny[j] = twoDx*invLen;
+			nz[j] = z*invLen;
+
+			float y = r - l;
+			float invLenT = 1.0f / sqrtf(twoDx*twoDx + y*y);
+			tx[j] = twoDx*invLenT;
+			ty[j] = y*invLenT;
+		}
+	}
+
+#if defined(CPU_X86)
+	CPU_TARGET_SSE4 void StencilRowSSE4(float* next, const float* prev, const float* up, const float* mid, const float* down,
+		int count, float k1, float k2, float k3)
+	{
+		const __m128 vk1 = _mm_set1_ps(k1);
+		const __m128 vk2 = _mm_set1_ps(k2);
+		const __m128 vk3 = _mm_set1_ps(k3);
+
+		int j = 0;
+		for (; j + 4 <= count; j += 4) {
+			__m128 sum = _mm_add_ps(_mm_loadu_ps(down + j), _mm_loadu_ps(up + j));
+			sum = _mm_add_ps(sum, _mm_loadu_ps(mid + j + 1));
+			sum = _mm_add_ps(sum, _mm_loadu_ps(mid + j - 1));
+
+			__m128 h = _mm_add_ps(_mm_mul_ps(vk1, _mm_loadu_ps(prev + j)), _mm_mul_ps(vk2, _mm_loadu_ps(mid + j)));
+			_mm_storeu_ps(next + j, _mm_add_ps(h, _mm_mul_ps(vk3, sum)));
+		}
+		StencilRowScalar(next + j, prev + j, up + j, mid + j, down + j, count - j, k1, k2, k3);
+	}
+
+	CPU_TARGET_SSE4 void NormalRowSSE4(const float* up, const float* mid, const float* down,
+		float* nx, float* ny, float* nz, float* tx, float* ty, int count, float twoDx)
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 d = _mm_set1_ps(twoDx);
+		const __m128 d2 = _mm_mul_ps(d, d);
+
+		int j = 0;
+		for (; j + 4 <= count; j += 4) {
+			__m128 l = _mm_loadu_ps(mid + j - 1);
+			__m128 r = _mm_loadu_ps(mid + j + 1);
+			__m128 t = _mm_loadu_ps(up + j);
+			__m128 b = _mm_loadu_ps(down + j);
+
+			__m128 x = _mm_sub_ps(l, r);
+			__m128 z = _mm_sub_ps(b, t);
+			__m128 lenSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), d2), _mm_mul_ps(z, z));
+			__m128 invLen = _mm_div_ps(one, _mm_sqrt_ps(lenSq));
+			_mm_storeu_ps(nx + j, _mm_mul_ps(x, invLen));
+			_mm_storeu_ps(ny + j, _mm_mul_ps(d, invLen));
+			_mm_storeu_ps(nz + j, _mm_mul_ps(z, invLen));
+
+			__m128 y = _mm_sub_ps(r, l);
+			__m128 invLenT = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(d2, _mm_mul_ps(y, y))));
+			_mm_storeu_ps(tx + j, _mm_mul_ps(d, invLenT));
+			_mm_storeu_ps(ty + j, _mm_mul_ps(y, invLenT));
+		}
+		NormalRowScalar(up + j, mid + j, down + j, nx + j, ny + j, nz + j, tx + j, ty + j, count - j, twoDx);
+	}
+
+	CPU_TARGET_AVX2 void StencilRowAVX2(float* next, const float* prev, const float* up, const float* mid, const float* down,
+		int count, float k1, float k2, float k3)
+	{
+		const __m256 vk1 = _mm256_set1_ps(k1);
+		const __m256 vk2 = _mm256_set1_ps(k2);
+		const __m256 vk3 = _mm256_set1_ps(k3);
+
+		int j = 0;
+		for (; j + 8 <= count; j += 8) {
+			__m256 sum = _mm256_add_ps(_mm256_loadu_ps(down + j), _mm256_loadu_ps(up + j));
+			sum = _mm256_add_ps(sum, _mm256_loadu_ps(mid + j + 1));
+			sum = _mm256_add_ps(sum, _mm256_loadu_ps(mid + j - 1));
+
+			__m256 h = _mm256_add_ps(_mm256_mul_ps(vk1, _mm256_loadu_ps(prev + j)), _mm256_mul_ps(vk2, _mm256_loadu_ps(mid + j)));
+			_mm256_storeu_ps(next + j, _mm256_add_ps(h, _mm256_mul_ps(vk3, sum)));
+		}
+		StencilRowScalar(next + j, prev + j, up + j, mid + j, down + j, count - j, k1, k2, k3);
+	}
+
+	CPU_TARGET_AVX2 void NormalRowAVX2(const float* up, const float* mid, const float* down,
+		float* nx, float* ny, float* nz, float* tx, float* ty, int count, float twoDx)
+	{
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 d = _mm256_set1_ps(twoDx);
+		const __m256 d2 = _mm256_mul_ps(d, d);
+
+		int j = 0;
+		for (; j + 8 <= count; j += 8) {
+			__m256 l = _mm256_loadu_ps(mid + j - 1);
+			__m256 r = _mm256_loadu_ps(mid + j + 1);
+			__m256 t = _mm256_loadu_ps(up + j);
+			__m256 b = _mm256_loadu_ps(down + j);
+
+			__m256 x = _mm256_sub_ps(l, r);
+			__m256 z = _mm256_sub_ps(b, t);
+			__m256 lenSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), d2), _mm256_mul_ps(z, z));
+			__m256 invLen = _mm256_div_ps(one, _mm256_sqrt_ps(lenSq));
+			_mm256_storeu_ps(nx + j, _mm256_mul_ps(x, invLen));
+			_mm256_storeu_ps(ny + j, _mm256_mul_ps(d, invLen));
+			_mm256_storeu_ps(nz + j, _mm256_mul_ps(z, invLen));
+
+			__m256 y = _mm256_sub_ps(r, l);
+			__m256 invLenT = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(d2, _mm256_mul_ps(y, y))));
+			_mm256_storeu_ps(tx + j, _mm256_mul_ps(d, invLenT));
+			_mm256_storeu_ps(ty + j, _mm256_mul_ps(y, invLenT));
+		}
+		NormalRowScalar(up + j, mid + j, down + j, nx + j, ny + j, nz + j, tx + j, ty + j, count - j, twoDx);
+	}
+#endif
+
+#if defined(CPU_NEON)
+	void StencilRowNEON(float* next, const float* prev, const float* up, const float* mid, const float* down,
+		int count, float k1, float k2, float k3)
+	{
+		const float32x4_t vk1 = vdupq_n_f32(k1);
+		const float32x4_t vk2 = vdupq_n_f32(k2);
+		const float32x4_t vk3 = vdupq_n_f32(k3);
+
+		int j = 0;
+		for (; j + 4 <= count; j += 4) {
+			float32x4_t sum = vaddq_f32(vld1q_f32(down + j), vld1q_f32(up + j));
+			sum = vaddq_f32(sum, vld1q_f32(mid + j + 1));
+			sum = vaddq_f32(sum, vld1q_f32(mid + j - 1));
+
+			float32x4_t h = vaddq_f32(vmulq_f32(vk1, vld1q_f32(prev + j)), vmulq_f32(vk2, vld1q_f32(mid + j)));
+			vst1q_f32(next + j, vaddq_f32(h, vmulq_f32(vk3, sum)));
+		}
+		StencilRowScalar(next + j, prev + j, up + j, mid + j, down + j, count - j, k1, k2, k3);
+	}
+
+	void NormalRowNEON(const float* up, const float* mid, const float* down,
+		float* nx, float* ny, float* nz, float* tx, float* ty, int count, float twoDx)
+	{
+		const float32x4_t one = vdupq_n_f32(1.0f);
+		const float32x4_t d = vdupq_n_f32(twoDx);
+		const float32x4_t d2 = vmulq_f32(d, d);
+
+		int j = 0;
+		for (; j + 4 <= count; j += 4) {
+			float32x4_t l = vld1q_f32(mid + j - 1);
+			float32x4_t r = vld1q_f32(mid + j + 1);
+			float32x4_t t = vld1q_f32(up + j);
+			float32x4_t b = vld1q_f32(down + j);
+
+			float32x4_t x = vsubq_f32(l, r);
+			float32x4_t z = vsubq_f32(b, t);
+			float32x4_t lenSq = vaddq_f32(vaddq_f32(vmulq_f32(x, x), d2), vmulq_f32(z, z));
+			float32x4_t invLen = vdivq_f32(one, vsqrtq_f32(lenSq));
+			vst1q_f32(nx + j, vmulq_f32(x, invLen));
+			vst1q_f32(ny + j, vmulq_f32(d, invLen));
+			vst1q_f32(nz + j, vmulq_f32(z, invLen));
+
+			float32x4_t y = vsubq_f32(r, l);
+			float32x4_t invLenT = vdivq_f32(one, vsqrtq_f32(vaddq_f32(d2, vmulq_f32(y, y))));
+			vst1q_f32(tx + j, vmulq_f32(d, invLenT));
+			vst1q_f32(ty + j, vmulq_f32(y, invLenT));
+		}
+		NormalRowScalar(up + j, mid + j, down + j, nx + j, ny + j, nz + j, tx + j, ty + j, count - j, twoDx);
+	}
+#endif
+
+	struct KernelTable
+	{
+		StencilRowFn Stencil;
+		NormalRowFn Normals;
+	};
+
+	KernelTable GetKernelTable(Waves::Kernel kernel)
+	{
+		switch (kernel) {
+#if defined(CPU_X86)
+		case Waves::Kernel::SSE4: return { StencilRowSSE4, NormalRowSSE4 };
+		case Waves::Kernel::AVX2: return { StencilRowAVX2, NormalRowAVX2 };
+#endif
+#if defined(CPU_NEON)
+		case Waves::Kernel::NEON: return { StencilRowNEON, NormalRowNEON };
+#endif
+		default: return { StencilRowScalar, NormalRowScalar };
+		}
+	}
+}
+
 Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
 {
     mNumRows = m;
@@ -27,28 +253,39 @@ Waves::Waves(int m, int n, float dx, float dt, float speed, float damping)
     mK2 = (4.0f - 8.0f*e) / d;
     mK3 = (2.0f*e) / d;
 
-    mPrevSolution.resize(m*n);
-    mCurrSolution.resize(m*n);
-    mNormals.resize(m*n);
-    mTangentX.resize(m*n);
+	// 8个平面依次排在mPlaneStorage里, 每个平面之后多留PlaneStagger个float的空隙,
+	// 使网格宽度为2的幂时各平面同一下标的地址也不会对齐到同一组cache set
+	const size_t planeSize = (size_t)m*n;
+	const size_t planePitch = (planeSize + 15) / 16 * 16 + PlaneStagger;
+	mPlaneStorage.assign(planePitch * 8, 0.0f);
+
+	float* plane = mPlaneStorage.data();
+	mPrevSolution = plane; plane += planePitch;
+	mCurrSolution = plane; plane += planePitch;
+	mNextSolution = plane; plane += planePitch;
+	mNormalX = plane;      plane += planePitch;
+	mNormalY = plane;      plane += planePitch;
+	mNormalZ = plane;      plane += planePitch;
+	mTangentXx = plane;    plane += planePitch;
+	mTangentXy = plane;
 
-    // Generate grid vertices in system memory.
+	// 初始为静止水面: 高度全0, 法线朝上, 切线沿+x
+	std::fill_n(mNormalY, planeSize, 1.0f);
+	std::fill_n(mTangentXx, planeSize, 1.0f);
 
-    float halfWidth = (n - 1)*dx*0.5f;
-    float halfDepth = (m - 1)*dx*0.5f;
-    for(int i = 0; i < m; ++i)
-    {
-        float z = halfDepth - i*dx;
-        for(int j = 0; j < n; ++j)
-        {
-            float x = -halfWidth + j*dx;
+    // Grid vertices are implied by the row/column index; see Position().
+    mHalfWidth = (n - 1)*dx*0.5f;
+    mHalfDepth = (m - 1)*dx*0.5f;
 
-            mPrevSolution[i*n + j] = XMFLOAT3(x, 0.0f, z);
-            mCurrSolution[i*n + j] = XMFLOAT3(x, 0.0f, z);
-            mNormals[i*n + j] = XMFLOAT3(0.0f, 1.0f, 0.0f);
-            mTangentX[i*n + j] = XMFLOAT3(1.0f, 0.0f, 0.0f);
-        }
-    }
+	// 初始水面静止, 没有活跃块
+	mBlockRows = (m + ActivityBlockSize - 1) / ActivityBlockSize;
+	mBlockCols = (n + ActivityBlockSize - 1) / ActivityBlockSize;
+	mActiveBlocks.assign((size_t)mBlockRows*mBlockCols, 0);
+	mUpdateBlocks.assign((size_t)mBlockRows*mBlockCols, 0);
+	mBlockVersions.assign((size_t)mBlockRows*mBlockCols, mVersion);
+
+	mKernel = BestKernel();
+	mThreadPool = &ThreadPool::Default();
 }
 
 Waves::~Waves()
@@ -85,75 +322,450 @@ float Waves::Depth()const
 	return mNumRows*mSpatialStep;
 }
 
-void Waves::Update(float dt)
+XMFLOAT3 Waves::Position(int i)const
+{
+	int row = i / mNumCols;
+	int col = i - row*mNumCols;
+	return XMFLOAT3(-mHalfWidth + col*mSpatialStep, mCurrSolution[i], mHalfDepth - row*mSpatialStep);
+}
+
+std::uint32_t Waves::WriteVertices(void* dst, const VertexLayout& layout, std::uint32_t sinceVersion, bool interpolate)const
+{
+	const int m = mNumRows;
+	const int n = mNumCols;
+	const float alpha = InterpolationAlpha();
+	const float invWidth = 1.0f / Width();
+	const float invDepth = 1.0f / Depth();
+
+	auto writeRow = [&](int i, int colBegin, int colEnd)
+	{
+		const float z = mHalfDepth - i*mSpatialStep;
+		std::uint8_t* v = static_cast<std::uint8_t*>(dst) + ((size_t)i*n + colBegin)*layout.Stride;
+
+		for (int j = colBegin; j < colEnd; ++j, v += layout.Stride) {
+			const int k = i*n + j;
+			const float x = -mHalfWidth + j*mSpatialStep;
+
+			if (layout.PositionOffset >= 0) {
+				float y = interpolate ? mPrevSolution[k] + alpha*(mCurrSolution[k] - mPrevSolution[k]) : mCurrSolution[k];
+				XMFLOAT3 pos(x, y, z);
+				std::memcpy(v + layout.PositionOffset, &pos, sizeof(XMFLOAT3));
+			}
+			if (layout.NormalOffset >= 0) {
+				XMFLOAT3 normal(mNormalX[k], mNormalY[k], mNormalZ[k]);
+				std::memcpy(v + layout.NormalOffset, &normal, sizeof(XMFLOAT3));
+			}
+			if (layout.TangentXOffset >= 0) {
+				XMFLOAT3 tangent(mTangentXx[k], mTangentXy[k], 0.0f);
+				std::memcpy(v + layout.TangentXOffset, &tangent, sizeof(XMFLOAT3));
+			}
+			if (layout.TexCOffset >= 0) {
+				XMFLOAT2 texC(0.5f + x*invWidth, 0.5f - z*invDepth);
+				std::memcpy(v + layout.TexCOffset, &texC, sizeof(XMFLOAT2));
+			}
+		}
+	};
+
+	// 按块行并行, 每行里把连续的脏块合成一段写出; 其余块在目标缓冲区里已是最新数据
+	const int grain = (mRowBlockSize > 0) ? std::max(1, mRowBlockSize / ActivityBlockSize) : 1;
+	mThreadPool->ParallelFor(0, mBlockRows, grain, [&](int blockBegin, int blockEnd)
+	{
+		for (int bi = blockBegin; bi < blockEnd; ++bi) {
+			const int rowBegin = bi*ActivityBlockSize;
+			const int rowEnd = std::min(rowBegin + ActivityBlockSize, m);
+
+			auto dirty = [&](int bj) {
+				const int b = bi*mBlockCols + bj;
+				return mBlockVersions[b] > sinceVersion || (interpolate && mUpdateBlocks[b]);
+			};
+
+			for (int bj = 0; bj < mBlockCols; ) {
+				if (!dirty(bj)) {
+					++bj;
+					continue;
+				}
+				int bk = bj + 1;
+				while (bk < mBlockCols && dirty(bk))
+					++bk;
+
+				const int colEnd = std::min(bk*ActivityBlockSize, n);
+				for (int i = rowBegin; i < rowEnd; ++i)
+					writeRow(i, bj*ActivityBlockSize, colEnd);
+				bj = bk;
+			}
+		}
+	});
+
+	return mVersion;
+}
+
+bool Waves::IsKernelSupported(Kernel kernel)
+{
+	switch (kernel) {
+	case Kernel::Scalar:
+		return true;
+#if defined(CPU_X86)
+	case Kernel::SSE4:
+		return GetCpuFeatures().SSE41;
+	case Kernel::AVX2:
+		return GetCpuFeatures().AVX2;
+#endif
+#if defined(CPU_NEON)
+	case Kernel::NEON:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+Waves::Kernel Waves::BestKernel()
+{
+	const Kernel candidates[] = { Kernel::AVX2, Kernel::NEON, Kernel::SSE4 };
+	for (Kernel kernel : candidates) {
+		if (IsKernelSupported(kernel))
+			return kernel;
+	}
+	return Kernel::Scalar;
+}
+
+bool Waves::SetKernel(Kernel kernel)
+{
+	if (!IsKernelSupported(kernel))
+		return false;
+
+	mKernel = kernel;
+	return true;
+}
+
+void Waves::SetTileWidth(int columns)
+{
+	mTileWidth = std::min(std::max(columns, 8), (int)MaxTileWidth);
+}
+
+void Waves::SetActivityTracking(bool enable)
+{
+	if (enable == mActivityTracking)
+		return;
+
+	// 打开时先把所有块都当作活跃块, 第一步之后再按实际波动退出;
+	// 关闭时所有块每步都参与计算
+	mActivityTracking = enable;
+	std::fill(mActiveBlocks.begin(), mActiveBlocks.end(), (std::uint8_t)1);
+	std::fill(mUpdateBlocks.begin(), mUpdateBlocks.end(), (std::uint8_t)1);
+}
+
+int Waves::UpdatedBlockCount()const
 {
-	static float t = 0;
+	return (int)std::count(mUpdateBlocks.begin(), mUpdateBlocks.end(), (std::uint8_t)1);
+}
+
+void Waves::SetThreadPool(ThreadPool* pool)
+{
+	mThreadPool = (pool != nullptr) ? pool : &ThreadPool::Default();
+}
 
+void Waves::Update(float dt)
+{
 	// Accumulate time.
-	t += dt;
+	mAccumulator += dt;
 
-	// Only update the simulation at the specified time step.
-	if( t >= mTimeStep )
+	// Only update the simulation at the specified time step. 帧时间较长时补跑多步,
+	// 但不超过mMaxSubsteps步, 否则求解本身越慢积压越多; 超出的整步直接丢弃
+	mLastSubstepCount = 0;
+	while (mAccumulator >= mTimeStep && mLastSubstepCount < mMaxSubsteps)
 	{
-		// Only update interior points; we use zero boundary conditions.
-		concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-		//for(int i = 1; i < mNumRows-1; ++i)
+		auto start = std::chrono::steady_clock::now();
+
+		Step();
+
+		std::chrono::duration<float> cost = std::chrono::steady_clock::now() - start;
+		mLastStepCost = cost.count();
+		mAverageStepCost = (mAverageStepCost == 0.0f) ? mLastStepCost : mAverageStepCost + 0.1f*(mLastStepCost - mAverageStepCost);
+
+		mAccumulator -= mTimeStep;
+		++mLastSubstepCount;
+	}
+
+	if (mAccumulator >= mTimeStep)
+		mAccumulator = std::fmod(mAccumulator, mTimeStep);
+}
+
+void Waves::SetMaxSubsteps(int steps)
+{
+	mMaxSubsteps = std::max(steps, 1);
+}
+
+int Waves::PendingSteps(float dt)const
+{
+	int steps = (int)((mAccumulator + dt) / mTimeStep);
+	return std::min(steps, mMaxSubsteps);
+}
+
+XMFLOAT3 Waves::InterpolatedPosition(int i)const
+{
+	// 步进后mPrevSolution保存的正是上一步的解(两遍与单遍算法都如此)
+	XMFLOAT3 p = Position(i);
+	p.y = mPrevSolution[i] + InterpolationAlpha()*(mCurrSolution[i] - mPrevSolution[i]);
+	return p;
+}
+
+void Waves::Step()
+{
+	++mVersion;
+
+	if (mActivityTracking)
+		BeginActiveStep();
+
+	if (mFusedUpdate)
+		StepFused();
+	else
+		StepTwoPass();
+
+	if (mActivityTracking)
+		EndActiveStep();
+	else
+		std::fill(mBlockVersions.begin(), mBlockVersions.end(), mVersion);
+}
+
+void Waves::ForEachRegion(const RegionFunc& func)const
+{
+	const int m = mNumRows;
+	const int n = mNumCols;
+
+	// Only update interior points; we use zero boundary conditions.
+	if (!mActivityTracking) {
+		mThreadPool->ParallelFor(1, m - 1, mRowBlockSize, [&](int rowBegin, int rowEnd)
 		{
-			for(int j = 1; j < mNumCols-1; ++j)
-			{
-				// After this update we will be discarding the old previous
-				// buffer, so overwrite that buffer with the new update.
-				// Note how we can do this inplace (read/write to same element) 
-				// because we won't need prev_ij again and the assignment happens last.
-
-				// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
-				// Moreover, our +z axis goes "down"; this is just to 
-				// keep consistent with our row indices going down.
-
-				mPrevSolution[i*mNumCols+j].y = 
-					mK1*mPrevSolution[i*mNumCols+j].y +
-					mK2*mCurrSolution[i*mNumCols+j].y +
-					mK3*(mCurrSolution[(i+1)*mNumCols+j].y + 
-					     mCurrSolution[(i-1)*mNumCols+j].y + 
-					     mCurrSolution[i*mNumCols+j+1].y + 
-						 mCurrSolution[i*mNumCols+j-1].y);
-			}
+			func(rowBegin, rowEnd, 1, n - 1);
 		});
+		return;
+	}
 
-		// We just overwrote the previous buffer with the new data, so
-		// this data needs to become the current solution and the old
-		// current solution becomes the new previous solution.
-		std::swap(mPrevSolution, mCurrSolution);
+	// 活跃块可能集中在少数几个块行里, 默认每个任务只处理一个块行, 便于线程间均衡
+	const int grain = (mRowBlockSize > 0) ? std::max(1, mRowBlockSize / ActivityBlockSize) : 1;
+	mThreadPool->ParallelFor(0, mBlockRows, grain, [&](int blockBegin, int blockEnd)
+	{
+		for (int bi = blockBegin; bi < blockEnd; ++bi) {
+			const int rowBegin = std::max(bi*ActivityBlockSize, 1);
+			const int rowEnd = std::min((bi + 1)*ActivityBlockSize, m - 1);
+			if (rowBegin >= rowEnd)
+				continue;
 
-		t = 0.0f; // reset time
+			const std::uint8_t* update = &mUpdateBlocks[bi*mBlockCols];
+			for (int bj = 0; bj < mBlockCols; ) {
+				if (!update[bj]) {
+					++bj;
+					continue;
+				}
+				int bk = bj + 1;
+				while (bk < mBlockCols && update[bk])
+					++bk;
 
-		//
-		// Compute normals using finite difference scheme.
-		//
-		concurrency::parallel_for(1, mNumRows - 1, [this](int i)
-		//for(int i = 1; i < mNumRows - 1; ++i)
-		{
-			for(int j = 1; j < mNumCols-1; ++j)
-			{
-				float l = mCurrSolution[i*mNumCols+j-1].y;
-				float r = mCurrSolution[i*mNumCols+j+1].y;
-				float t = mCurrSolution[(i-1)*mNumCols+j].y;
-				float b = mCurrSolution[(i+1)*mNumCols+j].y;
-				mNormals[i*mNumCols+j].x = -r+l;
-				mNormals[i*mNumCols+j].y = 2.0f*mSpatialStep;
-				mNormals[i*mNumCols+j].z = b-t;
-
-				XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&mNormals[i*mNumCols+j]));
-				XMStoreFloat3(&mNormals[i*mNumCols+j], n);
-
-				mTangentX[i*mNumCols+j] = XMFLOAT3(2.0f*mSpatialStep, r-l, 0.0f);
-				XMVECTOR T = XMVector3Normalize(XMLoadFloat3(&mTangentX[i*mNumCols+j]));
-				XMStoreFloat3(&mTangentX[i*mNumCols+j], T);
+				const int colBegin = std::max(bj*ActivityBlockSize, 1);
+				const int colEnd = std::min(bk*ActivityBlockSize, n - 1);
+				if (colBegin < colEnd)
+					func(rowBegin, rowEnd, colBegin, colEnd);
+				bj = bk;
 			}
-		});
+		}
+	});
+}
+
+void Waves::BeginActiveStep()
+{
+	/* 波每步最多传播一个格点, 只有活跃块及其8邻域的块可能在本步发生变化
+	* 不再参与计算的块高度已低于阈值, 清零后保持"高度全0, 法线朝上"不变,
+	* 这样相邻块的模板读到它时与真的不计算它完全一致 */
+	for (int bi = 0; bi < mBlockRows; ++bi) {
+		for (int bj = 0; bj < mBlockCols; ++bj) {
+			bool update = false;
+			for (int di = std::max(bi - 1, 0); di <= std::min(bi + 1, mBlockRows - 1) && !update; ++di) {
+				for (int dj = std::max(bj - 1, 0); dj <= std::min(bj + 1, mBlockCols - 1); ++dj) {
+					if (mActiveBlocks[di*mBlockCols + dj]) {
+						update = true;
+						break;
+					}
+				}
+			}
+
+			const int b = bi*mBlockCols + bj;
+			if (mUpdateBlocks[b] && !update) {
+				ClearBlock(bi, bj);
+				mBlockVersions[b] = mVersion;
+			}
+			mUpdateBlocks[b] = update ? 1 : 0;
+		}
 	}
 }
 
+void Waves::EndActiveStep()
+{
+	const int m = mNumRows;
+	const int n = mNumCols;
+	const float epsilon = mActivityEpsilon;
+
+	mThreadPool->ParallelFor(0, mBlockRows, 1, [&](int blockBegin, int blockEnd)
+	{
+		for (int bi = blockBegin; bi < blockEnd; ++bi) {
+			const int rowBegin = bi*ActivityBlockSize;
+			const int rowEnd = std::min(rowBegin + ActivityBlockSize, m);
+
+			for (int bj = 0; bj < mBlockCols; ++bj) {
+				const int b = bi*mBlockCols + bj;
+				if (!mUpdateBlocks[b])
+					continue;
+
+				const int colBegin = bj*ActivityBlockSize;
+				const int colEnd = std::min(colBegin + ActivityBlockSize, n);
+
+				// 上一解也要检查, 块要连续两步都低于阈值才算平息; 逐行扫描, 发现超过阈值的行即可停止
+				bool active = false;
+				for (int i = rowBegin; i < rowEnd && !active; ++i) {
+					const float* curr = &mCurrSolution[i*n];
+					const float* prev = &mPrevSolution[i*n];
+					float peak = 0.0f;
+					for (int j = colBegin; j < colEnd; ++j)
+						peak = std::max(peak, std::max(std::fabs(curr[j]), std::fabs(prev[j])));
+					active = (peak > epsilon);
+				}
+
+				mActiveBlocks[b] = active ? 1 : 0;
+				mBlockVersions[b] = mVersion;
+			}
+		}
+	});
+}
+
+void Waves::ClearBlock(int blockRow, int blockCol)
+{
+	const int n = mNumCols;
+	const int rowBegin = blockRow*ActivityBlockSize;
+	const int rowEnd = std::min(rowBegin + ActivityBlockSize, mNumRows);
+	const int colBegin = blockCol*ActivityBlockSize;
+	const int count = std::min(colBegin + ActivityBlockSize, n) - colBegin;
+
+	for (int i = rowBegin; i < rowEnd; ++i) {
+		const int k = i*n + colBegin;
+		std::fill_n(&mPrevSolution[k], count, 0.0f);
+		std::fill_n(&mCurrSolution[k], count, 0.0f);
+		std::fill_n(&mNextSolution[k], count, 0.0f);
+		std::fill_n(&mNormalX[k], count, 0.0f);
+		std::fill_n(&mNormalY[k], count, 1.0f);
+		std::fill_n(&mNormalZ[k], count, 0.0f);
+		std::fill_n(&mTangentXx[k], count, 1.0f);
+		std::fill_n(&mTangentXy[k], count, 0.0f);
+	}
+}
+
+void Waves::StepTwoPass()
+{
+	const KernelTable kernel = GetKernelTable(mKernel);
+	const int n = mNumCols;
+
+	ForEachRegion([this, &kernel, n](int rowBegin, int rowEnd, int colBegin, int colEnd)
+	{
+		// After this update we will be discarding the old previous
+		// buffer, so overwrite that buffer with the new update.
+		// Note how we can do this inplace (read/write to same element)
+		// because we won't need prev_ij again and the assignment happens last.
+
+		// Note j indexes x and i indexes z: h(x_j, z_i, t_k)
+		// Moreover, our +z axis goes "down"; this is just to
+		// keep consistent with our row indices going down.
+
+		for(int i = rowBegin; i < rowEnd; ++i)
+		{
+			const int k = i*n + colBegin;
+			const float* curr = &mCurrSolution[k];
+			kernel.Stencil(&mPrevSolution[k], &mPrevSolution[k], curr - n, curr, curr + n, colEnd - colBegin, mK1, mK2, mK3);
+		}
+	});
+
+	// We just overwrote the previous buffer with the new data, so
+	// this data needs to become the current solution and the old
+	// current solution becomes the new previous solution.
+	std::swap(mPrevSolution, mCurrSolution);
+
+	//
+	// Compute normals using finite difference scheme.
+	//
+	const float twoDx = 2.0f*mSpatialStep;
+	ForEachRegion([this, &kernel, n, twoDx](int rowBegin, int rowEnd, int colBegin, int colEnd)
+	{
+		for(int i = rowBegin; i < rowEnd; ++i)
+		{
+			const int k = i*n + colBegin;
+			const float* curr = &mCurrSolution[k];
+			kernel.Normals(curr - n, curr, curr + n,
+				&mNormalX[k], &mNormalY[k], &mNormalZ[k], &mTangentXx[k], &mTangentXy[k], colEnd - colBegin, twoDx);
+		}
+	});
+}
+
+void Waves::StepFused()
+{
+	const KernelTable kernel = GetKernelTable(mKernel);
+	const int m = mNumRows;
+	const int n = mNumCols;
+	const int tileWidth = mTileWidth;
+	const float twoDx = 2.0f*mSpatialStep;
+
+	/* 每个任务负责一个矩形区域, 再按列切成宽tileWidth的条带逐条处理
+	* 条带内自上而下扫描, 新高度先写进只有3行的滚动窗口(留在L1里):
+	* 窗口凑齐第i-2, i-1, i行后立即算出第i-1行的法线/切线, 高度场只需读一遍
+	* 为了不依赖相邻任务的结果, 区域上下各多算1行, 条带左右各多算1列(halo)
+	* 新解写入第三个平面mNextSolution, 上一解与当前解保持只读, halo的重复计算因此没有数据竞争 */
+	// 窗口放在栈上, 限制它的大小, 以免MaxTileWidth调大后每个工作线程的栈被撑爆
+	static_assert(3 * (MaxTileWidth + 2) * sizeof(float) <= 16 * 1024, "rolling window must stay small enough for L1 and the stack");
+	ForEachRegion([&](int rowBegin, int rowEnd, int colBegin, int colEnd)
+	{
+		float window[3][MaxTileWidth + 2];
+
+		for (int c0 = colBegin; c0 < colEnd; c0 += tileWidth) {
+			const int c1 = std::min(c0 + tileWidth, colEnd);
+			const int a = c0 - 1;// 窗口第0个元素对应的列
+			const int lo = std::max(a, 1);
+			const int hi = std::min(c1 + 1, n - 1);
+
+			for (int i = rowBegin - 1; i <= rowEnd; ++i) {
+				float* row = window[i % 3];
+				const float* curr = &mCurrSolution[i*n];
+
+				if (i == 0 || i == m - 1) {
+					// 上下边界不参与迭代, 高度保持不变
+					std::copy(curr + a, curr + c1 + 1, row);
+				}
+				else {
+					// 左右边界列同样保持不变
+					if (a == 0)
+						row[0] = curr[0];
+					if (c1 == n - 1)
+						row[c1 - a] = curr[c1];
+
+					kernel.Stencil(row + (lo - a), &mPrevSolution[i*n + lo], curr + lo - n, curr + lo, curr + lo + n,
+						hi - lo, mK1, mK2, mK3);
+
+					if (i >= rowBegin && i < rowEnd)
+						std::copy(row + 1, row + 1 + (c1 - c0), &mNextSolution[i*n + c0]);
+				}
+
+				// 窗口里已有第r-1, r, r+1行, 算出第r行的法线与切线
+				const int r = i - 1;
+				if (r >= rowBegin && r < rowEnd) {
+					const int k = r*n + c0;
+					kernel.Normals(window[(r + 2) % 3] + 1, window[r % 3] + 1, window[(r + 1) % 3] + 1,
+						&mNormalX[k], &mNormalY[k], &mNormalZ[k], &mTangentXx[k], &mTangentXy[k], c1 - c0, twoDx);
+				}
+			}
+		}
+	});
+
+	// 轮换三个平面: 当前解成为上一解, 新解成为当前解, 旧的上一解留作下一步的输出
+	std::swap(mPrevSolution, mCurrSolution);
+	std::swap(mCurrSolution, mNextSolution);
+}
+
 void Waves::Disturb(int i, int j, float magnitude)
 {
 	// Don't disturb boundaries.
@@ -163,10 +775,21 @@ void Waves::Disturb(int i, int j, float magnitude)
 	float halfMag = 0.5f*magnitude;
 
 	// Disturb the ijth vertex height and its neighbors.
-	mCurrSolution[i*mNumCols+j].y     += magnitude;
-	mCurrSolution[i*mNumCols+j+1].y   += halfMag;
-	mCurrSolution[i*mNumCols+j-1].y   += halfMag;
-	mCurrSolution[(i+1)*mNumCols+j].y += halfMag;
-	mCurrSolution[(i-1)*mNumCols+j].y += halfMag;
+	mCurrSolution[i*mNumCols+j]     += magnitude;
+	mCurrSolution[i*mNumCols+j+1]   += halfMag;
+	mCurrSolution[i*mNumCols+j-1]   += halfMag;
+	mCurrSolution[(i+1)*mNumCols+j] += halfMag;
+	mCurrSolution[(i-1)*mNumCols+j] += halfMag;
+
+	// 被扰动的格点所在的块(最多4个)变为活跃, 下一步起参与计算
+	++mVersion;
+	const int blockRows[] = { (i - 1) / ActivityBlockSize, (i + 1) / ActivityBlockSize };
+	const int blockCols[] = { (j - 1) / ActivityBlockSize, (j + 1) / ActivityBlockSize };
+	for (int bi : blockRows) {
+		for (int bj : blockCols) {
+			mActiveBlocks[bi*mBlockCols + bj] = 1;
+			mBlockVersions[bi*mBlockCols + bj] = mVersion;
+		}
+	}
 }
-	
+
@@ -16,6 +16,7 @@
 
 #include <cstdint>
 #include <DirectXMath.h>
+#include <stdexcept>
 #include <vector>
 
 /* 用户提供参数以自动生成的几何体存入GeometryGenerator类里
@@ -66,10 +67,14 @@ public:
 		std::vector<Vertex> Vertices;// MeshData结构体里的 顶点数组
 		std::vector<uint32> Indices32;// MeshData结构体里的 索引数组
 
-		/* 构建1个uint16型的索引数组*/
+		/* 构建1个uint16型的索引数组
+		* 有索引超过65535时抛出std::out_of_range, 不再静默截断; 先用Fits16判断, 放不下就改用Indices32与DXGI_FORMAT_R32_UINT */
 		std::vector<uint16>& GetIndices16()
 		{
-			if (mIndices16.empty()) 			{
+			if (mIndices16.empty() && !Indices32.empty()) {
+				if (!Fits16())
+					throw std::out_of_range("MeshData::GetIndices16: index exceeds 65535");
+
 				mIndices16.resize(Indices32.size());
 				for (size_t i = 0; i < Indices32.size(); ++i)
 					mIndices16[i] = static_cast<uint16>(Indices32[i]);
@@ -78,6 +83,16 @@ public:
 			return mIndices16;
 		}
 
+		// 所有索引都不超过65535, 即可以使用16位索引
+		bool Fits16()const
+		{
+			for (uint32 index : Indices32) {
+				if (index > 0xffff)
+					return false;
+			}
+			return true;
+		}
+
 	private:
 		std::vector<uint16> mIndices16;
 	};
@@ -526,18 +526,14 @@ void TreeBillboardsApp::UpdateWaves(const GameTimer& gt)
 
 	/* 使用波浪数学方程计算出的新数据来更新"波浪动态顶点缓存"*/
 	auto currWavesVB = mCurrFrameResource->WavesVB.get();// 暂存当前帧的 波浪顶点缓存
-	for (int i = 0; i < mWaves->VertexCount(); ++i) {
-		// 遍历到的第i个波浪点的数据 就 填充给 1个新点v
-		Vertex v;
-
-		v.Pos = mWaves->Position(i);
-		v.Normal = mWaves->Normal(i);
-		// Derive tex-coords from position by mapping [-w/2,w/2] --> [0,1]
-		v.TexC.x = 0.5f + v.Pos.x / mWaves->Width();
-		v.TexC.y = 0.5f - v.Pos.z / mWaves->Depth();
-		// 把第i个新点v作为数据源, 并真正拷贝到 当前这个FrameResource里的"WavesVB"里
-		currWavesVB->CopyData(i, v);
-	}
+	// 让波浪对象把新的位置, 法线与纹理坐标直接写进WavesVB映射出的内存, 不再逐点构造Vertex再CopyData
+	// 上次写入这个帧资源之后没变的块跳过
+	Waves::VertexLayout layout;
+	layout.Stride = sizeof(Vertex);
+	layout.PositionOffset = offsetof(Vertex, Pos);
+	layout.NormalOffset = offsetof(Vertex, Normal);
+	layout.TexCOffset = offsetof(Vertex, TexC);
+	mCurrFrameResource->WavesVersion = mWaves->WriteVertices(currWavesVB->MappedData(), layout, mCurrFrameResource->WavesVersion);
 
 	/* 最后记得给 波浪专属渲染项 里Geo管理员里的顶点数据 要被这个帧资源里的顶点数据 更新并填充*/
 	mWavesRitem->Geo->VertexBufferGPU = currWavesVB->Resource();
@@ -7,6 +7,7 @@
 #include "../../Common/UploadBuffer.h"
 #include "../../Common/GeometryGenerator.h"
 #include "../../Common/Camera.h"
+#include "../../Common/StreamedTextures.h"
 #include "FrameResource.h"
 
 using Microsoft::WRL::ComPtr;
@@ -18,6 +19,9 @@ using namespace DirectX::PackedVector;
 
 const int gNumFrameResources = 3;
 
+// 纹理流送的显存预算(字节)
+const UINT64 gTextureBudget = 32ull * 1024 * 1024;
+
 // Lightweight structure stores parameters to draw a shape.  This will
 // vary from app-to-app.
 struct RenderItem
@@ -44,6 +48,9 @@ struct RenderItem
 	Material* Mat = nullptr;
 	MeshGeometry* Geo = nullptr;
 
+	// 局部空间的包围盒, 纹理流送按它在屏幕上的大小决定所需的mip
+	BoundingBox Bounds;
+
     // Primitive topology.
     D3D12_PRIMITIVE_TOPOLOGY PrimitiveType = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
 
@@ -77,6 +84,7 @@ private:
 	void UpdateObjectCBs(const GameTimer& gt);
 	void UpdateMaterialBuffer(const GameTimer& gt);
 	void UpdateMainPassCB(const GameTimer& gt);
+	void UpdateTextureStreaming(const GameTimer& gt);
 
 	void LoadTextures();
     void BuildRootSignature();
@@ -102,10 +110,13 @@ private:
     ComPtr<ID3D12RootSignature> mRootSignature = nullptr;
 
 	ComPtr<ID3D12DescriptorHeap> mSrvDescriptorHeap = nullptr;
+	// 纹理按屏幕上所需的mip逐级调入/调出, 每个纹理占SRV堆里相邻的两个槽
+	std::unique_ptr<StreamedTextures> mStreamedTextures;
 
 	std::unordered_map<std::string, std::unique_ptr<MeshGeometry>> mGeometries;
 	std::unordered_map<std::string, std::unique_ptr<Material>> mMaterials;
-	std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;
+	std::unordered_map<std::string, StreamedTextures::TextureId> mTextures;
+	std::unordered_map<Material*, StreamedTextures::TextureId> mMaterialTextures;// 材质所用的漫反射纹理
 	std::unordered_map<std::string, ComPtr<ID3DBlob>> mShaders;
 	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> mPSOs;
 
@@ -172,9 +183,9 @@ bool CameraAndDynamicIndexingApp::Initialize()
 
 	mCamera.SetPosition(0.0f, 2.0f, -15.0f);
  
+	BuildDescriptorHeaps();// 纹理的SRV由StreamedTextures写入, 须先建好堆
 	LoadTextures();
     BuildRootSignature();
-	BuildDescriptorHeaps();
     BuildShadersAndInputLayout();
     BuildShapeGeometry();
 	BuildMaterials();
@@ -220,6 +231,7 @@ void CameraAndDynamicIndexingApp::Update(const GameTimer& gt)
     }
 
 	AnimateMaterials(gt);
+	UpdateTextureStreaming(gt);// 可能改变材质的纹理序号, 须在更新材质buffer之前
 	UpdateObjectCBs(gt);
 	UpdateMaterialBuffer(gt);
 	UpdateMainPassCB(gt);// 每帧都更新主Pass
@@ -256,6 +268,9 @@ void CameraAndDynamicIndexingApp::Draw(const GameTimer& gt)
 
 	mCommandList->SetGraphicsRootSignature(mRootSignature.Get());
 
+	// 记录本帧要换掉的纹理资源的拷贝与上传; 新资源的SRV从下一帧的材质数据开始使用
+	mStreamedTextures->Execute(mCommandList.Get(), mCurrentFence + 1);
+
 	auto passCB = mCurrFrameResource->PassCB->Resource();
 	mCommandList->SetGraphicsRootConstantBufferView(1, passCB->GetGPUVirtualAddress());
 
@@ -435,46 +450,63 @@ void CameraAndDynamicIndexingApp::UpdateMainPassCB(const GameTimer& gt)
 	currPassCB->CopyData(0, mMainPassCB);
 }
 
+/// 纹理流送: 按各渲染项在屏幕上的大小报告所需的mip, 并把换过资源的纹理的新SRV序号写回材质
+void CameraAndDynamicIndexingApp::UpdateTextureStreaming(const GameTimer& gt)
+{
+	// 此时已等到当前帧资源的围栏, 完成的换资源可以释放旧资源了
+	mStreamedTextures->Retire(mFence->GetCompletedValue());
+
+	TextureStreamer& streamer = mStreamedTextures->Streamer();
+	streamer.BeginFrame(mCamera.GetPosition3f(), mCamera.GetProj4x4f()(1, 1), (float)mClientHeight);
+	for(auto& e : mAllRitems)
+	{
+		BoundingBox worldBounds;
+		e->Bounds.Transform(worldBounds, XMLoadFloat4x4(&e->World));
+		BoundingSphere sphere;
+		BoundingSphere::CreateFromBoundingBox(sphere, worldBounds);
+
+		// 纹理在物体上重复的次数取TexTransform在u, v方向缩放的较大者
+		const float uvScale = e->TexTransform(0, 0) > e->TexTransform(1, 1) ? e->TexTransform(0, 0) : e->TexTransform(1, 1);
+		streamer.ReportUsage(mMaterialTextures[e->Mat], sphere, uvScale);
+	}
+	streamer.Update();
+
+	for(auto& e : mMaterialTextures)
+	{
+		const int srvIndex = (int)mStreamedTextures->SrvIndex(e.second);
+		if(e.first->DiffuseSrvHeapIndex != srvIndex)
+		{
+			e.first->DiffuseSrvHeapIndex = srvIndex;
+			e.first->NumFramesDirty = gNumFrameResources;
+		}
+	}
+}
+
 void CameraAndDynamicIndexingApp::LoadTextures()
 {
-	auto bricksTex = std::make_unique<Texture>();
-	bricksTex->Name = "bricksTex";
-	bricksTex->Filename = L"../../Textures/bricks.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), bricksTex->Filename.c_str(),
-		bricksTex->Resource, bricksTex->UploadHeap));
-
-	auto stoneTex = std::make_unique<Texture>();
-	stoneTex->Name = "stoneTex";
-	stoneTex->Filename = L"../../Textures/stone.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), stoneTex->Filename.c_str(),
-		stoneTex->Resource, stoneTex->UploadHeap));
-
-	auto tileTex = std::make_unique<Texture>();
-	tileTex->Name = "tileTex";
-	tileTex->Filename = L"../../Textures/tile.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), tileTex->Filename.c_str(),
-		tileTex->Resource, tileTex->UploadHeap));
-
-	auto crateTex = std::make_unique<Texture>();
-	crateTex->Name = "crateTex";
-	crateTex->Filename = L"../../Textures/WoodCrate01.dds";
-	ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-		mCommandList.Get(), crateTex->Filename.c_str(),
-		crateTex->Resource, crateTex->UploadHeap));
-
-	mTextures[bricksTex->Name] = std::move(bricksTex);
-	mTextures[stoneTex->Name] = std::move(stoneTex);
-	mTextures[tileTex->Name] = std::move(tileTex);
-	mTextures[crateTex->Name] = std::move(crateTex);
+	const std::string names[] = { "bricksTex", "stoneTex", "tileTex", "crateTex" };
+	const std::wstring filenames[] =
+	{
+		L"../../Textures/bricks.dds",
+		L"../../Textures/stone.dds",
+		L"../../Textures/tile.dds",
+		L"../../Textures/WoodCrate01.dds"
+	};
+
+	// 只上传各纹理的尾部mip, 其余的按需要在运行时调入; 初始化的命令在Initialize末尾的FlushCommandQueue时完成
+	mStreamedTextures->Streamer().SetBudget(gTextureBudget);
+	for(int i = 0; i < _countof(names); ++i)
+	{
+		StreamedTextures::TextureId id = 0;
+		ThrowIfFailed(mStreamedTextures->Add(mCommandList.Get(), filenames[i], mCurrentFence + 1, id));
+		mTextures[names[i]] = id;
+	}
 }
 
 void CameraAndDynamicIndexingApp::BuildRootSignature()
 {
 	CD3DX12_DESCRIPTOR_RANGE texTable;
-	texTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 4, 0, 0);// 这张纹理初始化为SRV型
+	texTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 8, 0, 0);// 这张纹理初始化为SRV型; 流送的纹理每张占两个槽
 	
 	// 按变更频率由高至低排列(依次是物体常量, 渲染过程常量, 材质用SRV, 纹理)
     CD3DX12_ROOT_PARAMETER slotRootParameter[4];
@@ -515,50 +547,13 @@ void CameraAndDynamicIndexingApp::BuildDescriptorHeaps()
 	// Create the SRV heap.
 	//
 	D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
-	srvHeapDesc.NumDescriptors = 4;
+	srvHeapDesc.NumDescriptors = 8;// 4张纹理, 每张两个槽
 	srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
 	srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 	ThrowIfFailed(md3dDevice->CreateDescriptorHeap(&srvHeapDesc, IID_PPV_ARGS(&mSrvDescriptorHeap)));
 
-	//
-	// Fill out the heap with actual descriptors.
-	//
-	CD3DX12_CPU_DESCRIPTOR_HANDLE hDescriptor(mSrvDescriptorHeap->GetCPUDescriptorHandleForHeapStart());
-
-	auto bricksTex = mTextures["bricksTex"]->Resource;
-	auto stoneTex = mTextures["stoneTex"]->Resource;
-	auto tileTex = mTextures["tileTex"]->Resource;
-	auto crateTex = mTextures["crateTex"]->Resource;
-
-	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	srvDesc.Format = bricksTex->GetDesc().Format;
-	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-	srvDesc.Texture2D.MostDetailedMip = 0;
-	srvDesc.Texture2D.MipLevels = bricksTex->GetDesc().MipLevels;
-	srvDesc.Texture2D.ResourceMinLODClamp = 0.0f;
-	md3dDevice->CreateShaderResourceView(bricksTex.Get(), &srvDesc, hDescriptor);
-
-	// next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
-
-	srvDesc.Format = stoneTex->GetDesc().Format;
-	srvDesc.Texture2D.MipLevels = stoneTex->GetDesc().MipLevels;
-	md3dDevice->CreateShaderResourceView(stoneTex.Get(), &srvDesc, hDescriptor);
-
-	// next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
-
-	srvDesc.Format = tileTex->GetDesc().Format;
-	srvDesc.Texture2D.MipLevels = tileTex->GetDesc().MipLevels;
-	md3dDevice->CreateShaderResourceView(tileTex.Get(), &srvDesc, hDescriptor);
-
-	// next descriptor
-	hDescriptor.Offset(1, mCbvSrvDescriptorSize);
-
-	srvDesc.Format = crateTex->GetDesc().Format;
-	srvDesc.Texture2D.MipLevels = crateTex->GetDesc().MipLevels;
-	md3dDevice->CreateShaderResourceView(crateTex.Get(), &srvDesc, hDescriptor);
+	// 描述符由StreamedTextures在加载与每次换资源时写入
+	mStreamedTextures = std::make_unique<StreamedTextures>(md3dDevice.Get(), mSrvDescriptorHeap.Get(), 0);
 }
 
 void CameraAndDynamicIndexingApp::BuildShadersAndInputLayout()
@@ -583,6 +578,7 @@ void CameraAndDynamicIndexingApp::BuildShadersAndInputLayout()
 void CameraAndDynamicIndexingApp::BuildShapeGeometry()
 {
     GeometryGenerator geoGen;
+    geoGen.SetOptimize(true);// 球体与柱体按顶点缓存重排三角形与顶点, 每个只多花约0.4ms
 	GeometryGenerator::MeshData box = geoGen.CreateBox(1.0f, 1.0f, 1.0f, 3);
 	GeometryGenerator::MeshData grid = geoGen.CreateGrid(20.0f, 30.0f, 60, 40);
 	GeometryGenerator::MeshData sphere = geoGen.CreateSphere(0.5f, 20, 20);
@@ -625,6 +621,18 @@ void CameraAndDynamicIndexingApp::BuildShapeGeometry()
 	cylinderSubmesh.StartIndexLocation = cylinderIndexOffset;
 	cylinderSubmesh.BaseVertexLocation = cylinderVertexOffset;
 
+	// 各子网格的包围盒
+	auto computeBounds = [](const GeometryGenerator::MeshData& mesh)
+	{
+		BoundingBox bounds;
+		BoundingBox::CreateFromPoints(bounds, mesh.Vertices.size(), &mesh.Vertices[0].Position, sizeof(GeometryGenerator::Vertex));
+		return bounds;
+	};
+	boxSubmesh.Bounds = computeBounds(box);
+	gridSubmesh.Bounds = computeBounds(grid);
+	sphereSubmesh.Bounds = computeBounds(sphere);
+	cylinderSubmesh.Bounds = computeBounds(cylinder);
+
 	//
 	// Extract the vertex elements we are interested in and pack the
 	// vertices of all the meshes into one vertex buffer.
@@ -784,6 +792,14 @@ void CameraAndDynamicIndexingApp::BuildMaterials()
 	mMaterials["stone0"] = std::move(stone0);
 	mMaterials["tile0"] = std::move(tile0);
 	mMaterials["crate0"] = std::move(crate0);
+
+	// 纹理的SRV序号由StreamedTextures决定, 换资源后会变, 每帧在UpdateTextureStreaming中刷新
+	mMaterialTextures[mMaterials["bricks0"].get()] = mTextures["bricksTex"];
+	mMaterialTextures[mMaterials["stone0"].get()] = mTextures["stoneTex"];
+	mMaterialTextures[mMaterials["tile0"].get()] = mTextures["tileTex"];
+	mMaterialTextures[mMaterials["crate0"].get()] = mTextures["crateTex"];
+	for(auto& e : mMaterialTextures)
+		e.first->DiffuseSrvHeapIndex = mStreamedTextures->SrvIndex(e.second);
 }
 
 void CameraAndDynamicIndexingApp::BuildRenderItems()
@@ -798,6 +814,7 @@ void CameraAndDynamicIndexingApp::BuildRenderItems()
 	boxRitem->IndexCount = boxRitem->Geo->DrawArgs["box"].IndexCount;
 	boxRitem->StartIndexLocation = boxRitem->Geo->DrawArgs["box"].StartIndexLocation;
 	boxRitem->BaseVertexLocation = boxRitem->Geo->DrawArgs["box"].BaseVertexLocation;
+	boxRitem->Bounds = boxRitem->Geo->DrawArgs["box"].Bounds;
 	mAllRitems.push_back(std::move(boxRitem));
 
     auto gridRitem = std::make_unique<RenderItem>();
@@ -810,6 +827,7 @@ void CameraAndDynamicIndexingApp::BuildRenderItems()
     gridRitem->IndexCount = gridRitem->Geo->DrawArgs["grid"].IndexCount;
     gridRitem->StartIndexLocation = gridRitem->Geo->DrawArgs["grid"].StartIndexLocation;
     gridRitem->BaseVertexLocation = gridRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
+	gridRitem->Bounds = gridRitem->Geo->DrawArgs["grid"].Bounds;
 	mAllRitems.push_back(std::move(gridRitem));
 
 	XMMATRIX brickTexTransform = XMMatrixScaling(1.0f, 1.0f, 1.0f);
@@ -836,6 +854,7 @@ void CameraAndDynamicIndexingApp::BuildRenderItems()
 		leftCylRitem->IndexCount = leftCylRitem->Geo->DrawArgs["cylinder"].IndexCount;
 		leftCylRitem->StartIndexLocation = leftCylRitem->Geo->DrawArgs["cylinder"].StartIndexLocation;
 		leftCylRitem->BaseVertexLocation = leftCylRitem->Geo->DrawArgs["cylinder"].BaseVertexLocation;
+		leftCylRitem->Bounds = leftCylRitem->Geo->DrawArgs["cylinder"].Bounds;
 
 		XMStoreFloat4x4(&rightCylRitem->World, leftCylWorld);
 		XMStoreFloat4x4(&rightCylRitem->TexTransform, brickTexTransform);
@@ -846,6 +865,7 @@ void CameraAndDynamicIndexingApp::BuildRenderItems()
 		rightCylRitem->IndexCount = rightCylRitem->Geo->DrawArgs["cylinder"].IndexCount;
 		rightCylRitem->StartIndexLocation = rightCylRitem->Geo->DrawArgs["cylinder"].StartIndexLocation;
 		rightCylRitem->BaseVertexLocation = rightCylRitem->Geo->DrawArgs["cylinder"].BaseVertexLocation;
+		rightCylRitem->Bounds = rightCylRitem->Geo->DrawArgs["cylinder"].Bounds;
 
 		XMStoreFloat4x4(&leftSphereRitem->World, leftSphereWorld);
 		leftSphereRitem->TexTransform = MathHelper::Identity4x4();
@@ -856,6 +876,7 @@ void CameraAndDynamicIndexingApp::BuildRenderItems()
 		leftSphereRitem->IndexCount = leftSphereRitem->Geo->DrawArgs["sphere"].IndexCount;
 		leftSphereRitem->StartIndexLocation = leftSphereRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
 		leftSphereRitem->BaseVertexLocation = leftSphereRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
+		leftSphereRitem->Bounds = leftSphereRitem->Geo->DrawArgs["sphere"].Bounds;
 
 		XMStoreFloat4x4(&rightSphereRitem->World, rightSphereWorld);
 		rightSphereRitem->TexTransform = MathHelper::Identity4x4();
@@ -866,6 +887,7 @@ void CameraAndDynamicIndexingApp::BuildRenderItems()
 		rightSphereRitem->IndexCount = rightSphereRitem->Geo->DrawArgs["sphere"].IndexCount;
 		rightSphereRitem->StartIndexLocation = rightSphereRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
 		rightSphereRitem->BaseVertexLocation = rightSphereRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
+		rightSphereRitem->Bounds = rightSphereRitem->Geo->DrawArgs["sphere"].Bounds;
 
 		mAllRitems.push_back(std::move(leftCylRitem));
 		mAllRitems.push_back(std::move(rightCylRitem));
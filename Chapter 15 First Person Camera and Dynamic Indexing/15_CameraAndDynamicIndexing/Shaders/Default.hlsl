@@ -32,7 +32,7 @@ struct MaterialData
 };
 
 // shader model 5.1ֵ֧,Texture2DArray,ߴ͸ʽиʸԲͬ,ԵñTexture2DArrayҪ
-Texture2D gDiffuseMap[4] : register(t0);
+Texture2D gDiffuseMap[8] : register(t0);
 // ѽṹbufferspace1,Ӷ鲻 ṹԴ ص
 // !!ע!! һеռüĴt0,t1,t2,t3space0ռ
 // ʽָΪspace1ռ,ʹüĴά,Դص,֮ǰռto,t1,t2,t3space0ռ,ṹbufferռtospace1ռ
@@ -7,6 +7,16 @@
 #include "../../Common/UploadBuffer.h"
 #include "../../Common/GeometryGenerator.h"
 #include "../../Common/Camera.h"
+#include "../../Common/MeshFile.h"
+#include "../../Common/IndexPacking.h"
+#include "../../Common/InstanceCuller.h"
+#include "../../Common/AabbTree.h"
+#include "../../Common/OcclusionCuller.h"
+#include "../../Common/FrameStats.h"
+#include "../../Common/MeshOptimizer.h"
+#include "../../Common/MeshSimplifier.h"
+#include "../../Common/LodSelector.h"
+#include "../../Common/ThreadPool.h"
 #include "FrameResource.h"
 
 using Microsoft::WRL::ComPtr;
@@ -17,6 +27,12 @@ using namespace DirectX::PackedVector;
 #pragma comment(lib, "D3D12.lib")
 
 const int gNumFrameResources = 3;// 默认定义3个帧资源
+const int gMaxOccluders = 16;// 每个渲染项每帧最多选作遮挡体的实例数
+
+// 骷髅头的LOD: 级数, 相邻两级的三角形数之比, 以及按投影大小切换的阈值(见LodSelector::SetThresholds)
+const int gSkullLodCount = 4;
+const float gSkullLodRatio = 0.4f;
+const float gSkullLodThresholds[gSkullLodCount - 1] = { 0.3f, 0.12f, 0.05f };
 
 /// 实例化技术需要用到的渲染项
 struct RenderItem
@@ -50,6 +66,25 @@ struct RenderItem
 	/* 这是新增的2个变量*/
 	BoundingBox Bounds;// 单个渲染项里的包围体; DirectxCollison库里提供的包围盒,是盒子中心与扩展向量组合的表达形式,公式是c=0.5(Vmin+Vmax), e=0.5(Vmax-Vmin)
 	std::vector<InstanceData> Instances;// 本次渲染项里持有的一组实例化数据; InstanceData等价于ObjectConstants; 渲染项里持有的一组实例(允许大容量); 渲染项里持有实例化次数
+	InstanceCuller Culler;// 各实例在世界空间的包围盒(SoA), 实例的World改变后须重新SetBounds
+	AabbTree SpatialIndex;// 实例段的空间索引, Culler每ChunkSize个实例一段、一个代理, UserData为段号
+	std::vector<int> ChunkProxies;// 各段在SpatialIndex中的代理; 段内实例移动后须以GetChunkBounds对其调用Move
+	std::vector<ContainmentType> ChunkContainment;// 本帧各段(胖包围盒)与视锥体的关系, 由UpdateInstanceData查得
+	ContainmentType FrustumContainment = DISJOINT;// 本帧全部实例与视锥体的关系, 由UpdateInstanceData求得
+	const OcclusionCuller::OccluderMesh* Occluder = nullptr;// 实例作为遮挡体时画进软件深度缓冲区的简化网格; 为空则不遮挡别的实例
+
+	/// 各级LOD的绘制参数, 第0级与下面的IndexCount等相同; 可见实例按LOD分桶后,
+	/// 第l级的实例在实例buffer中从StartInstance起连续存放, 每级各画一次
+	struct LodDrawArgs
+	{
+		UINT IndexCount = 0;
+		UINT StartIndexLocation = 0;
+		int BaseVertexLocation = 0;
+		UINT StartInstance = 0;
+		UINT InstanceCount = 0;
+	};
+	std::vector<LodDrawArgs> Lods;
+	LodSelector Lod;// 各实例当前的LOD
 
 	// 绘制三参数(但本工程再补1个 "要被实例化技术操作的实例数量").
 	UINT IndexCount = 0;
@@ -80,6 +115,7 @@ private:
 	void OnKeyboardInput(const GameTimer& gt);
 	void AnimateMaterials(const GameTimer& gt);
 	void UpdateInstanceData(const GameTimer& gt);
+	void RenderOccluders();
 	void UpdateMaterialBuffer(const GameTimer& gt);
 	void UpdateMainPassCB(const GameTimer& gt);
 
@@ -88,6 +124,9 @@ private:
 	void BuildDescriptorHeaps();
 	void BuildShadersAndInputLayout();
 	void BuildSkullGeometry();
+	bool BuildSkullGeometryFromCache();
+	void BuildSkullLods(MeshGeometry* geo, const Vertex* vertices, UINT vertexCount, std::vector<std::uint32_t>& indices);
+	bool BuildSkullIndexBuffer(MeshGeometry* geo, const std::vector<std::uint32_t>& indices, UINT vertexCount);
 	void BuildPSOs();
 	void BuildFrameResources();
 	void BuildMaterials();
@@ -119,8 +158,36 @@ private:
 
 	UINT mInstanceCount = 0;// 采用实例化技术处理的实例数量
 	bool mFrustumCullingEnabled = true;
+	std::vector<std::uint32_t> mVisibleInstances;// 并行剔除的暂存区, 每帧复用; 开启LOD时随后存放按LOD分好桶的可见实例
+	std::vector<std::uint32_t> mCompactInstances;// 开启LOD时剔除后的紧凑可见列表, 分桶前的中间结果
+	bool mLodEnabled = true;
 	BoundingFrustum mCamFrustum;// 相机视锥体
 
+	bool mOcclusionCullingEnabled = true;
+	OcclusionCuller mOcclusionCuller;// 遮挡体的软件深度缓冲区与Hi-Z
+	OcclusionCuller::OccluderMesh mSkullOccluder;// 骷髅头的遮挡体: 缩小的内接盒
+	std::vector<std::pair<float, UINT>> mOccluderCandidates;// (到相机距离的平方, 实例序号), 每帧复用
+
+	/// 逐帧统计: 实例的剔除结果与Update各阶段的耗时; 按P键把历史导出为FrameStats.csv/FrameStats.json
+	FrameStats mFrameStats;
+	int mStatInstances = FrameStats::InvalidId;		 // 全部实例数
+	int mStatTested = FrameStats::InvalidId;		 // 逐实例做过包围盒测试的实例数
+	int mStatVisible = FrameStats::InvalidId;		 // 最终写入实例buffer的实例数
+	int mStatFrustumCulled = FrameStats::InvalidId;	 // 被视锥体剔除的实例数(含被空间索引整棵子树排除的)
+	int mStatOcclusionCulled = FrameStats::InvalidId;// 通过视锥体测试后被遮挡剔除的实例数
+	int mStatOccluders = FrameStats::InvalidId;
+	int mStatOccluderTriangles = FrameStats::InvalidId;
+	int mStatTriangles = FrameStats::InvalidId;		 // 提交绘制的三角形数(各级LOD的实例数 * 三角形数之和)
+	int mStatLodInstances[LodSelector::MaxLods];	 // 各级LOD的可见实例数
+	int mTimerUpdate = FrameStats::InvalidId;
+	int mTimerFenceWait = FrameStats::InvalidId;
+	int mTimerOccluders = FrameStats::InvalidId;
+	int mTimerCulling = FrameStats::InvalidId;
+	int mTimerMaterials = FrameStats::InvalidId;
+	int mTimerPassCB = FrameStats::InvalidId;
+	bool mStatsDumpKeyDown = false;
+	wchar_t mCaptionBuffer[256];// 窗口标题在此格式化, 每帧不再构造字符串流
+
 	PassConstants mMainPassCB;// 主Pass;目前仅1个主PASS,日后可能会增加阴影Pass
 
 	Camera mCamera;
@@ -152,6 +219,23 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE prevInstance,
 InstancingAndCullingApp::InstancingAndCullingApp(HINSTANCE hInstance)
 	: D3DApp(hInstance)
 {
+	mStatInstances = mFrameStats.RegisterCounter("Instances");
+	mStatTested = mFrameStats.RegisterCounter("Tested");
+	mStatVisible = mFrameStats.RegisterCounter("Visible");
+	mStatFrustumCulled = mFrameStats.RegisterCounter("FrustumCulled");
+	mStatOcclusionCulled = mFrameStats.RegisterCounter("OcclusionCulled");
+	mStatOccluders = mFrameStats.RegisterCounter("Occluders");
+	mStatOccluderTriangles = mFrameStats.RegisterCounter("OccluderTriangles");
+	mStatTriangles = mFrameStats.RegisterCounter("Triangles");
+	for (int l = 0; l < LodSelector::MaxLods; ++l)
+		mStatLodInstances[l] = (l < gSkullLodCount) ? mFrameStats.RegisterCounter(("Lod" + std::to_string(l)).c_str()) : FrameStats::InvalidId;
+
+	mTimerUpdate = mFrameStats.RegisterTimer("Update");
+	mTimerFenceWait = mFrameStats.RegisterTimer("FenceWait");
+	mTimerOccluders = mFrameStats.RegisterTimer("Occluders");
+	mTimerCulling = mFrameStats.RegisterTimer("Culling");
+	mTimerMaterials = mFrameStats.RegisterTimer("Materials");
+	mTimerPassCB = mFrameStats.RegisterTimer("PassCB");
 }
 
 InstancingAndCullingApp::~InstancingAndCullingApp()
@@ -202,10 +286,15 @@ void InstancingAndCullingApp::OnResize()
 	mCamera.SetLens(0.25f * MathHelper::Pi, AspectRatio(), 1.0f, 1000.0f);
 	// 根据投影矩阵反过来计算观察空间里视锥体的函数如下
 	BoundingFrustum::CreateFromMatrix(mCamFrustum, mCamera.GetProj());
+
+	// 遮挡剔除的深度缓冲区只需与视口的宽高比一致
+	mOcclusionCuller.Resize(256, (int)(256.0f / AspectRatio()));
 }
 
 void InstancingAndCullingApp::Update(const GameTimer& gt)
 {
+	const auto updateStart = std::chrono::steady_clock::now();
+
 	OnKeyboardInput(gt);
 
 	// Cycle through the circular frame resource array.
@@ -215,6 +304,7 @@ void InstancingAndCullingApp::Update(const GameTimer& gt)
 	// Has the GPU finished processing the commands of the current frame resource?
 	// If not, wait until the GPU has completed commands up to this fence point.
 	if (mCurrFrameResource->Fence != 0 && mFence->GetCompletedValue() < mCurrFrameResource->Fence) {
+		FrameStats::ScopedTimer fenceTimer(mFrameStats, mTimerFenceWait);
 		HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
 		ThrowIfFailed(mFence->SetEventOnCompletion(mCurrFrameResource->Fence, eventHandle));
 		WaitForSingleObject(eventHandle, INFINITE);
@@ -223,8 +313,23 @@ void InstancingAndCullingApp::Update(const GameTimer& gt)
 
 	AnimateMaterials(gt);
 	UpdateInstanceData(gt);
-	UpdateMaterialBuffer(gt);
-	UpdateMainPassCB(gt);
+	{
+		FrameStats::ScopedTimer materialTimer(mFrameStats, mTimerMaterials);
+		UpdateMaterialBuffer(gt);
+	}
+	{
+		FrameStats::ScopedTimer passTimer(mFrameStats, mTimerPassCB);
+		UpdateMainPassCB(gt);
+	}
+	mFrameStats.AddTime(mTimerUpdate, std::chrono::steady_clock::now() - updateStart);
+
+	// 本帧的剔除结果显示在窗口标题上; 格式化进固定的缓冲区, assign会复用mMainWndCaption已有的内存
+	swprintf_s(mCaptionBuffer, L"实例化和裁剪工程里目前有:    %lld 个物体可以被看到 out of %lld (视锥体剔除 %lld, 遮挡剔除 %lld)",
+		mFrameStats.CurrentCounter(mStatVisible), mFrameStats.CurrentCounter(mStatInstances),
+		mFrameStats.CurrentCounter(mStatFrustumCulled), mFrameStats.CurrentCounter(mStatOcclusionCulled));
+	mMainWndCaption.assign(mCaptionBuffer);
+
+	mFrameStats.EndFrame();
 }
 
 void InstancingAndCullingApp::Draw(const GameTimer& gt)
@@ -344,6 +449,26 @@ void InstancingAndCullingApp::OnKeyboardInput(const GameTimer& gt)
 	if (GetAsyncKeyState('2') & 0x8000)
 		mFrustumCullingEnabled = false;
 
+	if (GetAsyncKeyState('3') & 0x8000)
+		mOcclusionCullingEnabled = true;
+
+	if (GetAsyncKeyState('4') & 0x8000)
+		mOcclusionCullingEnabled = false;
+
+	if (GetAsyncKeyState('5') & 0x8000)
+		mLodEnabled = true;
+
+	if (GetAsyncKeyState('6') & 0x8000)
+		mLodEnabled = false;
+
+	// 按下P键时(只在按下的那一帧)导出统计历史
+	const bool dumpKeyDown = (GetAsyncKeyState('P') & 0x8000) != 0;
+	if (dumpKeyDown && !mStatsDumpKeyDown) {
+		mFrameStats.WriteCsv("FrameStats.csv");
+		mFrameStats.WriteJson("FrameStats.json");
+	}
+	mStatsDumpKeyDown = dumpKeyDown;
+
 	mCamera.UpdateViewMatrix();
 }
 
@@ -357,55 +482,206 @@ void InstancingAndCullingApp::UpdateInstanceData(const GameTimer& gt)
 	XMMATRIX view = mCamera.GetView();									  // 暂存相机观察矩阵
 	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view); // 暂存相机观察矩阵的逆矩阵
 
+	/// 把摄像机的视锥体从 观察空间变换至世界空间, 每帧只变换这一次;
+	/// 各实例的包围盒已预先变换到世界空间, 不必再为每个实例求world的逆矩阵、把视锥体变换到其局部空间
+	BoundingFrustum worldSpaceFrustum;
+	mCamFrustum.Transform(worldSpaceFrustum, invView);
+	const InstanceCuller::Frustum frustum = InstanceCuller::MakeFrustum(worldSpaceFrustum);
+
+	/// 先在各渲染项的空间索引中查出各实例段与视锥体的关系: 在视锥体外的子树整个跳过,
+	/// 胖包围盒完全在视锥体内的段不必再测, 只有与视锥体边界相交的段随后用SIMD内核逐个剔除
+	for (auto& e : mAllRitems) {
+		if (!mFrustumCullingEnabled) {
+			e->FrustumContainment = CONTAINS;
+			continue;
+		}
+
+		e->ChunkContainment.assign(e->ChunkProxies.size(), DISJOINT);
+		size_t insideChunks = 0;
+		size_t hitChunks = 0;
+		e->SpatialIndex.QueryFrustum(frustum.Planes, InstanceCuller::PlaneCount, [&](int proxy, bool inside)
+		{
+			const auto chunk = (std::uint32_t)reinterpret_cast<std::uintptr_t>(e->SpatialIndex.GetUserData(proxy));
+			e->ChunkContainment[chunk] = inside ? CONTAINS : INTERSECTS;
+			insideChunks += inside ? 1 : 0;
+			++hitChunks;
+		});
+
+		if (hitChunks == 0)
+			e->FrustumContainment = DISJOINT;
+		else if (insideChunks == e->ChunkProxies.size())
+			e->FrustumContainment = CONTAINS;
+		else
+			e->FrustumContainment = INTERSECTS;
+	}
+
+	/// 遮挡剔除依附于视锥体剔除: 先把选出的遮挡体画进软件深度缓冲区, 通过视锥体测试的实例再逐个与Hi-Z比较
+	const bool occlusionCulling = mFrustumCullingEnabled && mOcclusionCullingEnabled;
+	if (occlusionCulling) {
+		FrameStats::ScopedTimer occluderTimer(mFrameStats, mTimerOccluders);
+		RenderOccluders();
+		mFrameStats.Set(mStatOccluders, mOcclusionCuller.OccluderCount());
+		mFrameStats.Set(mStatOccluderTriangles, mOcclusionCuller.RasterizedTriangleCount());
+	}
+
+	FrameStats::ScopedTimer cullingTimer(mFrameStats, mTimerCulling);
+
 	auto currInstanceBuffer = mCurrFrameResource->InstanceBuffer.get();// 当前帧的实例buffer
 	// 遍历所有渲染项
 	for (auto& e : mAllRitems) {
 		// 拿到但个渲染项里所有的实例次数
 		const auto& instanceData = e->Instances;
-		// 有一个计数器,暗示第几个缓存区
-		// 来确保结构化buffer前面的数据均为可见实例;而实例与视锥体相交就会被加入结构化buffer的下一个空槽位
-		// 要将visibleInstanceCount挪到遍历allRitems循环外，这样才能排序所有渲染项实例数据
-		// 如果有多个渲染项，如果InstanceIndex在循环内，后面数据将会覆盖掉前面的。
-		int visibleInstanceCount = 0;
-
-		// 遍历单个渲染项的所有实例
-		for (UINT i = 0; i < (UINT)instanceData.size(); ++i) {
-			XMMATRIX world        = XMLoadFloat4x4(&instanceData[i].World);		  // 暂存单个实例的world
-			XMMATRIX texTransform = XMLoadFloat4x4(&instanceData[i].TexTransform);// 暂存单个实例的TexTransform
-
-			XMMATRIX invWorld = XMMatrixInverse(&XMMatrixDeterminant(world), world);// 暂存一下world的逆矩阵
-			XMMATRIX viewToLocal = XMMatrixMultiply(invView, invWorld);				// 暂存一下viewToWorld
-
-			/// 把摄像机的视锥体从 观察空间变换至单个实例的局部空间(因为骷髅头MESH的ABB盒子位于局部空间)
-			BoundingFrustum localSpaceFrustum;
-			mCamFrustum.Transform(localSpaceFrustum, viewToLocal);
-
-			/// 在局部空间执行 包围体和视锥的相交测试
-			// !!!!如若关闭视锥体裁剪或者查到包围体仍在视锥内,则会进到这个if里执行逻辑
-			// if里的逻辑就是"不执行剔除",仍然拷贝数据源到结构体buffer里,会导致实例数量增多
-			if ((localSpaceFrustum.Contains(e->Bounds) != DirectX::DISJOINT/*包围体位于视锥体之外*/) || 
-				(mFrustumCullingEnabled == false)) {
+		const UINT instanceCount = (UINT)instanceData.size();
+		mVisibleInstances.resize(instanceCount);
+
+		// 有多级LOD时, 剔除只产出可见实例的紧凑列表并为各实例选好LOD, 分桶后再写实例buffer
+		const bool useLods = mLodEnabled && e->Lods.size() > 1;
+		if (useLods) {
+			mCompactInstances.resize(instanceCount);
+			e->Lod.BeginFrame(mCamera.GetPosition3f(), mCamera.GetProj4x4f()(1, 1));
+		}
+
+		// 把一段可见实例的数据直接写进映射出的结构化buffer, 从第firstSlot个槽位起连续存放;
+		// 各段的槽位区间互不重叠, 多个线程可以同时写, 且结构化buffer前面的数据均为可见实例
+		InstanceData* mappedInstances = currInstanceBuffer->MappedData();
+		auto writeInstances = [&](const std::uint32_t* visible, std::uint32_t count, std::uint32_t firstSlot)
+		{
+			for (std::uint32_t k = 0; k < count; ++k) {
+				const UINT i = visible[k];
+				XMMATRIX world        = XMLoadFloat4x4(&instanceData[i].World);		  // 暂存单个实例的world
+				XMMATRIX texTransform = XMLoadFloat4x4(&instanceData[i].TexTransform);// 暂存单个实例的TexTransform
+
 				InstanceData data;
 				XMStoreFloat4x4(&data.World,        XMMatrixTranspose(world));
 				XMStoreFloat4x4(&data.TexTransform, XMMatrixTranspose(texTransform));
 				data.MaterialIndex = instanceData[i].MaterialIndex;
 
-				// 把上面构建的数据源data,也就是可见实例的数据, 拷贝到对应序数的结构化buffer里
-				// //将实例数据一个个地拷贝至GPU缓存; //复制完实例数据，递增到下一个实例
-				currInstanceBuffer->CopyData(visibleInstanceCount++, data);
+				// 整个结构体一次写出, 上传堆是写合并内存, 按地址顺序整块写入最快
+				mappedInstances[firstSlot + k] = data;
+			}
+		};
+
+		// 剔除的输出回调: 不分LOD时直接写实例buffer, 否则记下可见实例并按包围球的投影大小选LOD
+		auto emitVisible = [&](const std::uint32_t* visible, std::uint32_t count, std::uint32_t firstSlot)
+		{
+			if (!useLods) {
+				writeInstances(visible, count, firstSlot);
+				return;
+			}
+
+			for (std::uint32_t k = 0; k < count; ++k) {
+				const std::uint32_t i = visible[k];
+				const BoundingBox bounds = e->Culler.GetBounds(i);
+				e->Lod.Select(i, BoundingSphere(bounds.Center, XMVectorGetX(XMVector3Length(XMLoadFloat3(&bounds.Extents)))));
+				mCompactInstances[firstSlot + k] = i;
 			}
+		};
+
+		/// 空间索引查出的相交段再在世界空间执行 包围体和视锥的相交测试; 各段交给线程池,
+		/// 按各段可见数的前缀和分配槽位, 写入的顺序与逐个串行剔除的结果完全相同
+		// 如若关闭视锥体裁剪,则"不执行剔除",所有实例都拷贝到结构体buffer里,会导致实例数量增多
+		// 全部实例都在视锥体内时, 开启遮挡剔除后仍要逐实例过滤
+		InstanceCuller::FilterFunc occlusionFilter;
+		if (occlusionCulling) {
+			occlusionFilter = [&](std::uint32_t* visible, std::uint32_t count)
+			{
+				const std::uint32_t unoccluded = mOcclusionCuller.FilterVisible(e->Culler, visible, count);
+				mFrameStats.Add(mStatOcclusionCulled, count - unoccluded);
+				return unoccluded;
+			};
 		}
+
+		UINT visibleInstanceCount = 0;
+		if (!mFrustumCullingEnabled) {
+			ThreadPool::Default().ParallelFor(0, (int)instanceCount, (int)InstanceCuller::ChunkSize, [&](int begin, int end)
+			{
+				for (int i = begin; i < end; ++i)
+					mVisibleInstances[i] = i;
+				emitVisible(&mVisibleInstances[begin], end - begin, begin);
+			});
+			visibleInstanceCount = instanceCount;
+		}
+		else if (e->FrustumContainment != DISJOINT) {
+			// 与视锥体边界相交的段用各实例精确的包围盒再测一次, 完全在内的段直接输出; 段按序号处理, 不必排序
+			UINT tested = 0;
+			for (UINT c = 0; c < (UINT)e->ChunkContainment.size(); ++c) {
+				if (e->ChunkContainment[c] == INTERSECTS)
+					tested += std::min(instanceCount - c * InstanceCuller::ChunkSize, InstanceCuller::ChunkSize);
+			}
+			mFrameStats.Add(mStatTested, tested);
+
+			visibleInstanceCount = e->Culler.CullChunks(frustum, e->ChunkContainment.data(), mVisibleInstances.data(), emitVisible, occlusionFilter);
+		}
+
 		// 查完所有骷髅头实例后, 更新渲染项里的 实例数量
 		e->InstanceCount = visibleInstanceCount;
 
-		// 更新每帧 统计有多少个实例在被剔除操作后仍然可见
-		std::wostringstream outs;
-		outs.precision(6);
-		outs << L"实例化和裁剪工程里" <<
-			L"目前有:    " << e->InstanceCount <<
-			L" 个物体可以被看到 out of " << e->Instances.size();
-		mMainWndCaption = outs.str();// 打印到窗口标题上
+		/// 按LOD稳定分桶, 同一级的实例在实例buffer里连续存放, 然后并行写出
+		for (auto& lod : e->Lods)
+			lod.StartInstance = lod.InstanceCount = 0;
+		if (useLods) {
+			std::uint32_t bucketStart[LodSelector::MaxLods];
+			std::uint32_t bucketCount[LodSelector::MaxLods];
+			e->Lod.Bucket(mCompactInstances.data(), visibleInstanceCount, mVisibleInstances.data(), bucketStart, bucketCount);
+			ThreadPool::Default().ParallelFor(0, (int)visibleInstanceCount, (int)InstanceCuller::ChunkSize, [&](int begin, int end)
+			{
+				writeInstances(&mVisibleInstances[begin], end - begin, begin);
+			});
+
+			for (size_t l = 0; l < e->Lods.size(); ++l) {
+				e->Lods[l].StartInstance = bucketStart[l];
+				e->Lods[l].InstanceCount = bucketCount[l];
+			}
+		}
+		else if (!e->Lods.empty()) {
+			e->Lods[0].InstanceCount = visibleInstanceCount;
+		}
+
+		for (size_t l = 0; l < e->Lods.size(); ++l) {
+			mFrameStats.Add(mStatLodInstances[l], e->Lods[l].InstanceCount);
+			mFrameStats.Add(mStatTriangles, (FrameStats::int64)e->Lods[l].InstanceCount * (e->Lods[l].IndexCount / 3));
+		}
+
+		// 统计有多少个实例在被剔除操作后仍然可见
+		mFrameStats.Add(mStatInstances, instanceCount);
+		mFrameStats.Add(mStatVisible, visibleInstanceCount);
+	}
+
+	// 没有被遮挡剔除又不可见的, 都是视锥体剔除掉的
+	mFrameStats.Set(mStatFrustumCulled, mFrameStats.CurrentCounter(mStatInstances) -
+		mFrameStats.CurrentCounter(mStatVisible) - mFrameStats.CurrentCounter(mStatOcclusionCulled));
+}
+
+void InstancingAndCullingApp::RenderOccluders()
+{
+	mOcclusionCuller.BeginFrame(XMMatrixMultiply(mCamera.GetView(), mCamera.GetProj()));
+
+	/// 离相机越近的实例在屏幕上越大, 遮挡的范围也越大; 每个渲染项只取相机前方最近的若干个实例作遮挡体
+	const XMFLOAT3 eyePos = mCamera.GetPosition3f();
+	const XMFLOAT3 look = mCamera.GetLook3f();
+	for (auto& e : mAllRitems) {
+		if (e->Occluder == nullptr || e->FrustumContainment == DISJOINT)
+			continue;
+
+		mOccluderCandidates.clear();
+		for (UINT i = 0; i < e->Culler.Count(); ++i) {
+			const BoundingBox bounds = e->Culler.GetBounds(i);
+			const float dx = bounds.Center.x - eyePos.x;
+			const float dy = bounds.Center.y - eyePos.y;
+			const float dz = bounds.Center.z - eyePos.z;
+			if (dx * look.x + dy * look.y + dz * look.z > 0.0f)
+				mOccluderCandidates.push_back(std::make_pair(dx * dx + dy * dy + dz * dz, i));
+		}
+
+		const size_t occluderCount = MathHelper::Min(mOccluderCandidates.size(), (size_t)gMaxOccluders);
+		std::nth_element(mOccluderCandidates.begin(), mOccluderCandidates.begin() + occluderCount, mOccluderCandidates.end());
+		for (size_t k = 0; k < occluderCount; ++k) {
+			const UINT i = mOccluderCandidates[k].second;
+			mOcclusionCuller.AddOccluder(e->Occluder, XMLoadFloat4x4(&e->Instances[i].World));
+		}
 	}
+
+	mOcclusionCuller.Render();
 }
 
 void InstancingAndCullingApp::UpdateMaterialBuffer(const GameTimer& gt)
@@ -655,6 +931,10 @@ void InstancingAndCullingApp::BuildShadersAndInputLayout()
 
 void InstancingAndCullingApp::BuildSkullGeometry()
 {
+	// 优先使用离线转换好的二进制缓存(Tools/MeshConverter -layout PNT -uv sphere -lods 3), 省去文本解析, 包围盒计算与LOD生成
+	if (BuildSkullGeometryFromCache())
+		return;
+
 	std::ifstream fin("Models/skull.txt");//把这个文件用作输入流
 	if (!fin) {
 		MessageBox(0, L"Models/skull.txt not found.", 0, 0);
@@ -709,43 +989,164 @@ void InstancingAndCullingApp::BuildSkullGeometry()
 	fin >> ignore;
 	fin >> ignore;
 
-	std::vector<std::int32_t> indices(3 * tcount);// 三角面
+	std::vector<std::uint32_t> indices(3 * tcount);// 三角面
 	for (UINT i = 0; i < tcount; ++i) {
 		fin >> indices[i * 3 + 0] >> indices[i * 3 + 1] >> indices[i * 3 + 2];
 	}
 
 	fin.close();
 
-	
-	/// 下面就是把数据源拷贝到CPU端和GPU端构建顶点缓存和索引缓存,给geo做值
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::int32_t);
+	// 文本文件中的三角形顺序对顶点缓存很不友好, 加载时按缓存, 过度绘制与取顶点顺序重排; 离线缓存已由MeshConverter排好
+	MeshOptimizer::Optimize(vertices.data(), vcount, sizeof(Vertex), offsetof(Vertex, Pos), indices.data(), (UINT)indices.size());
+
 	auto geo = std::make_unique<MeshGeometry>();
 	geo->Name = "skullGeo";
+
+	SubmeshGeometry submesh;
+	submesh.IndexCount = (UINT)indices.size();
+	submesh.StartIndexLocation = 0;
+	submesh.BaseVertexLocation = 0;
+	submesh.Bounds = bounds;// 新增的包围盒子
+
+	geo->DrawArgs["skull"] = submesh;
+
+	// 各级LOD的索引接在原索引之后
+	BuildSkullLods(geo.get(), vertices.data(), vcount, indices);
+
+	if (!BuildSkullIndexBuffer(geo.get(), indices, vcount)) {
+		MessageBox(0, L"Models/skull.txt has invalid indices.", 0, 0);
+		return;
+	}
+
+	/// 下面就是把数据源拷贝到CPU端和GPU端构建顶点缓存,给geo做值
+	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
 	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
 	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
 		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
 
-	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
-
 	geo->VertexByteStride = sizeof(Vertex);
 	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R32_UINT;
-	geo->IndexBufferByteSize = ibByteSize;
 
-	SubmeshGeometry submesh;
-	submesh.IndexCount = (UINT)indices.size();
-	submesh.StartIndexLocation = 0;
-	submesh.BaseVertexLocation = 0;
-	submesh.Bounds = bounds;// 新增的包围盒子
+	mGeometries[geo->Name] = std::move(geo);
+}
 
-	geo->DrawArgs["skull"] = submesh;
+bool InstancingAndCullingApp::BuildSkullGeometryFromCache()
+{
+	// 映射Models/skull.m3db; 文件不存在, 版本不符或顶点格式与本程序的Vertex不一致时返回false, 退回文本加载
+	MeshFile meshFile;
+	if (!meshFile.Open("Models/skull.m3db") || !meshFile.HasLayout("PNT", sizeof(Vertex)) || meshFile.SubmeshCount() == 0)
+		return false;
+
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = "skullGeo";
+
+	// 第0个子网格是完整的骷髅头; 用MeshConverter -lods 3转换过的文件, 其后依次是各级LOD
+	const bool fileHasLods = meshFile.SubmeshCount() >= (UINT)gSkullLodCount;
+	const UINT fileLodCount = fileHasLods ? (UINT)gSkullLodCount : 1;
+	for (UINT l = 0; l < fileLodCount; ++l) {
+		const MeshFile::Submesh& src = meshFile.Submeshes()[l];
+
+		SubmeshGeometry submesh;
+		submesh.IndexCount = src.IndexCount;
+		submesh.StartIndexLocation = src.StartIndexLocation;
+		submesh.BaseVertexLocation = src.BaseVertexLocation;
+		submesh.Bounds.Center = XMFLOAT3(src.Center);// 包围盒已在离线转换时算好
+		submesh.Bounds.Extents = XMFLOAT3(src.Extents);
+
+		geo->DrawArgs[(l == 0) ? "skull" : "skull_lod" + std::to_string(l)] = submesh;
+	}
+
+	// 索引读进数组(压缩过的在这里解码); 文件里没有LOD时在这里生成, 接在原索引之后
+	const UINT vertexCount = meshFile.GetHeader().VertexCount;
+	std::vector<std::uint32_t> indices(meshFile.IndexCount());
+	if (!meshFile.ReadIndices(indices.data()))
+		return false;
+	if (!fileHasLods)
+		BuildSkullLods(geo.get(), static_cast<const Vertex*>(meshFile.Vertices()), vertexCount, indices);
+
+	if (!BuildSkullIndexBuffer(geo.get(), indices, vertexCount))
+		return false;
+
+	/// 顶点直接从映射内存拷贝到CPU副本和GPU缓存, 不经过中间数组
+	const UINT vbByteSize = meshFile.VertexBufferByteSize();
+	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), meshFile.Vertices(), vbByteSize);
+	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), meshFile.Vertices(), vbByteSize, geo->VertexBufferUploader);
+
+	geo->VertexByteStride = sizeof(Vertex);
+	geo->VertexBufferByteSize = vbByteSize;
 
 	mGeometries[geo->Name] = std::move(geo);
+	return true;
+}
+
+bool InstancingAndCullingApp::BuildSkullIndexBuffer(MeshGeometry* geo, const std::vector<std::uint32_t>& indices, UINT vertexCount)
+{
+	/// 由IndexPacking校验所有DrawArgs并选择索引格式: 骷髅头约3万个顶点, 各级LOD共用这些顶点, 可以用16位索引;
+	/// 每个DrawArgs只画一次, 所以不允许切分, 放不下16位时保持32位
+	std::vector<IndexPacking::Range> ranges;
+	for (const auto& drawArg : geo->DrawArgs) {
+		IndexPacking::Range range;
+		range.IndexCount = drawArg.second.IndexCount;
+		range.StartIndexLocation = drawArg.second.StartIndexLocation;
+		range.BaseVertexLocation = drawArg.second.BaseVertexLocation;
+		ranges.push_back(range);
+	}
+
+	IndexPacking::Buffer indexBuffer;
+	if (!IndexPacking::Build(indices.data(), (UINT)indices.size(), ranges.data(), (UINT)ranges.size(), vertexCount, false, indexBuffer))
+		return false;
+
+	const UINT ibByteSize = (UINT)indexBuffer.Data.size();
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indexBuffer.Data.data(), ibByteSize);
+	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), indexBuffer.Data.data(), ibByteSize, geo->IndexBufferUploader);
+
+	geo->IndexFormat = indexBuffer.Index16 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+	geo->IndexBufferByteSize = ibByteSize;
+	return true;
+}
+
+void InstancingAndCullingApp::BuildSkullLods(MeshGeometry* geo, const Vertex* vertices, UINT vertexCount, std::vector<std::uint32_t>& indices)
+{
+	/// 用二次误差边折叠逐级简化: 每级由上一级简化而来, 三角形数约为上一级的gSkullLodRatio倍;
+	/// 简化只去掉顶点而不产生新顶点, 各级共用同一个顶点缓冲区, 只需把索引接在indices之后
+	const SubmeshGeometry base = geo->DrawArgs["skull"];
+
+	MeshSimplifier::Source source;
+	source.Vertices = vertices + base.BaseVertexLocation;
+	source.VertexStride = sizeof(Vertex);
+	source.PositionOffset = offsetof(Vertex, Pos);
+	source.VertexCount = vertexCount - base.BaseVertexLocation;
+	std::vector<std::uint32_t> previous(indices.begin() + base.StartIndexLocation,
+		indices.begin() + base.StartIndexLocation + base.IndexCount);
+	std::vector<std::uint32_t> lodIndices;
+
+	MeshOptimizer::Source optimizerSource;
+	optimizerSource.Vertices = source.Vertices;
+	optimizerSource.VertexStride = source.VertexStride;
+	optimizerSource.PositionOffset = source.PositionOffset;
+	optimizerSource.VertexCount = source.VertexCount;
+
+	for (int l = 1; l < gSkullLodCount; ++l) {
+		const UINT target = (UINT)(previous.size() * gSkullLodRatio) / 3 * 3;
+		MeshSimplifier::Simplify(source, previous.data(), (UINT)previous.size(), target, FLT_MAX, lodIndices);
+
+		// 折叠后剩余三角形的顺序对缓存不再友好, 重排一次(只排三角形, 顶点为各级共用)
+		MeshOptimizer::OptimizeVertexCache(lodIndices.data(), (UINT)lodIndices.size(), source.VertexCount, lodIndices.data());
+		MeshOptimizer::OptimizeOverdraw(optimizerSource, lodIndices.data(), (UINT)lodIndices.size(), lodIndices.data());
+
+		SubmeshGeometry submesh = base;
+		submesh.IndexCount = (UINT)lodIndices.size();
+		submesh.StartIndexLocation = (UINT)indices.size();
+		geo->DrawArgs["skull_lod" + std::to_string(l)] = submesh;
+
+		indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+		previous.swap(lodIndices);
+	}
 }
 
 void InstancingAndCullingApp::BuildPSOs()
@@ -874,6 +1275,39 @@ void InstancingAndCullingApp::BuildRenderItems()
 	// 设定骷髅头渲染项的包围体是 submeshgeometry里的 Bounds
 	skullRitem->Bounds = skullRitem->Geo->DrawArgs["skull"].Bounds;
 
+	// 第0级即完整的骷髅头, 其后是BuildSkullGeometry生成的各级简化网格
+	for (int l = 0; l < gSkullLodCount; ++l) {
+		const std::string name = (l == 0) ? "skull" : "skull_lod" + std::to_string(l);
+		auto it = skullRitem->Geo->DrawArgs.find(name);
+		if (it == skullRitem->Geo->DrawArgs.end())
+			break;
+
+		RenderItem::LodDrawArgs lod;
+		lod.IndexCount = it->second.IndexCount;
+		lod.StartIndexLocation = it->second.StartIndexLocation;
+		lod.BaseVertexLocation = it->second.BaseVertexLocation;
+		skullRitem->Lods.push_back(lod);
+	}
+	skullRitem->Lod.SetThresholds(gSkullLodThresholds, (int)skullRitem->Lods.size());
+
+	// 骷髅头的遮挡体取包围盒中心处缩小到0.4倍的盒子, 使它落在骷髅头内部, 遮挡剔除因此是保守的
+	const float occluderScale = 0.4f;
+	GeometryGenerator geoGen;
+	GeometryGenerator::MeshData occluderBox = geoGen.CreateBox(
+		2.0f * occluderScale * skullRitem->Bounds.Extents.x,
+		2.0f * occluderScale * skullRitem->Bounds.Extents.y,
+		2.0f * occluderScale * skullRitem->Bounds.Extents.z, 0);
+	mSkullOccluder.Positions.resize(occluderBox.Vertices.size());
+	for (size_t i = 0; i < occluderBox.Vertices.size(); ++i) {
+		const XMFLOAT3& p = occluderBox.Vertices[i].Position;
+		mSkullOccluder.Positions[i] = XMFLOAT3(
+			p.x + skullRitem->Bounds.Center.x,
+			p.y + skullRitem->Bounds.Center.y,
+			p.z + skullRitem->Bounds.Center.z);
+	}
+	mSkullOccluder.Indices = occluderBox.Indices32;
+	skullRitem->Occluder = &mSkullOccluder;
+
 	// 专门给骷髅头使用实例化技术; 构造125个实例化个体,也是125次实例化
 	const int n = 5;
 	mInstanceCount = n * n * n;
@@ -911,6 +1345,18 @@ void InstancingAndCullingApp::BuildRenderItems()
 		}
 	}
 
+	// 记下各实例在世界空间的包围盒, 供UpdateInstanceData剔除
+	skullRitem->Culler.Resize(mInstanceCount);
+	skullRitem->Lod.Resize(mInstanceCount);
+	for (UINT i = 0; i < mInstanceCount; ++i)
+		skullRitem->Culler.SetBounds(i, skullRitem->Bounds, XMLoadFloat4x4(&skullRitem->Instances[i].World));
+
+	// 每ChunkSize个实例一段, 段内包围盒的并集登记为渲染项空间索引里的一个叶子, UserData存段号;
+	// 实例沿网格按序号排列, 同一段在空间上是连续的一片, 叶子数只有实例数的1/ChunkSize
+	skullRitem->ChunkProxies.resize(skullRitem->Culler.ChunkCount());
+	for (UINT c = 0; c < (UINT)skullRitem->ChunkProxies.size(); ++c)
+		skullRitem->ChunkProxies[c] = skullRitem->SpatialIndex.Insert(skullRitem->Culler.GetChunkBounds(c), reinterpret_cast<void*>((std::uintptr_t)c));
+
 	// 全局渲染项数组仅注册 骷髅头这1个渲染项
 	mAllRitems.push_back(std::move(skullRitem));
 
@@ -931,9 +1377,16 @@ void InstancingAndCullingApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList
 
 		// 对于每次的渲染项, 实例结构buffer可以绕过堆,直接在管线上设置为root desciptor
 		auto instanceBuffer = mCurrFrameResource->InstanceBuffer->Resource();// 当前帧里的实例结构体buffer
-		mCommandList->SetGraphicsRootShaderResourceView(0, instanceBuffer->GetGPUVirtualAddress());// 实例结构化buffer在管线上绑定到0号
 
-		cmdList->DrawIndexedInstanced(ri->IndexCount, ri->InstanceCount/*此处不再是原先的1,而是设计为实例的数量*/, ri->StartIndexLocation, ri->BaseVertexLocation, 0);
+		// 每级LOD各画一次; 该级的实例在实例buffer中连续存放, 根描述符直接指向这一段的起点, 着色器中的SV_InstanceID仍从0开始
+		for (const auto& lod : ri->Lods) {
+			if (lod.InstanceCount == 0)
+				continue;
+
+			mCommandList->SetGraphicsRootShaderResourceView(0, instanceBuffer->GetGPUVirtualAddress() +
+				(UINT64)lod.StartInstance * sizeof(InstanceData));// 实例结构化buffer在管线上绑定到0号
+			cmdList->DrawIndexedInstanced(lod.IndexCount, lod.InstanceCount/*此处不再是原先的1,而是设计为实例的数量*/, lod.StartIndexLocation, lod.BaseVertexLocation, 0);
+		}
 	}
 }
 
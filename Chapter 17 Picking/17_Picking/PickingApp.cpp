@@ -7,6 +7,10 @@
 #include "../../Common/UploadBuffer.h"
 #include "../../Common/GeometryGenerator.h"
 #include "../../Common/Camera.h"
+#include "../../Common/MeshBvh.h"
+#include "../../Common/MeshOptimizer.h"
+#include "../../Common/IndexPacking.h"
+#include "../../Common/AabbTree.h"
 #include "FrameResource.h"
 
 using Microsoft::WRL::ComPtr;
@@ -28,6 +32,7 @@ struct RenderItem
 	bool Visible = true;// 单个渲染项的可见性
 
 	BoundingBox Bounds;
+	int SpatialProxy = AabbTree::NullNode;// 在场景空间索引中的代理; World改变后须以新的世界包围盒调用Move
 
 	// World matrix of the shape that describes the object's local space
 	// relative to the world space, which defines the position, orientation,
@@ -64,6 +69,24 @@ enum class RenderLayer : int
 	Count
 };
 
+// 世界空间的查询射线, 方向不必归一化, T以方向的长度为单位; 只接受[0, TMax)内的交点
+struct RayQuery
+{
+	XMFLOAT3 Origin;
+	XMFLOAT3 Direction;
+	float TMax = MathHelper::Infinity;
+};
+
+// RayQuery在所有可见非透明渲染项中的最近交点; Item为nullptr表示未命中
+struct RayHit
+{
+	RenderItem* Item = nullptr;
+	UINT Triangle = 0;// 三角形在Item->Geo索引缓冲区中的序号
+	float T = 0.0f;
+	float U = 0.0f;
+	float V = 0.0f;
+};
+
 class PickingApp : public D3DApp
 {
 public:
@@ -100,6 +123,7 @@ private:
 	void BuildRenderItems();
 	void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
 	void Pick(int sx, int sy);
+	void IntersectRays(const std::vector<RayQuery>& rays, std::vector<RayHit>& hits);
 
 	std::array<const CD3DX12_STATIC_SAMPLER_DESC, 6> GetStaticSamplers();
 
@@ -131,6 +155,14 @@ private:
 
 	RenderItem* mPickedRitem = nullptr;// 被拾取的渲染项三角形
 
+	// 非透明渲染项世界空间包围盒的空间索引, 射线查询先用它排除整批不相交的渲染项
+	AabbTree mSceneIndex;
+	std::vector<RenderItem*> mRayCandidates;
+
+	// IntersectRays变换到局部空间的射线与结果, 复用以免每次查询都分配内存
+	std::vector<MeshBvh::Ray> mLocalRays;
+	std::vector<MeshBvh::Hit> mLocalHits;
+
 	PassConstants mMainPassCB;
 
 	Camera mCamera;
@@ -594,20 +626,32 @@ void PickingApp::BuildCarGeometry()
 	fin >> ignore;
 	fin >> ignore;
 
-	std::vector<std::int32_t> indices(3 * tcount);
+	std::vector<std::uint32_t> indices(3 * tcount);
 	for (UINT i = 0; i < tcount; ++i) {
 		fin >> indices[i * 3 + 0] >> indices[i * 3 + 1] >> indices[i * 3 + 2];
 	}
 
 	fin.close();
 
+	// 按顶点缓存, 过度绘制与取顶点顺序重排; 拾取结果的三角形序号对应重排后的索引缓冲区, BVH在下面由同一份数据建立
+	MeshOptimizer::Optimize(vertices.data(), vcount, sizeof(Vertex), offsetof(Vertex, Pos), indices.data(), (UINT)indices.size());
+
 	//
 	// Pack the indices of all the meshes into one index buffer.
 	//
 
+	// 校验索引并自动选择格式: 车的顶点数远小于65536, 得到16位索引; 只有一个DrawArgs, 不切分
+	IndexPacking::Range range;
+	range.IndexCount = (UINT)indices.size();
+	IndexPacking::Buffer indexBuffer;
+	if (!IndexPacking::Build(indices.data(), (UINT)indices.size(), &range, 1, vcount, false, indexBuffer)) {
+		MessageBox(0, L"Models/car.txt has invalid indices.", 0, 0);
+		return;
+	}
+
 	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
 
-	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::int32_t);
+	const UINT ibByteSize = (UINT)indexBuffer.Data.size();
 
 	auto geo = std::make_unique<MeshGeometry>();
 	geo->Name = "carGeo";
@@ -616,17 +660,17 @@ void PickingApp::BuildCarGeometry()
 	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
 
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
-	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indexBuffer.Data.data(), ibByteSize);
 
 	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
 		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
 
 	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
+		mCommandList.Get(), indexBuffer.Data.data(), ibByteSize, geo->IndexBufferUploader);
 
 	geo->VertexByteStride = sizeof(Vertex);
 	geo->VertexBufferByteSize = vbByteSize;
-	geo->IndexFormat = DXGI_FORMAT_R32_UINT;
+	geo->IndexFormat = indexBuffer.Index16 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
 	geo->IndexBufferByteSize = ibByteSize;
 
 	SubmeshGeometry submesh;
@@ -637,6 +681,27 @@ void PickingApp::BuildCarGeometry()
 
 	geo->DrawArgs["car"] = submesh;
 
+	/// 由内存副本里的顶点/索引建立一次BVH, 之后拾取射线只需遍历少数节点和三角形
+	MeshBvh::Source source;
+	source.Vertices = geo->VertexBufferCPU->GetBufferPointer();
+	source.VertexStride = sizeof(Vertex);
+	source.PositionOffset = offsetof(Vertex, Pos);
+	source.VertexCount = (UINT)vertices.size();
+	source.Indices = geo->IndexBufferCPU->GetBufferPointer();
+	source.Index16 = (geo->IndexFormat == DXGI_FORMAT_R16_UINT);
+
+	std::vector<MeshBvh::Range> ranges;
+	for (const auto& drawArg : geo->DrawArgs) {
+		MeshBvh::Range range;
+		range.IndexCount = drawArg.second.IndexCount;
+		range.StartIndexLocation = drawArg.second.StartIndexLocation;
+		range.BaseVertexLocation = drawArg.second.BaseVertexLocation;
+		ranges.push_back(range);
+	}
+
+	geo->Bvh = std::make_shared<MeshBvh>();
+	geo->Bvh->Build(source, ranges);
+
 	mGeometries[geo->Name] = std::move(geo);
 }
 
@@ -768,6 +833,13 @@ void PickingApp::BuildRenderItems()
 
 	mAllRitems.push_back(std::move(carRitem));
 	mAllRitems.push_back(std::move(pickedRitem));
+
+	// 把非透明渲染项的世界空间包围盒登记到场景空间索引里
+	for (auto ri : mRitemLayer[(int)RenderLayer::Opaque]) {
+		BoundingBox worldBounds;
+		ri->Bounds.Transform(worldBounds, XMLoadFloat4x4(&ri->World));
+		ri->SpatialProxy = mSceneIndex.Insert(worldBounds, ri);
+	}
 }
 
 void PickingApp::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
@@ -872,68 +944,86 @@ void PickingApp::Pick(int sx, int sy)
 	XMMATRIX V = mCamera.GetView();
 	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(V), V);// 暂存一下 观察矩阵的逆矩阵
 
-	/// ====================以下逻辑负责把拾取射线从 观察空间变换到物体的 局部空间============================
+	// 把拾取射线变换到世界空间; 仿射变换保持直线参数不变, 交点的t与观察空间射线的t相同
+	std::vector<RayQuery> rays(1);
+	XMStoreFloat3(&rays[0].Origin, XMVector3TransformCoord(rayOrigin, invView));
+	XMStoreFloat3(&rays[0].Direction, XMVector3TransformNormal(rayDir, invView));
+
+	std::vector<RayHit> hits;
+	IntersectRays(rays, hits);
+
 	// 假设开始用户不拾取任何点,故把拾取无的渲染项可见性重置为为不可见
 	mPickedRitem->Visible = false;
 
-	/// 检测用户是否拾取了一个非透明渲染项;实际项目里,可能会提前设置好一些"可拾取物列表"
-	// 遍历所有非透明渲染项
-	for (auto ri : mRitemLayer[(int)RenderLayer::Opaque]) {
-		// 拿取 几何管理员
+	const RayHit& hit = hits[0];
+	if (hit.Item != nullptr) {
+		/// 为待拾取的最近三角形设置渲染项, 这里用特定的"heighlight材质"对三角形执行渲染
+		mPickedRitem->Visible = true;
+		mPickedRitem->Geo = hit.Item->Geo;
+		mPickedRitem->IndexCount = 3;
+		mPickedRitem->BaseVertexLocation = hit.Item->BaseVertexLocation;
+		mPickedRitem->World = hit.Item->World;// 强制让被拾取的三角形与被拾取的物体保持一模一样的世界矩阵
+		mPickedRitem->NumFramesDirty = gNumFrameResources;
+		mPickedRitem->StartIndexLocation = 3 * hit.Triangle;// 偏移到被拾取三角形的 索引缓存处
+	}
+}
+
+/// 批量求世界空间射线与可见非透明渲染项的最近交点, hits[i]对应rays[i]
+void PickingApp::IntersectRays(const std::vector<RayQuery>& rays, std::vector<RayHit>& hits)
+{
+	const UINT rayCount = (UINT)rays.size();
+	hits.assign(rayCount, RayHit());
+	mLocalRays.resize(rayCount);
+	mLocalHits.resize(rayCount);
+
+	/// 先在场景空间索引中找出包围盒至少与一条射线相交的渲染项, 其余的渲染项整个跳过
+	mRayCandidates.clear();
+	for (UINT i = 0; i < rayCount; ++i) {
+		mSceneIndex.QueryRay(XMLoadFloat3(&rays[i].Origin), XMLoadFloat3(&rays[i].Direction), rays[i].TMax,
+			[&](int proxy, float tMax)
+		{
+			mRayCandidates.push_back(static_cast<RenderItem*>(mSceneIndex.GetUserData(proxy)));
+			return tMax;
+		});
+	}
+	std::sort(mRayCandidates.begin(), mRayCandidates.end());
+	mRayCandidates.erase(std::unique(mRayCandidates.begin(), mRayCandidates.end()), mRayCandidates.end());
+
+	/// 检测射线是否命中了候选渲染项里的三角形
+	for (auto ri : mRayCandidates) {
 		auto geo = ri->Geo;
-		// 跳过不可见渲染项
-		if (ri->Visible == false)
+		// 跳过不可见渲染项, 以及没有建立BVH的几何体
+		if (ri->Visible == false || geo->Bvh == nullptr)
 			continue;
 
 		XMMATRIX W = XMLoadFloat4x4(&ri->World);// 世界矩阵
 		XMMATRIX invWorld = XMMatrixInverse(&XMMatrixDeterminant(W), W);// 世界矩阵的逆矩阵
 
 		/// 将射线变换到MESH的局部空间
-		XMMATRIX toLocal = XMMatrixMultiply(invView, invWorld);// View逆矩阵和World逆矩阵 叠加起来得到从观察空间 变换至 局部空间
-		rayOrigin = XMVector3TransformCoord(rayOrigin, toLocal);// XMVector3TransformCoord负责变换点,第四分量W为1
-		rayDir    = XMVector3TransformNormal(rayDir, toLocal);  // XMVector3TransformNormal负责变换向量,第四分量w为0
-
-		// 为相交检测而计算拾取射线方向上的单位长度
-		rayDir = XMVector3Normalize(rayDir);
-
-		/// 首先,如若射线碰到了包围盒,则有概率也碰到了MESH上的三角形,据此可以进一步判断射线与三角形相交
-		// 如果没碰到MESH的包围盒,则后续完全不用考虑,直接放弃
-		float tmin = 0.0f;
-		// BoundingBox::Intersects(原点,单位长度的方向,射线的相交参数),最后一个参数保存射线的相交参数P=r(t0)=q + t0u中的t0
-		if (ri->Bounds.Intersects(rayOrigin, rayDir, tmin)) {/// 判断渲染项里的包围盒是不是与 单位长度的拾取射线方向 相交
-			auto vertices = (Vertex*)geo->VertexBufferCPU->GetBufferPointer();     // 关联顶点的Blob内存副本,强转为本项目的顶点型指针,         即顶点数组
-			auto indices = (std::uint32_t*)geo->IndexBufferCPU->GetBufferPointer();// 关联索引的Blob内存副本,强转为本项目的std::uint32_t型指针,即索引数组
-			UINT triCount = ri->IndexCount / 3;// 由于是三角形, MESH的三角形数量就等于 1/3的索引数
-
-			// 找到离摄像机最近的三角形执行 三角形与拾取射线的相交检测
-			tmin = MathHelper::Infinity;
-			for (UINT i = 0; i < triCount; ++i) {/// 遍历所有三角形
-				// 此三角形的索引
-				UINT i0 = indices[i * 3 + 0];
-				UINT i1 = indices[i * 3 + 1];
-				UINT i2 = indices[i * 3 + 2];
-
-				// 此三角形的顶点
-				XMVECTOR v0 = XMLoadFloat3(&vertices[i0].Pos);
-				XMVECTOR v1 = XMLoadFloat3(&vertices[i1].Pos);
-				XMVECTOR v2 = XMLoadFloat3(&vertices[i2].Pos);
-				
-				float t = 0.0f;
-				if (TriangleTests::Intersects(rayOrigin, rayDir, v0, v1, v2, t)) {// 让射线与三角形相交检测使用TriangleTests::Intersects
-					if (t < tmin) {// t和保存射线的相交参数tmin作比较
-						// 满足t小于tmin则证明这是离摄像机最近的一个被拾取三角形
-						tmin = t;
-						UINT pickedTriangle = i;// 暂存一下满足拾取需求的当前三角形的序数
-						/// 为待拾取的最近三角形设置渲染项, 这里用特定的"heighlight材质"对三角形执行渲染
-						mPickedRitem->Visible = true;
-						mPickedRitem->IndexCount = 3;
-						mPickedRitem->BaseVertexLocation = 0;
-						mPickedRitem->World = ri->World;// 强制让被拾取的三角形与被拾取的物体(即遍历的单个渲染项)保持一模一样的世界矩阵
-						mPickedRitem->NumFramesDirty = gNumFrameResources;
-						mPickedRitem->StartIndexLocation = 3 * pickedTriangle;// 偏移到被拾取三角形的 索引缓存处
-					}
-				}
-			}
+		// 局部空间的方向不做归一化: 这样求得的t仍是世界空间射线的参数, 不同渲染项(即使缩放不同)之间可以直接比较远近,
+		// 目前最近的交点也就可以作为该射线在后续渲染项中的查询上限
+		for (UINT i = 0; i < rayCount; ++i) {
+			MeshBvh::Ray& local = mLocalRays[i];
+			XMStoreFloat3(&local.Origin, XMVector3TransformCoord(XMLoadFloat3(&rays[i].Origin), invWorld));
+			XMStoreFloat3(&local.Direction, XMVector3TransformNormal(XMLoadFloat3(&rays[i].Direction), invWorld));
+			local.TMax = (hits[i].Item != nullptr) ? hits[i].T : rays[i].TMax;
+		}
+
+		// BVH只在该渲染项的三角形中找交点, 每8条射线成包遍历
+		geo->Bvh->IntersectBatch(mLocalRays.data(), rayCount, mLocalHits.data(), ri->StartIndexLocation / 3, ri->IndexCount / 3);
+
+		for (UINT i = 0; i < rayCount; ++i) {
+			const MeshBvh::Hit& local = mLocalHits[i];
+			if (local.Triangle == MeshBvh::NoHit)
+				continue;
+
+			// 交点只可能比TMax更近, 直接替换
+			RayHit& hit = hits[i];
+			hit.Item = ri;
+			hit.Triangle = local.Triangle;
+			hit.T = local.T;
+			hit.U = local.U;
+			hit.V = local.V;
 		}
 	}
 }
\ No newline at end of file
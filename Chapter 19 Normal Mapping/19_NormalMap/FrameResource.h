@@ -12,6 +12,12 @@ struct ObjectConstants
 	UINT     ObjPad0;
 	UINT     ObjPad1;
 	UINT     ObjPad2;
+
+	// 压缩顶点的位置解码参数, 即子网格的包围盒(见VertexPacking.h)
+	DirectX::XMFLOAT3 PositionCenter = { 0.0f, 0.0f, 0.0f };
+	float    ObjPad3 = 0.0f;
+	DirectX::XMFLOAT3 PositionExtents = { 1.0f, 1.0f, 1.0f };
+	float    ObjPad4 = 0.0f;
 };
 
 struct PassConstants
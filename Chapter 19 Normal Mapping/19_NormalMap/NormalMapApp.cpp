@@ -24,6 +24,8 @@
 #include "../../Common/UploadBuffer.h"
 #include "../../Common/GeometryGenerator.h"
 #include "../../Common/Camera.h"
+#include "../../Common/TextureLoader.h"
+#include "../../Common/VertexPacking.h"
 #include "FrameResource.h"
 
 using Microsoft::WRL::ComPtr;
@@ -68,6 +70,9 @@ struct RenderItem
 	UINT IndexCount = 0;
 	UINT StartIndexLocation = 0;
 	int BaseVertexLocation = 0;
+
+	// 子网格的包围盒, 也是压缩顶点中位置的量化范围, 随物体常量传给着色器解码
+	BoundingBox Bounds;
 };
 
 enum class RenderLayer : int
@@ -103,6 +108,7 @@ private:
 	void UpdateMainPassCB(const GameTimer& gt);
 
 	void LoadTextures();
+	void CreateTextures();
 	void BuildRootSignature();
 	void BuildDescriptorHeaps();
 	void BuildShadersAndInputLayout();
@@ -130,6 +136,9 @@ private:
 	std::unordered_map<std::string, std::unique_ptr<MeshGeometry>> mGeometries;
 	std::unordered_map<std::string, std::unique_ptr<Material>> mMaterials;
 	std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;
+	// LoadTextures在线程池上发起的加载(纹理名, 结果), 由CreateTextures等待并创建纹理
+	TextureLoader mTextureLoader;
+	std::vector<std::pair<std::string, std::shared_future<TextureLoader::ImagePtr>>> mTextureLoads;
 	std::unordered_map<std::string, ComPtr<ID3DBlob>> mShaders;
 	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> mPSOs;
 
@@ -198,9 +207,10 @@ bool NormalMapApp::Initialize()
 
 	LoadTextures();
 	BuildRootSignature();
-	BuildDescriptorHeaps();
 	BuildShadersAndInputLayout();
 	BuildShapeGeometry();
+	CreateTextures();// 等待纹理加载完成并创建纹理, 描述符堆要用到纹理资源
+	BuildDescriptorHeaps();
 	BuildMaterials();
 	BuildRenderItems();
 	BuildFrameResources();
@@ -395,6 +405,8 @@ void NormalMapApp::UpdateObjectCBs(const GameTimer& gt)
 			XMStoreFloat4x4(&objConstants.World, XMMatrixTranspose(world));
 			XMStoreFloat4x4(&objConstants.TexTransform, XMMatrixTranspose(texTransform));
 			objConstants.MaterialIndex = e->Mat->MatCBIndex;
+			objConstants.PositionCenter = e->Bounds.Center;
+			objConstants.PositionExtents = e->Bounds.Extents;
 
 			currObjectCB->CopyData(e->ObjCBIndex, objConstants);
 
@@ -491,16 +503,22 @@ void NormalMapApp::LoadTextures()
 		L"../../Textures/snowcube1024.dds"
 	};
 
-	for (int i = 0; i < (int)texNames.size(); ++i) {
-		auto texMap = std::make_unique<Texture>();// CreateDDSTextureFromFile12接口来构造纹理
-		texMap->Name = texNames[i];
-		texMap->Filename = texFilenames[i];
-		ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-			mCommandList.Get(), texMap->Filename.c_str(),
-			texMap->Resource, texMap->UploadHeap));
-		// 全局纹理里注册
+	// 在线程池上映射并解析各DDS文件, 与随后的着色器编译和几何体构建重叠; 纹理资源在CreateTextures里创建
+	for (int i = 0; i < (int)texNames.size(); ++i)
+		mTextureLoads.emplace_back(texNames[i], mTextureLoader.LoadAsync(texFilenames[i]));
+}
+
+void NormalMapApp::CreateTextures()
+{
+	// 等待LoadTextures发起的加载, 创建纹理并在命令列表上记录上传
+	for (auto& load : mTextureLoads) {
+		auto texMap = std::make_unique<Texture>();
+		texMap->Name = load.first;
+		ThrowIfFailed(TextureLoader::CreateTexture(md3dDevice.Get(), mCommandList.Get(), load.second, *texMap));
+
 		mTextures[texMap->Name] = std::move(texMap);
 	}
+	mTextureLoads.clear();
 }
 
 void NormalMapApp::BuildRootSignature()
@@ -613,18 +631,20 @@ void NormalMapApp::BuildShadersAndInputLayout()
 	mShaders["skyVS"] = d3dUtil::CompileShader(L"Shaders\\Sky.hlsl", nullptr, "VS", "vs_5_1");
 	mShaders["skyPS"] = d3dUtil::CompileShader(L"Shaders\\Sky.hlsl", nullptr, "PS", "ps_5_1");
 
+	// 顶点缓冲区中是20字节的VertexPacking::PackedVertex: 位置为UNORM16, 法线与切线为八面体编码的SNORM16, 纹理坐标为half
 	mInputLayout =
 	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 32, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },// 增加Tangent语义
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 8, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TANGENT", 0, DXGI_FORMAT_R16G16_SNORM, 0, 16, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },// 增加Tangent语义
 	};
 }
 
 void NormalMapApp::BuildShapeGeometry()
 {
 	GeometryGenerator geoGen;
+	geoGen.SetOptimize(true);// 球体与柱体按顶点缓存重排三角形与顶点, 每个只多花约0.4ms
 	GeometryGenerator::MeshData box = geoGen.CreateBox(1.0f, 1.0f, 1.0f, 3);
 	GeometryGenerator::MeshData grid = geoGen.CreateGrid(20.0f, 30.0f, 60, 40);
 	GeometryGenerator::MeshData sphere = geoGen.CreateSphere(0.5f, 20, 20);
@@ -709,31 +729,59 @@ void NormalMapApp::BuildShapeGeometry()
 		vertices[k].TangentU = cylinder.Vertices[i].TangentU;
 	}
 
+	/// 压缩成20字节的顶点(原为44字节): 每个子网格的位置按它自己的包围盒量化, 精度比整个缓冲区共用一个范围高
+	VertexPacking::Layout layout;
+	layout.Stride = sizeof(Vertex);
+	layout.PositionOffset = offsetof(Vertex, Pos);
+	layout.NormalOffset = offsetof(Vertex, Normal);
+	layout.TexCOffset = offsetof(Vertex, TexC);
+	layout.TangentUOffset = offsetof(Vertex, TangentU);
+
+	std::vector<VertexPacking::PackedVertex> packedVertices(totalVertexCount);
+	auto packSubmesh = [&](SubmeshGeometry& submesh, size_t vertexCount) {
+		const Vertex* first = &vertices[submesh.BaseVertexLocation];
+		submesh.Bounds = VertexPacking::ComputeBounds(first, (UINT)vertexCount, layout);
+		VertexPacking::Encode(first, (UINT)vertexCount, layout, submesh.Bounds, &packedVertices[submesh.BaseVertexLocation]);
+
+#if defined(DEBUG) | defined(_DEBUG)
+		const VertexPacking::ErrorStats error = VertexPacking::MeasureError(first, (UINT)vertexCount, layout,
+			submesh.Bounds, &packedVertices[submesh.BaseVertexLocation]);
+		char text[192];
+		sprintf_s(text, "packed vertices: position max %.2e rms %.2e, normal %.4f deg, tangent %.4f deg, uv %.2e\n",
+			error.MaxPositionError, error.RmsPositionError, error.MaxNormalError, error.MaxTangentError, error.MaxTexCError);
+		OutputDebugStringA(text);
+#endif
+	};
+	packSubmesh(boxSubmesh, box.Vertices.size());
+	packSubmesh(gridSubmesh, grid.Vertices.size());
+	packSubmesh(sphereSubmesh, sphere.Vertices.size());
+	packSubmesh(cylinderSubmesh, cylinder.Vertices.size());
+
 	std::vector<std::uint16_t> indices;
 	indices.insert(indices.end(), std::begin(box.GetIndices16()), std::end(box.GetIndices16()));
 	indices.insert(indices.end(), std::begin(grid.GetIndices16()), std::end(grid.GetIndices16()));
 	indices.insert(indices.end(), std::begin(sphere.GetIndices16()), std::end(sphere.GetIndices16()));
 	indices.insert(indices.end(), std::begin(cylinder.GetIndices16()), std::end(cylinder.GetIndices16()));
 
-	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
+	const UINT vbByteSize = (UINT)packedVertices.size() * sizeof(VertexPacking::PackedVertex);
 	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::uint16_t);
 
 	auto geo = std::make_unique<MeshGeometry>();
 	geo->Name = "shapeGeo";
 
 	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
-	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), packedVertices.data(), vbByteSize);
 
 	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
 	CopyMemory(geo->IndexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
 	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
-		mCommandList.Get(), vertices.data(), vbByteSize, geo->VertexBufferUploader);
+		mCommandList.Get(), packedVertices.data(), vbByteSize, geo->VertexBufferUploader);
 
 	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
 		mCommandList.Get(), indices.data(), ibByteSize, geo->IndexBufferUploader);
 
-	geo->VertexByteStride = sizeof(Vertex);
+	geo->VertexByteStride = sizeof(VertexPacking::PackedVertex);
 	geo->VertexBufferByteSize = vbByteSize;
 	geo->IndexFormat = DXGI_FORMAT_R16_UINT;
 	geo->IndexBufferByteSize = ibByteSize;
@@ -873,6 +921,7 @@ void NormalMapApp::BuildRenderItems()
 	skyRitem->IndexCount = skyRitem->Geo->DrawArgs["sphere"].IndexCount;
 	skyRitem->StartIndexLocation = skyRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
 	skyRitem->BaseVertexLocation = skyRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
+	skyRitem->Bounds = skyRitem->Geo->DrawArgs["sphere"].Bounds;
 
 	mRitemLayer[(int)RenderLayer::Sky].push_back(skyRitem.get());
 	mAllRitems.push_back(std::move(skyRitem));
@@ -887,6 +936,7 @@ void NormalMapApp::BuildRenderItems()
 	boxRitem->IndexCount = boxRitem->Geo->DrawArgs["box"].IndexCount;
 	boxRitem->StartIndexLocation = boxRitem->Geo->DrawArgs["box"].StartIndexLocation;
 	boxRitem->BaseVertexLocation = boxRitem->Geo->DrawArgs["box"].BaseVertexLocation;
+	boxRitem->Bounds = boxRitem->Geo->DrawArgs["box"].Bounds;
 
 	mRitemLayer[(int)RenderLayer::Opaque].push_back(boxRitem.get());
 	mAllRitems.push_back(std::move(boxRitem));
@@ -901,6 +951,7 @@ void NormalMapApp::BuildRenderItems()
 	globeRitem->IndexCount = globeRitem->Geo->DrawArgs["sphere"].IndexCount;
 	globeRitem->StartIndexLocation = globeRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
 	globeRitem->BaseVertexLocation = globeRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
+	globeRitem->Bounds = globeRitem->Geo->DrawArgs["sphere"].Bounds;
 
 	mRitemLayer[(int)RenderLayer::Opaque].push_back(globeRitem.get());
 	mAllRitems.push_back(std::move(globeRitem));
@@ -915,6 +966,7 @@ void NormalMapApp::BuildRenderItems()
 	gridRitem->IndexCount = gridRitem->Geo->DrawArgs["grid"].IndexCount;
 	gridRitem->StartIndexLocation = gridRitem->Geo->DrawArgs["grid"].StartIndexLocation;
 	gridRitem->BaseVertexLocation = gridRitem->Geo->DrawArgs["grid"].BaseVertexLocation;
+	gridRitem->Bounds = gridRitem->Geo->DrawArgs["grid"].Bounds;
 
 	mRitemLayer[(int)RenderLayer::Opaque].push_back(gridRitem.get());
 	mAllRitems.push_back(std::move(gridRitem));
@@ -942,6 +994,7 @@ void NormalMapApp::BuildRenderItems()
 		leftCylRitem->IndexCount = leftCylRitem->Geo->DrawArgs["cylinder"].IndexCount;
 		leftCylRitem->StartIndexLocation = leftCylRitem->Geo->DrawArgs["cylinder"].StartIndexLocation;
 		leftCylRitem->BaseVertexLocation = leftCylRitem->Geo->DrawArgs["cylinder"].BaseVertexLocation;
+		leftCylRitem->Bounds = leftCylRitem->Geo->DrawArgs["cylinder"].Bounds;
 
 		XMStoreFloat4x4(&rightCylRitem->World, leftCylWorld);
 		XMStoreFloat4x4(&rightCylRitem->TexTransform, brickTexTransform);
@@ -952,6 +1005,7 @@ void NormalMapApp::BuildRenderItems()
 		rightCylRitem->IndexCount = rightCylRitem->Geo->DrawArgs["cylinder"].IndexCount;
 		rightCylRitem->StartIndexLocation = rightCylRitem->Geo->DrawArgs["cylinder"].StartIndexLocation;
 		rightCylRitem->BaseVertexLocation = rightCylRitem->Geo->DrawArgs["cylinder"].BaseVertexLocation;
+		rightCylRitem->Bounds = rightCylRitem->Geo->DrawArgs["cylinder"].Bounds;
 
 		XMStoreFloat4x4(&leftSphereRitem->World, leftSphereWorld);
 		leftSphereRitem->TexTransform = MathHelper::Identity4x4();
@@ -962,6 +1016,7 @@ void NormalMapApp::BuildRenderItems()
 		leftSphereRitem->IndexCount = leftSphereRitem->Geo->DrawArgs["sphere"].IndexCount;
 		leftSphereRitem->StartIndexLocation = leftSphereRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
 		leftSphereRitem->BaseVertexLocation = leftSphereRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
+		leftSphereRitem->Bounds = leftSphereRitem->Geo->DrawArgs["sphere"].Bounds;
 
 		XMStoreFloat4x4(&rightSphereRitem->World, rightSphereWorld);
 		rightSphereRitem->TexTransform = MathHelper::Identity4x4();
@@ -972,6 +1027,7 @@ void NormalMapApp::BuildRenderItems()
 		rightSphereRitem->IndexCount = rightSphereRitem->Geo->DrawArgs["sphere"].IndexCount;
 		rightSphereRitem->StartIndexLocation = rightSphereRitem->Geo->DrawArgs["sphere"].StartIndexLocation;
 		rightSphereRitem->BaseVertexLocation = rightSphereRitem->Geo->DrawArgs["sphere"].BaseVertexLocation;
+		rightSphereRitem->Bounds = rightSphereRitem->Geo->DrawArgs["sphere"].Bounds;
 
 		mRitemLayer[(int)RenderLayer::Opaque].push_back(leftCylRitem.get());
 		mRitemLayer[(int)RenderLayer::Opaque].push_back(rightCylRitem.get());
@@ -57,6 +57,10 @@ cbuffer cbPerObject : register(b0)
     uint gObjPad0;
     uint gObjPad1;
     uint gObjPad2;
+    float3 gPositionCenter;// 压缩顶点的位置解码参数, 即子网格的包围盒
+    float gObjPad3;
+    float3 gPositionExtents;
+    float gObjPad4;
 };
 
 // Constant data that varies per material.
@@ -85,6 +89,24 @@ cbuffer cbPass : register(b1)
     Light gLights[MaxLights];
 };
 
+//---------------------------------------------------------------------------------------
+// 压缩顶点的解码(编码见Common/VertexPacking.cpp)
+//---------------------------------------------------------------------------------------
+// 位置: UNORM16量化值[0, 1] --> 子网格包围盒[Center - Extents, Center + Extents]
+float3 DecodePosition(float3 q)
+{
+    return gPositionCenter + (q * 2.0f - 1.0f) * gPositionExtents;
+}
+
+// 八面体编码的单位向量: z < 0的半球在编码时沿对角线翻折到了正方形的4个角上, 这里翻折回来
+float3 DecodeOctahedral(float2 e)
+{
+    float3 v = float3(e, 1.0f - abs(e.x) - abs(e.y));
+    float t = saturate(-v.z);
+    v.xy += (v.xy >= 0.0f) ? -t : t;
+    return normalize(v);
+}
+
 //---------------------------------------------------------------------------------------
 // 新建NormalSampleToWorldSpace函数，将法线从切空间变换到世界空间
 //---------------------------------------------------------------------------------------
@@ -20,10 +20,10 @@
 
 struct VertexIn
 {
-    float3 PosL : POSITION;
-    float3 NormalL : NORMAL;
+    float3 PosL : POSITION;// 包围盒内的量化值, 见DecodePosition
+    float2 NormalL : NORMAL;// 八面体编码
     float2 TexC : TEXCOORD;
-    float3 TangentU : TANGENT;// 主shader中声明CPU传入数据，增加Tangent字段
+    float2 TangentU : TANGENT;// 主shader中声明CPU传入数据，增加Tangent字段; 八面体编码
 };
 
 struct VertexOut
@@ -42,14 +42,19 @@ VertexOut VS(VertexIn vin)
 	// Fetch the material data.
     MaterialData matData = gMaterialData[gMaterialIndex];
 	
+    // 解码压缩顶点
+    float3 posL = DecodePosition(vin.PosL);
+    float3 normalL = DecodeOctahedral(vin.NormalL);
+    float3 tangentL = DecodeOctahedral(vin.TangentU);
+
     // Transform to world space.
-    float4 posW = mul(float4(vin.PosL, 1.0f), gWorld);
+    float4 posW = mul(float4(posL, 1.0f), gWorld);
     vout.PosW = posW.xyz;
 
     // 只做均匀缩放，所以可以不使用逆转置矩阵
-    vout.NormalW = mul(vin.NormalL, (float3x3) gWorld);
+    vout.NormalW = mul(normalL, (float3x3) gWorld);
 	// 将顶点切线从物体空间转至世界空间
-    vout.TangentW = mul(vin.TangentU, (float3x3) gWorld);
+    vout.TangentW = mul(tangentL, (float3x3) gWorld);
 
     // Transform to homogeneous clip space.
     vout.PosH = mul(posW, gViewProj);
@@ -1,4 +1,4 @@
-//=============================================================================
+﻿//=============================================================================
 // Sky.fx by Frank Luna (C) 2011 All Rights Reserved.
 //=============================================================================
 
@@ -7,8 +7,8 @@
 
 struct VertexIn
 {
-    float3 PosL : POSITION;
-    float3 NormalL : NORMAL;
+    float3 PosL : POSITION;// 包围盒内的量化值, 见DecodePosition
+    float2 NormalL : NORMAL;// 八面体编码
     float2 TexC : TEXCOORD;
 };
 
@@ -23,10 +23,10 @@ VertexOut VS(VertexIn vin)
     VertexOut vout;
 
 	// Use local vertex position as cubemap lookup vector.
-    vout.PosL = vin.PosL;
+    vout.PosL = DecodePosition(vin.PosL);
 	
 	// Transform to world space.
-    float4 posW = mul(float4(vin.PosL, 1.0f), gWorld);
+    float4 posW = mul(float4(vout.PosL, 1.0f), gWorld);
 
 	// Always center sky about camera.
     posW.xyz += gEyePosW;
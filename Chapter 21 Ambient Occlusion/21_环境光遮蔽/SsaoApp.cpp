@@ -17,6 +17,9 @@
 #include "../../Common/UploadBuffer.h"
 #include "../../Common/GeometryGenerator.h"
 #include "../../Common/Camera.h"
+#include "../../Common/TextureLoader.h"
+#include "../../Common/MeshFile.h"
+#include "../../Common/AssetCache.h"
 #include "FrameResource.h"
 #include "ShadowMap.h"
 #include "Ssao.h"
@@ -90,12 +93,14 @@ private:
 	void UpdateSsaoCB(const GameTimer& gt);
 
 	void LoadTextures();
+	void CreateTextures();
 	void BuildRootSignature();
 	void BuildSsaoRootSignature();
 	void BuildDescriptorHeaps();
 	void BuildShadersAndInputLayout();
 	void BuildShapeGeometry();
 	void BuildSkullGeometry();
+	bool BuildSkullGeometryFromCache(const std::string& filename);
 	void BuildPSOs();
 	void BuildFrameResources();
 	void BuildMaterials();
@@ -126,6 +131,9 @@ private:
 	std::unordered_map<std::string, std::unique_ptr<MeshGeometry>> mGeometries; // 全局几何体表
 	std::unordered_map<std::string, std::unique_ptr<Material>> mMaterials;		// 全局材质表
 	std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;		// 全局贴图表
+	// LoadTextures在线程池上发起的加载(纹理名, 结果), 由CreateTextures等待并创建纹理
+	TextureLoader mTextureLoader;
+	std::vector<std::pair<std::string, std::shared_future<TextureLoader::ImagePtr>>> mTextureLoads;
 	std::unordered_map<std::string, ComPtr<ID3DBlob>> mShaders;					// 全局Shader表
 	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> mPSOs;			// 全局管线表
 	std::vector<D3D12_INPUT_ELEMENT_DESC> mInputLayout;							// 输入布局
@@ -232,15 +240,16 @@ bool SsaoApp::Initialize()
 
 	BuildRootSignature();/// 构建主场景根签名 (包含ObjectCB,PassCB,MatSB,2D纹理,CubeMap,注意各自的槽位),详见common.hlsl
 	BuildSsaoRootSignature();/// 构建 SSAO的根签名,详见Ssao.hlsl
-	BuildDescriptorHeaps();/// 1.创建出持有18个句柄的堆,并偏移句柄; 依次创建出2D纹理(含法线纹理)、天空球、
-						   /// 2.依次创建出ShadowMap、SSAO、SSAOAmbientmap的SRV 期间也顺带保留了它们各自在堆中的序数
-						   /// 3.针对shadowmap和ssao这两种资源,还要额外的创建出DSV和RTV,详见最后两个接口
 
 	BuildShadersAndInputLayout();/// 全局shader表里注册各种shader并填充顶点输入布局
 
 	BuildShapeGeometry();/// MeshGeometry类型的geo管理员各属性做值,管理场景类的一些场景几何体
 	BuildSkullGeometry();/// MeshGeometry类型的geo管理员各属性做值,管理场景类的骷髅头
 
+	CreateTextures();/// 等待LoadTextures发起的异步加载并创建纹理, 描述符堆要用到纹理资源
+	BuildDescriptorHeaps();/// 1.创建出持有18个句柄的堆,并偏移句柄; 依次创建出2D纹理(含法线纹理)、天空球、
+						   /// 2.依次创建出ShadowMap、SSAO、SSAOAmbientmap的SRV 期间也顺带保留了它们各自在堆中的序数
+						   /// 3.针对shadowmap和ssao这两种资源,还要额外的创建出DSV和RTV,详见最后两个接口
 	BuildMaterials();/// 构建出所有材质(注意材质序数和其使用的2D纹理位于堆的位置) 并 注册到全局材质表
 	BuildRenderItems();/// 构建所有物体的渲染项(含天空球、面片、盒子、骷髅头、地板、两侧柱子)
 	BuildFrameResources();/// 构建3个帧资源并存到数组里 每帧里构造出出2个PassCB, 1个SSAOCB, 渲染项个数的ObjectCB, 5个结构体材质
@@ -761,17 +770,22 @@ void SsaoApp::LoadTextures()
 		L"../../Textures/default_nmap.dds",
 		L"../../Textures/sunsetcube1024.dds"
 	};
-	/* 创建出每张2D纹理并在全局纹理表里注册*/
-	for (int i = 0; i < (int)texNames.size(); ++i) {
-		auto texMap = std::make_unique<Texture>();// 构建出2D纹理并设置属性
-		texMap->Name = texNames[i];// 纹理名字
-		texMap->Filename = texFilenames[i];// 纹理所在路径
-		ThrowIfFailed(DirectX::CreateDDSTextureFromFile12(md3dDevice.Get(),
-			mCommandList.Get(), texMap->Filename.c_str(),
-			texMap->Resource, texMap->UploadHeap));// 使用内建API构造出纹理
-
-		mTextures[texMap->Name] = std::move(texMap);// 本次迭代的纹理塞到全局纹理表
+	// 在线程池上映射并解析各DDS文件, 与随后的着色器编译和几何体构建重叠; 纹理资源在CreateTextures里创建
+	for (int i = 0; i < (int)texNames.size(); ++i)
+		mTextureLoads.emplace_back(texNames[i], mTextureLoader.LoadAsync(texFilenames[i]));
+}
+
+void SsaoApp::CreateTextures()
+{
+	// 等待LoadTextures发起的加载, 创建纹理并在命令列表上记录上传
+	for (auto& load : mTextureLoads) {
+		auto texMap = std::make_unique<Texture>();
+		texMap->Name = load.first;
+		ThrowIfFailed(TextureLoader::CreateTexture(md3dDevice.Get(), mCommandList.Get(), load.second, *texMap));
+
+		mTextures[texMap->Name] = std::move(texMap);
 	}
+	mTextureLoads.clear();
 }
 
 /// 构建主场景根签名 (包含ObjectCB,PassCB,MatSB,2D纹理,CubeMap,注意各自的槽位),详见common.hlsl
@@ -1026,6 +1040,7 @@ void SsaoApp::BuildShapeGeometry()
 {
 	/* 用几何生成器结合各种算法,生成一些几何体mesh*/
 	GeometryGenerator geoGen;
+	geoGen.SetOptimize(true);// 球体与柱体按顶点缓存重排三角形与顶点, 每个只多花约0.4ms
 	GeometryGenerator::MeshData box = geoGen.CreateBox(1.0f, 1.0f, 1.0f, 3);
 	GeometryGenerator::MeshData grid = geoGen.CreateGrid(20.0f, 30.0f, 60, 40);
 	GeometryGenerator::MeshData sphere = geoGen.CreateSphere(0.5f, 20, 20);
@@ -1156,6 +1171,23 @@ void SsaoApp::BuildShapeGeometry()
 /// MeshGeometry类型的geo管理员各属性做值,管理场景类的骷髅头
 void SsaoApp::BuildSkullGeometry()
 {
+	/* 优先使用离线转换好的二进制缓存(Tools/MeshConverter -layout PNTU), 切线已在转换时算好 */
+	if (BuildSkullGeometryFromCache("Models/skull.m3db"))
+		return;
+
+	/* 其次是上次解析文本模型后存进资源缓存的同一格式文件; 键含skull.txt的内容哈希与顶点布局, 模型改动后自动失效 */
+	AssetCache* cache = d3dUtil::GetAssetCache();
+	AssetCache::Key cacheKey = 0;
+	if (cache != nullptr) {
+		AssetCache::Hasher hasher("m3db");
+		hasher.Add(MeshFile::Version).Add("PNTU").Add(sizeof(Vertex));
+		std::string cachedPath;
+		if (!hasher.AddFile("Models/skull.txt"))
+			cache = nullptr;
+		else if (cache->Find(cacheKey = hasher.Finish(), cachedPath) && BuildSkullGeometryFromCache(cachedPath))
+			return;
+	}
+
 	/* 让fin读取这个文件 "Models/skull.txt" */
 	std::ifstream fin("Models/skull.txt");
 	if (!fin) {
@@ -1217,6 +1249,20 @@ void SsaoApp::BuildSkullGeometry()
 
 	fin.close();// 关闭输入流
 
+	/* 解析结果(含算好的切线与包围盒)按.m3db格式写进资源缓存, 下次启动直接映射 */
+	if (cache != nullptr) {
+		MeshFile::Submesh cachedSubmesh = {};
+		CopyMemory(cachedSubmesh.Name, "skull", 5);
+		cachedSubmesh.IndexCount = (std::uint32_t)indices.size();
+		cachedSubmesh.Center[0] = bounds.Center.x;   cachedSubmesh.Center[1] = bounds.Center.y;   cachedSubmesh.Center[2] = bounds.Center.z;
+		cachedSubmesh.Extents[0] = bounds.Extents.x; cachedSubmesh.Extents[1] = bounds.Extents.y; cachedSubmesh.Extents[2] = bounds.Extents.z;
+		const std::string tempPath = cache->TempPath(cacheKey);
+		if (MeshFile::Write(tempPath, "PNTU", sizeof(Vertex), vertices.data(), vcount,
+			reinterpret_cast<const std::uint32_t*>(indices.data()), (std::uint32_t)indices.size(), { cachedSubmesh }))
+			cache->Commit(cacheKey, tempPath);
+		else
+			DeleteFileA(tempPath.c_str());
+	}
 
 	const UINT vbByteSize = (UINT)vertices.size() * sizeof(Vertex);
 	const UINT ibByteSize = (UINT)indices.size() * sizeof(std::int32_t);
@@ -1247,6 +1293,50 @@ void SsaoApp::BuildSkullGeometry()
 	mGeometries[geo->Name] = std::move(geo);
 }
 
+/// 从内存映射的.m3db文件(离线转换的Models/skull.m3db或资源缓存里的同格式文件)构建骷髅头geo; 文件缺失或顶点格式与本程序Vertex不符时返回false
+bool SsaoApp::BuildSkullGeometryFromCache(const std::string& filename)
+{
+	MeshFile meshFile;
+	if (!meshFile.Open(filename) || !meshFile.HasLayout("PNTU", sizeof(Vertex)) || meshFile.SubmeshCount() == 0)
+		return false;
+
+	const MeshFile::Submesh& src = meshFile.Submeshes()[0];
+
+	// 文件里的索引都不超过65535时直接用16位索引
+	const bool index16 = meshFile.HasIndices16();
+	const UINT vbByteSize = meshFile.VertexBufferByteSize();
+	const UINT ibByteSize = meshFile.IndexCount() * (index16 ? sizeof(std::uint16_t) : sizeof(std::uint32_t));
+
+	/* 顶点直接从映射内存拷贝到CPU端和GPU端; 索引由ReadIndices拷贝(或解码)进CPU端副本, 再上传, 给geo做值*/
+	auto geo = std::make_unique<MeshGeometry>();
+	geo->Name = "skullGeo";// 管理骷髅头的geo
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &geo->IndexBufferCPU));
+	void* indexData = geo->IndexBufferCPU->GetBufferPointer();
+	if (!(index16 ? meshFile.ReadIndices(static_cast<std::uint16_t*>(indexData)) : meshFile.ReadIndices(static_cast<std::uint32_t*>(indexData))))
+		return false;
+	ThrowIfFailed(D3DCreateBlob(vbByteSize, &geo->VertexBufferCPU));
+	CopyMemory(geo->VertexBufferCPU->GetBufferPointer(), meshFile.Vertices(), vbByteSize);
+	geo->VertexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), meshFile.Vertices(), vbByteSize, geo->VertexBufferUploader);
+	geo->IndexBufferGPU = d3dUtil::CreateDefaultBuffer(md3dDevice.Get(),
+		mCommandList.Get(), indexData, ibByteSize, geo->IndexBufferUploader);
+	geo->VertexByteStride = sizeof(Vertex);
+	geo->VertexBufferByteSize = vbByteSize;
+	geo->IndexFormat = index16 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+	geo->IndexBufferByteSize = ibByteSize;
+
+	SubmeshGeometry submesh;
+	submesh.IndexCount = src.IndexCount;
+	submesh.StartIndexLocation = src.StartIndexLocation;
+	submesh.BaseVertexLocation = src.BaseVertexLocation;
+	submesh.Bounds.Center = XMFLOAT3(src.Center);  // 包围盒已在离线转换时算好
+	submesh.Bounds.Extents = XMFLOAT3(src.Extents);
+	geo->DrawArgs["skull"] = submesh;
+	// 骷髅头的geo 注册进全局几何体
+	mGeometries[geo->Name] = std::move(geo);
+	return true;
+}
+
 /// 构建各种的自定义的管线,详见函数内部
 void SsaoApp::BuildPSOs()
 {
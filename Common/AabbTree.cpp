@@ -0,0 +1,497 @@
+﻿//***************************************************************************************
+// AabbTree.cpp
+//***************************************************************************************
+
+#include "AabbTree.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	/* 遍历栈: 平衡后的树很矮, 通常用不完内置的InlineCapacity项; 超出时转用堆内存 */
+	template<typename T>
+	class TraversalStack
+	{
+	public:
+		void Push(const T& value)
+		{
+			if (mSize < InlineCapacity)
+				mInline[mSize] = value;
+			else
+				mOverflow.push_back(value);
+			++mSize;
+		}
+
+		T Pop()
+		{
+			--mSize;
+			if (mSize < InlineCapacity)
+				return mInline[mSize];
+
+			const T value = mOverflow.back();
+			mOverflow.pop_back();
+			return value;
+		}
+
+		bool Empty()const { return mSize == 0; }
+
+	private:
+		static const int InlineCapacity = 64;
+		T mInline[InlineCapacity];
+		std::vector<T> mOverflow;
+		int mSize = 0;
+	};
+
+	inline float SurfaceArea(const XMFLOAT3& boxMin, const XMFLOAT3& boxMax)
+	{
+		const float dx = boxMax.x - boxMin.x;
+		const float dy = boxMax.y - boxMin.y;
+		const float dz = boxMax.z - boxMin.z;
+		return 2.0f * (dx*dy + dy*dz + dz*dx);
+	}
+
+	inline void Union(const XMFLOAT3& aMin, const XMFLOAT3& aMax, const XMFLOAT3& bMin, const XMFLOAT3& bMax,
+		XMFLOAT3& outMin, XMFLOAT3& outMax)
+	{
+		outMin = XMFLOAT3(std::min(aMin.x, bMin.x), std::min(aMin.y, bMin.y), std::min(aMin.z, bMin.z));
+		outMax = XMFLOAT3(std::max(aMax.x, bMax.x), std::max(aMax.y, bMax.y), std::max(aMax.z, bMax.z));
+	}
+
+	// 两盒合并后的表面积
+	inline float UnionArea(const XMFLOAT3& aMin, const XMFLOAT3& aMax, const XMFLOAT3& bMin, const XMFLOAT3& bMax)
+	{
+		XMFLOAT3 boxMin, boxMax;
+		Union(aMin, aMax, bMin, bMax, boxMin, boxMax);
+		return SurfaceArea(boxMin, boxMax);
+	}
+
+	// 射线进入包围盒时的t, 与[0, tMax)不相交时返回FLT_MAX
+	inline float RayBox(const XMFLOAT3& boxMin, const XMFLOAT3& boxMax, const float o[3], const float invD[3], float tMax)
+	{
+		const float mn[3] = { boxMin.x, boxMin.y, boxMin.z };
+		const float mx[3] = { boxMax.x, boxMax.y, boxMax.z };
+		float tNear = 0.0f;
+		float tFar = tMax;
+		for (int a = 0; a < 3; ++a) {
+			const float t1 = (mn[a] - o[a]) * invD[a];
+			const float t2 = (mx[a] - o[a]) * invD[a];
+			tNear = std::max(tNear, std::min(t1, t2));
+			tFar = std::min(tFar, std::max(t1, t2));
+		}
+		return (tNear <= tFar) ? tNear : FLT_MAX;
+	}
+}
+
+AabbTree::AabbTree(float margin)
+	: mMargin(margin)
+{
+}
+
+int AabbTree::AllocateNode()
+{
+	if (mFreeList == NullNode) {
+		mNodes.emplace_back();
+		mNodes.back().Height = -1;
+		mNodes.back().Next = mFreeList;
+		mFreeList = (int)mNodes.size() - 1;
+	}
+
+	const int node = mFreeList;
+	mFreeList = mNodes[node].Next;
+
+	Node& n = mNodes[node];
+	n.Parent = NullNode;
+	n.Child1 = NullNode;
+	n.Child2 = NullNode;
+	n.Height = 0;
+	n.UserData = nullptr;
+	return node;
+}
+
+void AabbTree::FreeNode(int node)
+{
+	mNodes[node].Next = mFreeList;
+	mNodes[node].Height = -1;
+	mFreeList = node;
+}
+
+int AabbTree::Insert(const BoundingBox& bounds, void* userData)
+{
+	const int proxy = AllocateNode();
+	Node& n = mNodes[proxy];
+	n.Min = XMFLOAT3(bounds.Center.x - bounds.Extents.x - mMargin, bounds.Center.y - bounds.Extents.y - mMargin, bounds.Center.z - bounds.Extents.z - mMargin);
+	n.Max = XMFLOAT3(bounds.Center.x + bounds.Extents.x + mMargin, bounds.Center.y + bounds.Extents.y + mMargin, bounds.Center.z + bounds.Extents.z + mMargin);
+	n.UserData = userData;
+
+	InsertLeaf(proxy);
+	++mProxyCount;
+	return proxy;
+}
+
+void AabbTree::Remove(int proxy)
+{
+	assert(proxy >= 0 && proxy < (int)mNodes.size() && mNodes[proxy].IsLeaf() && mNodes[proxy].Height == 0);
+
+	RemoveLeaf(proxy);
+	FreeNode(proxy);
+	--mProxyCount;
+}
+
+bool AabbTree::Move(int proxy, const BoundingBox& bounds)
+{
+	assert(proxy >= 0 && proxy < (int)mNodes.size() && mNodes[proxy].IsLeaf() && mNodes[proxy].Height == 0);
+
+	const XMFLOAT3 boxMin(bounds.Center.x - bounds.Extents.x, bounds.Center.y - bounds.Extents.y, bounds.Center.z - bounds.Extents.z);
+	const XMFLOAT3 boxMax(bounds.Center.x + bounds.Extents.x, bounds.Center.y + bounds.Extents.y, bounds.Center.z + bounds.Extents.z);
+
+	const Node& n = mNodes[proxy];
+	if (n.Min.x <= boxMin.x && n.Min.y <= boxMin.y && n.Min.z <= boxMin.z &&
+		boxMax.x <= n.Max.x && boxMax.y <= n.Max.y && boxMax.z <= n.Max.z)
+		return false;
+
+	RemoveLeaf(proxy);
+	mNodes[proxy].Min = XMFLOAT3(boxMin.x - mMargin, boxMin.y - mMargin, boxMin.z - mMargin);
+	mNodes[proxy].Max = XMFLOAT3(boxMax.x + mMargin, boxMax.y + mMargin, boxMax.z + mMargin);
+	InsertLeaf(proxy);
+	return true;
+}
+
+void AabbTree::Clear()
+{
+	mNodes.clear();
+	mRoot = NullNode;
+	mFreeList = NullNode;
+	mProxyCount = 0;
+}
+
+BoundingBox AabbTree::GetFatBounds(int proxy)const
+{
+	BoundingBox bounds;
+	BoundingBox::CreateFromPoints(bounds, XMLoadFloat3(&mNodes[proxy].Min), XMLoadFloat3(&mNodes[proxy].Max));
+	return bounds;
+}
+
+void AabbTree::InsertLeaf(int leaf)
+{
+	if (mRoot == NullNode) {
+		mRoot = leaf;
+		mNodes[leaf].Parent = NullNode;
+		return;
+	}
+
+	// 自根向下选兄弟节点: 比较"与当前节点合并为新父节点"和"下降到某个子节点"的表面积代价
+	const XMFLOAT3 leafMin = mNodes[leaf].Min;
+	const XMFLOAT3 leafMax = mNodes[leaf].Max;
+	int index = mRoot;
+	while (!mNodes[index].IsLeaf()) {
+		const Node& n = mNodes[index];
+		const float area = SurfaceArea(n.Min, n.Max);
+		const float combinedArea = UnionArea(n.Min, n.Max, leafMin, leafMax);
+
+		// 在此处新建父节点的代价, 以及下降时各祖先因包围盒变大而增加的代价
+		const float cost = 2.0f * combinedArea;
+		const float inheritanceCost = 2.0f * (combinedArea - area);
+
+		float childCost[2];
+		const int children[2] = { n.Child1, n.Child2 };
+		for (int c = 0; c < 2; ++c) {
+			const Node& child = mNodes[children[c]];
+			const float unionArea = UnionArea(child.Min, child.Max, leafMin, leafMax);
+			childCost[c] = (child.IsLeaf() ? unionArea : unionArea - SurfaceArea(child.Min, child.Max)) + inheritanceCost;
+		}
+
+		if (cost < childCost[0] && cost < childCost[1])
+			break;
+
+		index = (childCost[0] < childCost[1]) ? children[0] : children[1];
+	}
+
+	// 新建父节点, 取代兄弟节点原来的位置
+	const int sibling = index;
+	const int oldParent = mNodes[sibling].Parent;
+	const int newParent = AllocateNode();
+	Node& p = mNodes[newParent];
+	p.Parent = oldParent;
+	Union(leafMin, leafMax, mNodes[sibling].Min, mNodes[sibling].Max, p.Min, p.Max);
+	p.Height = mNodes[sibling].Height + 1;
+	p.Child1 = sibling;
+	p.Child2 = leaf;
+
+	if (oldParent != NullNode) {
+		if (mNodes[oldParent].Child1 == sibling)
+			mNodes[oldParent].Child1 = newParent;
+		else
+			mNodes[oldParent].Child2 = newParent;
+	}
+	else {
+		mRoot = newParent;
+	}
+	mNodes[sibling].Parent = newParent;
+	mNodes[leaf].Parent = newParent;
+
+	// 向上重算包围盒与高度, 沿途旋转保持平衡
+	index = mNodes[leaf].Parent;
+	while (index != NullNode) {
+		index = Balance(index);
+		Refit(index);
+		index = mNodes[index].Parent;
+	}
+}
+
+void AabbTree::RemoveLeaf(int leaf)
+{
+	if (leaf == mRoot) {
+		mRoot = NullNode;
+		return;
+	}
+
+	const int parent = mNodes[leaf].Parent;
+	const int grandParent = mNodes[parent].Parent;
+	const int sibling = (mNodes[parent].Child1 == leaf) ? mNodes[parent].Child2 : mNodes[parent].Child1;
+
+	// 兄弟节点顶替父节点的位置
+	if (grandParent != NullNode) {
+		if (mNodes[grandParent].Child1 == parent)
+			mNodes[grandParent].Child1 = sibling;
+		else
+			mNodes[grandParent].Child2 = sibling;
+		mNodes[sibling].Parent = grandParent;
+		FreeNode(parent);
+
+		int index = grandParent;
+		while (index != NullNode) {
+			index = Balance(index);
+			Refit(index);
+			index = mNodes[index].Parent;
+		}
+	}
+	else {
+		mRoot = sibling;
+		mNodes[sibling].Parent = NullNode;
+		FreeNode(parent);
+	}
+}
+
+void AabbTree::Refit(int node)
+{
+	Node& n = mNodes[node];
+	const Node& child1 = mNodes[n.Child1];
+	const Node& child2 = mNodes[n.Child2];
+	Union(child1.Min, child1.Max, child2.Min, child2.Max, n.Min, n.Max);
+	n.Height = 1 + std::max(child1.Height, child2.Height);
+}
+
+int AabbTree::Balance(int iA)
+{
+	if (mNodes[iA].IsLeaf() || mNodes[iA].Height < 2)
+		return iA;
+
+	const int iB = mNodes[iA].Child1;
+	const int iC = mNodes[iA].Child2;
+	const int balance = mNodes[iC].Height - mNodes[iB].Height;
+	if (balance >= -1 && balance <= 1)
+		return iA;
+
+	// 较高的子树iUp上提到A的位置, A成为iUp的子节点, 并接手iUp较矮的那个子节点
+	const bool rotateC = balance > 1;
+	const int iUp = rotateC ? iC : iB;
+	const int iF = mNodes[iUp].Child1;
+	const int iG = mNodes[iUp].Child2;
+
+	mNodes[iUp].Child1 = iA;
+	mNodes[iUp].Parent = mNodes[iA].Parent;
+	mNodes[iA].Parent = iUp;
+
+	const int upParent = mNodes[iUp].Parent;
+	if (upParent != NullNode) {
+		if (mNodes[upParent].Child1 == iA)
+			mNodes[upParent].Child1 = iUp;
+		else
+			mNodes[upParent].Child2 = iUp;
+	}
+	else {
+		mRoot = iUp;
+	}
+
+	// iUp留下较高的孙节点, 较矮的交给A
+	const int iTall = (mNodes[iF].Height > mNodes[iG].Height) ? iF : iG;
+	const int iShort = (iTall == iF) ? iG : iF;
+	mNodes[iUp].Child2 = iTall;
+	if (rotateC)
+		mNodes[iA].Child2 = iShort;
+	else
+		mNodes[iA].Child1 = iShort;
+	mNodes[iShort].Parent = iA;
+
+	Refit(iA);
+	Refit(iUp);
+	return iUp;
+}
+
+void AabbTree::QueryFrustum(const XMFLOAT4* planes, int planeCount, const FrustumCallback& callback)const
+{
+	assert(planeCount >= 0 && planeCount <= 32);
+	if (mRoot == NullNode)
+		return;
+
+	// 栈中各项带一个平面掩码: 父节点已完全位于其内侧的平面不必再测
+	struct Entry
+	{
+		int Node;
+		unsigned PlaneMask;
+	};
+	TraversalStack<Entry> stack;
+	stack.Push({ mRoot, (planeCount == 32) ? 0xffffffffu : ((1u << planeCount) - 1) });
+
+	TraversalStack<int> insideStack;
+	while (!stack.Empty()) {
+		const Entry entry = stack.Pop();
+		const Node& n = mNodes[entry.Node];
+
+		const float c[3] = { 0.5f * (n.Min.x + n.Max.x), 0.5f * (n.Min.y + n.Max.y), 0.5f * (n.Min.z + n.Max.z) };
+		const float e[3] = { 0.5f * (n.Max.x - n.Min.x), 0.5f * (n.Max.y - n.Min.y), 0.5f * (n.Max.z - n.Min.z) };
+
+		unsigned mask = entry.PlaneMask;
+		bool outside = false;
+		for (int p = 0; p < planeCount && !outside; ++p) {
+			if ((mask & (1u << p)) == 0)
+				continue;
+
+			const XMFLOAT4& plane = planes[p];
+			const float dist = plane.x*c[0] + plane.y*c[1] + plane.z*c[2] + plane.w;
+			const float radius = std::fabs(plane.x)*e[0] + std::fabs(plane.y)*e[1] + std::fabs(plane.z)*e[2];
+			if (dist > radius)
+				outside = true;
+			else if (dist <= -radius)
+				mask &= ~(1u << p);
+		}
+		if (outside)
+			continue;
+
+		if (mask == 0) {
+			// 整棵子树都在视锥体内, 直接报告其中所有叶子
+			insideStack.Push(entry.Node);
+			while (!insideStack.Empty()) {
+				const int index = insideStack.Pop();
+				const Node& inner = mNodes[index];
+				if (inner.IsLeaf()) {
+					callback(index, true);
+				}
+				else {
+					insideStack.Push(inner.Child2);
+					insideStack.Push(inner.Child1);
+				}
+			}
+			continue;
+		}
+
+		if (n.IsLeaf()) {
+			callback(entry.Node, false);
+		}
+		else {
+			stack.Push({ n.Child2, mask });
+			stack.Push({ n.Child1, mask });
+		}
+	}
+}
+
+void AabbTree::QueryFrustum(const BoundingFrustum& frustum, const FrustumCallback& callback)const
+{
+	XMVECTOR planes[6];
+	frustum.GetPlanes(&planes[0], &planes[1], &planes[2], &planes[3], &planes[4], &planes[5]);
+
+	XMFLOAT4 stored[6];
+	for (int p = 0; p < 6; ++p)
+		XMStoreFloat4(&stored[p], planes[p]);
+	QueryFrustum(stored, 6, callback);
+}
+
+void AabbTree::QueryRay(FXMVECTOR origin, FXMVECTOR direction, float tMax, const RayCallback& callback)const
+{
+	if (mRoot == NullNode)
+		return;
+
+	XMFLOAT3 o3, d3;
+	XMStoreFloat3(&o3, origin);
+	XMStoreFloat3(&d3, direction);
+	const float o[3] = { o3.x, o3.y, o3.z };
+	const float d[3] = { d3.x, d3.y, d3.z };
+
+	// 方向分量为0时用极小值代替, 避免0 * inf产生NaN
+	float invD[3];
+	for (int a = 0; a < 3; ++a)
+		invD[a] = 1.0f / ((std::fabs(d[a]) > 1e-20f) ? d[a] : 1e-20f);
+
+	struct Entry
+	{
+		int Node;
+		float T;// 射线进入该节点包围盒时的t
+	};
+	TraversalStack<Entry> stack;
+
+	const float t = RayBox(mNodes[mRoot].Min, mNodes[mRoot].Max, o, invD, tMax);
+	if (t != FLT_MAX)
+		stack.Push({ mRoot, t });
+
+	while (!stack.Empty()) {
+		const Entry entry = stack.Pop();
+		if (entry.T > tMax)
+			continue;
+
+		const Node& n = mNodes[entry.Node];
+		if (n.IsLeaf()) {
+			tMax = callback(entry.Node, tMax);
+			if (tMax <= 0.0f)
+				return;
+			continue;
+		}
+
+		// 先压远的子节点, 让近的先出栈; 回调裁短射线后更远的节点会被entry.T > tMax剔除
+		const Entry left = { n.Child1, RayBox(mNodes[n.Child1].Min, mNodes[n.Child1].Max, o, invD, tMax) };
+		const Entry right = { n.Child2, RayBox(mNodes[n.Child2].Min, mNodes[n.Child2].Max, o, invD, tMax) };
+		const Entry& nearChild = (left.T <= right.T) ? left : right;
+		const Entry& farChild = (left.T <= right.T) ? right : left;
+		if (farChild.T != FLT_MAX)
+			stack.Push(farChild);
+		if (nearChild.T != FLT_MAX)
+			stack.Push(nearChild);
+	}
+}
+
+void AabbTree::QuerySphere(const BoundingSphere& sphere, const QueryCallback& callback)const
+{
+	if (mRoot == NullNode)
+		return;
+
+	const float c[3] = { sphere.Center.x, sphere.Center.y, sphere.Center.z };
+	const float radiusSq = sphere.Radius * sphere.Radius;
+
+	TraversalStack<int> stack;
+	stack.Push(mRoot);
+	while (!stack.Empty()) {
+		const int index = stack.Pop();
+		const Node& n = mNodes[index];
+
+		// 球心到包围盒的最近距离
+		const float mn[3] = { n.Min.x, n.Min.y, n.Min.z };
+		const float mx[3] = { n.Max.x, n.Max.y, n.Max.z };
+		float distSq = 0.0f;
+		for (int a = 0; a < 3; ++a) {
+			const float v = std::max(mn[a] - c[a], std::max(0.0f, c[a] - mx[a]));
+			distSq += v * v;
+		}
+		if (distSq > radiusSq)
+			continue;
+
+		if (n.IsLeaf()) {
+			callback(index);
+		}
+		else {
+			stack.Push(n.Child2);
+			stack.Push(n.Child1);
+		}
+	}
+}
@@ -0,0 +1,105 @@
+﻿//***************************************************************************************
+// AabbTree.h
+//
+// 场景的动态包围盒树(dynamic AABB tree), 可增量更新的空间索引, 用来存放渲染项或实例的世界空间包围盒.
+// 每个物体是一个叶子, 叶子存外扩了Margin的"胖"包围盒: 物体移动后只要仍在胖盒内就不必改动树,
+// 移出时才把该叶子删掉重新插入, 不需要整体重建. 插入时按表面积代价选兄弟节点, 并以旋转保持平衡.
+// 支持视锥体、射线、球体查询; 视锥体查询中完全在视锥内的子树不再逐平面测试, 完全在外的子树整体跳过.
+//***************************************************************************************
+
+#pragma once
+
+#include <cfloat>
+#include <functional>
+#include <vector>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+class AabbTree
+{
+public:
+	// 无效的节点/代理序号
+	static const int NullNode = -1;
+
+	// 视锥体查询的回调: proxy为命中的物体, inside为true表示其胖包围盒完全在视锥体内
+	using FrustumCallback = std::function<void(int proxy, bool inside)>;
+
+	/* 射线查询的回调: 射线与proxy的胖包围盒在[0, tMax)内相交时调用
+	* 返回新的tMax以裁短射线(例如已求得与该物体的精确交点), 原样返回tMax表示继续, 返回0则结束查询 */
+	using RayCallback = std::function<float(int proxy, float tMax)>;
+
+	// 球体查询的回调
+	using QueryCallback = std::function<void(int proxy)>;
+
+public:
+	/* margin为叶子胖包围盒向各方向外扩的距离, 取物体每帧典型移动量的几倍为宜 */
+	explicit AabbTree(float margin = 0.1f);
+	AabbTree(const AabbTree& rhs) = delete;
+	AabbTree& operator=(const AabbTree& rhs) = delete;
+
+	/* 插入一个物体, 返回其代理序号; 删除前序号保持不变, 可存在物体中用于Move/Remove */
+	int Insert(const DirectX::BoundingBox& bounds, void* userData);
+	void Remove(int proxy);
+
+	/* 更新物体的包围盒; 仍在胖包围盒内时什么也不做并返回false, 否则重新插入并返回true */
+	bool Move(int proxy, const DirectX::BoundingBox& bounds);
+
+	// 删除全部物体
+	void Clear();
+
+	void* GetUserData(int proxy)const { return mNodes[proxy].UserData; }
+	DirectX::BoundingBox GetFatBounds(int proxy)const;
+
+	int ProxyCount()const { return mProxyCount; }
+	// 树高, 叶子为0; 空树为-1
+	int Height()const { return (mRoot == NullNode) ? -1 : mNodes[mRoot].Height; }
+
+	/* 视锥体查询: 平面约定同InstanceCuller::Frustum, 法线指向视锥体外, 点在内侧即a*x + b*y + c*z + d <= 0
+	* 胖包围盒完全位于某个平面外侧的物体被剔除, 其余的各调用一次callback */
+	void QueryFrustum(const DirectX::XMFLOAT4* planes, int planeCount, const FrustumCallback& callback)const;
+	void QueryFrustum(const DirectX::BoundingFrustum& frustum, const FrustumCallback& callback)const;
+
+	/* 射线查询: 射线为origin + t * direction, direction不必归一化; 子节点按进入t由近到远访问 */
+	void QueryRay(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, float tMax, const RayCallback& callback)const;
+
+	/* 球体查询: 胖包围盒与球相交的物体 */
+	void QuerySphere(const DirectX::BoundingSphere& sphere, const QueryCallback& callback)const;
+
+private:
+	/* Child1为NullNode的是叶子; 空闲节点以Next串成链表 */
+	struct Node
+	{
+		DirectX::XMFLOAT3 Min;
+		DirectX::XMFLOAT3 Max;
+		union
+		{
+			int Parent;
+			int Next;
+		};
+		int Child1 = NullNode;
+		int Child2 = NullNode;
+		int Height = 0;// 叶子为0, 空闲节点为-1
+		void* UserData = nullptr;
+
+		bool IsLeaf()const { return Child1 == NullNode; }
+	};
+
+	int AllocateNode();
+	void FreeNode(int node);
+
+	void InsertLeaf(int leaf);
+	void RemoveLeaf(int leaf);
+
+	// 若node的两棵子树高度差超过1则旋转, 返回旋转后占据该位置的节点
+	int Balance(int node);
+
+	// 由子节点重算node的包围盒与高度
+	void Refit(int node);
+
+private:
+	std::vector<Node> mNodes;
+	int mRoot = NullNode;
+	int mFreeList = NullNode;
+	int mProxyCount = 0;
+	float mMargin = 0.1f;
+};
@@ -0,0 +1,659 @@
+﻿//***************************************************************************************
+// AssetCache.cpp
+//***************************************************************************************
+
+#include "AssetCache.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(AssetCache::IndexHeader) == 16, "AssetCache::IndexHeader must be 16 bytes");
+static_assert(sizeof(AssetCache::IndexRecord) == 32, "AssetCache::IndexRecord must be 32 bytes");
+
+const AssetCache::uint32 AssetCache::Magic;
+const AssetCache::uint32 AssetCache::Version;
+
+namespace
+{
+	using uint32 = AssetCache::uint32;
+	using uint64 = AssetCache::uint64;
+
+	const uint64 Prime1 = 11400714785074694791ull;
+	const uint64 Prime2 = 14029467366897019727ull;
+	const uint64 Prime3 = 1609587929392839161ull;
+	const uint64 Prime4 = 9650029242287828579ull;
+	const uint64 Prime5 = 2870177450012600261ull;
+
+	inline uint64 Rotl(uint64 x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	inline uint64 Read64(const std::uint8_t* p)
+	{
+		uint64 v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline uint32 Read32(const std::uint8_t* p)
+	{
+		uint32 v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	inline uint64 Round(uint64 acc, uint64 input)
+	{
+		acc += input * Prime2;
+		return Rotl(acc, 31) * Prime1;
+	}
+
+	inline uint64 MergeRound(uint64 acc, uint64 value)
+	{
+		acc ^= Round(0, value);
+		return acc * Prime1 + Prime4;
+	}
+
+	/// 文件系统操作; 路径都是窄字符(本地代码页)
+
+	bool MakeDirectory(const std::string& path)
+	{
+#if defined(_WIN32)
+		return CreateDirectoryA(path.c_str(), nullptr) != 0 || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+		struct stat st;
+		return ::mkdir(path.c_str(), 0755) == 0 || (::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+#endif
+	}
+
+	// 文件不存在时返回false
+	bool GetFileSize(const std::string& path, uint64& size)
+	{
+#if defined(_WIN32)
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data))
+			return false;
+		size = ((uint64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		return true;
+#else
+		struct stat st;
+		if (::stat(path.c_str(), &st) != 0)
+			return false;
+		size = (uint64)st.st_size;
+		return true;
+#endif
+	}
+
+	// 原子地用from替换to
+	bool ReplaceFile(const std::string& from, const std::string& to)
+	{
+#if defined(_WIN32)
+		return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+	}
+
+	unsigned long ProcessId()
+	{
+#if defined(_WIN32)
+		return GetCurrentProcessId();
+#else
+		return (unsigned long)::getpid();
+#endif
+	}
+
+	bool WriteFile(const std::string& path, const void* data, size_t size)
+	{
+		std::ofstream fout(path, std::ios::binary | std::ios::trunc);
+		if (!fout)
+			return false;
+		fout.write(static_cast<const char*>(data), (std::streamsize)size);
+		fout.close();
+		return !fout.fail();
+	}
+
+	const size_t NotMapped = (size_t)-1;
+
+	// 索引里没有记录的结果文件与临时文件至少这么旧才在Flush时删除, 以免删掉别的进程刚写好, 尚未登记的文件
+	const double OrphanAgeSeconds = 60.0 * 60.0;
+
+	/* 跨进程的互斥锁, 锁住lockPath文件直到析构; 持锁的进程退出时由系统释放, 不会留下死锁 */
+	class FileLock
+	{
+	public:
+		explicit FileLock(const std::string& lockPath)
+		{
+#if defined(_WIN32)
+			mFile = CreateFileA(lockPath.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+				nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			OVERLAPPED overlapped = {};
+			if (mFile != INVALID_HANDLE_VALUE && !LockFileEx(mFile, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped)) {
+				CloseHandle(mFile);
+				mFile = INVALID_HANDLE_VALUE;
+			}
+#else
+			mFile = ::open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+			if (mFile >= 0 && ::flock(mFile, LOCK_EX) != 0) {
+				::close(mFile);
+				mFile = -1;
+			}
+#endif
+		}
+
+		FileLock(const FileLock& rhs) = delete;
+		FileLock& operator=(const FileLock& rhs) = delete;
+
+		~FileLock()
+		{
+#if defined(_WIN32)
+			if (mFile != INVALID_HANDLE_VALUE) {
+				OVERLAPPED overlapped = {};
+				UnlockFileEx(mFile, 0, 1, 0, &overlapped);
+				CloseHandle(mFile);
+			}
+#else
+			if (mFile >= 0) {
+				::flock(mFile, LOCK_UN);
+				::close(mFile);
+			}
+#endif
+		}
+
+		bool IsLocked()const
+		{
+#if defined(_WIN32)
+			return mFile != INVALID_HANDLE_VALUE;
+#else
+			return mFile >= 0;
+#endif
+		}
+
+	private:
+#if defined(_WIN32)
+		HANDLE mFile = INVALID_HANDLE_VALUE;
+#else
+		int mFile = -1;
+#endif
+	};
+
+	struct DirectoryEntry
+	{
+		std::string Name;
+		double AgeSeconds;// 距最后一次修改的秒数
+	};
+
+	// 列出目录中的普通文件(不含子目录)
+	std::vector<DirectoryEntry> ListDirectory(const std::string& path)
+	{
+		std::vector<DirectoryEntry> entries;
+#if defined(_WIN32)
+		WIN32_FIND_DATAA data;
+		HANDLE find = FindFirstFileA((path + "/*").c_str(), &data);
+		if (find == INVALID_HANDLE_VALUE)
+			return entries;
+
+		FILETIME now;
+		GetSystemTimeAsFileTime(&now);
+		const uint64 nowTicks = ((uint64)now.dwHighDateTime << 32) | now.dwLowDateTime;
+		do {
+			if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				continue;
+			const uint64 ticks = ((uint64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+			const double age = (nowTicks > ticks) ? (double)(nowTicks - ticks) * 1e-7 : 0.0;// FILETIME以100ns为单位
+			entries.push_back({ data.cFileName, age });
+		} while (FindNextFileA(find, &data));
+		FindClose(find);
+#else
+		DIR* dir = ::opendir(path.c_str());
+		if (dir == nullptr)
+			return entries;
+
+		const std::time_t now = std::time(nullptr);
+		while (const dirent* entry = ::readdir(dir)) {
+			struct stat st;
+			if (::stat((path + "/" + entry->d_name).c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+				continue;
+			entries.push_back({ entry->d_name, std::max(0.0, std::difftime(now, st.st_mtime)) });
+		}
+		::closedir(dir);
+#endif
+		return entries;
+	}
+
+	// 结果文件名"<16位十六进制键>.bin"
+	bool ParseBlobName(const std::string& name, uint64& key)
+	{
+		if (name.size() != 20 || name.compare(16, 4, ".bin") != 0)
+			return false;
+
+		key = 0;
+		for (int i = 0; i < 16; ++i) {
+			const char c = name[i];
+			const int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+			if (digit < 0)
+				return false;
+			key = (key << 4) | (uint64)digit;
+		}
+		return true;
+	}
+
+	bool IsTempName(const std::string& name)
+	{
+		return name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0;
+	}
+
+	// 校验映射出的索引文件, 有效时返回其记录数组, 否则返回nullptr
+	const AssetCache::IndexRecord* ParseIndex(const MappedFile& file, AssetCache::IndexHeader& header)
+	{
+		if (file.Size() < sizeof(header))
+			return nullptr;
+		std::memcpy(&header, file.Data(), sizeof(header));
+		if (header.Magic != AssetCache::Magic || header.Version != AssetCache::Version ||
+			file.Size() != sizeof(AssetCache::IndexHeader) + (uint64)header.Count * sizeof(AssetCache::IndexRecord))
+			return nullptr;
+		return reinterpret_cast<const AssetCache::IndexRecord*>(file.Data() + sizeof(AssetCache::IndexHeader));
+	}
+
+	// 按键升序排列的记录中查找key
+	const AssetCache::IndexRecord* FindSorted(const AssetCache::IndexRecord* records, size_t count, uint64 key)
+	{
+		const AssetCache::IndexRecord* end = records + count;
+		const AssetCache::IndexRecord* it = std::lower_bound(records, end, key,
+			[](const AssetCache::IndexRecord& record, uint64 k) { return record.Key < k; });
+		return (it != end && it->Key == key) ? it : nullptr;
+	}
+}
+
+AssetCache::uint64 AssetCache::Hash(const void* data, size_t size, uint64 seed)
+{
+	const std::uint8_t* p = static_cast<const std::uint8_t*>(data);
+	const std::uint8_t* const end = p + size;
+	uint64 h;
+
+	if (size >= 32) {
+		uint64 v1 = seed + Prime1 + Prime2;
+		uint64 v2 = seed + Prime2;
+		uint64 v3 = seed;
+		uint64 v4 = seed - Prime1;
+		const std::uint8_t* const limit = end - 32;
+		do {
+			v1 = Round(v1, Read64(p));
+			v2 = Round(v2, Read64(p + 8));
+			v3 = Round(v3, Read64(p + 16));
+			v4 = Round(v4, Read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+		h = MergeRound(h, v1);
+		h = MergeRound(h, v2);
+		h = MergeRound(h, v3);
+		h = MergeRound(h, v4);
+	}
+	else {
+		h = seed + Prime5;
+	}
+
+	h += (uint64)size;
+	for (; p + 8 <= end; p += 8)
+		h = Rotl(h ^ Round(0, Read64(p)), 27) * Prime1 + Prime4;
+	if (p + 4 <= end) {
+		h = Rotl(h ^ (Read32(p) * Prime1), 23) * Prime2 + Prime3;
+		p += 4;
+	}
+	for (; p < end; ++p)
+		h = Rotl(h ^ (*p * Prime5), 11) * Prime1;
+
+	h ^= h >> 33;
+	h *= Prime2;
+	h ^= h >> 29;
+	h *= Prime3;
+	h ^= h >> 32;
+	return h;
+}
+
+AssetCache::Hasher::Hasher(const char* kind)
+{
+	Add(std::string(kind));
+}
+
+AssetCache::Hasher& AssetCache::Hasher::Add(const void* data, size_t size)
+{
+	const uint64 length = size;
+	mState = Hash(&length, sizeof(length), mState);
+	mState = Hash(data, size, mState);
+	return *this;
+}
+
+AssetCache::Hasher& AssetCache::Hasher::Add(const std::string& text)
+{
+	return Add(text.data(), text.size());
+}
+
+AssetCache::Hasher& AssetCache::Hasher::Add(uint64 value)
+{
+	return Add(&value, sizeof(value));
+}
+
+bool AssetCache::Hasher::AddFile(const std::string& filename)
+{
+	MappedFile file;
+	if (!file.Open(filename))
+		return false;
+	Add(file.Data(), file.Size());
+	return true;
+}
+
+std::string AssetCache::KeyString(Key key)
+{
+	static const char Digits[] = "0123456789abcdef";
+	std::string s(16, '0');
+	for (int i = 15; i >= 0; --i, key >>= 4)
+		s[i] = Digits[key & 0xf];
+	return s;
+}
+
+AssetCache::AssetCache(const std::string& directory, uint32 maxAge)
+	: mDirectory(directory), mMaxAge(maxAge)
+{
+	mOpen = MakeDirectory(mDirectory);
+	if (mOpen)
+		OpenIndex();
+}
+
+AssetCache::~AssetCache()
+{
+	Flush();
+}
+
+std::string AssetCache::BlobPath(Key key)const
+{
+	return mDirectory + "/" + KeyString(key) + ".bin";
+}
+
+std::string AssetCache::IndexPath()const
+{
+	return mDirectory + "/index.bin";
+}
+
+std::string AssetCache::TempPath(Key key)const
+{
+	// 进程号与序号区分同时写同一个键的进程与线程
+	static std::atomic<unsigned> counter(0);
+	return BlobPath(key) + "." + std::to_string(ProcessId()) + "-" + std::to_string(counter++) + ".tmp";
+}
+
+void AssetCache::OpenIndex()
+{
+	mRecords = nullptr;
+	mRecordCount = 0;
+	mStates.clear();
+
+	// 索引不存在是空缓存; 版本不符或大小对不上时整个丢弃, 下次Flush重写
+	if (!mIndexFile.Open(IndexPath()))
+		return;
+
+	IndexHeader header = {};
+	const IndexRecord* records = ParseIndex(mIndexFile, header);
+	if (records == nullptr) {
+		mIndexFile.Close();
+		mDirty = true;
+		return;
+	}
+
+	mGeneration = header.Generation;
+	mRecordCount = header.Count;
+	mRecords = records;
+	mStates.assign(mRecordCount, RecordState::Unused);
+}
+
+const AssetCache::IndexRecord* AssetCache::Lookup(Key key, size_t& mapped)const
+{
+	mapped = NotMapped;
+
+	auto added = mAdded.find(key);
+	if (added != mAdded.end())
+		return &added->second;
+
+	const IndexRecord* it = FindSorted(mRecords, mRecordCount, key);
+	if (it == nullptr)
+		return nullptr;
+
+	mapped = (size_t)(it - mRecords);
+	return (mStates[mapped] != RecordState::Invalid) ? it : nullptr;
+}
+
+void AssetCache::Invalidate(Key key, size_t mapped)
+{
+	if (mapped != NotMapped)
+		mStates[mapped] = RecordState::Invalid;
+	else
+		mAdded.erase(key);
+	std::remove(BlobPath(key).c_str());
+	++mStats.Invalidated;
+	mDirty = true;
+}
+
+bool AssetCache::FindRecord(Key key, IndexRecord& record, std::string& path)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!mOpen)
+		return false;
+
+	size_t mapped = NotMapped;
+	const IndexRecord* found = Lookup(key, mapped);
+	if (found == nullptr) {
+		++mStats.Misses;
+		return false;
+	}
+
+	// 结果文件被删或被截断时作废, 按未命中处理, 调用方会重建并重新写入
+	path = BlobPath(key);
+	uint64 size = 0;
+	if (!GetFileSize(path, size) || size != found->Size) {
+		Invalidate(key, mapped);
+		++mStats.Misses;
+		return false;
+	}
+
+	record = *found;
+	if (mapped != NotMapped)
+		mStates[mapped] = RecordState::Used;
+	++mStats.Hits;
+	mDirty = true;
+	return true;
+}
+
+bool AssetCache::Find(Key key, std::string& path)
+{
+	IndexRecord record;
+	return FindRecord(key, record, path);
+}
+
+bool AssetCache::Load(Key key, MappedFile& file, bool verify)
+{
+	IndexRecord record;
+	std::string path;
+	if (!FindRecord(key, record, path))
+		return false;
+
+	if (file.Open(path) && file.Size() == record.Size &&
+		(!verify || Hash(file.Data(), file.Size()) == record.Checksum))
+		return true;
+
+	file.Close();
+	std::lock_guard<std::mutex> lock(mMutex);
+	size_t mapped = NotMapped;
+	if (Lookup(key, mapped) != nullptr) {
+		Invalidate(key, mapped);
+		--mStats.Hits;
+		++mStats.Misses;
+	}
+	return false;
+}
+
+bool AssetCache::Store(Key key, const void* data, size_t size)
+{
+	if (!mOpen || size == 0)
+		return false;
+
+	const std::string temp = TempPath(key);
+	if (!WriteFile(temp, data, size)) {
+		std::remove(temp.c_str());
+		return false;
+	}
+	return Commit(key, temp);
+}
+
+bool AssetCache::Commit(Key key, const std::string& tempPath)
+{
+	IndexRecord record = {};
+	record.Key = key;
+	{
+		MappedFile file;
+		if (!mOpen || !file.Open(tempPath)) {
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		record.Size = file.Size();
+		record.Checksum = Hash(file.Data(), file.Size());
+	}
+
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!ReplaceFile(tempPath, BlobPath(key))) {
+		std::remove(tempPath.c_str());
+		return false;
+	}
+
+	// 映射索引里的旧条目由Flush按mAdded覆盖
+	mAdded[key] = record;
+	++mStats.Stores;
+	mDirty = true;
+	return true;
+}
+
+bool AssetCache::Flush()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (!mOpen)
+		return false;
+	if (!mDirty)
+		return true;
+
+	// 多个进程共用目录时, 别的进程可能在本进程打开索引之后写回过:
+	// 持锁重读磁盘上现在的索引, 在它的基础上合并本进程的改动, 不会丢掉别的进程新登记的条目
+	FileLock indexLock(IndexPath() + ".lock");
+	if (!indexLock.IsLocked())
+		return false;
+
+	MappedFile current;
+	IndexHeader currentHeader = {};
+	const IndexRecord* currentRecords = current.Open(IndexPath()) ? ParseIndex(current, currentHeader) : nullptr;
+	const uint32 currentCount = (currentRecords != nullptr) ? currentHeader.Count : 0;
+	const uint32 generation = std::max(mGeneration, (currentRecords != nullptr) ? currentHeader.Generation : 0u) + 1;
+
+	std::vector<IndexRecord> records;
+	records.reserve(currentCount + mAdded.size());
+	for (uint32 i = 0; i < currentCount; ++i) {
+		IndexRecord record = currentRecords[i];
+		if (mAdded.count(record.Key) != 0)
+			continue;
+
+		// 本进程对同一条目的查找结果; 内容已被别的进程重新写过(校验和不同)时不算
+		const IndexRecord* mapped = FindSorted(mRecords, mRecordCount, record.Key);
+		const RecordState state = (mapped != nullptr && mapped->Checksum == record.Checksum) ?
+			mStates[mapped - mRecords] : RecordState::Unused;
+		if (state == RecordState::Invalid)
+			continue;
+		if (state == RecordState::Used)
+			record.LastUsed = std::max(record.LastUsed, generation);
+
+		// 久未使用: 多半是源文件或选项改过之后留下的旧结果
+		if (generation - record.LastUsed > mMaxAge) {
+			std::remove(BlobPath(record.Key).c_str());
+			++mStats.Evicted;
+			continue;
+		}
+		records.push_back(record);
+	}
+	for (auto& e : mAdded) {
+		IndexRecord record = e.second;
+		record.LastUsed = generation;
+		records.push_back(record);
+	}
+	std::sort(records.begin(), records.end(),
+		[](const IndexRecord& a, const IndexRecord& b) { return a.Key < b.Key; });
+
+	// 索引里没有记录的结果文件与临时文件(写回失败, 进程中途退出等留下的)也删掉, 否则永远不会被淘汰
+	for (const DirectoryEntry& entry : ListDirectory(mDirectory)) {
+		Key key = 0;
+		const bool orphan = (ParseBlobName(entry.Name, key) && FindSorted(records.data(), records.size(), key) == nullptr) ||
+			IsTempName(entry.Name);
+		if (orphan && entry.AgeSeconds >= OrphanAgeSeconds) {
+			std::remove((mDirectory + "/" + entry.Name).c_str());
+			++mStats.Evicted;
+		}
+	}
+
+	IndexHeader header = {};
+	header.Magic = Magic;
+	header.Version = Version;
+	header.Generation = generation;
+	header.Count = (uint32)records.size();
+
+	std::vector<std::uint8_t> bytes(sizeof(header) + records.size() * sizeof(IndexRecord));
+	std::memcpy(bytes.data(), &header, sizeof(header));
+	if (!records.empty())
+		std::memcpy(bytes.data() + sizeof(header), records.data(), records.size() * sizeof(IndexRecord));
+
+	// 写不出临时文件时保留本次的全部状态(包括mAdded), 下次Flush再试
+	const std::string temp = IndexPath() + "." + std::to_string(ProcessId()) + ".tmp";
+	if (!WriteFile(temp, bytes.data(), bytes.size())) {
+		std::remove(temp.c_str());
+		return false;
+	}
+
+	// 被映射着的文件不能被替换(Windows), 先解除映射; 替换后重新映射, 本次的命中状态全部归零
+	current.Close();
+	mIndexFile.Close();
+	mRecords = nullptr;
+	mRecordCount = 0;
+	mStates.clear();
+
+	if (!ReplaceFile(temp, IndexPath())) {
+		std::remove(temp.c_str());
+		OpenIndex();
+		mDirty = true;
+		return false;
+	}
+
+	mAdded.clear();
+	mDirty = false;
+	mGeneration = generation;
+	OpenIndex();
+	return true;
+}
+
+AssetCache::Stats AssetCache::GetStats()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mStats;
+}
@@ -0,0 +1,153 @@
+﻿//***************************************************************************************
+// AssetCache.h
+//
+// 按内容寻址的磁盘资源缓存: 编译好的着色器字节码, 由文本模型转换出的二进制网格, 烘焙好的纹理等
+// 以"源内容的哈希 + 构建选项"为键存成目录下的独立文件, 下次启动时键相同就直接映射结果, 跳过重建.
+// 源文件或选项一变键就跟着变, 旧结果自然不再命中; 多次启动都没被用到的条目在Flush时连同文件删除,
+// 文件缺失或大小与索引不符的条目在查找时作废. 所以缓存不需要手工清理, 删掉整个目录也总是安全的.
+// 索引(index.bin)是按键排序的定长记录数组, 启动时内存映射后直接二分查找, 不逐条解析.
+// 每个结果先写临时文件再改名, 进程中途退出也不会留下写了一半的条目. 可在多个线程上同时使用;
+// 多个进程共用一个目录时, Flush在锁文件(index.bin.lock)的保护下重读磁盘上的索引再合并写回.
+// 本文件不依赖D3D.
+//***************************************************************************************
+
+#pragma once
+
+#include "MappedFile.h"
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class AssetCache
+{
+public:
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	// 缓存键, 由Hasher算出
+	using Key = uint64;
+
+	static const uint32 Magic = 0x58494341;  // "ACIX"
+	static const uint32 Version = 1;		  // 索引格式有变动时递增, 旧索引会被整个丢弃
+
+	/* 把源内容与构建选项依次串接成键; 每段先混入自身长度, 所以("ab", "c")与("a", "bc")的键不同 */
+	class Hasher
+	{
+	public:
+		// kind为资源种类与其生成代码的版本(例如"hlsl/1"), 生成方式改变时改版本号即可让旧结果全部失效
+		explicit Hasher(const char* kind);
+
+		Hasher& Add(const void* data, size_t size);
+		Hasher& Add(const std::string& text);
+		Hasher& Add(uint64 value);
+
+		// 映射并混入整个文件的内容; 打不开时返回false
+		bool AddFile(const std::string& filename);
+
+		Key Finish()const { return mState; }
+
+	private:
+		uint64 mState = 0;
+	};
+
+	/* 64位XXH64哈希; seed可以串接多段数据 */
+	static uint64 Hash(const void* data, size_t size, uint64 seed = 0);
+
+	/* 索引文件 = IndexHeader + Count个按Key升序排列的IndexRecord */
+	struct IndexHeader
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 Generation;	// 每次写回索引加1
+		uint32 Count;
+	};
+
+	struct IndexRecord
+	{
+		uint64 Key;
+		uint64 Size;		// 结果文件的字节数
+		uint64 Checksum;	// 结果文件内容的Hash, Load时可选校验
+		uint32 LastUsed;	// 最近一次被用到时的Generation
+		uint32 Reserved;
+	};
+
+	struct Stats
+	{
+		uint64 Hits = 0;
+		uint64 Misses = 0;
+		uint64 Stores = 0;
+		uint64 Invalidated = 0;	// 查找时发现文件缺失或损坏而作废的条目
+		uint64 Evicted = 0;		// Flush时因久未使用, 或索引中没有记录而删除的文件
+	};
+
+public:
+	/* 打开(必要时创建)directory作为缓存目录, 其上级目录须已存在
+	* maxAge: 连续这么多次写回索引都没被用到的条目会被删除 */
+	explicit AssetCache(const std::string& directory, uint32 maxAge = 16);
+	AssetCache(const AssetCache& rhs) = delete;
+	AssetCache& operator=(const AssetCache& rhs) = delete;
+	// 调用Flush
+	~AssetCache();
+
+	// 目录不可用时为false, 此时所有查找都不命中, 写入都失败
+	bool IsOpen()const { return mOpen; }
+	const std::string& Directory()const { return mDirectory; }
+
+	/* 查找key, 命中时path为结果文件的路径, 可直接用MappedFile或MeshFile等打开 */
+	bool Find(Key key, std::string& path);
+
+	/* 查找并映射结果文件; verify为true时顺带校验内容哈希(需要完整读一遍文件) */
+	bool Load(Key key, MappedFile& file, bool verify = false);
+
+	/* 写入size字节的结果, 已有同键的条目时替换它 */
+	bool Store(Key key, const void* data, size_t size);
+
+	/* 结果要由调用方自己写文件时(例如MeshFile::Write): 写到TempPath(key)返回的路径, 再Commit登记
+	* Commit失败或不调用时应删除临时文件 */
+	std::string TempPath(Key key)const;
+	bool Commit(Key key, const std::string& tempPath);
+
+	/* 写回索引: 与磁盘上现有的索引合并, 本次用到与新写入的条目记为最新一代, 超过maxAge代未用的条目连同文件删除;
+	* 目录中索引里没有记录的结果文件与临时文件超过一小时未修改的也删除
+	* 本次没有任何查找命中或写入时什么也不做; 失败时保留本次新写入的条目, 下次Flush再写 */
+	bool Flush();
+
+	Stats GetStats()const;
+
+	// 键的16位十六进制表示, 也是结果文件名
+	static std::string KeyString(Key key);
+
+private:
+	enum class RecordState : std::uint8_t
+	{
+		Unused,
+		Used,
+		Invalid
+	};
+
+	// 调用时须持有mMutex; 找到时返回记录, mapped为它在映射索引中的下标(新写入的条目为SIZE_MAX)
+	const IndexRecord* Lookup(Key key, size_t& mapped)const;
+	bool FindRecord(Key key, IndexRecord& record, std::string& path);
+	void Invalidate(Key key, size_t mapped);
+	void OpenIndex();
+	std::string BlobPath(Key key)const;
+	std::string IndexPath()const;
+
+private:
+	std::string mDirectory;
+	uint32 mMaxAge = 16;
+	bool mOpen = false;
+
+	mutable std::mutex mMutex;
+	MappedFile mIndexFile;
+	const IndexRecord* mRecords = nullptr;	// 指向映射的索引
+	uint32 mRecordCount = 0;
+	uint32 mGeneration = 0;
+	std::vector<RecordState> mStates;		// 与mRecords一一对应
+	std::unordered_map<Key, IndexRecord> mAdded;// 本次新写入的条目
+	bool mDirty = false;					// 本次有命中, 写入或作废, Flush须写回索引
+	Stats mStats;
+};
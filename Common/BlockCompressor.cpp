@@ -0,0 +1,1198 @@
+﻿//***************************************************************************************
+// BlockCompressor.cpp
+//***************************************************************************************
+
+#include "BlockCompressor.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+const std::uint32_t BlockCompressor::BlockDim;
+
+namespace
+{
+	using uint8 = std::uint8_t;
+	using uint16 = std::uint16_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	inline int Clamp(int v, int lo, int hi)
+	{
+		return (v < lo) ? lo : ((v > hi) ? hi : v);
+	}
+
+	/* count个像素的均值与channels维协方差矩阵(未除以count) */
+	template<int Channels>
+	void Covariance(const float (*pixels)[4], int count, float mean[4], float cov[4][4])
+	{
+		for (int c = 0; c < 4; ++c)
+			mean[c] = 0.0f;
+		for (int i = 0; i < count; ++i)
+			for (int c = 0; c < Channels; ++c)
+				mean[c] += pixels[i][c];
+		for (int c = 0; c < Channels; ++c)
+			mean[c] /= count;
+
+		for (int a = 0; a < 4; ++a)
+			for (int b = 0; b < 4; ++b)
+				cov[a][b] = 0.0f;
+		for (int i = 0; i < count; ++i) {
+			float d[4];
+			for (int c = 0; c < Channels; ++c)
+				d[c] = pixels[i][c] - mean[c];
+			for (int a = 0; a < Channels; ++a)
+				for (int b = 0; b < Channels; ++b)
+					cov[a][b] += d[a] * d[b];
+		}
+	}
+
+	/* 协方差矩阵的最大特征向量(幂迭代, iterations次), 返回对应的特征值 */
+	template<int Channels>
+	float PrincipalAxis(const float cov[4][4], int iterations, float axis[4])
+	{
+		// 从范围最大的对角线方向开始迭代, 收敛比从固定向量开始快
+		for (int c = 0; c < 4; ++c)
+			axis[c] = 0.0f;
+		int largest = 0;
+		for (int c = 1; c < Channels; ++c)
+			if (cov[c][c] > cov[largest][largest])
+				largest = c;
+		axis[largest] = 1.0f;
+		float eigenvalue = cov[largest][largest];
+		for (int it = 0; it < iterations; ++it) {
+			float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int a = 0; a < Channels; ++a)
+				for (int b = 0; b < Channels; ++b)
+					next[a] += cov[a][b] * axis[b];
+			float lengthSq = 0.0f;
+			for (int c = 0; c < Channels; ++c)
+				lengthSq += next[c] * next[c];
+			if (lengthSq < 1e-12f)
+				break;
+			eigenvalue = std::sqrt(lengthSq);
+			const float invLength = 1.0f / eigenvalue;
+			for (int c = 0; c < Channels; ++c)
+				axis[c] = next[c] * invLength;
+		}
+		return eigenvalue;
+	}
+
+	/* 块内像素在主成分方向上的投影范围: 求channels维协方差矩阵的最大特征向量,
+	* 返回沿该方向两端的点; 所有像素相同时两端都是该像素 */
+	template<int Channels>
+	void PrincipalEndpoints(const float (*pixels)[4], int count, float e0[4], float e1[4])
+	{
+		float mean[4], cov[4][4], axis[4];
+		Covariance<Channels>(pixels, count, mean, cov);
+		PrincipalAxis<Channels>(cov, 8, axis);
+
+		float tMin = FLT_MAX;
+		float tMax = -FLT_MAX;
+		for (int i = 0; i < count; ++i) {
+			float t = 0.0f;
+			for (int c = 0; c < Channels; ++c)
+				t += (pixels[i][c] - mean[c]) * axis[c];
+			tMin = std::min(tMin, t);
+			tMax = std::max(tMax, t);
+		}
+		for (int c = 0; c < Channels; ++c) {
+			e0[c] = mean[c] + tMin * axis[c];
+			e1[c] = mean[c] + tMax * axis[c];
+		}
+	}
+
+	/* 已知每个像素所选调色板项在两端点间的位置weights[i](0为e0, 1为e1), 用最小二乘法求新的端点
+	* 所有像素都落在同一端时方程退化, 返回false */
+	template<int Channels>
+	bool LeastSquaresEndpoints(const float (*pixels)[4], const float* weights, int count, float e0[4], float e1[4])
+	{
+		float a = 0.0f, b = 0.0f, c = 0.0f;
+		float x0[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		float x1[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < count; ++i) {
+			const float t = weights[i];
+			const float s = 1.0f - t;
+			a += s * s;
+			b += s * t;
+			c += t * t;
+			for (int k = 0; k < Channels; ++k) {
+				x0[k] += s * pixels[i][k];
+				x1[k] += t * pixels[i][k];
+			}
+		}
+		const float det = a * c - b * b;
+		if (std::fabs(det) < 1e-6f)
+			return false;
+		const float invDet = 1.0f / det;
+		for (int k = 0; k < Channels; ++k) {
+			e0[k] = (c * x0[k] - b * x1[k]) * invDet;
+			e1[k] = (a * x1[k] - b * x0[k]) * invDet;
+		}
+		return true;
+	}
+
+	/// BC1颜色块
+
+	inline uint16 PackRGB565(const float c[4])
+	{
+		const int r = Clamp((int)(c[0] * (31.0f / 255.0f) + 0.5f), 0, 31);
+		const int g = Clamp((int)(c[1] * (63.0f / 255.0f) + 0.5f), 0, 63);
+		const int b = Clamp((int)(c[2] * (31.0f / 255.0f) + 0.5f), 0, 31);
+		return (uint16)((r << 11) | (g << 5) | b);
+	}
+
+	inline void UnpackRGB565(uint16 v, int rgb[3])
+	{
+		const int r = (v >> 11) & 31;
+		const int g = (v >> 5) & 63;
+		const int b = v & 31;
+		rgb[0] = (r << 3) | (r >> 2);
+		rgb[1] = (g << 2) | (g >> 4);
+		rgb[2] = (b << 3) | (b >> 2);
+	}
+
+	/* 由两个端点得到BC1调色板; c0 > c1为4色模式, 否则为3色 + 透明(第3项alpha为0)
+	* forceFourColor为true时总按4色模式解释(BC2/BC3中的颜色块) */
+	void Bc1Palette(uint16 c0, uint16 c1, bool forceFourColor, int palette[4][4])
+	{
+		UnpackRGB565(c0, palette[0]);
+		UnpackRGB565(c1, palette[1]);
+		palette[0][3] = palette[1][3] = 255;
+		if (c0 > c1 || forceFourColor) {
+			for (int k = 0; k < 3; ++k) {
+				palette[2][k] = (2 * palette[0][k] + palette[1][k] + 1) / 3;
+				palette[3][k] = (palette[0][k] + 2 * palette[1][k] + 1) / 3;
+			}
+			palette[2][3] = palette[3][3] = 255;
+		}
+		else {
+			for (int k = 0; k < 3; ++k) {
+				palette[2][k] = (palette[0][k] + palette[1][k] + 1) / 2;
+				palette[3][k] = 0;
+			}
+			palette[2][3] = 255;
+			palette[3][3] = 0;
+		}
+	}
+
+	/* 按端点c0, c1为每个像素选最近的调色板项, 返回平方误差和; transparent[i]为true的像素固定用索引3 */
+	uint32 Bc1SelectIndices(const float (*pixels)[4], const bool* transparent, uint16 c0, uint16 c1, bool forceFourColor,
+		uint32& indices)
+	{
+		int palette[4][4];
+		Bc1Palette(c0, c1, forceFourColor, palette);
+		const bool threeColor = !(c0 > c1 || forceFourColor);
+		const int usable = threeColor ? 3 : 4;
+
+		indices = 0;
+		uint32 error = 0;
+		for (int i = 0; i < 16; ++i) {
+			if (transparent[i]) {
+				indices |= 3u << (2 * i);
+				continue;
+			}
+			int best = 0;
+			uint32 bestError = UINT32_MAX;
+			for (int k = 0; k < usable; ++k) {
+				uint32 e = 0;
+				for (int c = 0; c < 3; ++c) {
+					const int d = (int)pixels[i][c] - palette[k][c];
+					e += (uint32)(d * d);
+				}
+				if (e < bestError) {
+					bestError = e;
+					best = k;
+				}
+			}
+			indices |= (uint32)best << (2 * i);
+			error += bestError;
+		}
+		return error;
+	}
+
+	/* 编码BC1颜色块(8字节); allowTransparent为false时(BC3)只用4色模式 */
+	void EncodeBc1Block(const uint8* rgba, uint8* out, bool allowTransparent)
+	{
+		float pixels[16][4];
+		float opaque[16][4];
+		bool transparent[16];
+		int opaqueCount = 0;
+		bool anyTransparent = false;
+		for (int i = 0; i < 16; ++i) {
+			for (int c = 0; c < 4; ++c)
+				pixels[i][c] = rgba[4 * i + c];
+			transparent[i] = allowTransparent && rgba[4 * i + 3] < 128;
+			anyTransparent |= transparent[i];
+			if (!transparent[i])
+				std::memcpy(opaque[opaqueCount++], pixels[i], sizeof(pixels[i]));
+		}
+
+		uint16 c0 = 0;
+		uint16 c1 = 0;
+		uint32 indices = 0xffffffff;// 全透明的块: 两端点相等(3色模式), 索引全为3
+		if (opaqueCount > 0) {
+			float e0[4], e1[4];
+			PrincipalEndpoints<3>(opaque, opaqueCount, e0, e1);
+
+			uint32 bestError = UINT32_MAX;
+			/// 透明块只能用3色模式; 不透明块两种模式都试, 3色模式的中点有时更贴近两端聚集的颜色
+			for (int mode = anyTransparent ? 1 : 0; mode < (allowTransparent ? 2 : 1); ++mode) {
+				const bool threeColor = (mode == 1);
+				float a[4], b[4];
+				std::memcpy(a, e0, sizeof(a));
+				std::memcpy(b, e1, sizeof(b));
+
+				for (int iteration = 0; iteration < 3; ++iteration) {
+					uint16 p = PackRGB565(a);
+					uint16 q = PackRGB565(b);
+					// 4色模式要求c0 > c1, 3色模式要求c0 <= c1
+					if (threeColor ? (p > q) : (p < q))
+						std::swap(p, q);
+					if (!threeColor && p == q) {
+						// 两端点量化后相同: 4色模式无法表示, 改用c1 = c0 - 1(或c0 + 1)保证模式正确
+						if (q > 0)
+							--q;
+						else
+							++p;
+					}
+
+					uint32 candidate = 0;
+					const uint32 error = Bc1SelectIndices(pixels, transparent, p, q, !threeColor, candidate);
+					if (error < bestError) {
+						bestError = error;
+						c0 = p;
+						c1 = q;
+						indices = candidate;
+					}
+					if (error == 0)
+						break;
+
+					/// 按本轮索引修正端点
+					static const float FourColorWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+					static const float ThreeColorWeights[4] = { 0.0f, 1.0f, 0.5f, 0.0f };
+					float weights[16];
+					int n = 0;
+					float used[16][4];
+					for (int i = 0; i < 16; ++i) {
+						if (transparent[i])
+							continue;
+						const uint32 k = (candidate >> (2 * i)) & 3;
+						weights[n] = threeColor ? ThreeColorWeights[k] : FourColorWeights[k];
+						std::memcpy(used[n], pixels[i], sizeof(used[n]));
+						++n;
+					}
+					// 端点顺序可能因交换而与a, b相反, 按实际写入的顺序修正
+					int pc[3], qc[3];
+					UnpackRGB565(p, pc);
+					UnpackRGB565(q, qc);
+					for (int c = 0; c < 3; ++c) {
+						a[c] = (float)pc[c];
+						b[c] = (float)qc[c];
+					}
+					if (!LeastSquaresEndpoints<3>(used, weights, n, a, b))
+						break;
+				}
+			}
+		}
+
+		out[0] = (uint8)(c0 & 0xff);
+		out[1] = (uint8)(c0 >> 8);
+		out[2] = (uint8)(c1 & 0xff);
+		out[3] = (uint8)(c1 >> 8);
+		for (int k = 0; k < 4; ++k)
+			out[4 + k] = (uint8)(indices >> (8 * k));
+	}
+
+	void DecodeBc1Block(const uint8* in, uint8* rgba, bool forceFourColor)
+	{
+		const uint16 c0 = (uint16)(in[0] | (in[1] << 8));
+		const uint16 c1 = (uint16)(in[2] | (in[3] << 8));
+		const uint32 indices = (uint32)in[4] | ((uint32)in[5] << 8) | ((uint32)in[6] << 16) | ((uint32)in[7] << 24);
+		int palette[4][4];
+		Bc1Palette(c0, c1, forceFourColor, palette);
+		for (int i = 0; i < 16; ++i) {
+			const int* p = palette[(indices >> (2 * i)) & 3];
+			for (int c = 0; c < 4; ++c)
+				rgba[4 * i + c] = (uint8)p[c];
+		}
+	}
+
+	/// BC4单通道块
+
+	/* 由端点a0, a1得到8项调色板; a0 > a1为8值模式, 否则为6值模式(最后两项为0与255) */
+	void Bc4Palette(int a0, int a1, int palette[8])
+	{
+		palette[0] = a0;
+		palette[1] = a1;
+		if (a0 > a1) {
+			for (int i = 2; i < 8; ++i)
+				palette[i] = ((8 - i) * a0 + (i - 1) * a1 + 3) / 7;
+		}
+		else {
+			for (int i = 2; i < 6; ++i)
+				palette[i] = ((6 - i) * a0 + (i - 1) * a1 + 2) / 5;
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+	}
+
+	uint32 Bc4SelectIndices(const int* values, int a0, int a1, uint64& indices)
+	{
+		int palette[8];
+		Bc4Palette(a0, a1, palette);
+		indices = 0;
+		uint32 error = 0;
+		for (int i = 0; i < 16; ++i) {
+			int best = 0;
+			int bestError = INT32_MAX;
+			for (int k = 0; k < 8; ++k) {
+				const int d = values[i] - palette[k];
+				if (d * d < bestError) {
+					bestError = d * d;
+					best = k;
+				}
+			}
+			indices |= (uint64)best << (3 * i);
+			error += (uint32)bestError;
+		}
+		return error;
+	}
+
+	// 调色板项k在两端点间的位置(0为a0, 1为a1); 6值模式的0与255不参与修正, 为负值
+	float Bc4Weight(bool eightValues, int k)
+	{
+		if (k == 0)
+			return 0.0f;
+		if (k == 1)
+			return 1.0f;
+		if (eightValues)
+			return (k - 1) / 7.0f;
+		return (k < 6) ? (k - 1) / 5.0f : -1.0f;
+	}
+
+	/* 编码values(16个0~255的值)为BC4块(8字节) */
+	void EncodeBc4Block(const int* values, uint8* out)
+	{
+		int minValue = 255, maxValue = 0;
+		int innerMin = 255, innerMax = 0;// 不含0与255
+		for (int i = 0; i < 16; ++i) {
+			minValue = std::min(minValue, values[i]);
+			maxValue = std::max(maxValue, values[i]);
+			if (values[i] != 0 && values[i] != 255) {
+				innerMin = std::min(innerMin, values[i]);
+				innerMax = std::max(innerMax, values[i]);
+			}
+		}
+
+		int bestA0 = maxValue, bestA1 = minValue;
+		uint64 bestIndices = 0;
+		uint32 bestError = Bc4SelectIndices(values, bestA0, bestA1, bestIndices);
+
+		/// 依次尝试8值模式(a0 > a1)与6值模式(a0 <= a1), 每种都按所选索引用最小二乘法修正两轮
+		for (int mode = 0; mode < 2 && bestError > 0; ++mode) {
+			const bool eightValues = (mode == 0);
+			int a0 = eightValues ? maxValue : std::min(innerMin, innerMax);
+			int a1 = eightValues ? minValue : innerMax;
+			if (!eightValues && innerMin > innerMax)
+				a0 = a1 = 0;// 只有0与255: 由6值模式的固定项精确表示
+
+			for (int iteration = 0; iteration < 3; ++iteration) {
+				if (eightValues && a0 <= a1) {
+					if (a0 == a1) {
+						if (a0 < 255) ++a0; else --a1;
+					}
+					else {
+						std::swap(a0, a1);
+					}
+				}
+				if (!eightValues && a0 > a1)
+					std::swap(a0, a1);
+
+				uint64 indices = 0;
+				const uint32 error = Bc4SelectIndices(values, a0, a1, indices);
+				if (error < bestError) {
+					bestError = error;
+					bestA0 = a0;
+					bestA1 = a1;
+					bestIndices = indices;
+				}
+				if (error == 0)
+					break;
+
+				float pixels[16][4];
+				float weights[16];
+				int n = 0;
+				for (int i = 0; i < 16; ++i) {
+					const float w = Bc4Weight(eightValues, (int)((indices >> (3 * i)) & 7));
+					if (w < 0.0f)
+						continue;
+					pixels[n][0] = (float)values[i];
+					weights[n] = w;
+					++n;
+				}
+				float e0[4] = { (float)a0 }, e1[4] = { (float)a1 };
+				if (!LeastSquaresEndpoints<1>(pixels, weights, n, e0, e1))
+					break;
+				a0 = Clamp((int)std::lround(e0[0]), 0, 255);
+				a1 = Clamp((int)std::lround(e1[0]), 0, 255);
+			}
+		}
+
+		out[0] = (uint8)bestA0;
+		out[1] = (uint8)bestA1;
+		for (int k = 0; k < 6; ++k)
+			out[2 + k] = (uint8)(bestIndices >> (8 * k));
+	}
+
+	void DecodeBc4Block(const uint8* in, uint8* values, int stride)
+	{
+		int palette[8];
+		Bc4Palette(in[0], in[1], palette);
+		uint64 indices = 0;
+		for (int k = 0; k < 6; ++k)
+			indices |= (uint64)in[2 + k] << (8 * k);
+		for (int i = 0; i < 16; ++i)
+			values[i * stride] = (uint8)palette[(indices >> (3 * i)) & 7];
+	}
+
+	void EncodeBc4Channel(const uint8* rgba, int channel, uint8* out)
+	{
+		int values[16];
+		for (int i = 0; i < 16; ++i)
+			values[i] = rgba[4 * i + channel];
+		EncodeBc4Block(values, out);
+	}
+
+	/// BC7: 单子集的模式6, 5, 4, 两子集的模式1与模式7
+
+	const int Bc7Weights2[4] = { 0, 21, 43, 64 };
+	const int Bc7Weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+	const int Bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// 两子集的64种分区: 第i位为像素i所属的子集, 像素0总在子集0
+	const uint16 Bc7Partitions2[64] = {
+		0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+		0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+		0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+		0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+		0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+		0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+		0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+		0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22
+	};
+
+	// 子集1的锚点像素(子集0的锚点总是像素0); 锚点的索引最高位隐含为0, 不写入块中
+	const uint8 Bc7Anchors2[64] = {
+		15, 15, 15, 15, 15, 15, 15, 15,
+		15, 15, 15, 15, 15, 15, 15, 15,
+		15,  2,  8,  2,  2,  8,  8, 15,
+		 2,  8,  2,  2,  8,  8,  2,  2,
+		15, 15,  6,  8,  2,  8, 15, 15,
+		 2,  8,  2,  2,  2, 15, 15,  6,
+		 6,  2,  6,  8, 15, 15,  2,  2,
+		15, 15, 15, 15, 15,  2,  2, 15
+	};
+
+	inline int Bc7Interpolate(int e0, int e1, int weight)
+	{
+		return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+	}
+
+	// 按位写入128位块, 从最低位开始
+	struct BitWriter
+	{
+		uint8* Bytes;
+		int Position = 0;
+
+		explicit BitWriter(uint8* bytes) : Bytes(bytes) { std::memset(bytes, 0, 16); }
+
+		void Write(uint32 value, int bits)
+		{
+			for (int i = 0; i < bits; ++i, ++Position)
+				if (value & (1u << i))
+					Bytes[Position >> 3] |= (uint8)(1u << (Position & 7));
+		}
+	};
+
+	struct BitReader
+	{
+		const uint8* Bytes;
+		int Position = 0;
+
+		explicit BitReader(const uint8* bytes) : Bytes(bytes) {}
+
+		uint32 Read(int bits)
+		{
+			uint32 value = 0;
+			for (int i = 0; i < bits; ++i, ++Position)
+				value |= (uint32)((Bytes[Position >> 3] >> (Position & 7)) & 1) << i;
+			return value;
+		}
+	};
+
+	/* 为pixelCount个像素在channels个通道上选最近的调色板项(端点v0, v1, 权重表weights共count项), 返回平方误差和 */
+	template<int Channels>
+	uint32 Bc7SelectIndices(const float (*pixels)[4], int firstChannel, const int* v0, const int* v1,
+		const int* weights, int count, uint8 indices[16], int pixelCount = 16)
+	{
+		int palette[16][4];
+		for (int k = 0; k < count; ++k)
+			for (int c = 0; c < Channels; ++c)
+				palette[k][c] = Bc7Interpolate(v0[c], v1[c], weights[k]);
+
+		uint32 error = 0;
+		for (int i = 0; i < pixelCount; ++i) {
+			uint32 bestError = UINT32_MAX;
+			for (int k = 0; k < count; ++k) {
+				uint32 e = 0;
+				for (int c = 0; c < Channels; ++c) {
+					const int d = (int)pixels[i][firstChannel + c] - palette[k][c];
+					e += (uint32)(d * d);
+				}
+				if (e < bestError) {
+					bestError = e;
+					indices[i] = (uint8)k;
+				}
+			}
+			error += bestError;
+		}
+		return error;
+	}
+
+	/* 模式6: RGBA端点各7位 + 每端点一个p位(即8位端点的最低位), 16级索引; 返回平方误差和 */
+	uint32 EncodeBc7Mode6(const float (*pixels)[4], uint8* out)
+	{
+		float e0[4], e1[4];
+		PrincipalEndpoints<4>(pixels, 16, e0, e1);
+
+		uint32 bestError = UINT32_MAX;
+		int best0[4] = {}, best1[4] = {};
+		uint32 bestP0 = 0, bestP1 = 0;
+		uint8 bestIndices[16] = {};
+
+		for (int iteration = 0; iteration < 3; ++iteration) {
+			/// 两个端点的p位各有两种取法, 逐一尝试
+			uint8 roundIndices[16] = {};
+			uint32 roundError = UINT32_MAX;
+			int round0[4] = {}, round1[4] = {};
+			for (uint32 p = 0; p < 4; ++p) {
+				int q0[4], q1[4], v0[4], v1[4];
+				for (int c = 0; c < 4; ++c) {
+					q0[c] = Clamp((int)std::lround((e0[c] - (float)(p & 1)) * 0.5f), 0, 127);
+					q1[c] = Clamp((int)std::lround((e1[c] - (float)(p >> 1)) * 0.5f), 0, 127);
+					v0[c] = (q0[c] << 1) | (int)(p & 1);
+					v1[c] = (q1[c] << 1) | (int)(p >> 1);
+				}
+				uint8 indices[16];
+				const uint32 error = Bc7SelectIndices<4>(pixels, 0, v0, v1, Bc7Weights4, 16, indices);
+				if (error < roundError) {
+					roundError = error;
+					std::memcpy(roundIndices, indices, sizeof(indices));
+					std::memcpy(round0, v0, sizeof(v0));
+					std::memcpy(round1, v1, sizeof(v1));
+				}
+				if (error < bestError) {
+					bestError = error;
+					std::memcpy(best0, q0, sizeof(q0));
+					std::memcpy(best1, q1, sizeof(q1));
+					bestP0 = p & 1;
+					bestP1 = p >> 1;
+					std::memcpy(bestIndices, indices, sizeof(indices));
+				}
+			}
+			if (bestError == 0)
+				break;
+
+			float weights[16];
+			for (int i = 0; i < 16; ++i)
+				weights[i] = Bc7Weights4[roundIndices[i]] / 64.0f;
+			for (int c = 0; c < 4; ++c) {
+				e0[c] = (float)round0[c];
+				e1[c] = (float)round1[c];
+			}
+			if (!LeastSquaresEndpoints<4>(pixels, weights, 16, e0, e1))
+				break;
+		}
+
+		// 第一个像素的索引最高位隐含为0(锚点), 不满足时交换两端点并翻转索引
+		if (bestIndices[0] & 8) {
+			std::swap(best0, best1);
+			std::swap(bestP0, bestP1);
+			for (int i = 0; i < 16; ++i)
+				bestIndices[i] = (uint8)(15 - bestIndices[i]);
+		}
+
+		BitWriter writer(out);
+		writer.Write(1u << 6, 7);
+		for (int c = 0; c < 4; ++c) {
+			writer.Write((uint32)best0[c], 7);
+			writer.Write((uint32)best1[c], 7);
+		}
+		writer.Write(bestP0, 1);
+		writer.Write(bestP1, 1);
+		writer.Write(bestIndices[0], 3);
+		for (int i = 1; i < 16; ++i)
+			writer.Write(bestIndices[i], 4);
+		return bestError;
+	}
+
+	// bits位端点扩展为8位: 高位复制到低位
+	inline int Bc7ExpandBits(int q, int bits)
+	{
+		return (bits == 8) ? q : ((q << (8 - bits)) | (q >> (2 * bits - 8)));
+	}
+
+	/* 模式4与模式5的一组端点: Channels个通道共用一组indexBits位索引, 端点为bits位; 返回平方误差和
+	* 模式5的RGB为7位端点, alpha为8位; 模式4的RGB为5位, alpha为6位, 解码时都扩展为8位 */
+	template<int Channels>
+	uint32 FitBc7Component(const float (*pixels)[4], int firstChannel, int bits, int indexBits,
+		int q0[Channels], int q1[Channels], uint8 indices[16])
+	{
+		float channelPixels[16][4];
+		for (int i = 0; i < 16; ++i)
+			for (int c = 0; c < Channels; ++c)
+				channelPixels[i][c] = pixels[i][firstChannel + c];
+
+		float e0[4], e1[4];
+		PrincipalEndpoints<Channels>(channelPixels, 16, e0, e1);
+
+		const int* weights = (indexBits == 3) ? Bc7Weights3 : Bc7Weights2;
+		const int levels = 1 << indexBits;
+		const int maxValue = (1 << bits) - 1;
+		uint32 bestError = UINT32_MAX;
+		for (int iteration = 0; iteration < 3; ++iteration) {
+			int a[Channels], b[Channels], v0[Channels], v1[Channels];
+			for (int c = 0; c < Channels; ++c) {
+				a[c] = Clamp((int)std::lround(e0[c] * maxValue / 255.0f), 0, maxValue);
+				b[c] = Clamp((int)std::lround(e1[c] * maxValue / 255.0f), 0, maxValue);
+				v0[c] = Bc7ExpandBits(a[c], bits);
+				v1[c] = Bc7ExpandBits(b[c], bits);
+			}
+			uint8 candidate[16];
+			const uint32 error = Bc7SelectIndices<Channels>(channelPixels, 0, v0, v1, weights, levels, candidate);
+			if (error < bestError) {
+				bestError = error;
+				std::memcpy(q0, a, sizeof(a));
+				std::memcpy(q1, b, sizeof(b));
+				std::memcpy(indices, candidate, sizeof(candidate));
+			}
+			if (error == 0)
+				break;
+
+			float w[16];
+			for (int i = 0; i < 16; ++i)
+				w[i] = weights[candidate[i]] / 64.0f;
+			for (int c = 0; c < Channels; ++c) {
+				e0[c] = (float)v0[c];
+				e1[c] = (float)v1[c];
+			}
+			if (!LeastSquaresEndpoints<Channels>(channelPixels, w, 16, e0, e1))
+				break;
+		}
+
+		// 锚点: 第一个像素的索引最高位隐含为0
+		if (indices[0] >> (indexBits - 1)) {
+			for (int c = 0; c < Channels; ++c)
+				std::swap(q0[c], q1[c]);
+			for (int i = 0; i < 16; ++i)
+				indices[i] = (uint8)(levels - 1 - indices[i]);
+		}
+		return bestError;
+	}
+
+	/* 写出一组索引, 第一个像素少写最高位 */
+	void WriteBc7Indices(BitWriter& writer, const uint8 indices[16], int indexBits)
+	{
+		writer.Write(indices[0], indexBits - 1);
+		for (int i = 1; i < 16; ++i)
+			writer.Write(indices[i], indexBits);
+	}
+
+	/* 模式5: RGB与alpha各有一组端点和2位索引, 颜色与透明度互不影响(不使用通道旋转); 返回平方误差和 */
+	uint32 EncodeBc7Mode5(const float (*pixels)[4], uint8* out)
+	{
+		int c0[3] = {}, c1[3] = {}, a0[1] = {}, a1[1] = {};
+		uint8 colorIndices[16], alphaIndices[16];
+		const uint32 error = FitBc7Component<3>(pixels, 0, 7, 2, c0, c1, colorIndices) +
+			FitBc7Component<1>(pixels, 3, 8, 2, a0, a1, alphaIndices);
+
+		BitWriter writer(out);
+		writer.Write(1u << 5, 6);
+		writer.Write(0, 2);// 旋转
+		for (int c = 0; c < 3; ++c) {
+			writer.Write((uint32)c0[c], 7);
+			writer.Write((uint32)c1[c], 7);
+		}
+		writer.Write((uint32)a0[0], 8);
+		writer.Write((uint32)a1[0], 8);
+		WriteBc7Indices(writer, colorIndices, 2);
+		WriteBc7Indices(writer, alphaIndices, 2);
+		return error;
+	}
+
+	/* 模式4: 端点精度低于模式5, 但alpha(indexMode为0)或颜色(indexMode为1)可用3位索引,
+	* alpha是平滑过渡的(如mip缩小后的树叶边缘)时接近BC3的alpha精度; 返回平方误差和 */
+	uint32 EncodeBc7Mode4(const float (*pixels)[4], uint32 indexMode, uint8* out)
+	{
+		const int colorIndexBits = indexMode ? 3 : 2;
+		const int alphaIndexBits = indexMode ? 2 : 3;
+		int c0[3] = {}, c1[3] = {}, a0[1] = {}, a1[1] = {};
+		uint8 colorIndices[16], alphaIndices[16];
+		const uint32 error = FitBc7Component<3>(pixels, 0, 5, colorIndexBits, c0, c1, colorIndices) +
+			FitBc7Component<1>(pixels, 3, 6, alphaIndexBits, a0, a1, alphaIndices);
+
+		BitWriter writer(out);
+		writer.Write(1u << 4, 5);
+		writer.Write(0, 2);// 旋转
+		writer.Write(indexMode, 1);
+		for (int c = 0; c < 3; ++c) {
+			writer.Write((uint32)c0[c], 5);
+			writer.Write((uint32)c1[c], 5);
+		}
+		writer.Write((uint32)a0[0], 6);
+		writer.Write((uint32)a1[0], 6);
+		// 先写2位的一组, 再写3位的一组
+		if (indexMode) {
+			WriteBc7Indices(writer, alphaIndices, 2);
+			WriteBc7Indices(writer, colorIndices, 3);
+		}
+		else {
+			WriteBc7Indices(writer, colorIndices, 2);
+			WriteBc7Indices(writer, alphaIndices, 3);
+		}
+		return error;
+	}
+
+	/* 两子集模式的参数: 模式1为RGB端点6位 + 子集内两端点共用的p位, 3位索引, alpha总是255;
+	* 模式7为RGBA端点5位 + 每端点一个p位, 2位索引 */
+	struct Bc7PartitionMode
+	{
+		uint32 Mode;
+		int EndpointBits;	// 不含p位
+		bool SharedPBit;
+		int IndexBits;
+		const int* Weights;
+	};
+
+	const Bc7PartitionMode Bc7Mode1 = { 1, 6, true, 3, Bc7Weights3 };
+	const Bc7PartitionMode Bc7Mode7 = { 7, 5, false, 2, Bc7Weights2 };
+
+	// 每块完整拟合的分区数: 64种分区都先粗估一遍误差, 只对最好的几种做量化与迭代
+	const int Bc7PartitionCandidates = 2;
+
+	// bits位端点q加上p位后扩展为8位
+	inline int Bc7Expand(int q, int p, int bits)
+	{
+		return Bc7ExpandBits((q << 1) | p, bits + 1);
+	}
+
+	inline int Bc7Quantize(float value, int p, int bits)
+	{
+		const float maxValue = (float)((2 << bits) - 1);
+		return Clamp((int)std::lround((value * maxValue / 255.0f - (float)p) * 0.5f), 0, (1 << bits) - 1);
+	}
+
+	/* 取出分区partition中子集subset的像素, map为它们在块中的位置; 返回像素数 */
+	int GatherBc7Subset(const float (*pixels)[4], int partition, int subset, float (*subsetPixels)[4], int* map)
+	{
+		int n = 0;
+		for (int i = 0; i < 16; ++i) {
+			if ((int)((Bc7Partitions2[partition] >> i) & 1) != subset)
+				continue;
+			std::memcpy(subsetPixels[n], pixels[i], sizeof(pixels[i]));
+			map[n++] = i;
+		}
+		return n;
+	}
+
+	/* 挑选分区用的粗估误差: 各子集像素到其主成分直线的距离平方和(协方差矩阵的迹减去最大特征值),
+	* 不量化端点也不选索引, 只有完整拟合的几十分之一的计算量 */
+	template<int Channels>
+	float EstimateBc7Partition(const float (*pixels)[4], int partition)
+	{
+		float error = 0.0f;
+		for (int s = 0; s < 2; ++s) {
+			float subsetPixels[16][4];
+			int map[16];
+			const int n = GatherBc7Subset(pixels, partition, s, subsetPixels, map);
+			float mean[4], cov[4][4], axis[4];
+			Covariance<Channels>(subsetPixels, n, mean, cov);
+			float trace = 0.0f;
+			for (int c = 0; c < Channels; ++c)
+				trace += cov[c][c];
+			error += trace - PrincipalAxis<Channels>(cov, 4, axis);
+		}
+		return error;
+	}
+
+	/* 拟合一个子集的端点q0, q1与p位p[2], 做法同模式6; 返回平方误差和 */
+	template<int Channels>
+	uint32 FitBc7Subset(const float (*pixels)[4], int count, const Bc7PartitionMode& mode,
+		int q0[4], int q1[4], int p[2], uint8 indices[16])
+	{
+		float e0[4], e1[4];
+		PrincipalEndpoints<Channels>(pixels, count, e0, e1);
+
+		const int levels = 1 << mode.IndexBits;
+		const uint32 pCount = mode.SharedPBit ? 2 : 4;
+		uint32 bestError = UINT32_MAX;
+		for (int iteration = 0; iteration < 3; ++iteration) {
+			uint8 roundIndices[16] = {};
+			uint32 roundError = UINT32_MAX;
+			int round0[4] = {}, round1[4] = {};
+			for (uint32 pBits = 0; pBits < pCount; ++pBits) {
+				const int p0 = (int)(pBits & 1);
+				const int p1 = mode.SharedPBit ? p0 : (int)(pBits >> 1);
+				int a[4], b[4], v0[4], v1[4];
+				for (int c = 0; c < Channels; ++c) {
+					a[c] = Bc7Quantize(e0[c], p0, mode.EndpointBits);
+					b[c] = Bc7Quantize(e1[c], p1, mode.EndpointBits);
+					v0[c] = Bc7Expand(a[c], p0, mode.EndpointBits);
+					v1[c] = Bc7Expand(b[c], p1, mode.EndpointBits);
+				}
+				uint8 candidate[16];
+				const uint32 error = Bc7SelectIndices<Channels>(pixels, 0, v0, v1, mode.Weights, levels, candidate, count);
+				if (error < roundError) {
+					roundError = error;
+					std::memcpy(roundIndices, candidate, sizeof(candidate));
+					std::memcpy(round0, v0, sizeof(v0));
+					std::memcpy(round1, v1, sizeof(v1));
+				}
+				if (error < bestError) {
+					bestError = error;
+					std::memcpy(q0, a, sizeof(a));
+					std::memcpy(q1, b, sizeof(b));
+					p[0] = p0;
+					p[1] = p1;
+					std::memcpy(indices, candidate, sizeof(candidate));
+				}
+			}
+			if (bestError == 0)
+				break;
+
+			float weights[16];
+			for (int i = 0; i < count; ++i)
+				weights[i] = mode.Weights[roundIndices[i]] / 64.0f;
+			for (int c = 0; c < Channels; ++c) {
+				e0[c] = (float)round0[c];
+				e1[c] = (float)round1[c];
+			}
+			if (!LeastSquaresEndpoints<Channels>(pixels, weights, count, e0, e1))
+				break;
+		}
+		return bestError;
+	}
+
+	/* 按分区partition编码模式1或模式7的块; 返回平方误差和 */
+	template<int Channels>
+	uint32 EncodeBc7Partitioned(const float (*pixels)[4], const Bc7PartitionMode& mode, int partition, uint8* out)
+	{
+		int q[2][2][4] = {};	// [子集][端点][通道]
+		int p[2][2] = {};
+		uint8 indices[16] = {};
+		uint32 error = 0;
+		const int levels = 1 << mode.IndexBits;
+		for (int s = 0; s < 2; ++s) {
+			float subsetPixels[16][4];
+			int map[16];
+			const int n = GatherBc7Subset(pixels, partition, s, subsetPixels, map);
+			uint8 subsetIndices[16] = {};
+			error += FitBc7Subset<Channels>(subsetPixels, n, mode, q[s][0], q[s][1], p[s], subsetIndices);
+
+			// 锚点的索引最高位为1时交换两端点并翻转索引
+			const int anchor = (s == 0) ? 0 : Bc7Anchors2[partition];
+			for (int k = 0; k < n; ++k) {
+				if (map[k] == anchor && (subsetIndices[k] >> (mode.IndexBits - 1)) != 0) {
+					std::swap(q[s][0], q[s][1]);
+					std::swap(p[s][0], p[s][1]);
+					for (int i = 0; i < n; ++i)
+						subsetIndices[i] = (uint8)(levels - 1 - subsetIndices[i]);
+					break;
+				}
+			}
+			for (int k = 0; k < n; ++k)
+				indices[map[k]] = subsetIndices[k];
+		}
+
+		BitWriter writer(out);
+		writer.Write(1u << mode.Mode, mode.Mode + 1);
+		writer.Write((uint32)partition, 6);
+		const int channels = (mode.Mode == 7) ? 4 : 3;
+		for (int c = 0; c < channels; ++c)
+			for (int s = 0; s < 2; ++s)
+				for (int e = 0; e < 2; ++e)
+					writer.Write((uint32)q[s][e][c], mode.EndpointBits);
+		for (int s = 0; s < 2; ++s) {
+			writer.Write((uint32)p[s][0], 1);
+			if (!mode.SharedPBit)
+				writer.Write((uint32)p[s][1], 1);
+		}
+		const int anchor = Bc7Anchors2[partition];
+		for (int i = 0; i < 16; ++i)
+			writer.Write(indices[i], (i == 0 || i == anchor) ? mode.IndexBits - 1 : mode.IndexBits);
+		return error;
+	}
+
+	/* 粗估全部分区后完整编码最好的几种, 误差小于bestError时写入out并更新bestError */
+	template<int Channels>
+	void TryBc7Partitions(const float (*pixels)[4], const Bc7PartitionMode& mode, uint8* out, uint32& bestError)
+	{
+		float estimates[64];
+		int order[64];
+		for (int i = 0; i < 64; ++i) {
+			estimates[i] = EstimateBc7Partition<Channels>(pixels, i);
+			order[i] = i;
+		}
+		std::partial_sort(order, order + Bc7PartitionCandidates, order + 64,
+			[&](int a, int b) { return estimates[a] < estimates[b]; });
+
+		uint8 block[16];
+		for (int k = 0; k < Bc7PartitionCandidates && bestError != 0; ++k) {
+			const uint32 error = EncodeBc7Partitioned<Channels>(pixels, mode, order[k], block);
+			if (error < bestError) {
+				bestError = error;
+				std::memcpy(out, block, sizeof(block));
+			}
+		}
+	}
+
+	void EncodeBc7Block(const uint8* rgba, uint8* out)
+	{
+		float pixels[16][4];
+		bool opaque = true;
+		for (int i = 0; i < 16; ++i) {
+			for (int c = 0; c < 4; ++c)
+				pixels[i][c] = rgba[4 * i + c];
+			opaque &= rgba[4 * i + 3] == 255;
+		}
+
+		// 模式6对渐变的块最精确; 块内有两种明显不同的颜色(如树叶的边缘)时两子集模式更好,
+		// 不透明的块用颜色精度高的模式1, 有透明度时用带alpha的模式7.
+		// 有透明度时alpha往往与颜色无关, 再试alpha与颜色各用一组索引的模式5与模式4
+		uint32 bestError = EncodeBc7Mode6(pixels, out);
+		if (bestError == 0)
+			return;
+		if (opaque) {
+			TryBc7Partitions<3>(pixels, Bc7Mode1, out, bestError);
+			return;
+		}
+		uint8 block[16];
+		for (int candidate = 0; candidate < 3; ++candidate) {
+			const uint32 error = (candidate == 0) ? EncodeBc7Mode5(pixels, block) :
+				EncodeBc7Mode4(pixels, (uint32)(candidate - 1), block);
+			if (error < bestError) {
+				bestError = error;
+				std::memcpy(out, block, sizeof(block));
+			}
+		}
+		TryBc7Partitions<4>(pixels, Bc7Mode7, out, bestError);
+	}
+
+	void DecodeBc7Block(const uint8* in, uint8* rgba)
+	{
+		BitReader reader(in);
+		int mode = 0;
+		while (mode < 8 && reader.Read(1) == 0)
+			++mode;
+
+		if (mode == 6) {
+			int q[2][4];
+			for (int c = 0; c < 4; ++c) {
+				q[0][c] = (int)reader.Read(7);
+				q[1][c] = (int)reader.Read(7);
+			}
+			const int p0 = (int)reader.Read(1);
+			const int p1 = (int)reader.Read(1);
+			for (int i = 0; i < 16; ++i) {
+				const int k = (int)reader.Read(i == 0 ? 3 : 4);
+				for (int c = 0; c < 4; ++c)
+					rgba[4 * i + c] = (uint8)Bc7Interpolate((q[0][c] << 1) | p0, (q[1][c] << 1) | p1, Bc7Weights4[k]);
+			}
+		}
+		else if (mode == 4 || mode == 5) {
+			// 模式4: 5位颜色, 6位alpha端点, 一组2位与一组3位索引; 模式5: 7位颜色, 8位alpha端点, 两组2位索引
+			const uint32 rotation = reader.Read(2);
+			const uint32 indexMode = (mode == 4) ? reader.Read(1) : 0;
+			const int colorBits = (mode == 4) ? 5 : 7;
+			const int alphaBits = (mode == 4) ? 6 : 8;
+			int v[2][4];
+			for (int c = 0; c < 3; ++c)
+				for (int e = 0; e < 2; ++e)
+					v[e][c] = Bc7ExpandBits((int)reader.Read(colorBits), colorBits);
+			v[0][3] = Bc7ExpandBits((int)reader.Read(alphaBits), alphaBits);
+			v[1][3] = Bc7ExpandBits((int)reader.Read(alphaBits), alphaBits);
+
+			const int secondBits = (mode == 4) ? 3 : 2;
+			uint8 first[16], second[16];
+			for (int i = 0; i < 16; ++i)
+				first[i] = (uint8)reader.Read(i == 0 ? 1 : 2);
+			for (int i = 0; i < 16; ++i)
+				second[i] = (uint8)reader.Read(i == 0 ? secondBits - 1 : secondBits);
+			const uint8* colorIndices = indexMode ? second : first;
+			const uint8* alphaIndices = indexMode ? first : second;
+			const int* colorWeights = (indexMode && mode == 4) ? Bc7Weights3 : Bc7Weights2;
+			const int* alphaWeights = (!indexMode && mode == 4) ? Bc7Weights3 : Bc7Weights2;
+			for (int i = 0; i < 16; ++i) {
+				for (int c = 0; c < 3; ++c)
+					rgba[4 * i + c] = (uint8)Bc7Interpolate(v[0][c], v[1][c], colorWeights[colorIndices[i]]);
+				rgba[4 * i + 3] = (uint8)Bc7Interpolate(v[0][3], v[1][3], alphaWeights[alphaIndices[i]]);
+				// 旋转: alpha与某个颜色通道交换
+				if (rotation != 0)
+					std::swap(rgba[4 * i + 3], rgba[4 * i + rotation - 1]);
+			}
+		}
+		else if (mode == 1 || mode == 7) {
+			const Bc7PartitionMode& info = (mode == 1) ? Bc7Mode1 : Bc7Mode7;
+			const int partition = (int)reader.Read(6);
+			const int channels = (mode == 7) ? 4 : 3;
+			int q[2][2][4] = {};
+			for (int c = 0; c < channels; ++c)
+				for (int s = 0; s < 2; ++s)
+					for (int e = 0; e < 2; ++e)
+						q[s][e][c] = (int)reader.Read(info.EndpointBits);
+			int p[2][2];
+			for (int s = 0; s < 2; ++s) {
+				p[s][0] = (int)reader.Read(1);
+				p[s][1] = info.SharedPBit ? p[s][0] : (int)reader.Read(1);
+			}
+			const int anchor = Bc7Anchors2[partition];
+			for (int i = 0; i < 16; ++i) {
+				const int k = (int)reader.Read((i == 0 || i == anchor) ? info.IndexBits - 1 : info.IndexBits);
+				const int s = (Bc7Partitions2[partition] >> i) & 1;
+				for (int c = 0; c < channels; ++c)
+					rgba[4 * i + c] = (uint8)Bc7Interpolate(Bc7Expand(q[s][0][c], p[s][0], info.EndpointBits),
+						Bc7Expand(q[s][1][c], p[s][1], info.EndpointBits), info.Weights[k]);
+				if (channels == 3)
+					rgba[4 * i + 3] = 255;
+			}
+		}
+		else {
+			std::memset(rgba, 0, 64);// 不支持的模式
+		}
+	}
+}
+
+std::uint32_t BlockCompressor::BlockBytes(Format format)
+{
+	return (format == Format::BC1 || format == Format::BC4) ? 8 : 16;
+}
+
+size_t BlockCompressor::RowPitch(Format format, std::uint32_t width)
+{
+	return (size_t)std::max(1u, (width + 3) / 4) * BlockBytes(format);
+}
+
+size_t BlockCompressor::SurfaceSize(Format format, std::uint32_t width, std::uint32_t height)
+{
+	return RowPitch(format, width) * std::max(1u, (height + 3) / 4);
+}
+
+void BlockCompressor::EncodeBlock(Format format, const std::uint8_t rgba[64], void* block)
+{
+	uint8* out = static_cast<uint8*>(block);
+	switch (format) {
+	case Format::BC1:
+		EncodeBc1Block(rgba, out, true);
+		break;
+	case Format::BC3:
+		EncodeBc4Channel(rgba, 3, out);
+		EncodeBc1Block(rgba, out + 8, false);
+		break;
+	case Format::BC4:
+		EncodeBc4Channel(rgba, 0, out);
+		break;
+	case Format::BC5:
+		EncodeBc4Channel(rgba, 0, out);
+		EncodeBc4Channel(rgba, 1, out + 8);
+		break;
+	case Format::BC7:
+		EncodeBc7Block(rgba, out);
+		break;
+	}
+}
+
+void BlockCompressor::DecodeBlock(Format format, const void* block, std::uint8_t rgba[64])
+{
+	const uint8* in = static_cast<const uint8*>(block);
+	switch (format) {
+	case Format::BC1:
+		DecodeBc1Block(in, rgba, false);
+		break;
+	case Format::BC3:
+		DecodeBc1Block(in + 8, rgba, true);
+		DecodeBc4Block(in, rgba + 3, 4);
+		break;
+	case Format::BC4:
+	case Format::BC5:
+		for (int i = 0; i < 16; ++i) {
+			rgba[4 * i + 1] = rgba[4 * i + 2] = 0;
+			rgba[4 * i + 3] = 255;
+		}
+		DecodeBc4Block(in, rgba, 4);
+		if (format == Format::BC5)
+			DecodeBc4Block(in + 8, rgba + 1, 4);
+		break;
+	case Format::BC7:
+		DecodeBc7Block(in, rgba);
+		break;
+	}
+}
+
+void BlockCompressor::Encode(Format format, const std::uint8_t* rgba, std::uint32_t width, std::uint32_t height, size_t rowPitch,
+	void* dst, ThreadPool* pool)
+{
+	if (rgba == nullptr || dst == nullptr || width == 0 || height == 0)
+		return;
+
+	const uint32 blocksWide = (width + 3) / 4;
+	const uint32 blocksHigh = (height + 3) / 4;
+	const size_t blockBytes = BlockBytes(format);
+	const size_t dstPitch = RowPitch(format, width);
+	uint8* out = static_cast<uint8*>(dst);
+
+	ThreadPool& threads = pool ? *pool : ThreadPool::Default();
+	threads.ParallelFor(0, (int)blocksHigh, 1, [&](int begin, int end) {
+		uint8 block[64];
+		for (int by = begin; by < end; ++by) {
+			for (uint32 bx = 0; bx < blocksWide; ++bx) {
+				// 超出图像的像素复制最后一行/列
+				for (uint32 y = 0; y < 4; ++y) {
+					const uint32 sy = std::min(by * 4 + y, height - 1);
+					for (uint32 x = 0; x < 4; ++x) {
+						const uint32 sx = std::min(bx * 4 + x, width - 1);
+						std::memcpy(block + 4 * (4 * y + x), rgba + sy * rowPitch + 4 * (size_t)sx, 4);
+					}
+				}
+				EncodeBlock(format, block, out + by * dstPitch + bx * blockBytes);
+			}
+		}
+	});
+}
+
+void BlockCompressor::Decode(Format format, const void* src, std::uint32_t width, std::uint32_t height,
+	std::uint8_t* rgba, size_t rowPitch, ThreadPool* pool)
+{
+	if (src == nullptr || rgba == nullptr || width == 0 || height == 0)
+		return;
+
+	const uint32 blocksWide = (width + 3) / 4;
+	const uint32 blocksHigh = (height + 3) / 4;
+	const size_t blockBytes = BlockBytes(format);
+	const size_t srcPitch = RowPitch(format, width);
+	const uint8* in = static_cast<const uint8*>(src);
+
+	ThreadPool& threads = pool ? *pool : ThreadPool::Default();
+	threads.ParallelFor(0, (int)blocksHigh, 0, [&](int begin, int end) {
+		uint8 block[64];
+		for (int by = begin; by < end; ++by) {
+			for (uint32 bx = 0; bx < blocksWide; ++bx) {
+				DecodeBlock(format, in + by * srcPitch + bx * blockBytes, block);
+				for (uint32 y = 0; y < 4 && by * 4 + y < height; ++y)
+					for (uint32 x = 0; x < 4 && bx * 4 + x < width; ++x)
+						std::memcpy(rgba + (by * 4 + y) * rowPitch + 4 * (size_t)(bx * 4 + x), block + 4 * (4 * y + x), 4);
+			}
+		}
+	});
+}
@@ -0,0 +1,62 @@
+﻿//***************************************************************************************
+// BlockCompressor.h
+//
+// BC1/BC3/BC4/BC5/BC7块压缩的CPU编码器与解码器, 供离线烘焙纹理(TextureBaker)使用.
+// 每个4x4像素块独立编码: 端点取像素在主成分方向上的投影范围, 再按选出的索引用最小二乘法反复修正端点.
+//   BC1  RGB 565端点 + 2位索引, 8字节; 块内有alpha < 128的像素时改用3色 + 透明模式
+//   BC3  BC4编码的alpha + 4色模式的BC1颜色, 16字节
+//   BC4  单通道(R) 8位端点 + 3位索引, 8字节; 在8值与6值(含精确的0和255)两种模式中取误差小的
+//   BC5  两个BC4块分别存R与G, 16字节, 用于法线贴图(z由着色器按单位长度重建)
+//   BC7  单子集的模式6(RGBA共用7位端点 + p位, 4位索引), 模式5与模式4(颜色与alpha各有一组端点和索引),
+//        两子集的模式1(不透明块, RGB 6位端点)与模式7(有透明度的块, RGBA 5位端点), 每块取误差最小的一种;
+//        两子集模式先按主成分拟合粗估全部64种分区, 只完整编码最好的两种. 不用三子集的模式0, 2, 3, 16字节
+// 整张表面按块行并行编码; 宽高不是4的倍数时, 边缘块用复制的边界像素补齐.
+// 解码器用于计算压缩误差(PSNR), 与D3D的解码结果至多相差舍入误差; BC7只能解码模式1, 4, 5, 6, 7的块.
+// 本文件不依赖D3D.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class ThreadPool;
+
+class BlockCompressor
+{
+public:
+	enum class Format
+	{
+		BC1,
+		BC3,
+		BC4,
+		BC5,
+		BC7
+	};
+
+	// 块的边长(像素)
+	static const std::uint32_t BlockDim = 4;
+
+	// 一个块的字节数, 8或16
+	static std::uint32_t BlockBytes(Format format);
+
+	// width x height表面压缩后每行块与整张表面的字节数
+	static size_t RowPitch(Format format, std::uint32_t width);
+	static size_t SurfaceSize(Format format, std::uint32_t width, std::uint32_t height);
+
+	/* 编码一个块: rgba为4x4块的16个像素, 每像素RGBA8, 行主序; block写入BlockBytes(format)字节
+	* BC4只用R通道, BC5只用R与G */
+	static void EncodeBlock(Format format, const std::uint8_t rgba[64], void* block);
+
+	/* 解码一个块为16个RGBA8像素; BC4/BC5没有的通道: G, B为0, A为255 */
+	static void DecodeBlock(Format format, const void* block, std::uint8_t rgba[64]);
+
+	/* 编码整张表面: rgba每行rowPitch字节, dst为SurfaceSize(format, width, height)字节, 块按行主序排列
+	* 按块行并行, pool为nullptr时用ThreadPool::Default() */
+	static void Encode(Format format, const std::uint8_t* rgba, std::uint32_t width, std::uint32_t height, size_t rowPitch,
+		void* dst, ThreadPool* pool = nullptr);
+
+	/* 解码整张表面到每行rowPitch字节的RGBA8图像 */
+	static void Decode(Format format, const void* src, std::uint32_t width, std::uint32_t height,
+		std::uint8_t* rgba, size_t rowPitch, ThreadPool* pool = nullptr);
+};
@@ -0,0 +1,70 @@
+﻿//***************************************************************************************
+// CpuFeatures.h
+//
+// 运行时检测CPU支持的SIMD指令集, 供各处的SIMD内核(Waves, MeshBvh等)在运行时选择实现.
+// 另定义了平台宏与按函数启用指令集的宏:
+//   CPU_X86 / CPU_NEON             编译目标为x86/x64 或 ARM64
+//   CPU_TARGET_SSE4 / CPU_TARGET_AVX2  写在函数前, GCC/Clang据此为该函数启用对应指令集;
+//                                  MSVC可在任意函数中使用各指令集的intrinsic, 两个宏为空
+//***************************************************************************************
+
+#pragma once
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(_MSC_VER) && !defined(__clang__)
+#define CPU_TARGET_SSE4
+#define CPU_TARGET_AVX2
+#else
+#define CPU_TARGET_SSE4 __attribute__((target("sse4.1")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define CPU_NEON 1
+#include <arm_neon.h>
+#endif
+
+struct CpuFeatures
+{
+	bool SSE41 = false;
+	bool AVX2 = false;
+};
+
+inline CpuFeatures DetectCpuFeatures()
+{
+	CpuFeatures features;
+#if defined(CPU_X86)
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	const int maxLeaf = info[0];
+
+	__cpuid(info, 1);
+	features.SSE41 = (info[2] & (1 << 19)) != 0;
+
+	// AVX还需要操作系统在上下文切换时保存YMM寄存器(OSXSAVE + XCR0)
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx = (info[2] & (1 << 28)) != 0;
+	if (osxsave && avx && (_xgetbv(0) & 0x6) == 0x6 && maxLeaf >= 7) {
+		__cpuidex(info, 7, 0);
+		features.AVX2 = (info[1] & (1 << 5)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	features.SSE41 = __builtin_cpu_supports("sse4.1") != 0;
+	features.AVX2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+#endif
+	return features;
+}
+
+/* 首次调用时检测一次, 之后返回缓存的结果 */
+inline const CpuFeatures& GetCpuFeatures()
+{
+	static const CpuFeatures features = DetectCpuFeatures();
+	return features;
+}
@@ -32,6 +32,8 @@
 
 #pragma warning(pop)
 
+#include <vector>
+
 #if defined(_MSC_VER) && (_MSC_VER<1610) && !defined(_In_reads_)
 #define _In_reads_(exp)
 #define _Out_writes_(exp)
@@ -55,6 +57,43 @@ namespace DirectX
         DDS_ALPHA_MODE_CUSTOM        = 4,
     };
 
+	// A DDS file parsed on the CPU for Direct3D 12: the resource description plus
+	// one D3D12_SUBRESOURCE_DATA per (array slice, mip) in D3D12 subresource order.
+	// The subresources point straight into the DDS data that was parsed (no pixel copy),
+	// so that memory must stay alive until CreateDDSTextureFromData12 has returned.
+	struct DDS_TEXTURE_DATA12
+	{
+		D3D12_RESOURCE_DIMENSION resDim = D3D12_RESOURCE_DIMENSION_UNKNOWN;
+		size_t width = 0;
+		size_t height = 0;
+		size_t depth = 0;
+		size_t mipCount = 0;
+		size_t arraySize = 0;
+		DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+		bool isCubeMap = false;
+		DDS_ALPHA_MODE alphaMode = DDS_ALPHA_MODE_UNKNOWN;
+		std::vector<D3D12_SUBRESOURCE_DATA> subresources;
+	};
+
+	// Validates the DDS header and lays out the subresources without touching a device,
+	// so it may run on any thread (e.g. over a memory-mapped file on a worker).
+	// Mips larger than maxsize are skipped as in CreateDDSTextureFromMemory12.
+	HRESULT LoadDDSTextureDataFromMemory12(_In_reads_bytes_(ddsDataSize) const uint8_t* ddsData,
+		                                   _In_ size_t ddsDataSize,
+		                                   _Out_ DDS_TEXTURE_DATA12& textureData,
+		                                   _In_ size_t maxsize = 0
+		                                   );
+
+	// Creates the default-heap texture and its upload heap from parsed data and records
+	// the copy on cmdList. Must be called on the thread that owns cmdList; the pixel data
+	// is copied into the upload heap before this returns.
+	HRESULT CreateDDSTextureFromData12(_In_ ID3D12Device* device,
+		                               _In_ ID3D12GraphicsCommandList* cmdList,
+		                               _In_ const DDS_TEXTURE_DATA12& textureData,
+		                               _Out_ Microsoft::WRL::ComPtr<ID3D12Resource>& texture,
+		                               _Out_ Microsoft::WRL::ComPtr<ID3D12Resource>& textureUploadHeap
+		                               );
+
     // Standard version
     HRESULT CreateDDSTextureFromMemory( _In_ ID3D11Device* d3dDevice,
                                         _In_reads_bytes_(ddsDataSize) const uint8_t* ddsData,
@@ -0,0 +1,805 @@
+﻿//***************************************************************************************
+// DdsParser.cpp
+//***************************************************************************************
+
+#include "DdsParser.h"
+#include <cstring>
+
+const DdsParser::uint32 DdsParser::Magic;
+const DdsParser::uint32 DdsParser::MaxMipLevels;
+const DdsParser::uint32 DdsParser::MaxTexture1DSize;
+const DdsParser::uint32 DdsParser::MaxTexture2DSize;
+const DdsParser::uint32 DdsParser::MaxTextureCubeSize;
+const DdsParser::uint32 DdsParser::MaxTexture3DSize;
+const DdsParser::uint32 DdsParser::MaxArraySize;
+const DdsParser::uint32 DdsParser::HeaderSize;
+
+namespace
+{
+	using uint32 = DdsParser::uint32;
+	using uint64 = DdsParser::uint64;
+
+	static_assert(sizeof(DdsParser::PixelFormat) == 32, "DDS_PIXELFORMAT size mismatch");
+	static_assert(sizeof(DdsParser::Header) == 124, "DDS_HEADER size mismatch");
+	static_assert(sizeof(DdsParser::HeaderDxt10) == 20, "DDS_HEADER_DXT10 size mismatch");
+
+	inline uint32 FourCC(char ch0, char ch1, char ch2, char ch3)
+	{
+		return (uint32)(std::uint8_t)ch0 | ((uint32)(std::uint8_t)ch1 << 8) |
+			((uint32)(std::uint8_t)ch2 << 16) | ((uint32)(std::uint8_t)ch3 << 24);
+	}
+
+	// DDS_PIXELFORMAT::flags
+	const uint32 PixelFourCC = 0x00000004;		// DDPF_FOURCC
+	const uint32 PixelRGB = 0x00000040;			// DDPF_RGB
+	const uint32 PixelLuminance = 0x00020000;	// DDPF_LUMINANCE
+	const uint32 PixelAlpha = 0x00000002;		// DDPF_ALPHA
+
+	// DDS_HEADER::flags
+	const uint32 HeaderCaps = 0x00000001;		// DDSD_CAPS
+	const uint32 HeaderHeight = 0x00000002;		// DDSD_HEIGHT
+	const uint32 HeaderWidth = 0x00000004;		// DDSD_WIDTH
+	const uint32 HeaderPitch = 0x00000008;		// DDSD_PITCH
+	const uint32 HeaderPixelFormat = 0x00001000;// DDSD_PIXELFORMAT
+	const uint32 HeaderMipCount = 0x00020000;	// DDSD_MIPMAPCOUNT
+	const uint32 HeaderLinearSize = 0x00080000;	// DDSD_LINEARSIZE
+	const uint32 HeaderVolume = 0x00800000;		// DDSD_DEPTH
+
+	// DDS_HEADER::caps
+	const uint32 CapsComplex = 0x00000008;		// DDSCAPS_COMPLEX
+	const uint32 CapsTexture = 0x00001000;		// DDSCAPS_TEXTURE
+	const uint32 CapsMipMap = 0x00400000;		// DDSCAPS_MIPMAP
+
+	// DDS_HEADER::caps2
+	const uint32 CapsCubeMap = 0x00000200;		// DDSCAPS2_CUBEMAP
+	const uint32 CapsCubeAllFaces = 0x0000fe00;	// DDSCAPS2_CUBEMAP | 六个面
+	const uint32 CapsVolume = 0x00200000;		// DDSCAPS2_VOLUME
+
+	// DDS_HEADER_DXT10
+	const uint32 MiscTextureCube = 0x4;			// D3D11_RESOURCE_MISC_TEXTURECUBE
+	const uint32 MiscFlags2AlphaModeMask = 0x7;
+
+	// 下一级mip的边长
+	inline uint32 NextMipSize(uint32 size)
+	{
+		return (size > 1) ? (size >> 1) : 1;
+	}
+
+	// 边长为size的纹理最多有几级mip
+	inline uint32 FullMipCount(uint32 size)
+	{
+		uint32 count = 1;
+		while (size > 1) {
+			size >>= 1;
+			++count;
+		}
+		return count;
+	}
+}
+
+DdsParser::Result DdsParser::ParseHeader(const void* data, size_t size, Info& info)
+{
+	info = Info();
+
+	if (data == nullptr)
+		return Result::InvalidArgument;
+
+	const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+	if (size < sizeof(uint32) + sizeof(Header))
+		return Result::TooSmall;
+
+	// 按字节拷出, 映射文件以外的内存不保证4字节对齐
+	uint32 magic;
+	std::memcpy(&magic, bytes, sizeof(magic));
+	if (magic != Magic)
+		return Result::BadMagic;
+
+	Header header;
+	std::memcpy(&header, bytes + sizeof(uint32), sizeof(header));
+	if (header.size != sizeof(Header) || header.ddspf.size != sizeof(PixelFormat))
+		return Result::BadHeader;
+
+	uint32 width = header.width;
+	uint32 height = header.height;
+	uint32 depth = header.depth;
+	uint32 mipCount = (header.mipMapCount == 0) ? 1 : header.mipMapCount;
+	uint32 arraySize = 1;
+	uint32 offset = sizeof(uint32) + sizeof(Header);
+	DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+	Dimension dim = Dimension::Unknown;
+	bool isCubeMap = false;
+	AlphaMode alpha = AlphaMode::Unknown;
+
+	if ((header.ddspf.flags & PixelFourCC) && header.ddspf.fourCC == FourCC('D', 'X', '1', '0')) {
+		if (size < offset + sizeof(HeaderDxt10))
+			return Result::TooSmall;
+
+		HeaderDxt10 ext;
+		std::memcpy(&ext, bytes + offset, sizeof(ext));
+		offset += sizeof(HeaderDxt10);
+
+		arraySize = ext.arraySize;
+		if (arraySize == 0)
+			return Result::InvalidData;
+
+		// 文件里的格式可能是任意32位值, BitsPerPixel不认识的都不支持
+		format = ext.dxgiFormat;
+
+		switch (format) {
+		case DXGI_FORMAT_AI44:
+		case DXGI_FORMAT_IA44:
+		case DXGI_FORMAT_P8:
+		case DXGI_FORMAT_A8P8:
+			return Result::UnsupportedFormat;
+
+		default:
+			if (BitsPerPixel(format) == 0)
+				return Result::UnsupportedFormat;
+		}
+
+		switch (ext.resourceDimension) {
+		case (uint32)Dimension::Texture1D:
+			if ((header.flags & HeaderHeight) && height != 1)
+				return Result::InvalidData;
+			height = depth = 1;
+			break;
+
+		case (uint32)Dimension::Texture2D:
+			if (ext.miscFlag & MiscTextureCube) {
+				// 先比较再乘6, arraySize来自文件, 乘法可能溢出
+				if (arraySize > MaxArraySize / 6)
+					return Result::TooLarge;
+				arraySize *= 6;
+				isCubeMap = true;
+			}
+			depth = 1;
+			break;
+
+		case (uint32)Dimension::Texture3D:
+			if (!(header.flags & HeaderVolume))
+				return Result::InvalidData;
+			if (arraySize > 1)
+				return Result::UnsupportedDimension;
+			break;
+
+		default:
+			return Result::UnsupportedDimension;
+		}
+		dim = static_cast<Dimension>(ext.resourceDimension);
+
+		const uint32 mode = ext.miscFlags2 & MiscFlags2AlphaModeMask;
+		if (mode >= (uint32)AlphaMode::Straight && mode <= (uint32)AlphaMode::Custom)
+			alpha = static_cast<AlphaMode>(mode);
+	}
+	else {
+		format = GetDXGIFormat(header.ddspf);
+		if (format == DXGI_FORMAT_UNKNOWN)
+			return Result::UnsupportedFormat;
+
+		if (header.flags & HeaderVolume) {
+			dim = Dimension::Texture3D;
+		}
+		else {
+			if (header.caps2 & CapsCubeMap) {
+				// 不支持只有部分面的立方体贴图
+				if ((header.caps2 & CapsCubeAllFaces) != CapsCubeAllFaces)
+					return Result::UnsupportedDimension;
+				arraySize = 6;
+				isCubeMap = true;
+			}
+			depth = 1;
+			dim = Dimension::Texture2D;
+		}
+
+		if ((header.ddspf.flags & PixelFourCC) &&
+			(header.ddspf.fourCC == FourCC('D', 'X', 'T', '2') || header.ddspf.fourCC == FourCC('D', 'X', 'T', '4')))
+			alpha = AlphaMode::Premultiplied;
+	}
+
+	if (width == 0 || height == 0 || depth == 0)
+		return Result::InvalidData;
+
+	/// 不信任文件中超出D3D12硬件上限的尺寸; 下面的字节数都用64位计算, 不会溢出
+	if (mipCount > MaxMipLevels)
+		return Result::TooLarge;
+
+	switch (dim) {
+	case Dimension::Texture1D:
+		if (arraySize > MaxArraySize || width > MaxTexture1DSize)
+			return Result::TooLarge;
+		break;
+
+	case Dimension::Texture2D:
+		if (arraySize > MaxArraySize)
+			return Result::TooLarge;
+		if (isCubeMap) {
+			if (width > MaxTextureCubeSize || height > MaxTextureCubeSize)
+				return Result::TooLarge;
+		}
+		else if (width > MaxTexture2DSize || height > MaxTexture2DSize) {
+			return Result::TooLarge;
+		}
+		break;
+
+	case Dimension::Texture3D:
+		if (width > MaxTexture3DSize || height > MaxTexture3DSize || depth > MaxTexture3DSize)
+			return Result::TooLarge;
+		break;
+
+	default:
+		return Result::UnsupportedDimension;
+	}
+
+	// 最小的一级已是1x1x1, 再多的级数没有意义, D3D也不接受
+	uint32 largest = width;
+	if (height > largest)
+		largest = height;
+	if (depth > largest)
+		largest = depth;
+	if (mipCount > FullMipCount(largest))
+		return Result::InvalidData;
+
+	/// 一个数组切片的整条mip链的字节数
+	uint64 sliceSize = 0;
+	uint32 w = width;
+	uint32 h = height;
+	uint32 d = depth;
+	for (uint32 i = 0; i < mipCount; ++i) {
+		uint64 numBytes = 0;
+		if (!GetSurfaceInfo(w, h, format, &numBytes, nullptr, nullptr))
+			return Result::UnsupportedFormat;
+
+		sliceSize += numBytes * d;
+		w = NextMipSize(w);
+		h = NextMipSize(h);
+		d = NextMipSize(d);
+	}
+
+	const uint64 dataSize = sliceSize * arraySize;
+	if (dataSize > (uint64)(size - offset))
+		return Result::Truncated;
+
+	info.Dim = dim;
+	info.Width = width;
+	info.Height = height;
+	info.Depth = depth;
+	info.MipCount = mipCount;
+	info.ArraySize = arraySize;
+	info.Format = format;
+	info.IsCubeMap = isCubeMap;
+	info.Alpha = alpha;
+	info.DataOffset = offset;
+	info.DataSize = dataSize;
+	return Result::Ok;
+}
+
+DdsParser::Result DdsParser::GetSubresources(const void* data, size_t size, const Info& info,
+	uint32 firstMip, Subresource* table, size_t capacity)
+{
+	if (data == nullptr || table == nullptr || info.MipCount == 0 || info.ArraySize == 0 || firstMip >= info.MipCount)
+		return Result::InvalidArgument;
+
+	const uint64 count = (uint64)(info.MipCount - firstMip) * info.ArraySize;
+	if (count > capacity)
+		return Result::InvalidArgument;
+
+	// info可能不是由这段数据解析出来的, 每个子资源仍逐一检查是否越界
+	if (info.DataOffset > size || info.DataSize > (uint64)(size - info.DataOffset))
+		return Result::Truncated;
+
+	const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+	const uint64 end = (uint64)info.DataOffset + info.DataSize;
+	uint64 offset = info.DataOffset;
+	size_t index = 0;
+	for (uint32 slice = 0; slice < info.ArraySize; ++slice) {
+		uint32 w = info.Width;
+		uint32 h = info.Height;
+		uint32 d = info.Depth;
+		for (uint32 mip = 0; mip < info.MipCount; ++mip) {
+			uint64 numBytes = 0;
+			uint64 rowBytes = 0;
+			uint64 numRows = 0;
+			if (!GetSurfaceInfo(w, h, info.Format, &numBytes, &rowBytes, &numRows))
+				return Result::UnsupportedFormat;
+
+			const uint64 mipSize = numBytes * d;
+			if (mipSize > end - offset)
+				return Result::Truncated;
+
+			if (mip >= firstMip) {
+				Subresource& sub = table[index++];
+				sub.Data = bytes + offset;
+				sub.Offset = offset;
+				sub.Width = w;
+				sub.Height = h;
+				sub.Depth = d;
+				sub.RowCount = (uint32)numRows;
+				sub.RowPitch = rowBytes;
+				sub.SlicePitch = numBytes;
+			}
+
+			offset += mipSize;
+			w = NextMipSize(w);
+			h = NextMipSize(h);
+			d = NextMipSize(d);
+		}
+	}
+
+	return Result::Ok;
+}
+
+DdsParser::uint32 DdsParser::SkipMips(const Info& info, uint32 maxSize)
+{
+	if (maxSize == 0 || info.MipCount <= 1)
+		return 0;
+
+	uint32 skip = 0;
+	uint32 w = info.Width;
+	uint32 h = info.Height;
+	uint32 d = info.Depth;
+	while (skip < info.MipCount && (w > maxSize || h > maxSize || d > maxSize)) {
+		++skip;
+		w = NextMipSize(w);
+		h = NextMipSize(h);
+		d = NextMipSize(d);
+	}
+	return skip;
+}
+
+bool DdsParser::IsBlockCompressed(DXGI_FORMAT format)
+{
+	return (format >= DXGI_FORMAT_BC1_TYPELESS && format <= DXGI_FORMAT_BC5_SNORM) ||
+		(format >= DXGI_FORMAT_BC6H_TYPELESS && format <= DXGI_FORMAT_BC7_UNORM_SRGB);
+}
+
+DdsParser::uint32 DdsParser::BitsPerPixel(DXGI_FORMAT format)
+{
+	switch (format) {
+	case DXGI_FORMAT_R32G32B32A32_TYPELESS:
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:
+	case DXGI_FORMAT_R32G32B32A32_UINT:
+	case DXGI_FORMAT_R32G32B32A32_SINT:
+		return 128;
+
+	case DXGI_FORMAT_R32G32B32_TYPELESS:
+	case DXGI_FORMAT_R32G32B32_FLOAT:
+	case DXGI_FORMAT_R32G32B32_UINT:
+	case DXGI_FORMAT_R32G32B32_SINT:
+		return 96;
+
+	case DXGI_FORMAT_R16G16B16A16_TYPELESS:
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+	case DXGI_FORMAT_R16G16B16A16_UNORM:
+	case DXGI_FORMAT_R16G16B16A16_UINT:
+	case DXGI_FORMAT_R16G16B16A16_SNORM:
+	case DXGI_FORMAT_R16G16B16A16_SINT:
+	case DXGI_FORMAT_R32G32_TYPELESS:
+	case DXGI_FORMAT_R32G32_FLOAT:
+	case DXGI_FORMAT_R32G32_UINT:
+	case DXGI_FORMAT_R32G32_SINT:
+	case DXGI_FORMAT_R32G8X24_TYPELESS:
+	case DXGI_FORMAT_D32_FLOAT_S8X24_UINT:
+	case DXGI_FORMAT_R32_FLOAT_X8X24_TYPELESS:
+	case DXGI_FORMAT_X32_TYPELESS_G8X24_UINT:
+	case DXGI_FORMAT_Y416:
+	case DXGI_FORMAT_Y210:
+	case DXGI_FORMAT_Y216:
+		return 64;
+
+	case DXGI_FORMAT_R10G10B10A2_TYPELESS:
+	case DXGI_FORMAT_R10G10B10A2_UNORM:
+	case DXGI_FORMAT_R10G10B10A2_UINT:
+	case DXGI_FORMAT_R11G11B10_FLOAT:
+	case DXGI_FORMAT_R8G8B8A8_TYPELESS:
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+	case DXGI_FORMAT_R8G8B8A8_UINT:
+	case DXGI_FORMAT_R8G8B8A8_SNORM:
+	case DXGI_FORMAT_R8G8B8A8_SINT:
+	case DXGI_FORMAT_R16G16_TYPELESS:
+	case DXGI_FORMAT_R16G16_FLOAT:
+	case DXGI_FORMAT_R16G16_UNORM:
+	case DXGI_FORMAT_R16G16_UINT:
+	case DXGI_FORMAT_R16G16_SNORM:
+	case DXGI_FORMAT_R16G16_SINT:
+	case DXGI_FORMAT_R32_TYPELESS:
+	case DXGI_FORMAT_D32_FLOAT:
+	case DXGI_FORMAT_R32_FLOAT:
+	case DXGI_FORMAT_R32_UINT:
+	case DXGI_FORMAT_R32_SINT:
+	case DXGI_FORMAT_R24G8_TYPELESS:
+	case DXGI_FORMAT_D24_UNORM_S8_UINT:
+	case DXGI_FORMAT_R24_UNORM_X8_TYPELESS:
+	case DXGI_FORMAT_X24_TYPELESS_G8_UINT:
+	case DXGI_FORMAT_R9G9B9E5_SHAREDEXP:
+	case DXGI_FORMAT_R8G8_B8G8_UNORM:
+	case DXGI_FORMAT_G8R8_G8B8_UNORM:
+	case DXGI_FORMAT_B8G8R8A8_UNORM:
+	case DXGI_FORMAT_B8G8R8X8_UNORM:
+	case DXGI_FORMAT_R10G10B10_XR_BIAS_A2_UNORM:
+	case DXGI_FORMAT_B8G8R8A8_TYPELESS:
+	case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+	case DXGI_FORMAT_B8G8R8X8_TYPELESS:
+	case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+	case DXGI_FORMAT_AYUV:
+	case DXGI_FORMAT_Y410:
+	case DXGI_FORMAT_YUY2:
+		return 32;
+
+	case DXGI_FORMAT_P010:
+	case DXGI_FORMAT_P016:
+		return 24;
+
+	case DXGI_FORMAT_R8G8_TYPELESS:
+	case DXGI_FORMAT_R8G8_UNORM:
+	case DXGI_FORMAT_R8G8_UINT:
+	case DXGI_FORMAT_R8G8_SNORM:
+	case DXGI_FORMAT_R8G8_SINT:
+	case DXGI_FORMAT_R16_TYPELESS:
+	case DXGI_FORMAT_R16_FLOAT:
+	case DXGI_FORMAT_D16_UNORM:
+	case DXGI_FORMAT_R16_UNORM:
+	case DXGI_FORMAT_R16_UINT:
+	case DXGI_FORMAT_R16_SNORM:
+	case DXGI_FORMAT_R16_SINT:
+	case DXGI_FORMAT_B5G6R5_UNORM:
+	case DXGI_FORMAT_B5G5R5A1_UNORM:
+	case DXGI_FORMAT_A8P8:
+	case DXGI_FORMAT_B4G4R4A4_UNORM:
+		return 16;
+
+	case DXGI_FORMAT_NV12:
+	case DXGI_FORMAT_420_OPAQUE:
+	case DXGI_FORMAT_NV11:
+		return 12;
+
+	case DXGI_FORMAT_R8_TYPELESS:
+	case DXGI_FORMAT_R8_UNORM:
+	case DXGI_FORMAT_R8_UINT:
+	case DXGI_FORMAT_R8_SNORM:
+	case DXGI_FORMAT_R8_SINT:
+	case DXGI_FORMAT_A8_UNORM:
+	case DXGI_FORMAT_AI44:
+	case DXGI_FORMAT_IA44:
+	case DXGI_FORMAT_P8:
+		return 8;
+
+	case DXGI_FORMAT_R1_UNORM:
+		return 1;
+
+	case DXGI_FORMAT_BC1_TYPELESS:
+	case DXGI_FORMAT_BC1_UNORM:
+	case DXGI_FORMAT_BC1_UNORM_SRGB:
+	case DXGI_FORMAT_BC4_TYPELESS:
+	case DXGI_FORMAT_BC4_UNORM:
+	case DXGI_FORMAT_BC4_SNORM:
+		return 4;
+
+	case DXGI_FORMAT_BC2_TYPELESS:
+	case DXGI_FORMAT_BC2_UNORM:
+	case DXGI_FORMAT_BC2_UNORM_SRGB:
+	case DXGI_FORMAT_BC3_TYPELESS:
+	case DXGI_FORMAT_BC3_UNORM:
+	case DXGI_FORMAT_BC3_UNORM_SRGB:
+	case DXGI_FORMAT_BC5_TYPELESS:
+	case DXGI_FORMAT_BC5_UNORM:
+	case DXGI_FORMAT_BC5_SNORM:
+	case DXGI_FORMAT_BC6H_TYPELESS:
+	case DXGI_FORMAT_BC6H_UF16:
+	case DXGI_FORMAT_BC6H_SF16:
+	case DXGI_FORMAT_BC7_TYPELESS:
+	case DXGI_FORMAT_BC7_UNORM:
+	case DXGI_FORMAT_BC7_UNORM_SRGB:
+		return 8;
+
+	default:
+		return 0;
+	}
+}
+
+bool DdsParser::GetSurfaceInfo(uint32 width, uint32 height, DXGI_FORMAT format,
+	uint64* numBytes, uint64* rowBytes, uint64* numRows)
+{
+	uint64 bytes = 0;
+	uint64 rowSize = 0;
+	uint64 rows = 0;
+
+	bool bc = false;
+	bool packed = false;
+	bool planar = false;
+	uint64 bpe = 0;
+	switch (format) {
+	case DXGI_FORMAT_BC1_TYPELESS:
+	case DXGI_FORMAT_BC1_UNORM:
+	case DXGI_FORMAT_BC1_UNORM_SRGB:
+	case DXGI_FORMAT_BC4_TYPELESS:
+	case DXGI_FORMAT_BC4_UNORM:
+	case DXGI_FORMAT_BC4_SNORM:
+		bc = true;
+		bpe = 8;
+		break;
+
+	case DXGI_FORMAT_BC2_TYPELESS:
+	case DXGI_FORMAT_BC2_UNORM:
+	case DXGI_FORMAT_BC2_UNORM_SRGB:
+	case DXGI_FORMAT_BC3_TYPELESS:
+	case DXGI_FORMAT_BC3_UNORM:
+	case DXGI_FORMAT_BC3_UNORM_SRGB:
+	case DXGI_FORMAT_BC5_TYPELESS:
+	case DXGI_FORMAT_BC5_UNORM:
+	case DXGI_FORMAT_BC5_SNORM:
+	case DXGI_FORMAT_BC6H_TYPELESS:
+	case DXGI_FORMAT_BC6H_UF16:
+	case DXGI_FORMAT_BC6H_SF16:
+	case DXGI_FORMAT_BC7_TYPELESS:
+	case DXGI_FORMAT_BC7_UNORM:
+	case DXGI_FORMAT_BC7_UNORM_SRGB:
+		bc = true;
+		bpe = 16;
+		break;
+
+	case DXGI_FORMAT_R8G8_B8G8_UNORM:
+	case DXGI_FORMAT_G8R8_G8B8_UNORM:
+	case DXGI_FORMAT_YUY2:
+		packed = true;
+		bpe = 4;
+		break;
+
+	case DXGI_FORMAT_Y210:
+	case DXGI_FORMAT_Y216:
+		packed = true;
+		bpe = 8;
+		break;
+
+	case DXGI_FORMAT_NV12:
+	case DXGI_FORMAT_420_OPAQUE:
+		planar = true;
+		bpe = 2;
+		break;
+
+	case DXGI_FORMAT_P010:
+	case DXGI_FORMAT_P016:
+		planar = true;
+		bpe = 4;
+		break;
+
+	default:
+		break;
+	}
+
+	if (bc) {
+		// 4x4的块, 不足一块的边按一块算
+		const uint64 blocksWide = (width > 0) ? ((uint64)width + 3) / 4 : 0;
+		const uint64 blocksHigh = (height > 0) ? ((uint64)height + 3) / 4 : 0;
+		rowSize = blocksWide * bpe;
+		rows = blocksHigh;
+		bytes = rowSize * blocksHigh;
+	}
+	else if (packed) {
+		rowSize = (((uint64)width + 1) >> 1) * bpe;
+		rows = height;
+		bytes = rowSize * height;
+	}
+	else if (format == DXGI_FORMAT_NV11) {
+		rowSize = (((uint64)width + 3) >> 2) * 4;
+		rows = (uint64)height * 2;// 与D3D一样按较大的尺寸算, 比实际的4:1:1数据多
+		bytes = rowSize * rows;
+	}
+	else if (planar) {
+		rowSize = (((uint64)width + 1) >> 1) * bpe;
+		bytes = (rowSize * height) + ((rowSize * height + 1) >> 1);
+		rows = (uint64)height + (((uint64)height + 1) >> 1);
+	}
+	else {
+		const uint64 bpp = BitsPerPixel(format);
+		if (bpp == 0)
+			return false;
+		rowSize = ((uint64)width * bpp + 7) / 8;// 向上取整到字节
+		rows = height;
+		bytes = rowSize * height;
+	}
+
+	if (numBytes)
+		*numBytes = bytes;
+	if (rowBytes)
+		*rowBytes = rowSize;
+	if (numRows)
+		*numRows = rows;
+	return true;
+}
+
+// 对应不上的旧式格式(D3DFMT_X8B8G8R8, A2R10G10B10, X1R5G5B5, 24位RGB, 调色板等)都返回UNKNOWN
+#define ISBITMASK(r, g, b, a) (ddpf.RBitMask == r && ddpf.GBitMask == g && ddpf.BBitMask == b && ddpf.ABitMask == a)
+
+DXGI_FORMAT DdsParser::GetDXGIFormat(const PixelFormat& ddpf)
+{
+	if (ddpf.flags & PixelRGB) {
+		// sRGB格式只会写在DX10扩展头里
+		switch (ddpf.RGBBitCount) {
+		case 32:
+			if (ISBITMASK(0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000))
+				return DXGI_FORMAT_R8G8B8A8_UNORM;
+			if (ISBITMASK(0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000))
+				return DXGI_FORMAT_B8G8R8A8_UNORM;
+			if (ISBITMASK(0x00ff0000, 0x0000ff00, 0x000000ff, 0x00000000))
+				return DXGI_FORMAT_B8G8R8X8_UNORM;
+
+			// D3DX写10:10:10:2格式时会交换红蓝掩码, 这里按D3DX的写法识别
+			if (ISBITMASK(0x3ff00000, 0x000ffc00, 0x000003ff, 0xc0000000))
+				return DXGI_FORMAT_R10G10B10A2_UNORM;
+
+			if (ISBITMASK(0x0000ffff, 0xffff0000, 0x00000000, 0x00000000))
+				return DXGI_FORMAT_R16G16_UNORM;
+
+			// D3D9中唯一的32位单通道格式是R32F
+			if (ISBITMASK(0xffffffff, 0x00000000, 0x00000000, 0x00000000))
+				return DXGI_FORMAT_R32_FLOAT;
+			break;
+
+		case 16:
+			if (ISBITMASK(0x7c00, 0x03e0, 0x001f, 0x8000))
+				return DXGI_FORMAT_B5G5R5A1_UNORM;
+			if (ISBITMASK(0xf800, 0x07e0, 0x001f, 0x0000))
+				return DXGI_FORMAT_B5G6R5_UNORM;
+			if (ISBITMASK(0x0f00, 0x00f0, 0x000f, 0xf000))
+				return DXGI_FORMAT_B4G4R4A4_UNORM;
+			break;
+		}
+	}
+	else if (ddpf.flags & PixelLuminance) {
+		if (ddpf.RGBBitCount == 8) {
+			if (ISBITMASK(0x000000ff, 0x00000000, 0x00000000, 0x00000000))
+				return DXGI_FORMAT_R8_UNORM;
+		}
+
+		if (ddpf.RGBBitCount == 16) {
+			if (ISBITMASK(0x0000ffff, 0x00000000, 0x00000000, 0x00000000))
+				return DXGI_FORMAT_R16_UNORM;
+			if (ISBITMASK(0x000000ff, 0x00000000, 0x00000000, 0x0000ff00))
+				return DXGI_FORMAT_R8G8_UNORM;
+		}
+	}
+	else if (ddpf.flags & PixelAlpha) {
+		if (ddpf.RGBBitCount == 8)
+			return DXGI_FORMAT_A8_UNORM;
+	}
+	else if (ddpf.flags & PixelFourCC) {
+		const uint32 fourCC = ddpf.fourCC;
+		if (fourCC == FourCC('D', 'X', 'T', '1'))
+			return DXGI_FORMAT_BC1_UNORM;
+		if (fourCC == FourCC('D', 'X', 'T', '3'))
+			return DXGI_FORMAT_BC2_UNORM;
+		if (fourCC == FourCC('D', 'X', 'T', '5'))
+			return DXGI_FORMAT_BC3_UNORM;
+
+		// 预乘alpha的DXT2/DXT4与BC2/BC3的数据相同
+		if (fourCC == FourCC('D', 'X', 'T', '2'))
+			return DXGI_FORMAT_BC2_UNORM;
+		if (fourCC == FourCC('D', 'X', 'T', '4'))
+			return DXGI_FORMAT_BC3_UNORM;
+
+		if (fourCC == FourCC('A', 'T', 'I', '1') || fourCC == FourCC('B', 'C', '4', 'U'))
+			return DXGI_FORMAT_BC4_UNORM;
+		if (fourCC == FourCC('B', 'C', '4', 'S'))
+			return DXGI_FORMAT_BC4_SNORM;
+
+		if (fourCC == FourCC('A', 'T', 'I', '2') || fourCC == FourCC('B', 'C', '5', 'U'))
+			return DXGI_FORMAT_BC5_UNORM;
+		if (fourCC == FourCC('B', 'C', '5', 'S'))
+			return DXGI_FORMAT_BC5_SNORM;
+
+		// BC6H与BC7只会写在DX10扩展头里
+
+		if (fourCC == FourCC('R', 'G', 'B', 'G'))
+			return DXGI_FORMAT_R8G8_B8G8_UNORM;
+		if (fourCC == FourCC('G', 'R', 'G', 'B'))
+			return DXGI_FORMAT_G8R8_G8B8_UNORM;
+
+		if (fourCC == FourCC('Y', 'U', 'Y', '2'))
+			return DXGI_FORMAT_YUY2;
+
+		// fourCC里直接写D3DFORMAT枚举值的情况
+		switch (fourCC) {
+		case 36: // D3DFMT_A16B16G16R16
+			return DXGI_FORMAT_R16G16B16A16_UNORM;
+		case 110: // D3DFMT_Q16W16V16U16
+			return DXGI_FORMAT_R16G16B16A16_SNORM;
+		case 111: // D3DFMT_R16F
+			return DXGI_FORMAT_R16_FLOAT;
+		case 112: // D3DFMT_G16R16F
+			return DXGI_FORMAT_R16G16_FLOAT;
+		case 113: // D3DFMT_A16B16G16R16F
+			return DXGI_FORMAT_R16G16B16A16_FLOAT;
+		case 114: // D3DFMT_R32F
+			return DXGI_FORMAT_R32_FLOAT;
+		case 115: // D3DFMT_G32R32F
+			return DXGI_FORMAT_R32G32_FLOAT;
+		case 116: // D3DFMT_A32B32G32R32F
+			return DXGI_FORMAT_R32G32B32A32_FLOAT;
+		}
+	}
+
+	return DXGI_FORMAT_UNKNOWN;
+}
+
+#undef ISBITMASK
+
+size_t DdsParser::WriteHeader(const Info& info, void* dst, size_t capacity)
+{
+	if (dst == nullptr || capacity < HeaderSize)
+		return 0;
+	if (info.Width == 0 || info.Height == 0 || info.Depth == 0 || info.MipCount == 0 || info.ArraySize == 0)
+		return 0;
+	if (info.Dim != Dimension::Texture1D && info.Dim != Dimension::Texture2D && info.Dim != Dimension::Texture3D)
+		return 0;
+	if (info.IsCubeMap && (info.Dim != Dimension::Texture2D || info.ArraySize % 6 != 0))
+		return 0;
+
+	uint64 numBytes = 0, rowBytes = 0, numRows = 0;
+	if (!GetSurfaceInfo(info.Width, info.Height, info.Format, &numBytes, &rowBytes, &numRows))
+		return 0;
+	Header header = {};
+	header.size = sizeof(Header);
+	header.flags = HeaderCaps | HeaderHeight | HeaderWidth | HeaderPixelFormat;
+	header.height = info.Height;
+	header.width = info.Width;
+	// 块压缩格式填首级mip的总字节数, 其它填每行字节数
+	if (IsBlockCompressed(info.Format)) {
+		header.flags |= HeaderLinearSize;
+		header.pitchOrLinearSize = (uint32)numBytes;
+	}
+	else {
+		header.flags |= HeaderPitch;
+		header.pitchOrLinearSize = (uint32)rowBytes;
+	}
+	header.caps = CapsTexture;
+	if (info.MipCount > 1) {
+		header.flags |= HeaderMipCount;
+		header.mipMapCount = info.MipCount;
+		header.caps |= CapsComplex | CapsMipMap;
+	}
+	if (info.Dim == Dimension::Texture3D) {
+		header.flags |= HeaderVolume;
+		header.depth = info.Depth;
+		header.caps |= CapsComplex;
+		header.caps2 = CapsVolume;
+	}
+	if (info.IsCubeMap) {
+		header.caps |= CapsComplex;
+		header.caps2 = CapsCubeAllFaces;
+	}
+	header.ddspf.size = sizeof(PixelFormat);
+	header.ddspf.flags = PixelFourCC;
+	header.ddspf.fourCC = FourCC('D', 'X', '1', '0');
+
+	HeaderDxt10 extension = {};
+	extension.dxgiFormat = info.Format;
+	extension.resourceDimension = (uint32)info.Dim;
+	extension.miscFlag = info.IsCubeMap ? MiscTextureCube : 0;
+	extension.arraySize = info.IsCubeMap ? info.ArraySize / 6 : info.ArraySize;
+	extension.miscFlags2 = (uint32)info.Alpha & MiscFlags2AlphaModeMask;
+
+	std::uint8_t* out = static_cast<std::uint8_t*>(dst);
+	const uint32 magic = Magic;
+	std::memcpy(out, &magic, sizeof(magic));
+	std::memcpy(out + sizeof(magic), &header, sizeof(header));
+	std::memcpy(out + sizeof(magic) + sizeof(header), &extension, sizeof(extension));
+	return HeaderSize;
+}
+
+const char* DdsParser::ResultString(Result result)
+{
+	switch (result) {
+	case Result::Ok:					return "ok";
+	case Result::InvalidArgument:		return "invalid argument";
+	case Result::TooSmall:				return "too small";
+	case Result::BadMagic:				return "bad magic";
+	case Result::BadHeader:				return "bad header";
+	case Result::InvalidData:			return "invalid data";
+	case Result::UnsupportedFormat:		return "unsupported format";
+	case Result::UnsupportedDimension:	return "unsupported dimension";
+	case Result::TooLarge:				return "too large";
+	case Result::Truncated:				return "truncated";
+	}
+	return "unknown";
+}
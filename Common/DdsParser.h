@@ -0,0 +1,176 @@
+﻿//***************************************************************************************
+// DdsParser.h
+//
+// 与平台无关的DDS容器解析与校验: 从一段内存(例如MappedFile映射的文件)解析出头部, 像素格式,
+// 纹理维度, mip链与纹理数组, 并给出每个子资源在这段内存中的位置, 供D3D11/D3D12创建资源时直接引用.
+// 不分配内存, 不依赖D3D与Windows头文件, 只用到dxgiformat.h里的DXGI_FORMAT枚举, 因此可在Linux上编译与模糊测试.
+// 所有来自文件的尺寸都先按D3D12硬件上限校验, 偏移与大小用64位计算, 畸形或被截断的文件只会得到错误码.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <dxgiformat.h>
+
+class DdsParser
+{
+public:
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	// 文件开头的"DDS "
+	static const uint32 Magic = 0x20534444;
+
+	// 单个维度与纹理数组的上限, 与D3D12_REQ_*一致
+	static const uint32 MaxMipLevels = 15;
+	static const uint32 MaxTexture1DSize = 16384;
+	static const uint32 MaxTexture2DSize = 16384;
+	static const uint32 MaxTextureCubeSize = 16384;
+	static const uint32 MaxTexture3DSize = 2048;
+	static const uint32 MaxArraySize = 2048;
+
+	/* 文件中的结构体, 字段名与DirectXTex的DDS.h一致; 解析时按字节拷出, 不要求输入内存对齐 */
+#pragma pack(push, 1)
+	struct PixelFormat
+	{
+		uint32 size;
+		uint32 flags;
+		uint32 fourCC;
+		uint32 RGBBitCount;
+		uint32 RBitMask;
+		uint32 GBitMask;
+		uint32 BBitMask;
+		uint32 ABitMask;
+	};
+
+	struct Header
+	{
+		uint32 size;
+		uint32 flags;
+		uint32 height;
+		uint32 width;
+		uint32 pitchOrLinearSize;
+		uint32 depth;// 只在flags含DDSD_DEPTH时有效
+		uint32 mipMapCount;
+		uint32 reserved1[11];
+		PixelFormat ddspf;
+		uint32 caps;
+		uint32 caps2;
+		uint32 caps3;
+		uint32 caps4;
+		uint32 reserved2;
+	};
+
+	// ddspf.fourCC为"DX10"时紧跟在Header之后
+	struct HeaderDxt10
+	{
+		DXGI_FORMAT dxgiFormat;
+		uint32 resourceDimension;
+		uint32 miscFlag;
+		uint32 arraySize;
+		uint32 miscFlags2;
+	};
+#pragma pack(pop)
+
+	// 纹理维度, 数值与D3D11/D3D12_RESOURCE_DIMENSION相同
+	enum class Dimension : uint32
+	{
+		Unknown = 0,
+		Texture1D = 2,
+		Texture2D = 3,
+		Texture3D = 4
+	};
+
+	// 数值与DDS_ALPHA_MODE相同
+	enum class AlphaMode : uint32
+	{
+		Unknown = 0,
+		Straight = 1,
+		Premultiplied = 2,
+		Opaque = 3,
+		Custom = 4
+	};
+
+	enum class Result
+	{
+		Ok,
+		InvalidArgument,	// 空指针, 或子资源表容量不足 / firstMip越界
+		TooSmall,			// 数据短于头部
+		BadMagic,			// 不是DDS文件
+		BadHeader,			// 头部或像素格式结构体的大小字段不对
+		InvalidData,		// 维度, 数组大小, mip数或标志位自相矛盾
+		UnsupportedFormat,	// 没有对应的DXGI格式, 或是调色板等不支持的格式
+		UnsupportedDimension,// 不支持的资源维度, 或不完整的立方体贴图
+		TooLarge,			// 超出D3D12的尺寸, 数组或mip数上限
+		Truncated			// 像素数据比mip链与数组所需的短
+	};
+
+	/* 解析出的纹理描述 */
+	struct Info
+	{
+		Dimension Dim = Dimension::Unknown;
+		uint32 Width = 0;
+		uint32 Height = 0;
+		uint32 Depth = 0;		// 非3D纹理为1
+		uint32 MipCount = 0;	// 至少为1
+		uint32 ArraySize = 0;	// 立方体贴图已乘以6
+		DXGI_FORMAT Format = DXGI_FORMAT_UNKNOWN;
+		bool IsCubeMap = false;
+		AlphaMode Alpha = AlphaMode::Unknown;
+		uint32 DataOffset = 0;	// 像素数据相对文件开头的偏移
+		uint64 DataSize = 0;	// 全部子资源的总字节数, 已确认不超出输入
+
+		uint32 SubresourceCount()const { return MipCount * ArraySize; }
+	};
+
+	/* 一个子资源(某个数组切片的某级mip), 3D纹理的一个子资源包含全部Depth个切片 */
+	struct Subresource
+	{
+		const std::uint8_t* Data = nullptr;// 指向输入内存
+		uint64 Offset = 0;		// 相对文件开头
+		uint32 Width = 0;
+		uint32 Height = 0;
+		uint32 Depth = 0;
+		uint32 RowCount = 0;	// 行数(块压缩格式为块的行数)
+		uint64 RowPitch = 0;	// 每行字节数
+		uint64 SlicePitch = 0;	// 每个深度切片的字节数
+	};
+
+public:
+	/* 解析并校验头部, 同时确认size足以容纳整条mip链与全部数组切片; 不读取像素 */
+	static Result ParseHeader(const void* data, size_t size, Info& info);
+
+	/* 按D3D的子资源顺序(下标 = 切片 * 级数 + 级)填写table, 跳过前firstMip级mip
+	* 共写入(info.MipCount - firstMip) * info.ArraySize项, capacity不足时返回InvalidArgument
+	* data与size须与ParseHeader时相同 */
+	static Result GetSubresources(const void* data, size_t size, const Info& info,
+		uint32 firstMip, Subresource* table, size_t capacity);
+
+	/* 宽, 高或深超过maxSize的前几级mip的级数, 可作为GetSubresources的firstMip
+	* maxSize为0或只有1级mip时返回0; 每级都超过时返回MipCount */
+	static uint32 SkipMips(const Info& info, uint32 maxSize);
+
+	// BC1~BC7块压缩格式; 这类纹理的首级mip宽高须为4的倍数
+	static bool IsBlockCompressed(DXGI_FORMAT format);
+
+	// 每像素位数, 不支持的格式为0
+	static uint32 BitsPerPixel(DXGI_FORMAT format);
+
+	/* 一个width x height表面的字节数, 每行字节数与行数; 不支持的格式返回false */
+	static bool GetSurfaceInfo(uint32 width, uint32 height, DXGI_FORMAT format,
+		uint64* numBytes, uint64* rowBytes, uint64* numRows);
+
+	// 由旧式(非DX10)像素格式推出DXGI格式, 无法对应时为DXGI_FORMAT_UNKNOWN
+	static DXGI_FORMAT GetDXGIFormat(const PixelFormat& ddpf);
+
+	/* 写出info所描述纹理的文件头("DDS " + Header + HeaderDxt10, 共HeaderSize字节), 像素数据按子资源顺序紧随其后
+	* 总是使用DX10扩展头, 以便表示_SRGB与BC7等格式; 只用到info的维度, 尺寸, mip数, 数组大小, 格式, 立方体与alpha模式
+	* 返回写入的字节数, capacity不足或info不合法时返回0 */
+	static size_t WriteHeader(const Info& info, void* dst, size_t capacity);
+
+	// WriteHeader写出的字节数
+	static const uint32 HeaderSize = 4 + sizeof(Header) + sizeof(HeaderDxt10);
+
+	static const char* ResultString(Result result);
+};
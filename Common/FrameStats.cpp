@@ -0,0 +1,311 @@
+﻿//***************************************************************************************
+// FrameStats.cpp
+//***************************************************************************************
+
+#include "FrameStats.h"
+#include <algorithm>
+#include <fstream>
+#include <ostream>
+
+namespace
+{
+	// 名称中的引号与反斜杠等在CSV/JSON里需要转义; 登记的名称一般只含字母数字, 这里只做最小的处理
+	void WriteCsvName(std::ostream& out, const char* name, const char* suffix)
+	{
+		bool quote = false;
+		for (const char* c = name; *c != '\0'; ++c) {
+			if (*c == ',' || *c == '"' || *c == '\n' || *c == '\r')
+				quote = true;
+		}
+
+		if (!quote) {
+			out << name << suffix;
+			return;
+		}
+
+		out << '"';
+		for (const char* c = name; *c != '\0'; ++c) {
+			if (*c == '"')
+				out << '"';
+			out << *c;
+		}
+		out << suffix << '"';
+	}
+
+	void WriteJsonName(std::ostream& out, const char* name)
+	{
+		static const char hex[] = "0123456789abcdef";
+		out << '"';
+		for (const char* c = name; *c != '\0'; ++c) {
+			const unsigned char ch = (unsigned char)*c;
+			if (ch == '"' || ch == '\\')
+				out << '\\' << *c;
+			else if (ch < 0x20)
+				out << "\\u00" << hex[ch >> 4] << hex[ch & 0xf];
+			else
+				out << *c;
+		}
+		out << '"';
+	}
+
+	const double SecondsToMs = 1000.0;
+}
+
+FrameStats::FrameStats(int historyLength)
+{
+	mHistoryLength = std::max(historyLength, 1);
+	mCounterHistory.assign((size_t)mHistoryLength * MaxCounters, 0);
+	mTimeHistory.assign((size_t)mHistoryLength * MaxTimers, 0.0);
+
+	for (int i = 0; i < MaxCounters; ++i) {
+		mCounterNames[i][0] = '\0';
+		mCounters[i].store(0, std::memory_order_relaxed);
+	}
+	for (int i = 0; i < MaxTimers; ++i) {
+		mTimerNames[i][0] = '\0';
+		mTicks[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+int FrameStats::Register(char (*names)[MaxNameLength + 1], int& count, int maxCount, const char* name)
+{
+	// 先按截断后的名称查找已有项
+	char truncated[MaxNameLength + 1];
+	int length = 0;
+	for (; length < MaxNameLength && name[length] != '\0'; ++length)
+		truncated[length] = name[length];
+	truncated[length] = '\0';
+
+	for (int i = 0; i < count; ++i) {
+		if (std::char_traits<char>::compare(names[i], truncated, (size_t)length + 1) == 0)
+			return i;
+	}
+
+	if (count >= maxCount)
+		return InvalidId;
+
+	std::char_traits<char>::copy(names[count], truncated, (size_t)length + 1);
+	return count++;
+}
+
+int FrameStats::RegisterCounter(const char* name)
+{
+	return Register(mCounterNames, mCounterCount, MaxCounters, name);
+}
+
+int FrameStats::RegisterTimer(const char* name)
+{
+	return Register(mTimerNames, mTimerCount, MaxTimers, name);
+}
+
+void FrameStats::Add(int counter, int64 value)
+{
+	if ((unsigned int)counter < (unsigned int)mCounterCount)
+		mCounters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void FrameStats::Set(int counter, int64 value)
+{
+	if ((unsigned int)counter < (unsigned int)mCounterCount)
+		mCounters[counter].store(value, std::memory_order_relaxed);
+}
+
+void FrameStats::AddTime(int timer, std::chrono::steady_clock::duration duration)
+{
+	if ((unsigned int)timer < (unsigned int)mTimerCount)
+		mTicks[timer].fetch_add((int64)duration.count(), std::memory_order_relaxed);
+}
+
+void FrameStats::AddTime(int timer, double seconds)
+{
+	AddTime(timer, std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds)));
+}
+
+FrameStats::int64 FrameStats::CurrentCounter(int counter)const
+{
+	if ((unsigned int)counter >= (unsigned int)mCounterCount)
+		return 0;
+	return mCounters[counter].load(std::memory_order_relaxed);
+}
+
+double FrameStats::CurrentTime(int timer)const
+{
+	if ((unsigned int)timer >= (unsigned int)mTimerCount)
+		return 0.0;
+	const std::chrono::steady_clock::duration ticks(mTicks[timer].load(std::memory_order_relaxed));
+	return std::chrono::duration<double>(ticks).count();
+}
+
+void FrameStats::EndFrame()
+{
+	const int row = (int)(mFrameCount % (std::uint64_t)mHistoryLength);
+	int64* counters = &mCounterHistory[(size_t)row * MaxCounters];
+	double* times = &mTimeHistory[(size_t)row * MaxTimers];
+
+	for (int i = 0; i < mCounterCount; ++i)
+		counters[i] = mCounters[i].exchange(0, std::memory_order_relaxed);
+	for (int i = 0; i < mTimerCount; ++i) {
+		const std::chrono::steady_clock::duration ticks(mTicks[i].exchange(0, std::memory_order_relaxed));
+		times[i] = std::chrono::duration<double>(ticks).count();
+	}
+
+	++mFrameCount;
+}
+
+int FrameStats::HistorySize()const
+{
+	return (int)std::min<std::uint64_t>(mFrameCount, (std::uint64_t)mHistoryLength);
+}
+
+int FrameStats::HistoryRow(int framesAgo)const
+{
+	return (int)((mFrameCount - 1 - (std::uint64_t)framesAgo) % (std::uint64_t)mHistoryLength);
+}
+
+FrameStats::int64 FrameStats::Counter(int counter, int framesAgo)const
+{
+	if ((unsigned int)counter >= (unsigned int)mCounterCount)
+		return 0;
+	return mCounterHistory[(size_t)HistoryRow(framesAgo) * MaxCounters + counter];
+}
+
+double FrameStats::Time(int timer, int framesAgo)const
+{
+	if ((unsigned int)timer >= (unsigned int)mTimerCount)
+		return 0.0;
+	return mTimeHistory[(size_t)HistoryRow(framesAgo) * MaxTimers + timer];
+}
+
+double FrameStats::AverageCounter(int counter)const
+{
+	const int frames = HistorySize();
+	if (frames == 0)
+		return 0.0;
+
+	double sum = 0.0;
+	for (int f = 0; f < frames; ++f)
+		sum += (double)Counter(counter, f);
+	return sum / frames;
+}
+
+double FrameStats::AverageTime(int timer)const
+{
+	const int frames = HistorySize();
+	if (frames == 0)
+		return 0.0;
+
+	double sum = 0.0;
+	for (int f = 0; f < frames; ++f)
+		sum += Time(timer, f);
+	return sum / frames;
+}
+
+double FrameStats::MaxTime(int timer)const
+{
+	double result = 0.0;
+	for (int f = 0; f < HistorySize(); ++f)
+		result = std::max(result, Time(timer, f));
+	return result;
+}
+
+void FrameStats::WriteCsv(std::ostream& out)const
+{
+	const std::ios::fmtflags flags = out.flags();
+	const std::streamsize precision = out.precision();
+	out.unsetf(std::ios::floatfield);
+	out.precision(6);
+
+	out << "frame";
+	for (int i = 0; i < mCounterCount; ++i) {
+		out << ',';
+		WriteCsvName(out, mCounterNames[i], "");
+	}
+	for (int i = 0; i < mTimerCount; ++i) {
+		out << ',';
+		WriteCsvName(out, mTimerNames[i], "_ms");
+	}
+	out << '\n';
+
+	const int frames = HistorySize();
+	for (int f = frames - 1; f >= 0; --f) {
+		out << (mFrameCount - 1 - (std::uint64_t)f);
+		for (int i = 0; i < mCounterCount; ++i)
+			out << ',' << Counter(i, f);
+		for (int i = 0; i < mTimerCount; ++i)
+			out << ',' << Time(i, f) * SecondsToMs;
+		out << '\n';
+	}
+
+	out.flags(flags);
+	out.precision(precision);
+}
+
+void FrameStats::WriteJson(std::ostream& out)const
+{
+	const std::ios::fmtflags flags = out.flags();
+	const std::streamsize precision = out.precision();
+	out.unsetf(std::ios::floatfield);
+	out.precision(6);
+
+	const int frames = HistorySize();
+	out << "{\n";
+	out << "  \"firstFrame\": " << (mFrameCount - (std::uint64_t)frames) << ",\n";
+	out << "  \"frameCount\": " << frames << ",\n";
+
+	out << "  \"counters\": {";
+	for (int i = 0; i < mCounterCount; ++i) {
+		out << (i == 0 ? "\n    " : ",\n    ");
+		WriteJsonName(out, mCounterNames[i]);
+		out << ": [";
+		for (int f = frames - 1; f >= 0; --f)
+			out << Counter(i, f) << (f > 0 ? ", " : "");
+		out << ']';
+	}
+	out << (mCounterCount > 0 ? "\n  },\n" : "},\n");
+
+	out << "  \"timersMs\": {";
+	for (int i = 0; i < mTimerCount; ++i) {
+		out << (i == 0 ? "\n    " : ",\n    ");
+		WriteJsonName(out, mTimerNames[i]);
+		out << ": [";
+		for (int f = frames - 1; f >= 0; --f)
+			out << Time(i, f) * SecondsToMs << (f > 0 ? ", " : "");
+		out << ']';
+	}
+	out << (mTimerCount > 0 ? "\n  }\n" : "}\n");
+	out << "}\n";
+
+	out.flags(flags);
+	out.precision(precision);
+}
+
+bool FrameStats::WriteCsv(const std::string& filename)const
+{
+	std::ofstream fout(filename);
+	if (!fout)
+		return false;
+	WriteCsv(fout);
+	fout.close();
+	return !fout.fail();
+}
+
+bool FrameStats::WriteJson(const std::string& filename)const
+{
+	std::ofstream fout(filename);
+	if (!fout)
+		return false;
+	WriteJson(fout);
+	fout.close();
+	return !fout.fail();
+}
+
+void FrameStats::Reset()
+{
+	mFrameCount = 0;
+	std::fill(mCounterHistory.begin(), mCounterHistory.end(), 0);
+	std::fill(mTimeHistory.begin(), mTimeHistory.end(), 0.0);
+	for (int i = 0; i < MaxCounters; ++i)
+		mCounters[i].store(0, std::memory_order_relaxed);
+	for (int i = 0; i < MaxTimers; ++i)
+		mTicks[i].store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,126 @@
+﻿//***************************************************************************************
+// FrameStats.h
+//
+// 逐帧的计数器与耗时统计: 名称在初始化时登记一次, 之后每帧只按序号累加, 不分配内存也不拼字符串.
+// 当前帧的值是原子量, 可以在线程池的任务里同时累加; EndFrame把它们存入固定长度的环形历史并清零.
+// 历史可随时导出为CSV或JSON(按列存放), 供离线分析; 导出时才做格式化.
+// 本文件不依赖D3D.
+//***************************************************************************************
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+class FrameStats
+{
+public:
+	using int64 = std::int64_t;
+
+	static const int MaxCounters = 32;
+	static const int MaxTimers = 16;
+	static const int MaxNameLength = 31;// 名称最大长度(不含结尾0), 超出部分被截掉
+	static const int InvalidId = -1;	// 登记失败时返回; 以它调用Add/AddTime等不做任何事
+
+	/* 在析构时把自构造起经过的时间累加到指定的计时器 */
+	class ScopedTimer
+	{
+	public:
+		ScopedTimer(FrameStats& stats, int timer)
+			: mStats(stats), mTimer(timer), mStart(std::chrono::steady_clock::now()) {}
+		ScopedTimer(const ScopedTimer& rhs) = delete;
+		ScopedTimer& operator=(const ScopedTimer& rhs) = delete;
+		~ScopedTimer()
+		{
+			mStats.AddTime(mTimer, std::chrono::steady_clock::now() - mStart);
+		}
+
+	private:
+		FrameStats& mStats;
+		int mTimer;
+		std::chrono::steady_clock::time_point mStart;
+	};
+
+public:
+	// historyLength为环形历史保存的帧数, 至少为1
+	explicit FrameStats(int historyLength = 256);
+	FrameStats(const FrameStats& rhs) = delete;
+	FrameStats& operator=(const FrameStats& rhs) = delete;
+
+	/* 登记计数器/计时器, 返回其序号; 同名的返回已有序号, 超出MaxCounters/MaxTimers时返回InvalidId
+	* 只应在初始化时调用, 不能与Add/EndFrame等同时进行 */
+	int RegisterCounter(const char* name);
+	int RegisterTimer(const char* name);
+
+	int CounterCount()const { return mCounterCount; }
+	int TimerCount()const { return mTimerCount; }
+	const char* CounterName(int counter)const { return mCounterNames[counter]; }
+	const char* TimerName(int timer)const { return mTimerNames[timer]; }
+
+	/* 累加到当前帧, 可在多个线程上同时调用 */
+	void Add(int counter, int64 value = 1);
+	void AddTime(int timer, std::chrono::steady_clock::duration duration);
+	void AddTime(int timer, double seconds);
+
+	// 直接设定当前帧的计数值, 用于每帧只算一次的量
+	void Set(int counter, int64 value);
+
+	// 当前帧(尚未结束)里已累加的值; 编号无效时返回0
+	int64 CurrentCounter(int counter)const;
+	double CurrentTime(int timer)const;
+
+	/* 结束当前帧: 把当前值存入历史, 覆盖最老的一帧, 再全部清零; 须在没有其他线程累加时调用 */
+	void EndFrame();
+
+	// 自构造起已结束的帧数, 以及历史中实际保存的帧数(不超过历史长度)
+	std::uint64_t FrameCount()const { return mFrameCount; }
+	int HistorySize()const;
+	int HistoryLength()const { return mHistoryLength; }
+
+	/* 历史中的值: framesAgo = 0为最近结束的一帧, 须小于HistorySize(); 耗时以秒为单位; 编号无效时返回0 */
+	int64 Counter(int counter, int framesAgo = 0)const;
+	double Time(int timer, int framesAgo = 0)const;
+
+	// 历史中各帧的平均值与最大值
+	double AverageCounter(int counter)const;
+	double AverageTime(int timer)const;
+	double MaxTime(int timer)const;
+
+	/* 按从旧到新的顺序导出历史
+	* CSV: 首行为表头"frame,计数器..., 计时器_ms...", 之后每帧一行
+	* JSON: {"firstFrame": n, "frameCount": m, "counters": {"名称": [...]}, "timersMs": {"名称": [...]}} */
+	void WriteCsv(std::ostream& out)const;
+	void WriteJson(std::ostream& out)const;
+	bool WriteCsv(const std::string& filename)const;
+	bool WriteJson(const std::string& filename)const;
+
+	// 清空历史与当前帧的值, 保留已登记的名称
+	void Reset();
+
+private:
+	static int Register(char (*names)[MaxNameLength + 1], int& count, int maxCount, const char* name);
+
+	// 历史中第framesAgo帧所在的行
+	int HistoryRow(int framesAgo)const;
+
+private:
+	int mHistoryLength = 0;
+	std::uint64_t mFrameCount = 0;
+
+	int mCounterCount = 0;
+	int mTimerCount = 0;
+	char mCounterNames[MaxCounters][MaxNameLength + 1];
+	char mTimerNames[MaxTimers][MaxNameLength + 1];
+
+	// 当前帧; 耗时以steady_clock的tick累加
+	std::atomic<int64> mCounters[MaxCounters];
+	std::atomic<int64> mTicks[MaxTimers];
+
+	// 环形历史, 每帧一行: 计数器为MaxCounters列, 耗时为MaxTimers列(秒)
+	std::vector<int64> mCounterHistory;
+	std::vector<double> mTimeHistory;
+};
@@ -3,10 +3,29 @@
 //***************************************************************************************
 
 #include "GeometryGenerator.h"
+#include "MeshOptimizer.h"
+#include "ThreadPool.h"
 #include <algorithm>
+#include <cstddef>
 
 using namespace DirectX;
 
+namespace
+{
+	// 不小于value的最小2的幂, value为0时返回1
+	inline std::uint32_t NextPowerOfTwo(std::uint32_t value)
+	{
+		std::uint32_t result = 1;
+		while (result < value)
+			result <<= 1;
+		return result;
+	}
+}
+
+const GeometryGenerator::uint32 GeometryGenerator::MaxSubdivisions;
+const GeometryGenerator::uint32 GeometryGenerator::ParallelVertexThreshold;
+const std::uint64_t GeometryGenerator::EmptyEdge;
+
 GeometryGenerator::MeshData GeometryGenerator::CreateBox(float width, float height, float depth, uint32 numSubdivisions)
 {
     MeshData meshData;
@@ -92,10 +111,14 @@ GeometryGenerator::MeshData GeometryGenerator::CreateBox(float width, float heig
 	meshData.Indices32.assign(&i[0], &i[36]);
 
     // Put a cap on the number of subdivisions.
-    numSubdivisions = std::min<uint32>(numSubdivisions, 6u);
+    numSubdivisions = std::min<uint32>(numSubdivisions, MaxSubdivisions);
+
+	// 每个面细分n次后是(2^n + 1)^2个顶点的规则栅格, 2*4^n个三角形; 各面顶点不共享(法线不同)
+	const uint32 side = 1u << numSubdivisions;
+	ReserveSubdivide(meshData, 6*(side + 1)*(side + 1), 6*2*side*side);
 
     for(uint32 i = 0; i < numSubdivisions; ++i)
-        Subdivide(meshData);
+        Subdivide(meshData, true);
 
     return meshData;
 }
@@ -104,6 +127,14 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 {
     MeshData meshData;
 
+	// 两极各1个顶点, 中间stackCount-1个环各sliceCount+1个顶点;
+	// 两极各sliceCount个三角形, 中间每层2*sliceCount个
+	const uint32 ringVertexCount = sliceCount + 1;
+	const uint32 ringCount = stackCount - 1;
+	const uint32 vertexCount = ringCount*ringVertexCount + 2;
+	meshData.Vertices.resize(vertexCount);
+	meshData.Indices32.resize(6*sliceCount*(stackCount - 1));
+
 	//
 	// Compute the vertices stating at the top pole and moving down the stacks.
 	//
@@ -111,63 +142,56 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 	// Poles: note that there will be texture coordinate distortion as there is
 	// not a unique point on the texture map to assign to the pole when mapping
 	// a rectangular texture onto a sphere.
-	Vertex topVertex(0.0f, +radius, 0.0f, 0.0f, +1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
-	Vertex bottomVertex(0.0f, -radius, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
-
-	meshData.Vertices.push_back( topVertex );
+	meshData.Vertices[0] = Vertex(0.0f, +radius, 0.0f, 0.0f, +1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+	meshData.Vertices[vertexCount - 1] = Vertex(0.0f, -radius, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
 
 	float phiStep   = XM_PI/stackCount;
 	float thetaStep = 2.0f*XM_PI/sliceCount;
 
 	// Compute vertices for each stack ring (do not count the poles as rings).
-	for(uint32 i = 1; i <= stackCount-1; ++i)
-	{
-		float phi = i*phiStep;
-
-		// Vertices of ring.
-        for(uint32 j = 0; j <= sliceCount; ++j)
-		{
-			float theta = j*thetaStep;
-
-			Vertex v;
-
-			// spherical to cartesian
-			v.Position.x = radius*sinf(phi)*cosf(theta);
-			v.Position.y = radius*cosf(phi);
-			v.Position.z = radius*sinf(phi)*sinf(theta);
-
-			// Partial derivative of P with respect to theta
-			v.TangentU.x = -radius*sinf(phi)*sinf(theta);
-			v.TangentU.y = 0.0f;
-			v.TangentU.z = +radius*sinf(phi)*cosf(theta);
-
-			XMVECTOR T = XMLoadFloat3(&v.TangentU);
-			XMStoreFloat3(&v.TangentU, XMVector3Normalize(T));
-
-			XMVECTOR p = XMLoadFloat3(&v.Position);
-			XMStoreFloat3(&v.Normal, XMVector3Normalize(p));
-
-			v.TexC.x = theta / XM_2PI;
-			v.TexC.y = phi / XM_PI;
-
-			meshData.Vertices.push_back( v );
+	// 第r个环(从上往下, 不含两极)的顶点从下标1 + r*ringVertexCount开始
+	ForEachRow(ringCount, vertexCount, [&](int begin, int end) {
+		for (int r = begin; r < end; ++r) {
+			const float phi = (r + 1)*phiStep;
+			const float sinPhi = sinf(phi);
+			const float cosPhi = cosf(phi);
+			Vertex* ring = &meshData.Vertices[1 + r*ringVertexCount];
+
+			// Vertices of ring.
+			for (uint32 j = 0; j <= sliceCount; ++j) {
+				const float theta = j*thetaStep;
+				const float sinTheta = sinf(theta);
+				const float cosTheta = cosf(theta);
+
+				Vertex& v = ring[j];
+
+				// spherical to cartesian
+				v.Position = XMFLOAT3(radius*sinPhi*cosTheta, radius*cosPhi, radius*sinPhi*sinTheta);
+
+				// 法线即单位球上的点; 切线为P对theta的偏导(-r*sinPhi*sinTheta, 0, r*sinPhi*cosTheta)归一化的结果,
+				// 两极之外sinPhi > 0, 归一化后与半径无关
+				v.Normal = XMFLOAT3(sinPhi*cosTheta, cosPhi, sinPhi*sinTheta);
+				v.TangentU = XMFLOAT3(-sinTheta, 0.0f, cosTheta);
+
+				v.TexC.x = theta / XM_2PI;
+				v.TexC.y = phi / XM_PI;
+			}
 		}
-	}
-
-	meshData.Vertices.push_back( bottomVertex );
+	});
 
 	//
 	// Compute indices for top stack.  The top stack was written first to the vertex buffer
 	// and connects the top pole to the first ring.
 	//
 
+	uint32* indices = meshData.Indices32.data();
     for(uint32 i = 1; i <= sliceCount; ++i)
 	{
-		meshData.Indices32.push_back(0);
-		meshData.Indices32.push_back(i+1);
-		meshData.Indices32.push_back(i);
+		*indices++ = 0;
+		*indices++ = i+1;
+		*indices++ = i;
 	}
-	
+
 	//
 	// Compute indices for inner stacks (not connected to poles).
 	//
@@ -175,20 +199,22 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 	// Offset the indices to the index of the first vertex in the first ring.
 	// This is just skipping the top pole vertex.
     uint32 baseIndex = 1;
-    uint32 ringVertexCount = sliceCount + 1;
-	for(uint32 i = 0; i < stackCount-2; ++i)
-	{
-		for(uint32 j = 0; j < sliceCount; ++j)
-		{
-			meshData.Indices32.push_back(baseIndex + i*ringVertexCount + j);
-			meshData.Indices32.push_back(baseIndex + i*ringVertexCount + j+1);
-			meshData.Indices32.push_back(baseIndex + (i+1)*ringVertexCount + j);
-
-			meshData.Indices32.push_back(baseIndex + (i+1)*ringVertexCount + j);
-			meshData.Indices32.push_back(baseIndex + i*ringVertexCount + j+1);
-			meshData.Indices32.push_back(baseIndex + (i+1)*ringVertexCount + j+1);
+	uint32* innerIndices = indices;
+	ForEachRow(stackCount - 2, vertexCount, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			uint32* row = innerIndices + 6*sliceCount*i;
+			for (uint32 j = 0; j < sliceCount; ++j) {
+				*row++ = baseIndex + i*ringVertexCount + j;
+				*row++ = baseIndex + i*ringVertexCount + j+1;
+				*row++ = baseIndex + (i+1)*ringVertexCount + j;
+
+				*row++ = baseIndex + (i+1)*ringVertexCount + j;
+				*row++ = baseIndex + i*ringVertexCount + j+1;
+				*row++ = baseIndex + (i+1)*ringVertexCount + j+1;
+			}
 		}
-	}
+	});
+	indices += 6*sliceCount*(stackCount - 2);
 
 	//
 	// Compute indices for bottom stack.  The bottom stack was written last to the vertex buffer
@@ -196,30 +222,25 @@ GeometryGenerator::MeshData GeometryGenerator::CreateSphere(float radius, uint32
 	//
 
 	// South pole vertex was added last.
-	uint32 southPoleIndex = (uint32)meshData.Vertices.size()-1;
+	uint32 southPoleIndex = vertexCount-1;
 
 	// Offset the indices to the index of the first vertex in the last ring.
 	baseIndex = southPoleIndex - ringVertexCount;
 	
 	for(uint32 i = 0; i < sliceCount; ++i)
 	{
-		meshData.Indices32.push_back(southPoleIndex);
-		meshData.Indices32.push_back(baseIndex+i);
-		meshData.Indices32.push_back(baseIndex+i+1);
+		*indices++ = southPoleIndex;
+		*indices++ = baseIndex+i;
+		*indices++ = baseIndex+i+1;
 	}
 
+	Optimize(meshData);
+
     return meshData;
 }
  
-void GeometryGenerator::Subdivide(MeshData& meshData)
+void GeometryGenerator::Subdivide(MeshData& meshData, bool interpolateAttributes)
 {
-	// Save a copy of the input geometry.
-	MeshData inputCopy = meshData;
-
-
-	meshData.Vertices.resize(0);
-	meshData.Indices32.resize(0);
-
 	//       v1
 	//       *
 	//      / \
@@ -230,47 +251,100 @@ void GeometryGenerator::Subdivide(MeshData& meshData)
 	// *-----*-----*
 	// v0    m2     v2
 
-	uint32 numTris = (uint32)inputCopy.Indices32.size()/3;
-	for(uint32 i = 0; i < numTris; ++i)
-	{
-		Vertex v0 = inputCopy.Vertices[ inputCopy.Indices32[i*3+0] ];
-		Vertex v1 = inputCopy.Vertices[ inputCopy.Indices32[i*3+1] ];
-		Vertex v2 = inputCopy.Vertices[ inputCopy.Indices32[i*3+2] ];
-
-		//
-		// Generate the midpoints.
-		//
-
-        Vertex m0 = MidPoint(v0, v1);
-        Vertex m1 = MidPoint(v1, v2);
-        Vertex m2 = MidPoint(v0, v2);
-
-		//
-		// Add new geometry.
-		//
-
-		meshData.Vertices.push_back(v0); // 0
-		meshData.Vertices.push_back(v1); // 1
-		meshData.Vertices.push_back(v2); // 2
-		meshData.Vertices.push_back(m0); // 3
-		meshData.Vertices.push_back(m1); // 4
-		meshData.Vertices.push_back(m2); // 5
- 
-		meshData.Indices32.push_back(i*6+0);
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+5);
+	/// 不再复制整个MeshData, 也不再为每个三角形各造6个顶点:
+	/// 第1遍按三角形顺序给每条边分配一个中点下标, 相邻三角形经中点表共享; 随后一次性补齐中点顶点;
+	/// 第2遍从后往前原地改写索引, 第t个三角形变为第4t~4t+3个, 写入位置总在尚未读取的三角形之后
+	const uint32 numTris = (uint32)meshData.Indices32.size()/3;
+	const uint32 tableSize = NextPowerOfTwo(2*3*numTris);
+	mEdgeKeys.assign(tableSize, EmptyEdge);
+	mEdgeMidpoints.resize(tableSize);
+	mEdgeMask = tableSize - 1;
+
+	uint32 vertexCount = (uint32)meshData.Vertices.size();
+	for (uint32 i = 0; i < 3*numTris; i += 3) {
+		const uint32 v0 = meshData.Indices32[i+0];
+		const uint32 v1 = meshData.Indices32[i+1];
+		const uint32 v2 = meshData.Indices32[i+2];
+		EdgeMidpoint(v0, v1, vertexCount);
+		EdgeMidpoint(v1, v2, vertexCount);
+		EdgeMidpoint(v0, v2, vertexCount);
+	}
+
+	// 中点按(小端点, 大端点)的顺序计算, 两个方向经过这条边的三角形共用同一个顶点
+	meshData.Vertices.resize(vertexCount);
+	for (uint32 slot = 0; slot < tableSize; ++slot) {
+		const std::uint64_t key = mEdgeKeys[slot];
+		if (key == EmptyEdge)
+			continue;
+
+		const Vertex& v0 = meshData.Vertices[(uint32)(key >> 32)];
+		const Vertex& v1 = meshData.Vertices[(uint32)key];
+		Vertex& m = meshData.Vertices[mEdgeMidpoints[slot]];
+		if (interpolateAttributes)
+			m = MidPoint(v0, v1);
+		else
+			m.Position = XMFLOAT3(0.5f*(v0.Position.x + v1.Position.x), 0.5f*(v0.Position.y + v1.Position.y), 0.5f*(v0.Position.z + v1.Position.z));
+	}
+
+	meshData.Indices32.resize(12*numTris);
+	uint32* indices = meshData.Indices32.data();
+	for (uint32 i = numTris; i-- > 0; ) {
+		const uint32 v0 = indices[i*3+0];
+		const uint32 v1 = indices[i*3+1];
+		const uint32 v2 = indices[i*3+2];
+
+		// 中点在第1遍都已分配, 这里只是查表
+		const uint32 m0 = EdgeMidpoint(v0, v1, vertexCount);
+		const uint32 m1 = EdgeMidpoint(v1, v2, vertexCount);
+		const uint32 m2 = EdgeMidpoint(v0, v2, vertexCount);
+
+		uint32* dst = indices + i*12;
+		dst[0] = v0; dst[1]  = m0; dst[2]  = m2;
+		dst[3] = m0; dst[4]  = m1; dst[5]  = m2;
+		dst[6] = m2; dst[7]  = m1; dst[8]  = v2;
+		dst[9] = m0; dst[10] = v1; dst[11] = m1;
+	}
+}
+
+void GeometryGenerator::ReserveSubdivide(MeshData& meshData, uint32 finalVertexCount, uint32 finalTriangleCount)
+{
+	meshData.Vertices.reserve(finalVertexCount);
+	meshData.Indices32.reserve(3*finalTriangleCount);
 
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+4);
-		meshData.Indices32.push_back(i*6+5);
+	// 最后一次细分前有finalTriangleCount/4个三角形, 中点表按它的边数上限取容量
+	const uint32 tableSize = NextPowerOfTwo(2*3*(finalTriangleCount/4));
+	mEdgeKeys.reserve(tableSize);
+	mEdgeMidpoints.reserve(tableSize);
+}
 
-		meshData.Indices32.push_back(i*6+5);
-		meshData.Indices32.push_back(i*6+4);
-		meshData.Indices32.push_back(i*6+2);
+GeometryGenerator::uint32 GeometryGenerator::EdgeMidpoint(uint32 a, uint32 b, uint32& vertexCount)
+{
+	const std::uint64_t key = (a < b) ? ((std::uint64_t)a << 32 | b) : ((std::uint64_t)b << 32 | a);
+	uint32 slot = (uint32)((key * 0x9E3779B97F4A7C15ull) >> 32) & mEdgeMask;
+	for (;;) {
+		if (mEdgeKeys[slot] == key)
+			return mEdgeMidpoints[slot];
+		if (mEdgeKeys[slot] == EmptyEdge)
+			break;
+		slot = (slot + 1) & mEdgeMask;
+	}
 
-		meshData.Indices32.push_back(i*6+3);
-		meshData.Indices32.push_back(i*6+1);
-		meshData.Indices32.push_back(i*6+4);
+	mEdgeKeys[slot] = key;
+	mEdgeMidpoints[slot] = vertexCount;
+	return vertexCount++;
+}
+
+void GeometryGenerator::ForEachRow(uint32 rowCount, uint32 vertexCount, const std::function<void(int begin, int end)>& body)
+{
+	if (rowCount == 0)
+		return;
+
+	if (vertexCount >= ParallelVertexThreshold && rowCount > 1) {
+		ThreadPool& pool = (mThreadPool != nullptr) ? *mThreadPool : ThreadPool::Default();
+		pool.ParallelFor(0, (int)rowCount, 0, body);
+	}
+	else {
+		body(0, (int)rowCount);
 	}
 }
 
@@ -309,7 +383,7 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGeosphere(float radius, uin
     MeshData meshData;
 
 	// Put a cap on the number of subdivisions.
-    numSubdivisions = std::min<uint32>(numSubdivisions, 6u);
+    numSubdivisions = std::min<uint32>(numSubdivisions, MaxSubdivisions);
 
 	// Approximate a sphere by tessellating an icosahedron.
 
@@ -334,47 +408,59 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGeosphere(float radius, uin
 		10,1,6, 11,0,9, 2,11,9, 5,2,9,  11,2,7 
 	};
 
+	// 闭合的三角网格每次细分后: 三角形数x4, 新增顶点数 = 边数 = 1.5 * 三角形数
+	// n次细分后共10*4^n + 2个顶点, 20*4^n个三角形
+	const uint32 scale = 1u << (2*numSubdivisions);
+	ReserveSubdivide(meshData, 10*scale + 2, 20*scale);
+
     meshData.Vertices.resize(12);
     meshData.Indices32.assign(&k[0], &k[60]);
 
 	for(uint32 i = 0; i < 12; ++i)
 		meshData.Vertices[i].Position = pos[i];
 
+	// 其余属性在下面投影到球面时统一算出, 细分只需插值位置
 	for(uint32 i = 0; i < numSubdivisions; ++i)
-		Subdivide(meshData);
+		Subdivide(meshData, false);
 
 	// Project vertices onto sphere and scale.
-	for(uint32 i = 0; i < meshData.Vertices.size(); ++i)
-	{
-		// Project onto unit sphere.
-		XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&meshData.Vertices[i].Position));
+	const uint32 vertexCount = (uint32)meshData.Vertices.size();
+	const uint32 rowSize = 1024;// 每行(并行的最小单位)的顶点数
+	ForEachRow((vertexCount + rowSize - 1) / rowSize, vertexCount, [&](int begin, int end) {
+		for(uint32 i = begin*rowSize; i < std::min(end*rowSize, vertexCount); ++i)
+		{
+			// Project onto unit sphere.
+			XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&meshData.Vertices[i].Position));
 
-		// Project onto sphere.
-		XMVECTOR p = radius*n;
+			// Project onto sphere.
+			XMVECTOR p = radius*n;
 
-		XMStoreFloat3(&meshData.Vertices[i].Position, p);
-		XMStoreFloat3(&meshData.Vertices[i].Normal, n);
+			XMStoreFloat3(&meshData.Vertices[i].Position, p);
+			XMStoreFloat3(&meshData.Vertices[i].Normal, n);
 
-		// Derive texture coordinates from spherical coordinates.
-        float theta = atan2f(meshData.Vertices[i].Position.z, meshData.Vertices[i].Position.x);
+			// Derive texture coordinates from spherical coordinates.
+	        float theta = atan2f(meshData.Vertices[i].Position.z, meshData.Vertices[i].Position.x);
 
-        // Put in [0, 2pi].
-        if(theta < 0.0f)
-            theta += XM_2PI;
+	        // Put in [0, 2pi].
+	        if(theta < 0.0f)
+	            theta += XM_2PI;
 
-		float phi = acosf(meshData.Vertices[i].Position.y / radius);
+			float phi = acosf(meshData.Vertices[i].Position.y / radius);
 
-		meshData.Vertices[i].TexC.x = theta/XM_2PI;
-		meshData.Vertices[i].TexC.y = phi/XM_PI;
+			meshData.Vertices[i].TexC.x = theta/XM_2PI;
+			meshData.Vertices[i].TexC.y = phi/XM_PI;
 
-		// Partial derivative of P with respect to theta
-		meshData.Vertices[i].TangentU.x = -radius*sinf(phi)*sinf(theta);
-		meshData.Vertices[i].TangentU.y = 0.0f;
-		meshData.Vertices[i].TangentU.z = +radius*sinf(phi)*cosf(theta);
+			// Partial derivative of P with respect to theta
+			meshData.Vertices[i].TangentU.x = -radius*sinf(phi)*sinf(theta);
+			meshData.Vertices[i].TangentU.y = 0.0f;
+			meshData.Vertices[i].TangentU.z = +radius*sinf(phi)*cosf(theta);
 
-		XMVECTOR T = XMLoadFloat3(&meshData.Vertices[i].TangentU);
-		XMStoreFloat3(&meshData.Vertices[i].TangentU, XMVector3Normalize(T));
-	}
+			XMVECTOR T = XMLoadFloat3(&meshData.Vertices[i].TangentU);
+			XMStoreFloat3(&meshData.Vertices[i].TangentU, XMVector3Normalize(T));
+		}
+	});
+
+	Optimize(meshData);
 
     return meshData;
 }
@@ -394,87 +480,101 @@ GeometryGenerator::MeshData GeometryGenerator::CreateCylinder(float bottomRadius
 
 	uint32 ringCount = stackCount+1;// 共计多少环,环数==层数+1
 
-	// 遍历每个环
-	for(uint32 i = 0; i < ringCount; ++i)
-	{
-		float y = -0.5f*height + i*stackHeight;// 第i环的高度值 y
-		float r = bottomRadius + i*radiusStep; //第i环的半径值 r
+	// +1是细节处理,让每个环第一点和最后点重合,但是纹理坐标各异
+	uint32 ringVertexCount = sliceCount+1;
 
-		// 环上的各个顶点
-		float dTheta = 2.0f*XM_PI/sliceCount;// 每个环上每个点之间的间隔长度
+	// 侧面ringCount个环, 顶盖与底盖各一个环加一个圆心; 侧面每层2*sliceCount个三角形, 两个盖各sliceCount个
+	const uint32 sideVertexCount = ringCount*ringVertexCount;
+	meshData.Vertices.reserve(sideVertexCount + 2*(ringVertexCount + 1));
+	meshData.Indices32.reserve(6*sliceCount*stackCount + 2*3*sliceCount);
+	meshData.Vertices.resize(sideVertexCount);
+	meshData.Indices32.resize(6*sliceCount*stackCount);
 
-		// 计算 第i环的第j个顶点 的各个属性值(坐标,UV,切线)
-		for(uint32 j = 0; j <= sliceCount; ++j)
+	// 遍历每个环, 各环互不相关, 可以并行
+	ForEachRow(ringCount, sideVertexCount, [&](int begin, int end) {
+		for(uint32 i = begin; i < (uint32)end; ++i)
 		{
-			Vertex vertex;
-
-			float c = cosf(j*dTheta);
-			float s = sinf(j*dTheta);
-
-			vertex.Position = XMFLOAT3(r*c, y, r*s);
-
-			vertex.TexC.x = (float)j/sliceCount;
-			vertex.TexC.y = 1.0f - (float)i/stackCount;
-
-			// Cylinder can be parameterized as follows, where we introduce v
-			// parameter that goes in the same direction as the v tex-coord
-			// so that the bitangent goes in the same direction as the v tex-coord.
-			//   Let r0 be the bottom radius and let r1 be the top radius.
-			//   y(v) = h - hv for v in [0,1].
-			//   r(v) = r1 + (r0-r1)v
-			//
-			//   x(t, v) = r(v)*cos(t)
-			//   y(t, v) = h - hv
-			//   z(t, v) = r(v)*sin(t)
-			// 
-			//  dx/dt = -r(v)*sin(t)
-			//  dy/dt = 0
-			//  dz/dt = +r(v)*cos(t)
-			//
-			//  dx/dv = (r0-r1)*cos(t)
-			//  dy/dv = -h
-			//  dz/dv = (r0-r1)*sin(t)
-
-			// This is unit length.
-			vertex.TangentU = XMFLOAT3(-s, 0.0f, c);
-
-			float dr = bottomRadius-topRadius;
-			XMFLOAT3 bitangent(dr*c, -height, dr*s);
-
-			XMVECTOR T = XMLoadFloat3(&vertex.TangentU);
-			XMVECTOR B = XMLoadFloat3(&bitangent);
-			XMVECTOR N = XMVector3Normalize(XMVector3Cross(T, B));
-			XMStoreFloat3(&vertex.Normal, N);
-
-			meshData.Vertices.push_back(vertex);// 填充顶点数组
+			float y = -0.5f*height + i*stackHeight;// 第i环的高度值 y
+			float r = bottomRadius + i*radiusStep; //第i环的半径值 r
+
+			// 环上的各个顶点
+			float dTheta = 2.0f*XM_PI/sliceCount;// 每个环上每个点之间的间隔长度
+
+			// 计算 第i环的第j个顶点 的各个属性值(坐标,UV,切线)
+			for(uint32 j = 0; j <= sliceCount; ++j)
+			{
+				Vertex vertex;
+
+				float c = cosf(j*dTheta);
+				float s = sinf(j*dTheta);
+
+				vertex.Position = XMFLOAT3(r*c, y, r*s);
+
+				vertex.TexC.x = (float)j/sliceCount;
+				vertex.TexC.y = 1.0f - (float)i/stackCount;
+
+				// Cylinder can be parameterized as follows, where we introduce v
+				// parameter that goes in the same direction as the v tex-coord
+				// so that the bitangent goes in the same direction as the v tex-coord.
+				//   Let r0 be the bottom radius and let r1 be the top radius.
+				//   y(v) = h - hv for v in [0,1].
+				//   r(v) = r1 + (r0-r1)v
+				//
+				//   x(t, v) = r(v)*cos(t)
+				//   y(t, v) = h - hv
+				//   z(t, v) = r(v)*sin(t)
+				// 
+				//  dx/dt = -r(v)*sin(t)
+				//  dy/dt = 0
+				//  dz/dt = +r(v)*cos(t)
+				//
+				//  dx/dv = (r0-r1)*cos(t)
+				//  dy/dv = -h
+				//  dz/dv = (r0-r1)*sin(t)
+
+				// This is unit length.
+				vertex.TangentU = XMFLOAT3(-s, 0.0f, c);
+
+				float dr = bottomRadius-topRadius;
+				XMFLOAT3 bitangent(dr*c, -height, dr*s);
+
+				XMVECTOR T = XMLoadFloat3(&vertex.TangentU);
+				XMVECTOR B = XMLoadFloat3(&bitangent);
+				XMVECTOR N = XMVector3Normalize(XMVector3Cross(T, B));
+				XMStoreFloat3(&vertex.Normal, N);
+
+				meshData.Vertices[i*ringVertexCount + j] = vertex;// 填充顶点数组
+			}
+			// !!!每个环上的第一个点和最后一个点位置重合,但是纹理坐标有区别
 		}
-		// !!!每个环上的第一个点和最后一个点位置重合,但是纹理坐标有区别
-	}
+	});
 
-	/// 取索引的思路是遍历每个层和每个切片,运用公式 注意i层和i+1层之间的三角形(公式就是462到471)
-
-	// +1是细节处理,让每个环第一点和最后点重合,但是纹理坐标各异
-	uint32 ringVertexCount = sliceCount+1;
+	/// 取索引的思路是遍历每个层和每个切片,运用公式 注意i层和i+1层之间的三角形
 
 	// 计算每个侧面块里的三角形索引
-	for(uint32 i = 0; i < stackCount; ++i)
-	{
-		for(uint32 j = 0; j < sliceCount; ++j)// 第i层的第j个切片
+	ForEachRow(stackCount, sideVertexCount, [&](int begin, int end) {
+		for(uint32 i = begin; i < (uint32)end; ++i)
 		{
-			meshData.Indices32.push_back(i*ringVertexCount + j);
-			meshData.Indices32.push_back((i+1)*ringVertexCount + j);
-			meshData.Indices32.push_back((i+1)*ringVertexCount + j+1);
-
-			meshData.Indices32.push_back(i*ringVertexCount + j);
-			meshData.Indices32.push_back((i+1)*ringVertexCount + j+1);
-			meshData.Indices32.push_back(i*ringVertexCount + j+1);
+			uint32* row = &meshData.Indices32[6*sliceCount*i];
+			for(uint32 j = 0; j < sliceCount; ++j)// 第i层的第j个切片
+			{
+				*row++ = i*ringVertexCount + j;
+				*row++ = (i+1)*ringVertexCount + j;
+				*row++ = (i+1)*ringVertexCount + j+1;
+
+				*row++ = i*ringVertexCount + j;
+				*row++ = (i+1)*ringVertexCount + j+1;
+				*row++ = i*ringVertexCount + j+1;
+			}
 		}
-	}
+	});
 
-	// 算顶盖和底盖
+	// 算顶盖和底盖(在上面预留好的空间里追加)
 	BuildCylinderTopCap(bottomRadius, topRadius, height, sliceCount, stackCount, meshData);
 	BuildCylinderBottomCap(bottomRadius, topRadius, height, sliceCount, stackCount, meshData);
 
+	Optimize(meshData);
+
     return meshData;
 }
 
@@ -581,22 +681,24 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGrid(float width, float dep
 	float dv = 1.0f / (m-1);
 
 	meshData.Vertices.resize(vertexCount);
-	for(uint32 i = 0; i < m; ++i)
-	{
-		float z = halfDepth - i*dz;
-		for(uint32 j = 0; j < n; ++j)
+	ForEachRow(m, vertexCount, [&](int begin, int end) {
+		for(uint32 i = begin; i < (uint32)end; ++i)
 		{
-			float x = -halfWidth + j*dx;
-
-			meshData.Vertices[i*n+j].Position = XMFLOAT3(x, 0.0f, z);
-			meshData.Vertices[i*n+j].Normal   = XMFLOAT3(0.0f, 1.0f, 0.0f);
-			meshData.Vertices[i*n+j].TangentU = XMFLOAT3(1.0f, 0.0f, 0.0f);
-
-			// 在栅格上拉伸纹理
-			meshData.Vertices[i*n+j].TexC.x = j*du;
-			meshData.Vertices[i*n+j].TexC.y = i*dv;
+			float z = halfDepth - i*dz;
+			for(uint32 j = 0; j < n; ++j)
+			{
+				float x = -halfWidth + j*dx;
+
+				meshData.Vertices[i*n+j].Position = XMFLOAT3(x, 0.0f, z);
+				meshData.Vertices[i*n+j].Normal   = XMFLOAT3(0.0f, 1.0f, 0.0f);
+				meshData.Vertices[i*n+j].TangentU = XMFLOAT3(1.0f, 0.0f, 0.0f);
+
+				// 在栅格上拉伸纹理
+				meshData.Vertices[i*n+j].TexC.x = j*du;
+				meshData.Vertices[i*n+j].TexC.y = i*dv;
+			}
 		}
-	}
+	});
  
     //
 	// 对于一个规模为m * n顶点的栅格来说,四边形中的2个三角形的线性数组索引计算方式如下
@@ -604,23 +706,25 @@ GeometryGenerator::MeshData GeometryGenerator::CreateGrid(float width, float dep
 
 	meshData.Indices32.resize(faceCount*3); // 单三角面有3个索引
 
-	// 遍历每个四边形并计算索引
-	uint32 k = 0;
-	for(uint32 i = 0; i < m-1; ++i)
-	{
-		for(uint32 j = 0; j < n-1; ++j)
+	// 遍历每个四边形并计算索引, 第i行四边形的索引从6*(n-1)*i开始
+	ForEachRow(m-1, vertexCount, [&](int begin, int end) {
+		for(uint32 i = begin; i < (uint32)end; ++i)
 		{
-			meshData.Indices32[k]   = i*n+j;
-			meshData.Indices32[k+1] = i*n+j+1;
-			meshData.Indices32[k+2] = (i+1)*n+j;
-
-			meshData.Indices32[k+3] = (i+1)*n+j;
-			meshData.Indices32[k+4] = i*n+j+1;
-			meshData.Indices32[k+5] = (i+1)*n+j+1;
-
-			k += 6; // 下一个四边形
+			uint32 k = 6*(n-1)*i;
+			for(uint32 j = 0; j < n-1; ++j)
+			{
+				meshData.Indices32[k]   = i*n+j;
+				meshData.Indices32[k+1] = i*n+j+1;
+				meshData.Indices32[k+2] = (i+1)*n+j;
+
+				meshData.Indices32[k+3] = (i+1)*n+j;
+				meshData.Indices32[k+4] = i*n+j+1;
+				meshData.Indices32[k+5] = (i+1)*n+j+1;
+
+				k += 6; // 下一个四边形
+			}
 		}
-	}
+	});
 
     return meshData;
 }
@@ -667,3 +771,12 @@ GeometryGenerator::MeshData GeometryGenerator::CreateQuad(float x, float y, floa
 
     return meshData;
 }
+
+void GeometryGenerator::Optimize(MeshData& meshData)
+{
+	if (!mOptimize)
+		return;
+
+	MeshOptimizer::Optimize(meshData.Vertices.data(), (uint32)meshData.Vertices.size(), sizeof(Vertex), offsetof(Vertex, Position),
+		meshData.Indices32.data(), (uint32)meshData.Indices32.size());
+}
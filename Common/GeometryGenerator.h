@@ -15,12 +15,19 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <DirectXMath.h>
+#include <stdexcept>
 #include <vector>
 
+class ThreadPool;
+
 /* 用户提供参数以自动生成的几何体存入GeometryGenerator类里
 * 它是一个工具类,用于生成栅格,球体,柱体,长方体
-* 此类还可以创建出后续技术要使用的顶点数据,然后存到顶点缓存里*/
+* 此类还可以创建出后续技术要使用的顶点数据,然后存到顶点缓存里
+* SetOptimize(true)后CreateSphere, CreateGeosphere与CreateCylinder返回前会用MeshOptimizer重排三角形与顶点, 默认不重排
+* 各函数先按闭式算出顶点/索引数, 一次分配好输出再按下标填写; 顶点数较多时按行(环)在线程池上并行生成
+* 细分时共享边的中点只生成一次, 一个生成器对象内部的临时表在多次调用间复用, 不同对象可在不同线程上同时使用*/
 class GeometryGenerator
 {
 public:
@@ -63,10 +70,14 @@ public:
 	*/
 	struct MeshData
 	{
-		/* 构建1个uint16型的索引数组*/
+		/* 构建1个uint16型的索引数组
+		* 有索引超过65535时抛出std::out_of_range, 不再静默截断; 先用Fits16判断, 放不下就改用Indices32与DXGI_FORMAT_R32_UINT */
 		std::vector<uint16>& GetIndices16()
 		{
-			if (mIndices16.empty()) 			{
+			if (mIndices16.empty() && !Indices32.empty()) {
+				if (!Fits16())
+					throw std::out_of_range("MeshData::GetIndices16: index exceeds 65535");
+
 				mIndices16.resize(Indices32.size());
 				for (size_t i = 0; i < Indices32.size(); ++i)
 					mIndices16[i] = static_cast<uint16>(Indices32[i]);
@@ -74,6 +85,16 @@ public:
 
 			return mIndices16;
 		}
+
+		// 所有索引都不超过65535, 即可以使用16位索引
+		bool Fits16()const
+		{
+			for (uint32 index : Indices32) {
+				if (index > 0xffff)
+					return false;
+			}
+			return true;
+		}
 	public:
 		std::vector<Vertex> Vertices; // 几何生成器的返回值MeshData里持有1个 顶点数组
 		std::vector<uint32> Indices32;// 几何生成器的返回值MeshData里持有1个 索引数组
@@ -113,10 +134,46 @@ public:
 	///</summary>
 	MeshData CreateQuad(float x, float y, float w, float h, float depth);
 
+	// CreateBox与CreateGeosphere的细分次数上限
+	static const uint32 MaxSubdivisions = 8;
+
+	// 顶点数不少于此值时按行并行生成
+	static const uint32 ParallelVertexThreshold = 16384;
+
+	// 并行生成所用的线程池, 默认为ThreadPool::Default(); 传nullptr恢复默认
+	void SetThreadPool(ThreadPool* pool) { mThreadPool = pool; }
+
+	/* 为true时CreateSphere等返回前调用MeshOptimizer重排(默认false)
+	* 重排的耗时是生成本身的数十倍, 但书中20x20的球体与柱体各约0.4ms, 章节示例都打开; 更密的网格(64x64球体约4ms)宜离线优化(Tools/MeshConverter) */
+	void SetOptimize(bool optimize) { mOptimize = optimize; }
+	bool IsOptimize()const { return mOptimize; }
+
 private:
-	void Subdivide(MeshData& meshData);
+	/* 每个三角形一分为四; 新顶点(边的中点)追加在原顶点之后, 原顶点下标不变
+	* interpolateAttributes为false时只算中点位置, 其余属性由调用方随后重写(测地球体) */
+	void Subdivide(MeshData& meshData, bool interpolateAttributes);
+	// 为细分到finalVertexCount个顶点, finalTriangleCount个三角形一次预留好输出与中点表
+	void ReserveSubdivide(MeshData& meshData, uint32 finalVertexCount, uint32 finalTriangleCount);
+	// 在中点表里查找边ab(不分方向)的中点顶点下标, 没有则分配下标vertexCount并使之加1
+	uint32 EdgeMidpoint(uint32 a, uint32 b, uint32& vertexCount);
+	// 行数为rowCount的生成循环: vertexCount不少于ParallelVertexThreshold时在线程池上并行, 否则直接串行执行
+	void ForEachRow(uint32 rowCount, uint32 vertexCount, const std::function<void(int begin, int end)>& body);
 	Vertex MidPoint(const Vertex& v0, const Vertex& v1);
 	void BuildCylinderTopCap(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount, MeshData& meshData);
 	void BuildCylinderBottomCap(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount, MeshData& meshData);
+
+	/* 按顶点缓存, 过度绘制与取顶点的局部性重排球体, 测地球体与柱体的三角形和顶点(见MeshOptimizer.h)
+	* 只改变顺序, 生成的形状与三角形集合不变 */
+	void Optimize(MeshData& meshData);
+
+private:
+	ThreadPool* mThreadPool = nullptr;
+	bool mOptimize = false;
+
+	/* 边到中点顶点的开放寻址哈希表: 键为(小端点 << 32 | 大端点), 空槽为EmptyEdge; 容量为2的幂 */
+	static const std::uint64_t EmptyEdge = ~0ull;
+	std::vector<std::uint64_t> mEdgeKeys;
+	std::vector<uint32> mEdgeMidpoints;
+	uint32 mEdgeMask = 0;
 };
 
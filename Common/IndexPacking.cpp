@@ -0,0 +1,390 @@
+﻿//***************************************************************************************
+// IndexPacking.cpp
+//***************************************************************************************
+
+#include "IndexPacking.h"
+#include <cstring>
+
+namespace
+{
+	/// 编码格式: 1字节版本号, 之后每个三角形一个首字节, 高4位为边码, 低4位为顶点码
+	///   边码0~14: 三角形的一条边(轮转后为ab)是边FIFO中第几新的边, 只需再编码第3个顶点c(低4位)
+	///   边码15:   没有共享边, 低4位为a的顶点码, 随后一字节的高/低4位分别为b, c的顶点码
+	/// 顶点码: 0为下一个新顶点(next, 之后next加1), 1~14为顶点FIFO中第(码-1)新的顶点,
+	/// 15为显式索引, 在所有码字节之后按顶点顺序跟一个变长整数: 与上一个显式索引之差的zigzag编码
+	const std::uint8_t CodecVersion = 1;
+
+	const int FifoSize = 16;
+	const std::uint32_t NoEdge = 15;
+	const std::uint32_t VertexNext = 0;
+	const std::uint32_t VertexExplicit = 15;
+	const std::uint32_t MaxVertexFifoCode = 14;
+
+	// 编码与解码共用的状态, 两边按完全相同的顺序更新
+	struct CodecState
+	{
+		std::uint32_t EdgeA[FifoSize];
+		std::uint32_t EdgeB[FifoSize];
+		std::uint32_t Vertices[FifoSize];
+		std::uint32_t EdgeHead = 0;
+		std::uint32_t VertexHead = 0;
+		std::uint32_t Next = 0;
+		std::uint32_t Last = 0;
+
+		CodecState()
+		{
+			// 用不可能出现的索引填满, 避免开头几个三角形误匹配
+			std::memset(EdgeA, 0xff, sizeof(EdgeA));
+			std::memset(EdgeB, 0xff, sizeof(EdgeB));
+			std::memset(Vertices, 0xff, sizeof(Vertices));
+		}
+
+		// 第age新的边/顶点, age = 0为最近压入的
+		std::uint32_t EdgeSlot(std::uint32_t age)const { return (EdgeHead - 1 - age) & (FifoSize - 1); }
+		std::uint32_t VertexAt(std::uint32_t age)const { return Vertices[(VertexHead - 1 - age) & (FifoSize - 1)]; }
+
+		void PushEdge(std::uint32_t a, std::uint32_t b)
+		{
+			EdgeA[EdgeHead & (FifoSize - 1)] = a;
+			EdgeB[EdgeHead & (FifoSize - 1)] = b;
+			++EdgeHead;
+		}
+
+		void PushVertex(std::uint32_t v)
+		{
+			Vertices[VertexHead & (FifoSize - 1)] = v;
+			++VertexHead;
+		}
+
+		// 三角形abc之后, 相邻三角形会以相反方向经过它的边, 所以压入反向的边
+		void PushTriangleEdges(std::uint32_t a, std::uint32_t b, std::uint32_t c, bool sharedAB)
+		{
+			if (!sharedAB)
+				PushEdge(b, a);
+			PushEdge(c, b);
+			PushEdge(a, c);
+		}
+	};
+
+	inline std::uint32_t ZigZag(std::uint32_t delta)
+	{
+		return (delta << 1) ^ (std::uint32_t)((std::int32_t)delta >> 31);
+	}
+
+	inline std::uint32_t UnZigZag(std::uint32_t value)
+	{
+		return (value >> 1) ^ (0u - (value & 1));
+	}
+
+	inline bool ReadVarint(const std::uint8_t*& p, const std::uint8_t* end, std::uint32_t& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 35; shift += 7) {
+			if (p == end)
+				return false;
+			const std::uint8_t byte = *p++;
+			value |= (std::uint32_t)(byte & 0x7f) << shift;
+			if ((byte & 0x80) == 0)
+				return shift < 28 || byte < 0x10;// 第5字节只能携带最高4位
+		}
+		return false;
+	}
+
+	// 编码一个顶点: 返回顶点码, 显式索引的变长整数写进extra; 状态的更新与DecodeVertex一致
+	std::uint32_t EncodeVertex(std::uint32_t v, CodecState& state, std::uint8_t* extra, int& extraSize)
+	{
+		if (v == state.Next) {
+			++state.Next;
+			state.PushVertex(v);
+			return VertexNext;
+		}
+
+		for (std::uint32_t age = 0; age < MaxVertexFifoCode; ++age) {
+			if (state.VertexAt(age) == v)
+				return age + 1;
+		}
+
+		std::uint32_t value = ZigZag(v - state.Last);
+		while (value >= 0x80) {
+			extra[extraSize++] = (std::uint8_t)(value | 0x80);
+			value >>= 7;
+		}
+		extra[extraSize++] = (std::uint8_t)value;
+		state.Last = v;
+		state.PushVertex(v);
+		return VertexExplicit;
+	}
+
+	inline bool DecodeVertex(std::uint32_t code, CodecState& state, const std::uint8_t*& p, const std::uint8_t* end, std::uint32_t& v)
+	{
+		if (code == VertexNext) {
+			v = state.Next++;
+			state.PushVertex(v);
+		}
+		else if (code != VertexExplicit) {
+			v = state.VertexAt(code - 1);
+		}
+		else {
+			std::uint32_t value;
+			if (!ReadVarint(p, end, value))
+				return false;
+			v = state.Last + UnZigZag(value);
+			state.Last = v;
+			state.PushVertex(v);
+		}
+		return true;
+	}
+
+	template<typename T>
+	bool DecodeIndices(const std::uint8_t* encoded, size_t byteSize, T* indices, std::uint32_t indexCount)
+	{
+		if (indexCount % 3 != 0 || byteSize < 1 || encoded[0] != CodecVersion)
+			return false;
+
+		const std::uint32_t maxIndex = (std::uint32_t)(T)~T(0);
+		const std::uint8_t* p = encoded + 1;
+		const std::uint8_t* end = encoded + byteSize;
+		CodecState state;
+
+		for (std::uint32_t i = 0; i < indexCount; i += 3) {
+			if (p == end)
+				return false;
+			const std::uint32_t lead = *p++;
+			const std::uint32_t edge = lead >> 4;
+
+			std::uint32_t a, b, c;
+			if (edge != NoEdge) {
+				const std::uint32_t slot = state.EdgeSlot(edge);
+				a = state.EdgeA[slot];
+				b = state.EdgeB[slot];
+				if (!DecodeVertex(lead & 15, state, p, end, c))
+					return false;
+			}
+			else {
+				if (p == end)
+					return false;
+				const std::uint32_t codes = *p++;
+				if (!DecodeVertex(lead & 15, state, p, end, a) ||
+					!DecodeVertex(codes >> 4, state, p, end, b) ||
+					!DecodeVertex(codes & 15, state, p, end, c))
+					return false;
+			}
+			state.PushTriangleEdges(a, b, c, edge != NoEdge);
+
+			if (a > maxIndex || b > maxIndex || c > maxIndex)
+				return false;
+			indices[i + 0] = (T)a;
+			indices[i + 1] = (T)b;
+			indices[i + 2] = (T)c;
+		}
+
+		// 多余的字节说明数据与indexCount不符
+		return p == end;
+	}
+}
+
+bool IndexPacking::Validate(const std::uint32_t* indices, std::uint32_t indexCount,
+	const Range* ranges, std::uint32_t rangeCount, std::uint32_t vertexCount)
+{
+	for (std::uint32_t r = 0; r < rangeCount; ++r) {
+		const Range& range = ranges[r];
+		if (range.IndexCount % 3 != 0 || range.StartIndexLocation > indexCount ||
+			range.IndexCount > indexCount - range.StartIndexLocation)
+			return false;
+
+		const std::int64_t base = range.BaseVertexLocation;
+		const std::uint32_t* first = indices + range.StartIndexLocation;
+		for (std::uint32_t i = 0; i < range.IndexCount; ++i) {
+			const std::int64_t v = base + first[i];
+			if (v < 0 || v >= (std::int64_t)vertexCount)
+				return false;
+		}
+	}
+	return true;
+}
+
+bool IndexPacking::Fits16(const std::uint32_t* indices, const Range* ranges, std::uint32_t rangeCount)
+{
+	for (std::uint32_t r = 0; r < rangeCount; ++r) {
+		const std::uint32_t* first = indices + ranges[r].StartIndexLocation;
+		for (std::uint32_t i = 0; i < ranges[r].IndexCount; ++i) {
+			if (first[i] >= MaxVertices16)
+				return false;
+		}
+	}
+	return true;
+}
+
+bool IndexPacking::Split16(const std::uint32_t* indices, const Range& range,
+	std::vector<std::uint32_t>& outIndices, std::vector<Range>& outRanges)
+{
+	const size_t oldIndexCount = outIndices.size();
+	const size_t oldRangeCount = outRanges.size();
+	const std::uint32_t* first = indices + range.StartIndexLocation;
+
+	/// 按三角形顺序贪心地扩大当前块的顶点窗口[windowMin, windowMax], 跨度超出16位时另起一块
+	std::uint32_t chunkStart = 0;
+	std::uint32_t windowMin = 0xffffffff;
+	std::uint32_t windowMax = 0;
+	auto closeChunk = [&](std::uint32_t chunkEnd) {
+		Range chunk;
+		chunk.IndexCount = chunkEnd - chunkStart;
+		chunk.StartIndexLocation = (std::uint32_t)outIndices.size();
+		chunk.BaseVertexLocation = range.BaseVertexLocation + (std::int32_t)windowMin;
+		for (std::uint32_t i = chunkStart; i < chunkEnd; ++i)
+			outIndices.push_back(first[i] - windowMin);
+		outRanges.push_back(chunk);
+	};
+
+	for (std::uint32_t i = 0; i + 2 < range.IndexCount; i += 3) {
+		const std::uint32_t a = first[i], b = first[i + 1], c = first[i + 2];
+		const std::uint32_t triMin = (a < b) ? ((a < c) ? a : c) : ((b < c) ? b : c);
+		const std::uint32_t triMax = (a > b) ? ((a > c) ? a : c) : ((b > c) ? b : c);
+		if (triMax - triMin >= MaxVertices16) {
+			outIndices.resize(oldIndexCount);
+			outRanges.resize(oldRangeCount);
+			return false;
+		}
+
+		const std::uint32_t newMin = (triMin < windowMin) ? triMin : windowMin;
+		const std::uint32_t newMax = (triMax > windowMax) ? triMax : windowMax;
+		if (i > chunkStart && newMax - newMin >= MaxVertices16) {
+			closeChunk(i);
+			chunkStart = i;
+			windowMin = triMin;
+			windowMax = triMax;
+		}
+		else {
+			windowMin = newMin;
+			windowMax = newMax;
+		}
+	}
+	if (range.IndexCount > chunkStart)
+		closeChunk(range.IndexCount);
+
+	return true;
+}
+
+bool IndexPacking::Build(const std::uint32_t* indices, std::uint32_t indexCount,
+	const Range* ranges, std::uint32_t rangeCount, std::uint32_t vertexCount, bool allowSplit, Buffer& buffer)
+{
+	buffer = Buffer();
+	if (!Validate(indices, indexCount, ranges, rangeCount, vertexCount))
+		return false;
+
+	// 不切分时各段参数原样保留, 整个索引数组按所选格式输出
+	auto keepLayout = [&](bool index16) {
+		buffer.Index16 = index16;
+		buffer.Ranges.assign(ranges, ranges + rangeCount);
+		buffer.FirstRange.resize(rangeCount + 1);
+		for (std::uint32_t r = 0; r <= rangeCount; ++r)
+			buffer.FirstRange[r] = r;
+
+		buffer.Data.resize((size_t)indexCount * buffer.IndexSize());
+		if (index16) {
+			// 不属于任何子网格的索引不会被绘制, 一并截断即可
+			std::uint16_t* dst = reinterpret_cast<std::uint16_t*>(buffer.Data.data());
+			for (std::uint32_t i = 0; i < indexCount; ++i)
+				dst[i] = (std::uint16_t)indices[i];
+		}
+		else if (indexCount > 0) {
+			std::memcpy(buffer.Data.data(), indices, (size_t)indexCount * sizeof(std::uint32_t));
+		}
+	};
+
+	if (Fits16(indices, ranges, rangeCount)) {
+		keepLayout(true);
+		return true;
+	}
+	if (!allowSplit) {
+		keepLayout(false);
+		return true;
+	}
+
+	/// 逐个子网格重新排布: 放得下的原样拷贝, 放不下的切块; 只要有一个切不开就退回32位
+	std::vector<std::uint32_t> packed;
+	packed.reserve(indexCount);
+	buffer.FirstRange.push_back(0);
+	for (std::uint32_t r = 0; r < rangeCount; ++r) {
+		if (Fits16(indices, &ranges[r], 1)) {
+			Range range = ranges[r];
+			range.StartIndexLocation = (std::uint32_t)packed.size();
+			packed.insert(packed.end(), indices + ranges[r].StartIndexLocation,
+				indices + ranges[r].StartIndexLocation + ranges[r].IndexCount);
+			buffer.Ranges.push_back(range);
+		}
+		else if (!Split16(indices, ranges[r], packed, buffer.Ranges)) {
+			buffer = Buffer();
+			keepLayout(false);
+			return true;
+		}
+		buffer.FirstRange.push_back((std::uint32_t)buffer.Ranges.size());
+	}
+
+	buffer.Index16 = true;
+	buffer.Data.resize(packed.size() * sizeof(std::uint16_t));
+	std::uint16_t* dst = reinterpret_cast<std::uint16_t*>(buffer.Data.data());
+	for (size_t i = 0; i < packed.size(); ++i)
+		dst[i] = (std::uint16_t)packed[i];
+	return true;
+}
+
+void IndexPacking::Encode(const std::uint32_t* indices, std::uint32_t indexCount, std::vector<std::uint8_t>& encoded)
+{
+	encoded.reserve(encoded.size() + EncodeBound(indexCount));
+	encoded.push_back(CodecVersion);
+
+	CodecState state;
+	std::uint8_t extra[3 * 5];
+	for (std::uint32_t i = 0; i + 2 < indexCount; i += 3) {
+		std::uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+
+		/// 在边FIFO里找三角形的某条边, 找到则把三角形轮转成以该边开头(绕序不变)
+		std::uint32_t edge = NoEdge;
+		for (std::uint32_t age = 0; age < NoEdge && edge == NoEdge; ++age) {
+			const std::uint32_t slot = state.EdgeSlot(age);
+			const std::uint32_t ea = state.EdgeA[slot], eb = state.EdgeB[slot];
+			if (ea == a && eb == b)
+				edge = age;
+			else if (ea == b && eb == c) {
+				edge = age;
+				const std::uint32_t t = a; a = b; b = c; c = t;
+			}
+			else if (ea == c && eb == a) {
+				edge = age;
+				const std::uint32_t t = c; c = b; b = a; a = t;
+			}
+		}
+
+		int extraSize = 0;
+		if (edge != NoEdge) {
+			const std::uint32_t codeC = EncodeVertex(c, state, extra, extraSize);
+			encoded.push_back((std::uint8_t)((edge << 4) | codeC));
+		}
+		else {
+			const std::uint32_t codeA = EncodeVertex(a, state, extra, extraSize);
+			const std::uint32_t codeB = EncodeVertex(b, state, extra, extraSize);
+			const std::uint32_t codeC = EncodeVertex(c, state, extra, extraSize);
+			encoded.push_back((std::uint8_t)((NoEdge << 4) | codeA));
+			encoded.push_back((std::uint8_t)((codeB << 4) | codeC));
+		}
+		encoded.insert(encoded.end(), extra, extra + extraSize);
+		state.PushTriangleEdges(a, b, c, edge != NoEdge);
+	}
+}
+
+size_t IndexPacking::EncodeBound(std::uint32_t indexCount)
+{
+	// 每个三角形最多2个码字节与3个5字节的变长整数
+	return 1 + (size_t)(indexCount / 3) * (2 + 3 * 5);
+}
+
+bool IndexPacking::Decode(const std::uint8_t* encoded, size_t byteSize, std::uint32_t* indices, std::uint32_t indexCount)
+{
+	return DecodeIndices(encoded, byteSize, indices, indexCount);
+}
+
+bool IndexPacking::Decode(const std::uint8_t* encoded, size_t byteSize, std::uint16_t* indices, std::uint32_t indexCount)
+{
+	return DecodeIndices(encoded, byteSize, indices, indexCount);
+}
@@ -0,0 +1,85 @@
+﻿//***************************************************************************************
+// IndexPacking.h
+//
+// 索引缓冲区的格式选择, 校验与压缩.
+//   Build    为一组子网格(SubmeshGeometry的绘制参数)生成索引缓冲区: 先校验每段索引都落在顶点范围内,
+//            各段相对BaseVertexLocation的索引都不超过65535时用16位索引, 否则可把超出的子网格切成若干段,
+//            每段引用的顶点落在65536个连续顶点的窗口内, 段内索引改为相对窗口起点, 不复制顶点
+//   Encode/Decode  三角形列表的无损压缩编码, 用于磁盘上的网格文件(见MeshFile); 解码只做逐字节的查表与比较,
+//            重排过顶点缓存顺序的网格(见MeshOptimizer)每个三角形约1~2字节, 即16位索引的1/4左右
+// 本文件不依赖D3D.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class IndexPacking
+{
+public:
+	/* 一段索引, 与SubmeshGeometry的绘制参数一致 */
+	struct Range
+	{
+		std::uint32_t IndexCount = 0;
+		std::uint32_t StartIndexLocation = 0;
+		std::int32_t BaseVertexLocation = 0;
+	};
+
+	/* Build的结果
+	* Data即索引缓冲区的内容, 可直接交给D3DCreateBlob/CreateDefaultBuffer, 格式为Index16 ? R16_UINT : R32_UINT
+	* 第i个输入子网格对应Ranges[FirstRange[i], FirstRange[i + 1]), 没有切分时恰好一段, 且StartIndexLocation与输入相同 */
+	struct Buffer
+	{
+		bool Index16 = false;
+		std::vector<std::uint8_t> Data;
+		std::vector<Range> Ranges;
+		std::vector<std::uint32_t> FirstRange;// rangeCount + 1项
+
+		std::uint32_t IndexSize()const { return Index16 ? 2u : 4u; }
+		std::uint32_t IndexCount()const { return (std::uint32_t)(Data.size() / IndexSize()); }
+		std::uint32_t RangeCount(std::uint32_t submesh)const { return FirstRange[submesh + 1] - FirstRange[submesh]; }
+	};
+
+	// 16位索引能表示的顶点数
+	static const std::uint32_t MaxVertices16 = 65536;
+
+public:
+	/* 校验ranges: 每段落在indices[0, indexCount)内, IndexCount为3的倍数,
+	* 且段内每个索引加上BaseVertexLocation都落在[0, vertexCount)内 */
+	static bool Validate(const std::uint32_t* indices, std::uint32_t indexCount,
+		const Range* ranges, std::uint32_t rangeCount, std::uint32_t vertexCount);
+
+	/* 每段的索引(相对各自的BaseVertexLocation)都不超过65535, 即整个缓冲区可以用16位索引 */
+	static bool Fits16(const std::uint32_t* indices, const Range* ranges, std::uint32_t rangeCount);
+
+	/* 把一段索引按三角形顺序切成若干块, 每块引用的顶点都落在MaxVertices16个连续顶点的窗口内
+	* 块内索引改为相对窗口起点(追加到outIndices), BaseVertexLocation加上窗口起点(追加到outRanges)
+	* 顶点按首次使用顺序排好(MeshOptimizer::OptimizeVertexFetch)时窗口最紧凑, 块数最少
+	* 有单个三角形的顶点跨度就超过65535时返回false, 此时outIndices/outRanges不变 */
+	static bool Split16(const std::uint32_t* indices, const Range& range,
+		std::vector<std::uint32_t>& outIndices, std::vector<Range>& outRanges);
+
+	/* 为ranges所指的子网格生成索引缓冲区, 会替换buffer之前的内容:
+	*  1. Validate失败时返回false
+	*  2. Fits16时把全部索引窄化为16位, 各段参数不变
+	*  3. 否则allowSplit为true时对放不下的子网格调用Split16, 切分后全部可用16位时输出16位索引
+	*  4. 仍放不下(或不允许切分)时保持32位索引, 各段参数不变
+	* 切分会让一个子网格变成多次绘制, 只有能逐段绘制的调用方才应打开allowSplit */
+	static bool Build(const std::uint32_t* indices, std::uint32_t indexCount,
+		const Range* ranges, std::uint32_t rangeCount, std::uint32_t vertexCount, bool allowSplit, Buffer& buffer);
+
+	/* 压缩一个三角形列表(indexCount为3的倍数), 结果追加到encoded之后
+	* 解码得到的三角形顺序与绕序都不变, 但三角形内的3个顶点可能被轮转(例如abc变为bca),
+	* 只在依赖首顶点(provoking vertex)的nointerpolation属性上有区别 */
+	static void Encode(const std::uint32_t* indices, std::uint32_t indexCount, std::vector<std::uint8_t>& encoded);
+
+	// Encode输出的最大字节数
+	static size_t EncodeBound(std::uint32_t indexCount);
+
+	/* 解码出indexCount个索引; 数据被截断, 损坏或与indexCount不符时返回false
+	* 16位版本另在有索引超过65535时返回false */
+	static bool Decode(const std::uint8_t* encoded, size_t byteSize, std::uint32_t* indices, std::uint32_t indexCount);
+	static bool Decode(const std::uint8_t* encoded, size_t byteSize, std::uint16_t* indices, std::uint32_t indexCount);
+};
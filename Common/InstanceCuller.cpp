@@ -0,0 +1,433 @@
+﻿//***************************************************************************************
+// InstanceCuller.cpp
+//***************************************************************************************
+
+#include "InstanceCuller.h"
+#include "CpuFeatures.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	/* 各平面的法线、法线分量的绝对值与d, 按分量拆开以便广播到SIMD寄存器
+	* 包围盒在平面法线上的投影半径 = |a|*ex + |b|*ey + |c|*ez */
+	struct PlaneSet
+	{
+		float Nx[InstanceCuller::PlaneCount];
+		float Ny[InstanceCuller::PlaneCount];
+		float Nz[InstanceCuller::PlaneCount];
+		float Ax[InstanceCuller::PlaneCount];
+		float Ay[InstanceCuller::PlaneCount];
+		float Az[InstanceCuller::PlaneCount];
+		float D[InstanceCuller::PlaneCount];
+	};
+
+	struct BoundsView
+	{
+		const float* CenterX;
+		const float* CenterY;
+		const float* CenterZ;
+		const float* ExtentX;
+		const float* ExtentY;
+		const float* ExtentZ;
+	};
+
+	PlaneSet MakePlaneSet(const InstanceCuller::Frustum& frustum)
+	{
+		PlaneSet planes;
+		for (int p = 0; p < InstanceCuller::PlaneCount; ++p) {
+			const XMFLOAT4& plane = frustum.Planes[p];
+			planes.Nx[p] = plane.x;
+			planes.Ny[p] = plane.y;
+			planes.Nz[p] = plane.z;
+			planes.Ax[p] = std::fabs(plane.x);
+			planes.Ay[p] = std::fabs(plane.y);
+			planes.Az[p] = std::fabs(plane.z);
+			planes.D[p] = plane.w;
+		}
+		return planes;
+	}
+
+	/* 剔除[begin, end), 可见序号写入visible, 返回个数
+	* 各内核的运算顺序相同且不用FMA, 结果逐位一致 */
+	typedef std::uint32_t(*CullFn)(const PlaneSet& planes, const BoundsView& bounds,
+		std::uint32_t begin, std::uint32_t end, std::uint32_t* visible);
+
+	std::uint32_t CullScalar(const PlaneSet& planes, const BoundsView& bounds,
+		std::uint32_t begin, std::uint32_t end, std::uint32_t* visible)
+	{
+		std::uint32_t n = 0;
+		for (std::uint32_t i = begin; i < end; ++i) {
+			bool outside = false;
+			for (int p = 0; p < InstanceCuller::PlaneCount; ++p) {
+				const float dist = planes.Nx[p]*bounds.CenterX[i] + planes.Ny[p]*bounds.CenterY[i] + planes.Nz[p]*bounds.CenterZ[i] + planes.D[p];
+				const float radius = planes.Ax[p]*bounds.ExtentX[i] + planes.Ay[p]*bounds.ExtentY[i] + planes.Az[p]*bounds.ExtentZ[i];
+				outside |= dist > radius;
+			}
+
+			// 无分支地写出: 总是写入, 可见时才前移
+			visible[n] = i;
+			n += outside ? 0 : 1;
+		}
+		return n;
+	}
+
+#if defined(CPU_X86)
+	/* 紧凑输出用的查找表, 以可见掩码为下标:
+	* Lanes4[m]为4路掩码m中可见通道的序号(按升序排在前面), Lanes8[m]把8路的序号每个占4位打包成一个整数,
+	* Count8[m]为掩码中1的个数. SIMD内核据此一次写出一组序号, 再按可见数前移 */
+	struct CompactTable
+	{
+		alignas(16) std::int32_t Lanes4[16][4];
+		std::uint32_t Lanes8[256];
+		std::uint8_t Count8[256];
+
+		CompactTable()
+		{
+			for (int m = 0; m < 256; ++m) {
+				int count = 0;
+				Lanes8[m] = 0;
+				for (int k = 0; k < 8; ++k) {
+					if ((m >> k) & 1)
+						Lanes8[m] |= (std::uint32_t)k << (4 * count++);
+				}
+				Count8[m] = (std::uint8_t)count;
+			}
+
+			for (int m = 0; m < 16; ++m) {
+				int count = 0;
+				for (int k = 0; k < 4; ++k)
+					Lanes4[m][k] = 0;
+				for (int k = 0; k < 4; ++k) {
+					if ((m >> k) & 1)
+						Lanes4[m][count++] = k;
+				}
+			}
+		}
+	};
+
+	const CompactTable& GetCompactTable()
+	{
+		static const CompactTable table;
+		return table;
+	}
+
+	CPU_TARGET_SSE4 std::uint32_t CullSSE4(const PlaneSet& planes, const BoundsView& bounds,
+		std::uint32_t begin, std::uint32_t end, std::uint32_t* visible)
+	{
+		const CompactTable& table = GetCompactTable();
+		std::uint32_t n = 0;
+		std::uint32_t i = begin;
+		for (; i + 4 <= end; i += 4) {
+			const __m128 cx = _mm_loadu_ps(bounds.CenterX + i);
+			const __m128 cy = _mm_loadu_ps(bounds.CenterY + i);
+			const __m128 cz = _mm_loadu_ps(bounds.CenterZ + i);
+			const __m128 ex = _mm_loadu_ps(bounds.ExtentX + i);
+			const __m128 ey = _mm_loadu_ps(bounds.ExtentY + i);
+			const __m128 ez = _mm_loadu_ps(bounds.ExtentZ + i);
+
+			__m128 outside = _mm_setzero_ps();
+			for (int p = 0; p < InstanceCuller::PlaneCount; ++p) {
+				const __m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(_mm_set1_ps(planes.Nx[p]), cx),
+					_mm_mul_ps(_mm_set1_ps(planes.Ny[p]), cy)),
+					_mm_mul_ps(_mm_set1_ps(planes.Nz[p]), cz)),
+					_mm_set1_ps(planes.D[p]));
+				const __m128 radius = _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(_mm_set1_ps(planes.Ax[p]), ex),
+					_mm_mul_ps(_mm_set1_ps(planes.Ay[p]), ey)),
+					_mm_mul_ps(_mm_set1_ps(planes.Az[p]), ez));
+				outside = _mm_or_ps(outside, _mm_cmpgt_ps(dist, radius));
+			}
+
+			// 总是写满4个序号, 只前移可见的个数; n不超过i - begin, 所以不会写出visible的count个元素之外
+			const unsigned mask = ~(unsigned)_mm_movemask_ps(outside) & 0xf;
+			const __m128i lanes = _mm_load_si128(reinterpret_cast<const __m128i*>(table.Lanes4[mask]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(visible + n), _mm_add_epi32(lanes, _mm_set1_epi32((int)i)));
+			n += table.Count8[mask];
+		}
+
+		return n + CullScalar(planes, bounds, i, end, visible + n);
+	}
+
+	CPU_TARGET_AVX2 std::uint32_t CullAVX2(const PlaneSet& planes, const BoundsView& bounds,
+		std::uint32_t begin, std::uint32_t end, std::uint32_t* visible)
+	{
+		const CompactTable& table = GetCompactTable();
+		const __m256i shifts = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+		const __m256i laneMask = _mm256_set1_epi32(7);
+		std::uint32_t n = 0;
+		std::uint32_t i = begin;
+		for (; i + 8 <= end; i += 8) {
+			const __m256 cx = _mm256_loadu_ps(bounds.CenterX + i);
+			const __m256 cy = _mm256_loadu_ps(bounds.CenterY + i);
+			const __m256 cz = _mm256_loadu_ps(bounds.CenterZ + i);
+			const __m256 ex = _mm256_loadu_ps(bounds.ExtentX + i);
+			const __m256 ey = _mm256_loadu_ps(bounds.ExtentY + i);
+			const __m256 ez = _mm256_loadu_ps(bounds.ExtentZ + i);
+
+			__m256 outside = _mm256_setzero_ps();
+			for (int p = 0; p < InstanceCuller::PlaneCount; ++p) {
+				const __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+					_mm256_mul_ps(_mm256_set1_ps(planes.Nx[p]), cx),
+					_mm256_mul_ps(_mm256_set1_ps(planes.Ny[p]), cy)),
+					_mm256_mul_ps(_mm256_set1_ps(planes.Nz[p]), cz)),
+					_mm256_set1_ps(planes.D[p]));
+				const __m256 radius = _mm256_add_ps(_mm256_add_ps(
+					_mm256_mul_ps(_mm256_set1_ps(planes.Ax[p]), ex),
+					_mm256_mul_ps(_mm256_set1_ps(planes.Ay[p]), ey)),
+					_mm256_mul_ps(_mm256_set1_ps(planes.Az[p]), ez));
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(dist, radius, _CMP_GT_OQ));
+			}
+
+			// 把打包的通道序号展开到8个32位通道, 写满8个, 只前移可见的个数
+			const unsigned mask = ~(unsigned)_mm256_movemask_ps(outside) & 0xff;
+			const __m256i lanes = _mm256_and_si256(_mm256_srlv_epi32(_mm256_set1_epi32((int)table.Lanes8[mask]), shifts), laneMask);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(visible + n), _mm256_add_epi32(lanes, _mm256_set1_epi32((int)i)));
+			n += table.Count8[mask];
+		}
+
+		return n + CullScalar(planes, bounds, i, end, visible + n);
+	}
+#endif
+
+	CullFn GetCullFn(InstanceCuller::Kernel kernel)
+	{
+		switch (kernel) {
+#if defined(CPU_X86)
+		case InstanceCuller::Kernel::SSE4: return CullSSE4;
+		case InstanceCuller::Kernel::AVX2: return CullAVX2;
+#endif
+		default: return CullScalar;
+		}
+	}
+}
+
+InstanceCuller::InstanceCuller()
+{
+	mKernel = BestKernel();
+	mThreadPool = &ThreadPool::Default();
+}
+
+void InstanceCuller::Resize(std::uint32_t count)
+{
+	mCount = count;
+	mCenterX.resize(count, 0.0f);
+	mCenterY.resize(count, 0.0f);
+	mCenterZ.resize(count, 0.0f);
+	mExtentX.resize(count, 0.0f);
+	mExtentY.resize(count, 0.0f);
+	mExtentZ.resize(count, 0.0f);
+}
+
+void InstanceCuller::SetBounds(std::uint32_t index, const BoundingBox& worldBounds)
+{
+	mCenterX[index] = worldBounds.Center.x;
+	mCenterY[index] = worldBounds.Center.y;
+	mCenterZ[index] = worldBounds.Center.z;
+	mExtentX[index] = worldBounds.Extents.x;
+	mExtentY[index] = worldBounds.Extents.y;
+	mExtentZ[index] = worldBounds.Extents.z;
+}
+
+void InstanceCuller::SetBounds(std::uint32_t index, const BoundingBox& localBounds, FXMMATRIX world)
+{
+	BoundingBox worldBounds;
+	localBounds.Transform(worldBounds, world);
+	SetBounds(index, worldBounds);
+}
+
+BoundingBox InstanceCuller::GetBounds(std::uint32_t index)const
+{
+	return BoundingBox(
+		XMFLOAT3(mCenterX[index], mCenterY[index], mCenterZ[index]),
+		XMFLOAT3(mExtentX[index], mExtentY[index], mExtentZ[index]));
+}
+
+BoundingBox InstanceCuller::GetChunkBounds(std::uint32_t chunk)const
+{
+	const std::uint32_t first = chunk * ChunkSize;
+	const std::uint32_t last = std::min(mCount, first + ChunkSize);
+
+	XMFLOAT3 vMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 vMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (std::uint32_t i = first; i < last; ++i) {
+		vMin.x = std::min(vMin.x, mCenterX[i] - mExtentX[i]);
+		vMin.y = std::min(vMin.y, mCenterY[i] - mExtentY[i]);
+		vMin.z = std::min(vMin.z, mCenterZ[i] - mExtentZ[i]);
+		vMax.x = std::max(vMax.x, mCenterX[i] + mExtentX[i]);
+		vMax.y = std::max(vMax.y, mCenterY[i] + mExtentY[i]);
+		vMax.z = std::max(vMax.z, mCenterZ[i] + mExtentZ[i]);
+	}
+
+	BoundingBox bounds;
+	BoundingBox::CreateFromPoints(bounds, XMLoadFloat3(&vMin), XMLoadFloat3(&vMax));
+	return bounds;
+}
+
+InstanceCuller::Frustum InstanceCuller::MakeFrustum(const BoundingFrustum& worldFrustum)
+{
+	XMVECTOR planes[PlaneCount];
+	worldFrustum.GetPlanes(&planes[0], &planes[1], &planes[2], &planes[3], &planes[4], &planes[5]);
+
+	Frustum frustum;
+	for (int p = 0; p < PlaneCount; ++p)
+		XMStoreFloat4(&frustum.Planes[p], planes[p]);
+	return frustum;
+}
+
+std::uint32_t InstanceCuller::Cull(const Frustum& frustum, std::uint32_t first, std::uint32_t count, std::uint32_t* visible)const
+{
+	if (count == 0)
+		return 0;
+
+	const PlaneSet planes = MakePlaneSet(frustum);
+	const BoundsView bounds = {
+		mCenterX.data(), mCenterY.data(), mCenterZ.data(),
+		mExtentX.data(), mExtentY.data(), mExtentZ.data() };
+	return GetCullFn(mKernel)(planes, bounds, first, first + count, visible);
+}
+
+std::uint32_t InstanceCuller::CullList(const Frustum& frustum, const std::uint32_t* candidates, std::uint32_t count, std::uint32_t* visible)const
+{
+	// 候选通常只是少数与视锥体边界相交的实例, 按序号逐个取出包围盒用标量测试即可
+	const PlaneSet planes = MakePlaneSet(frustum);
+	std::uint32_t n = 0;
+	for (std::uint32_t k = 0; k < count; ++k) {
+		const std::uint32_t i = candidates[k];
+		bool outside = false;
+		for (int p = 0; p < PlaneCount; ++p) {
+			const float dist = planes.Nx[p]*mCenterX[i] + planes.Ny[p]*mCenterY[i] + planes.Nz[p]*mCenterZ[i] + planes.D[p];
+			const float radius = planes.Ax[p]*mExtentX[i] + planes.Ay[p]*mExtentY[i] + planes.Az[p]*mExtentZ[i];
+			outside |= dist > radius;
+		}
+
+		// n <= k, 就地压缩时不会覆盖尚未读取的候选
+		visible[n] = i;
+		n += outside ? 0 : 1;
+	}
+	return n;
+}
+
+std::uint32_t InstanceCuller::CullParallel(const Frustum& frustum, std::uint32_t* visible, const EmitFunc& emit, const FilterFunc& filter)
+{
+	return CullChunks(frustum, nullptr, visible, emit, filter);
+}
+
+std::uint32_t InstanceCuller::CullChunks(const Frustum& frustum, const ContainmentType* chunkContainment, std::uint32_t* visible,
+	const EmitFunc& emit, const FilterFunc& filter)
+{
+	const int chunkCount = (int)ChunkCount();
+	mChunkCounts.resize(chunkCount);
+
+	// 第一遍: 各段分别剔除, 结果写在暂存区中本段自己的位置
+	mThreadPool->ParallelFor(0, chunkCount, 1, [&](int chunkBegin, int chunkEnd)
+	{
+		for (int c = chunkBegin; c < chunkEnd; ++c) {
+			const ContainmentType containment = chunkContainment ? chunkContainment[c] : INTERSECTS;
+			const std::uint32_t first = (std::uint32_t)c * ChunkSize;
+			const std::uint32_t count = std::min(mCount - first, (std::uint32_t)ChunkSize);
+			std::uint32_t visibleCount = 0;
+			if (containment == CONTAINS) {
+				for (std::uint32_t k = 0; k < count; ++k)
+					visible[first + k] = first + k;
+				visibleCount = count;
+			}
+			else if (containment == INTERSECTS) {
+				visibleCount = Cull(frustum, first, count, visible + first);
+			}
+
+			if (filter && visibleCount > 0)
+				visibleCount = filter(visible + first, visibleCount);
+			mChunkCounts[c] = visibleCount;
+		}
+	});
+
+	return EmitChunks(visible, mCount, emit);
+}
+
+std::uint32_t InstanceCuller::EmitParallel(std::uint32_t* visible, std::uint32_t count, const EmitFunc& emit, const FilterFunc& filter)
+{
+	const int chunkCount = (int)((count + ChunkSize - 1) / ChunkSize);
+	mChunkCounts.resize(chunkCount);
+
+	mThreadPool->ParallelFor(0, chunkCount, 1, [&](int chunkBegin, int chunkEnd)
+	{
+		for (int c = chunkBegin; c < chunkEnd; ++c) {
+			const std::uint32_t first = (std::uint32_t)c * ChunkSize;
+			std::uint32_t visibleCount = std::min(count - first, (std::uint32_t)ChunkSize);
+			if (filter && visibleCount > 0)
+				visibleCount = filter(visible + first, visibleCount);
+			mChunkCounts[c] = visibleCount;
+		}
+	});
+
+	return EmitChunks(visible, count, emit);
+}
+
+std::uint32_t InstanceCuller::EmitChunks(const std::uint32_t* visible, std::uint32_t itemCount, const EmitFunc& emit)
+{
+	const int chunkCount = (int)((itemCount + ChunkSize - 1) / ChunkSize);
+
+	// 各段可见数的排他前缀和即各段的输出起点; 段数只有实例数的1/ChunkSize, 串行求即可
+	std::uint32_t total = 0;
+	for (int c = 0; c < chunkCount; ++c) {
+		const std::uint32_t count = mChunkCounts[c];
+		mChunkCounts[c] = total;
+		total += count;
+	}
+
+	// 第二遍: 各段把可见实例写到自己的输出区间
+	mThreadPool->ParallelFor(0, chunkCount, 1, [&](int chunkBegin, int chunkEnd)
+	{
+		for (int c = chunkBegin; c < chunkEnd; ++c) {
+			const std::uint32_t slot = mChunkCounts[c];
+			const std::uint32_t count = ((c + 1 < chunkCount) ? mChunkCounts[c + 1] : total) - slot;
+			if (count > 0)
+				emit(visible + (std::uint32_t)c * ChunkSize, count, slot);
+		}
+	});
+
+	return total;
+}
+
+void InstanceCuller::SetThreadPool(ThreadPool* pool)
+{
+	mThreadPool = (pool != nullptr) ? pool : &ThreadPool::Default();
+}
+
+bool InstanceCuller::IsKernelSupported(Kernel kernel)
+{
+	switch (kernel) {
+	case Kernel::Scalar:
+		return true;
+	case Kernel::SSE4:
+		return GetCpuFeatures().SSE41;
+	case Kernel::AVX2:
+		return GetCpuFeatures().AVX2;
+	default:
+		return false;
+	}
+}
+
+InstanceCuller::Kernel InstanceCuller::BestKernel()
+{
+	if (IsKernelSupported(Kernel::AVX2))
+		return Kernel::AVX2;
+	if (IsKernelSupported(Kernel::SSE4))
+		return Kernel::SSE4;
+	return Kernel::Scalar;
+}
+
+bool InstanceCuller::SetKernel(Kernel kernel)
+{
+	if (!IsKernelSupported(kernel))
+		return false;
+
+	mKernel = kernel;
+	return true;
+}
@@ -0,0 +1,133 @@
+﻿//***************************************************************************************
+// InstanceCuller.h
+//
+// 大量实例的视锥体剔除. 每个实例存一个世界空间的轴对齐包围盒(中心与半长), 按分量拆成SoA数组;
+// 剔除时直接用世界空间的视锥体平面测试, 不必再为每个实例求逆矩阵、把视锥体变换到局部空间.
+// 测试有Scalar/SSE4/AVX2内核(每条指令4/8个实例), 输出可见实例序号的紧凑列表.
+// CullParallel把实例分段交给线程池, 按各段可见数的前缀和分配输出位置, 各线程写互不重叠的区间;
+// CullChunks另外接受各段与视锥体的关系, 整段在外的跳过, 整段在内的不再测试.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+class ThreadPool;
+
+class InstanceCuller
+{
+public:
+	// 剔除内核
+	enum class Kernel
+	{
+		Scalar,
+		SSE4,	// x86/x64, 每条指令处理4个实例
+		AVX2	// x86/x64, 每条指令处理8个实例
+	};
+
+	/* 视锥体的6个平面(a, b, c, d), 法线(a, b, c)已归一化且指向视锥体外:
+	* 点p在平面内侧即a*p.x + b*p.y + c*p.z + d <= 0, 与BoundingFrustum::GetPlanes一致 */
+	static const int PlaneCount = 6;
+	struct Frustum
+	{
+		DirectX::XMFLOAT4 Planes[PlaneCount];
+	};
+
+	// CullParallel每段(每个并行任务)的实例数
+	static const std::uint32_t ChunkSize = 4096;
+
+	/* CullParallel的输出回调: visible为一段实例中可见实例的序号(升序), 依次对应输出的第firstSlot, firstSlot + 1, ...个位置
+	* 各段的输出区间互不重叠, 回调会在多个线程上同时执行 */
+	using EmitFunc = std::function<void(const std::uint32_t* visible, std::uint32_t count, std::uint32_t firstSlot)>;
+
+	/* CullParallel的过滤回调: 就地去掉visible中通过视锥体测试但仍不需要的实例(例如被遮挡的), 保持升序, 返回剩下的个数
+	* 在第一遍中对每段调用, 也会在多个线程上同时执行 */
+	using FilterFunc = std::function<std::uint32_t(std::uint32_t* visible, std::uint32_t count)>;
+
+public:
+	InstanceCuller();
+	InstanceCuller(const InstanceCuller& rhs) = delete;
+	InstanceCuller& operator=(const InstanceCuller& rhs) = delete;
+
+	// 设置实例数, 新增实例的包围盒为空(中心在原点, 半长为0)
+	void Resize(std::uint32_t count);
+	std::uint32_t Count()const { return mCount; }
+
+	// 第index个实例的世界空间包围盒
+	void SetBounds(std::uint32_t index, const DirectX::BoundingBox& worldBounds);
+	DirectX::BoundingBox GetBounds(std::uint32_t index)const;
+
+	/* 由局部空间的包围盒与世界矩阵设置: 取变换后8个角点的轴对齐包围盒(BoundingBox::Transform)
+	* 只有平移与等比缩放时与原包围盒一样紧, 有旋转时会略大, 剔除结果仍是保守的 */
+	void SetBounds(std::uint32_t index, const DirectX::BoundingBox& localBounds, DirectX::FXMMATRIX world);
+
+	// 取世界空间视锥体的平面; 视锥体可由观察空间的mCamFrustum经Transform(invView)得到
+	static Frustum MakeFrustum(const DirectX::BoundingFrustum& worldFrustum);
+
+	/* 剔除[first, first + count)内的实例, 把与视锥体不相离的实例序号按升序写入visible, 返回写入的个数
+	* visible须能容纳count个元素. 包围盒完全位于某个平面外侧即判为不可见,
+	* 与BoundingFrustum::Contains(box) != DISJOINT的平面测试相同 */
+	std::uint32_t Cull(const Frustum& frustum, std::uint32_t first, std::uint32_t count, std::uint32_t* visible)const;
+	std::uint32_t Cull(const Frustum& frustum, std::uint32_t* visible)const { return Cull(frustum, 0, mCount, visible); }
+
+	/* 并行剔除全部实例: 每ChunkSize个实例一段, 各线程先分别剔除各段, 再按各段可见数的前缀和
+	* 求出每段在输出中的起始位置, 然后并行地对每段调用emit; 返回可见实例总数
+	* 所有可见实例的输出位置与Cull的紧凑列表完全相同(按序号升序)
+	* visible为剔除用的暂存区, 须能容纳Count()个元素; 其中第k段的结果从visible + k * ChunkSize开始, 不是紧凑列表
+	* filter不为空时, 各段剔除后再经它过滤, 输出位置按过滤后的个数分配 */
+	std::uint32_t CullParallel(const Frustum& frustum, std::uint32_t* visible, const EmitFunc& emit, const FilterFunc& filter = nullptr);
+
+	/* 同CullParallel, 但调用方已知各段与视锥体的关系(例如由各段包围盒的空间索引查得), chunkContainment每段一项:
+	* DISJOINT的段整段跳过, CONTAINS的段不必测试、全部实例直接可见, 只有INTERSECTS的段用Cull逐个测试
+	* 输出顺序与CullParallel相同, 不必再排序; chunkContainment为空时每段都按INTERSECTS处理 */
+	std::uint32_t CullChunks(const Frustum& frustum, const DirectX::ContainmentType* chunkContainment, std::uint32_t* visible,
+		const EmitFunc& emit, const FilterFunc& filter = nullptr);
+
+	// 段数, 即CullChunks的chunkContainment所需的项数
+	std::uint32_t ChunkCount()const { return (mCount + ChunkSize - 1) / ChunkSize; }
+	// 第chunk段全部实例包围盒的并集, 可登记进空间索引, 每段一个代理
+	DirectX::BoundingBox GetChunkBounds(std::uint32_t chunk)const;
+
+	/* 只剔除candidates中列出的count个实例(例如空间索引查出的与视锥体相交的实例), 测试同Cull
+	* 可见的序号按candidates中的顺序写入visible, 返回个数; visible可以就是candidates */
+	std::uint32_t CullList(const Frustum& frustum, const std::uint32_t* candidates, std::uint32_t count, std::uint32_t* visible)const;
+
+	/* 对已有的可见实例列表做CullParallel的后半部分: 每ChunkSize个一段, 先经filter就地过滤(filter为空则不过滤),
+	* 再按各段剩余个数的前缀和分配输出位置并行调用emit; 返回输出的总数. visible中的序号会被过滤改写 */
+	std::uint32_t EmitParallel(std::uint32_t* visible, std::uint32_t count, const EmitFunc& emit, const FilterFunc& filter = nullptr);
+
+	// 并行剔除所用的线程池, 默认为ThreadPool::Default(); 传nullptr恢复默认
+	void SetThreadPool(ThreadPool* pool);
+
+	// 当前CPU能否运行指定内核
+	static bool IsKernelSupported(Kernel kernel);
+	// 当前CPU支持的最快内核, 构造时默认使用
+	static Kernel BestKernel();
+
+	// 切换内核; CPU不支持时返回false, 保持原内核不变
+	bool SetKernel(Kernel kernel);
+	Kernel GetKernel()const { return mKernel; }
+
+private:
+	std::uint32_t mCount = 0;
+
+	// 包围盒中心与半长的各分量平面
+	std::vector<float> mCenterX;
+	std::vector<float> mCenterY;
+	std::vector<float> mCenterZ;
+	std::vector<float> mExtentX;
+	std::vector<float> mExtentY;
+	std::vector<float> mExtentZ;
+
+	Kernel mKernel = Kernel::Scalar;
+
+	// visible按ChunkSize分段, 共itemCount个; mChunkCounts已存有各段的可见数: 就地改为各段的输出起点, 再并行地对每段调用emit; 返回可见总数
+	std::uint32_t EmitChunks(const std::uint32_t* visible, std::uint32_t itemCount, const EmitFunc& emit);
+
+	ThreadPool* mThreadPool = nullptr;
+	std::vector<std::uint32_t> mChunkCounts;// CullParallel中各段的可见数, 随后就地改为各段的输出起点
+};
@@ -0,0 +1,94 @@
+﻿//***************************************************************************************
+// LodSelector.cpp
+//***************************************************************************************
+
+#include "LodSelector.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+LodSelector::LodSelector()
+	: mEyePos(0.0f, 0.0f, 0.0f)
+{
+	for (int i = 0; i < MaxLods - 1; ++i)
+		mThresholds[i] = 0.0f;
+}
+
+void LodSelector::SetThresholds(const float* thresholds, int lodCount)
+{
+	mLodCount = std::min(std::max(lodCount, 1), MaxLods);
+	for (int i = 0; i < mLodCount - 1; ++i)
+		mThresholds[i] = thresholds[i];
+	std::fill(mLods.begin(), mLods.end(), (std::uint8_t)0);
+}
+
+void LodSelector::Resize(std::uint32_t count)
+{
+	mLods.resize(count, 0);
+}
+
+void LodSelector::BeginFrame(const XMFLOAT3& eyePos, float projScaleY)
+{
+	mEyePos = eyePos;
+	mProjScaleY = projScaleY;
+}
+
+float LodSelector::ProjectedSize(const BoundingSphere& sphere)const
+{
+	const float dx = sphere.Center.x - mEyePos.x;
+	const float dy = sphere.Center.y - mEyePos.y;
+	const float dz = sphere.Center.z - mEyePos.z;
+	const float distance = std::sqrt(dx*dx + dy*dy + dz*dz);
+	if (distance <= sphere.Radius)
+		return FLT_MAX;
+
+	return sphere.Radius * mProjScaleY / distance;
+}
+
+int LodSelector::LodForSize(float size)const
+{
+	int lod = 0;
+	while (lod < mLodCount - 1 && size <= mThresholds[lod])
+		++lod;
+	return lod;
+}
+
+int LodSelector::Select(std::uint32_t instance, const BoundingSphere& sphere)
+{
+	const float size = ProjectedSize(sphere);
+	int lod = mLods[instance];
+
+	// 当前级别的区间向两侧各放宽滞后比例, 仍在区间内就保持不变
+	const float upper = (lod == 0) ? FLT_MAX : mThresholds[lod - 1] * (1.0f + mHysteresis);
+	const float lower = (lod >= mLodCount - 1) ? 0.0f : mThresholds[lod] * (1.0f - mHysteresis);
+	if (size > upper || size <= lower) {
+		lod = LodForSize(size);
+		mLods[instance] = (std::uint8_t)lod;
+	}
+	return lod;
+}
+
+void LodSelector::Bucket(const std::uint32_t* instances, std::uint32_t count, std::uint32_t* sorted,
+	std::uint32_t bucketStart[MaxLods], std::uint32_t bucketCount[MaxLods])const
+{
+	// 计数排序: 先数出每级的实例数, 前缀和即各桶起点, 再按原顺序放入
+	for (int l = 0; l < MaxLods; ++l)
+		bucketCount[l] = 0;
+	for (std::uint32_t i = 0; i < count; ++i)
+		++bucketCount[mLods[instances[i]]];
+
+	std::uint32_t next[MaxLods];
+	std::uint32_t offset = 0;
+	for (int l = 0; l < MaxLods; ++l) {
+		bucketStart[l] = offset;
+		next[l] = offset;
+		offset += bucketCount[l];
+	}
+
+	for (std::uint32_t i = 0; i < count; ++i) {
+		const std::uint32_t instance = instances[i];
+		sorted[next[mLods[instance]]++] = instance;
+	}
+}
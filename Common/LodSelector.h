@@ -0,0 +1,73 @@
+﻿//***************************************************************************************
+// LodSelector.h
+//
+// 按屏幕上的投影大小为每个实例选择细节层次(LOD), 并把可见实例按LOD分桶, 使同一LOD的实例在实例buffer里连续,
+// 每级LOD只需一次DrawIndexedInstanced.
+// 投影大小取包围球半径在屏幕上所占的比例: 半径 * 投影矩阵的_22 / 距离, 1表示占满半个屏幕高度.
+// 相邻两级之间的阈值两侧各留一段滞后区间(hysteresis): 实例只有越过区间才切换, 在阈值附近来回移动时不会每帧跳变.
+// 每个实例的当前LOD各存一个字节; 不同实例的选择互不相关, 可以分给多个线程同时进行.
+// 不依赖D3D.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+class LodSelector
+{
+public:
+	static const int MaxLods = 8;
+
+public:
+	LodSelector();
+	LodSelector(const LodSelector& rhs) = delete;
+	LodSelector& operator=(const LodSelector& rhs) = delete;
+
+	/* 设定LOD级数与切换阈值: thresholds有lodCount - 1个, 须严格递减
+	* 投影大小大于thresholds[0]用第0级(最精细), 在(thresholds[i], thresholds[i - 1]]内用第i级, 不大于最后一个阈值用最粗的一级
+	* 所有实例回到第0级; lodCount会被限制在[1, MaxLods] */
+	void SetThresholds(const float* thresholds, int lodCount);
+	int LodCount()const { return mLodCount; }
+	float GetThreshold(int index)const { return mThresholds[index]; }
+
+	// 滞后区间占阈值的比例, 默认0.1: 变粗须小于阈值 * (1 - h), 变细须大于阈值 * (1 + h)
+	void SetHysteresis(float fraction) { mHysteresis = fraction; }
+	float GetHysteresis()const { return mHysteresis; }
+
+	// 实例数; 新实例从第0级开始
+	void Resize(std::uint32_t count);
+	std::uint32_t Count()const { return (std::uint32_t)mLods.size(); }
+
+	/* 每帧开始选择前设定相机位置与投影矩阵的_22(即1 / tan(fovY / 2)) */
+	void BeginFrame(const DirectX::XMFLOAT3& eyePos, float projScaleY);
+
+	/* 包围球的投影大小; 相机在球内时返回FLT_MAX */
+	float ProjectedSize(const DirectX::BoundingSphere& sphere)const;
+
+	/* 按投影大小为第instance个实例选择LOD并记下, 返回所选的级别
+	* 可在多个线程上同时调用, 只要各线程处理的实例互不重复 */
+	int Select(std::uint32_t instance, const DirectX::BoundingSphere& sphere);
+	int GetLod(std::uint32_t instance)const { return mLods[instance]; }
+
+	/* 把instances中的实例序号按当前LOD稳定地分桶写入sorted(不能与instances重叠):
+	* 第l级的实例位于sorted[bucketStart[l], bucketStart[l] + bucketCount[l]), 桶内保持原有顺序 */
+	void Bucket(const std::uint32_t* instances, std::uint32_t count, std::uint32_t* sorted,
+		std::uint32_t bucketStart[MaxLods], std::uint32_t bucketCount[MaxLods])const;
+
+private:
+	// 不考虑滞后时投影大小对应的级别
+	int LodForSize(float size)const;
+
+private:
+	int mLodCount = 1;
+	float mThresholds[MaxLods - 1];
+	float mHysteresis = 0.1f;
+
+	DirectX::XMFLOAT3 mEyePos;
+	float mProjScaleY = 1.0f;
+
+	std::vector<std::uint8_t> mLods;
+};
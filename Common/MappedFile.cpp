@@ -0,0 +1,159 @@
+﻿//***************************************************************************************
+// MappedFile.cpp
+//***************************************************************************************
+
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string& filename)
+{
+	return Map(filename.c_str(), false);
+}
+
+bool MappedFile::Open(const std::wstring& filename)
+{
+#if defined(_WIN32)
+	return Map(filename.c_str(), true);
+#else
+	// 按UTF-8编码宽字符路径
+	std::string utf8;
+	for (wchar_t ch : filename) {
+		const std::uint32_t c = (std::uint32_t)ch;
+		if (c < 0x80)
+			utf8 += (char)c;
+		else if (c < 0x800) {
+			utf8 += (char)(0xc0 | (c >> 6));
+			utf8 += (char)(0x80 | (c & 0x3f));
+		}
+		else if (c < 0x10000) {
+			utf8 += (char)(0xe0 | (c >> 12));
+			utf8 += (char)(0x80 | ((c >> 6) & 0x3f));
+			utf8 += (char)(0x80 | (c & 0x3f));
+		}
+		else {
+			utf8 += (char)(0xf0 | (c >> 18));
+			utf8 += (char)(0x80 | ((c >> 12) & 0x3f));
+			utf8 += (char)(0x80 | ((c >> 6) & 0x3f));
+			utf8 += (char)(0x80 | (c & 0x3f));
+		}
+	}
+	return Map(utf8.c_str(), false);
+#endif
+}
+
+bool MappedFile::Map(const void* filename, bool wide)
+{
+	Close();
+	mErrorCode = 0;
+
+#if defined(_WIN32)
+	HANDLE file = wide
+		? CreateFileW(static_cast<const wchar_t*>(filename), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr)
+		: CreateFileA(static_cast<const char*>(filename), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		mErrorCode = GetLastError();
+		return false;
+	}
+
+	LARGE_INTEGER fileSize = {};
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0 ||
+		(unsigned long long)fileSize.QuadPart > (size_t)-1) {
+		mErrorCode = (fileSize.QuadPart == 0) ? ERROR_HANDLE_EOF : GetLastError();
+		CloseHandle(file);
+		return false;
+	}
+
+	// 视图建好后文件与映射对象的句柄即可关闭, 视图本身会保持对它们的引用
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	const void* view = (mapping != nullptr) ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (view == nullptr)
+		mErrorCode = GetLastError();
+	if (mapping != nullptr)
+		CloseHandle(mapping);
+	CloseHandle(file);
+	if (view == nullptr)
+		return false;
+
+	mData = static_cast<const std::uint8_t*>(view);
+	mSize = (size_t)fileSize.QuadPart;
+#else
+	(void)wide;
+	errno = 0;
+	int fd = ::open(static_cast<const char*>(filename), O_RDONLY);
+	if (fd < 0) {
+		mErrorCode = (unsigned long)errno;
+		return false;
+	}
+
+	struct stat st;
+	if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+		mErrorCode = (errno != 0) ? (unsigned long)errno : (unsigned long)EINVAL;
+		::close(fd);
+		return false;
+	}
+
+	// 映射建好后即可关闭文件描述符
+	void* view = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED)
+		mErrorCode = (unsigned long)errno;
+	::close(fd);
+	if (view == MAP_FAILED)
+		return false;
+
+	mData = static_cast<const std::uint8_t*>(view);
+	mSize = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::Touch()const
+{
+	Touch(0, mSize);
+}
+
+void MappedFile::Touch(size_t offset, size_t size)const
+{
+	if (offset >= mSize)
+		return;
+	if (size > mSize - offset)
+		size = mSize - offset;
+
+	// 按最小的4KB页步进, 每页读一个字节; volatile防止读取被优化掉
+	const size_t PageSize = 4096;
+	volatile std::uint8_t sink = 0;
+	for (size_t at = offset - offset % PageSize; at < offset + size; at += PageSize)
+		sink ^= mData[at];
+	(void)sink;
+}
+
+void MappedFile::Close()
+{
+	if (mData != nullptr) {
+#if defined(_WIN32)
+		UnmapViewOfFile(mData);
+#else
+		::munmap(const_cast<std::uint8_t*>(mData), mSize);
+#endif
+	}
+	mData = nullptr;
+	mSize = 0;
+}
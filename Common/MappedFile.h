@@ -0,0 +1,50 @@
+﻿//***************************************************************************************
+// MappedFile.h
+//
+// 只读地把整个文件映射进内存(Windows上为CreateFileMapping/MapViewOfFile, 其它平台为mmap).
+// 映射后数据按需由操作系统分页读入, 不经过ReadFile拷贝到堆内存; Data()在Close()或析构之前有效.
+// 本文件不依赖D3D, 工作线程上的纹理加载(TextureLoader)与离线工具共用.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile& rhs) = delete;
+	MappedFile& operator=(const MappedFile& rhs) = delete;
+	~MappedFile();
+
+	/* 映射整个文件, 会先关闭之前的映射; 文件不存在或为空时返回false, ErrorCode()为系统错误码
+	* 宽字符版本在非Windows平台上按UTF-8转换路径 */
+	bool Open(const std::string& filename);
+	bool Open(const std::wstring& filename);
+	void Close();
+
+	bool IsOpen()const { return mData != nullptr; }
+
+	const std::uint8_t* Data()const { return mData; }
+	size_t Size()const { return mSize; }
+
+	/* 逐页读一遍整个文件, 让缺页(磁盘读取)发生在调用线程上; 在工作线程上调用后,
+	* 之后别的线程再拷贝Data()时就不必等待磁盘 */
+	void Touch()const;
+	// 只预读[offset, offset + size)所在的页, 超出文件的部分忽略
+	void Touch(size_t offset, size_t size)const;
+
+	// 上一次Open失败时的GetLastError() / errno, 成功时为0
+	unsigned long ErrorCode()const { return mErrorCode; }
+
+private:
+	bool Map(const void* filename, bool wide);
+
+private:
+	const std::uint8_t* mData = nullptr;
+	size_t mSize = 0;
+	unsigned long mErrorCode = 0;
+};
@@ -0,0 +1,722 @@
+﻿//***************************************************************************************
+// MeshBvh.cpp
+//***************************************************************************************
+
+#include "MeshBvh.h"
+#include "CpuFeatures.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+using namespace DirectX;
+
+namespace
+{
+	// 分桶SAH每个轴的桶数
+	const int BinCount = 16;
+	// 遍历一个内部节点的代价, 以一次三角形求交为单位
+	const float TraversalCost = 1.0f;
+
+	struct Box
+	{
+		float Min[3] = { +FLT_MAX, +FLT_MAX, +FLT_MAX };
+		float Max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		void Grow(const float p[3])
+		{
+			for (int a = 0; a < 3; ++a) {
+				Min[a] = std::min(Min[a], p[a]);
+				Max[a] = std::max(Max[a], p[a]);
+			}
+		}
+
+		void Grow(const Box& b)
+		{
+			for (int a = 0; a < 3; ++a) {
+				Min[a] = std::min(Min[a], b.Min[a]);
+				Max[a] = std::max(Max[a], b.Max[a]);
+			}
+		}
+
+		// 表面积的一半; 空盒为0
+		float HalfArea()const
+		{
+			if (Min[0] > Max[0])
+				return 0.0f;
+			const float dx = Max[0] - Min[0];
+			const float dy = Max[1] - Min[1];
+			const float dz = Max[2] - Min[2];
+			return dx*dy + dy*dz + dz*dx;
+		}
+	};
+
+	// 建树时每个三角形的临时数据
+	struct BuildTriangle
+	{
+		float V[3][3];
+		Box Bounds;
+		float Centroid[3];
+		std::uint32_t Id;
+	};
+
+	struct BuildTask
+	{
+		std::uint32_t Node;
+		std::uint32_t Begin;
+		std::uint32_t End;
+		int Depth;
+	};
+
+	// 三角形质心落在哪个桶
+	inline int BinIndex(const BuildTriangle& t, int axis, float minCentroid, float scale)
+	{
+		return std::min(BinCount - 1, (int)((t.Centroid[axis] - minCentroid) * scale));
+	}
+
+	// 射线进入包围盒时的t, 不相交或进入点不在[0, tMax]内时返回FLT_MAX
+	inline float RayBox(const float* boxMin, const float* boxMax, const float o[3], const float invD[3], float tMax)
+	{
+		float t1 = (boxMin[0] - o[0]) * invD[0];
+		float t2 = (boxMax[0] - o[0]) * invD[0];
+		float tNear = std::min(t1, t2);
+		float tFar = std::max(t1, t2);
+
+		t1 = (boxMin[1] - o[1]) * invD[1];
+		t2 = (boxMax[1] - o[1]) * invD[1];
+		tNear = std::max(tNear, std::min(t1, t2));
+		tFar = std::min(tFar, std::max(t1, t2));
+
+		t1 = (boxMin[2] - o[2]) * invD[2];
+		t2 = (boxMax[2] - o[2]) * invD[2];
+		tNear = std::max(tNear, std::min(t1, t2));
+		tFar = std::min(tFar, std::max(t1, t2));
+
+		tNear = std::max(tNear, 0.0f);
+		tFar = std::min(tFar, tMax);
+		return (tNear <= tFar) ? tNear : FLT_MAX;
+	}
+
+	// 方向分量为0时用极小值代替, 避免0 * inf产生NaN
+	inline float SafeReciprocal(float d)
+	{
+		return 1.0f / ((std::fabs(d) > 1e-20f) ? d : 1e-20f);
+	}
+
+	/* Moller-Trumbore射线三角形求交, 两面都可命中; 交点t须在[0, tMax)内
+	* 各SIMD内核的运算顺序与此相同且不用FMA, 结果逐位一致 */
+	inline bool RayTriangle(const float o[3], const float d[3], const float* v0, const float* e1, const float* e2,
+		float tMax, float& t, float& u, float& v)
+	{
+		const float p[3] = { d[1]*e2[2] - d[2]*e2[1], d[2]*e2[0] - d[0]*e2[2], d[0]*e2[1] - d[1]*e2[0] };
+		const float det = e1[0]*p[0] + e1[1]*p[1] + e1[2]*p[2];
+		if (det == 0.0f)
+			return false;
+
+		const float invDet = 1.0f / det;
+		const float s[3] = { o[0] - v0[0], o[1] - v0[1], o[2] - v0[2] };
+		u = (s[0]*p[0] + s[1]*p[1] + s[2]*p[2]) * invDet;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+
+		const float q[3] = { s[1]*e1[2] - s[2]*e1[1], s[2]*e1[0] - s[0]*e1[2], s[0]*e1[1] - s[1]*e1[0] };
+		v = (d[0]*q[0] + d[1]*q[1] + d[2]*q[2]) * invDet;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+
+		t = (e2[0]*q[0] + e2[1]*q[1] + e2[2]*q[2]) * invDet;
+		return t >= 0.0f && t < tMax;
+	}
+
+	/* 成包查询的射线, SoA排布; 不足PacketWidth条时多出的通道TMax为-1, 永远不会命中 */
+	struct alignas(32) RayPacket
+	{
+		float Ox[MeshBvh::PacketWidth];
+		float Oy[MeshBvh::PacketWidth];
+		float Oz[MeshBvh::PacketWidth];
+		float Dx[MeshBvh::PacketWidth];
+		float Dy[MeshBvh::PacketWidth];
+		float Dz[MeshBvh::PacketWidth];
+		float InvDx[MeshBvh::PacketWidth];
+		float InvDy[MeshBvh::PacketWidth];
+		float InvDz[MeshBvh::PacketWidth];
+		float TMax[MeshBvh::PacketWidth];// 各射线目前最近的交点, 即查询上限
+		float U[MeshBvh::PacketWidth];
+		float V[MeshBvh::PacketWidth];
+		std::uint32_t Triangle[MeshBvh::PacketWidth];
+	};
+
+	/* 包围盒内核: 返回与盒相交的射线掩码(第k位对应第k条射线), tNear为其中最小的进入t */
+	typedef unsigned(*PacketBoxFn)(const RayPacket& packet, const float* boxMin, const float* boxMax, float& tNear);
+
+	/* 三角形内核: 整包射线与一个三角形求交, 比TMax更近的交点写回TMax/U/V/Triangle */
+	typedef void(*PacketTriangleFn)(RayPacket& packet, const float* v0, const float* e1, const float* e2, std::uint32_t id);
+
+	unsigned PacketBoxScalar(const RayPacket& packet, const float* boxMin, const float* boxMax, float& tNear)
+	{
+		unsigned mask = 0;
+		tNear = FLT_MAX;
+		for (int k = 0; k < MeshBvh::PacketWidth; ++k) {
+			const float o[3] = { packet.Ox[k], packet.Oy[k], packet.Oz[k] };
+			const float invD[3] = { packet.InvDx[k], packet.InvDy[k], packet.InvDz[k] };
+			const float t = RayBox(boxMin, boxMax, o, invD, packet.TMax[k]);
+			if (t != FLT_MAX) {
+				mask |= 1u << k;
+				tNear = std::min(tNear, t);
+			}
+		}
+		return mask;
+	}
+
+	void PacketTriangleScalar(RayPacket& packet, const float* v0, const float* e1, const float* e2, std::uint32_t id)
+	{
+		for (int k = 0; k < MeshBvh::PacketWidth; ++k) {
+			const float o[3] = { packet.Ox[k], packet.Oy[k], packet.Oz[k] };
+			const float d[3] = { packet.Dx[k], packet.Dy[k], packet.Dz[k] };
+			float t, u, v;
+			if (RayTriangle(o, d, v0, e1, e2, packet.TMax[k], t, u, v)) {
+				packet.TMax[k] = t;
+				packet.U[k] = u;
+				packet.V[k] = v;
+				packet.Triangle[k] = id;
+			}
+		}
+	}
+
+#if defined(CPU_X86)
+	CPU_TARGET_SSE4 unsigned PacketBoxSSE4(const RayPacket& packet, const float* boxMin, const float* boxMax, float& tNear)
+	{
+		const __m128 minX = _mm_set1_ps(boxMin[0]), minY = _mm_set1_ps(boxMin[1]), minZ = _mm_set1_ps(boxMin[2]);
+		const __m128 maxX = _mm_set1_ps(boxMax[0]), maxY = _mm_set1_ps(boxMax[1]), maxZ = _mm_set1_ps(boxMax[2]);
+		const __m128 miss = _mm_set1_ps(FLT_MAX);
+
+		unsigned mask = 0;
+		__m128 nearest = miss;
+		for (int k = 0; k < MeshBvh::PacketWidth; k += 4) {
+			const __m128 ox = _mm_load_ps(packet.Ox + k);
+			const __m128 invDx = _mm_load_ps(packet.InvDx + k);
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(minX, ox), invDx);
+			__m128 t2 = _mm_mul_ps(_mm_sub_ps(maxX, ox), invDx);
+			__m128 tn = _mm_min_ps(t1, t2);
+			__m128 tf = _mm_max_ps(t1, t2);
+
+			const __m128 oy = _mm_load_ps(packet.Oy + k);
+			const __m128 invDy = _mm_load_ps(packet.InvDy + k);
+			t1 = _mm_mul_ps(_mm_sub_ps(minY, oy), invDy);
+			t2 = _mm_mul_ps(_mm_sub_ps(maxY, oy), invDy);
+			tn = _mm_max_ps(tn, _mm_min_ps(t1, t2));
+			tf = _mm_min_ps(tf, _mm_max_ps(t1, t2));
+
+			const __m128 oz = _mm_load_ps(packet.Oz + k);
+			const __m128 invDz = _mm_load_ps(packet.InvDz + k);
+			t1 = _mm_mul_ps(_mm_sub_ps(minZ, oz), invDz);
+			t2 = _mm_mul_ps(_mm_sub_ps(maxZ, oz), invDz);
+			tn = _mm_max_ps(tn, _mm_min_ps(t1, t2));
+			tf = _mm_min_ps(tf, _mm_max_ps(t1, t2));
+
+			tn = _mm_max_ps(tn, _mm_setzero_ps());
+			tf = _mm_min_ps(tf, _mm_load_ps(packet.TMax + k));
+			const __m128 hit = _mm_cmple_ps(tn, tf);
+			mask |= (unsigned)_mm_movemask_ps(hit) << k;
+			nearest = _mm_min_ps(nearest, _mm_blendv_ps(miss, tn, hit));
+		}
+
+		nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+		nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+		tNear = _mm_cvtss_f32(nearest);
+		return mask;
+	}
+
+	CPU_TARGET_SSE4 void PacketTriangleSSE4(RayPacket& packet, const float* v0, const float* e1, const float* e2, std::uint32_t id)
+	{
+		const __m128 v0x = _mm_set1_ps(v0[0]), v0y = _mm_set1_ps(v0[1]), v0z = _mm_set1_ps(v0[2]);
+		const __m128 e1x = _mm_set1_ps(e1[0]), e1y = _mm_set1_ps(e1[1]), e1z = _mm_set1_ps(e1[2]);
+		const __m128 e2x = _mm_set1_ps(e2[0]), e2y = _mm_set1_ps(e2[1]), e2z = _mm_set1_ps(e2[2]);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 ids = _mm_castsi128_ps(_mm_set1_epi32((int)id));
+
+		for (int k = 0; k < MeshBvh::PacketWidth; k += 4) {
+			const __m128 dx = _mm_load_ps(packet.Dx + k);
+			const __m128 dy = _mm_load_ps(packet.Dy + k);
+			const __m128 dz = _mm_load_ps(packet.Dz + k);
+
+			const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+			const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+			const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+			const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+			const __m128 invDet = _mm_div_ps(one, det);
+
+			const __m128 sx = _mm_sub_ps(_mm_load_ps(packet.Ox + k), v0x);
+			const __m128 sy = _mm_sub_ps(_mm_load_ps(packet.Oy + k), v0y);
+			const __m128 sz = _mm_sub_ps(_mm_load_ps(packet.Oz + k), v0z);
+			const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), invDet);
+
+			const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+			const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+			const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+			const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+			const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+			const __m128 tMax = _mm_load_ps(packet.TMax + k);
+			__m128 hit = _mm_cmpneq_ps(det, zero);
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmple_ps(u, one)));
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(_mm_add_ps(u, v), one)));
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, tMax)));
+			if (_mm_movemask_ps(hit) == 0)
+				continue;
+
+			__m128i* triangle = reinterpret_cast<__m128i*>(packet.Triangle + k);
+			_mm_store_ps(packet.TMax + k, _mm_blendv_ps(tMax, t, hit));
+			_mm_store_ps(packet.U + k, _mm_blendv_ps(_mm_load_ps(packet.U + k), u, hit));
+			_mm_store_ps(packet.V + k, _mm_blendv_ps(_mm_load_ps(packet.V + k), v, hit));
+			_mm_store_si128(triangle, _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(_mm_load_si128(triangle)), ids, hit)));
+		}
+	}
+
+	CPU_TARGET_AVX2 unsigned PacketBoxAVX2(const RayPacket& packet, const float* boxMin, const float* boxMax, float& tNear)
+	{
+		const __m256 ox = _mm256_load_ps(packet.Ox);
+		const __m256 invDx = _mm256_load_ps(packet.InvDx);
+		__m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMin[0]), ox), invDx);
+		__m256 t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMax[0]), ox), invDx);
+		__m256 tn = _mm256_min_ps(t1, t2);
+		__m256 tf = _mm256_max_ps(t1, t2);
+
+		const __m256 oy = _mm256_load_ps(packet.Oy);
+		const __m256 invDy = _mm256_load_ps(packet.InvDy);
+		t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMin[1]), oy), invDy);
+		t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMax[1]), oy), invDy);
+		tn = _mm256_max_ps(tn, _mm256_min_ps(t1, t2));
+		tf = _mm256_min_ps(tf, _mm256_max_ps(t1, t2));
+
+		const __m256 oz = _mm256_load_ps(packet.Oz);
+		const __m256 invDz = _mm256_load_ps(packet.InvDz);
+		t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMin[2]), oz), invDz);
+		t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(boxMax[2]), oz), invDz);
+		tn = _mm256_max_ps(tn, _mm256_min_ps(t1, t2));
+		tf = _mm256_min_ps(tf, _mm256_max_ps(t1, t2));
+
+		tn = _mm256_max_ps(tn, _mm256_setzero_ps());
+		tf = _mm256_min_ps(tf, _mm256_load_ps(packet.TMax));
+		const __m256 hit = _mm256_cmp_ps(tn, tf, _CMP_LE_OQ);
+
+		__m256 nearest = _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), tn, hit);
+		__m128 half = _mm_min_ps(_mm256_castps256_ps128(nearest), _mm256_extractf128_ps(nearest, 1));
+		half = _mm_min_ps(half, _mm_shuffle_ps(half, half, _MM_SHUFFLE(2, 3, 0, 1)));
+		half = _mm_min_ps(half, _mm_shuffle_ps(half, half, _MM_SHUFFLE(1, 0, 3, 2)));
+		tNear = _mm_cvtss_f32(half);
+		return (unsigned)_mm256_movemask_ps(hit);
+	}
+
+	CPU_TARGET_AVX2 void PacketTriangleAVX2(RayPacket& packet, const float* v0, const float* e1, const float* e2, std::uint32_t id)
+	{
+		const __m256 e1x = _mm256_set1_ps(e1[0]), e1y = _mm256_set1_ps(e1[1]), e1z = _mm256_set1_ps(e1[2]);
+		const __m256 e2x = _mm256_set1_ps(e2[0]), e2y = _mm256_set1_ps(e2[1]), e2z = _mm256_set1_ps(e2[2]);
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 one = _mm256_set1_ps(1.0f);
+
+		const __m256 dx = _mm256_load_ps(packet.Dx);
+		const __m256 dy = _mm256_load_ps(packet.Dy);
+		const __m256 dz = _mm256_load_ps(packet.Dz);
+
+		const __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+		const __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+		const __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+		const __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+		const __m256 invDet = _mm256_div_ps(one, det);
+
+		const __m256 sx = _mm256_sub_ps(_mm256_load_ps(packet.Ox), _mm256_set1_ps(v0[0]));
+		const __m256 sy = _mm256_sub_ps(_mm256_load_ps(packet.Oy), _mm256_set1_ps(v0[1]));
+		const __m256 sz = _mm256_sub_ps(_mm256_load_ps(packet.Oz), _mm256_set1_ps(v0[2]));
+		const __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+
+		const __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+		const __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+		const __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+		const __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+		const __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+		const __m256 tMax = _mm256_load_ps(packet.TMax);
+		__m256 hit = _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ);
+		hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+		hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ), _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+		hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GE_OQ), _mm256_cmp_ps(t, tMax, _CMP_LT_OQ)));
+		if (_mm256_movemask_ps(hit) == 0)
+			return;
+
+		__m256i* triangle = reinterpret_cast<__m256i*>(packet.Triangle);
+		_mm256_store_ps(packet.TMax, _mm256_blendv_ps(tMax, t, hit));
+		_mm256_store_ps(packet.U, _mm256_blendv_ps(_mm256_load_ps(packet.U), u, hit));
+		_mm256_store_ps(packet.V, _mm256_blendv_ps(_mm256_load_ps(packet.V), v, hit));
+		_mm256_store_si256(triangle, _mm256_blendv_epi8(_mm256_load_si256(triangle), _mm256_set1_epi32((int)id), _mm256_castps_si256(hit)));
+	}
+#endif
+
+	struct PacketKernels
+	{
+		PacketBoxFn Box;
+		PacketTriangleFn Triangle;
+	};
+
+	PacketKernels GetPacketKernels(MeshBvh::Kernel kernel)
+	{
+		switch (kernel) {
+#if defined(CPU_X86)
+		case MeshBvh::Kernel::SSE4: return { PacketBoxSSE4, PacketTriangleSSE4 };
+		case MeshBvh::Kernel::AVX2: return { PacketBoxAVX2, PacketTriangleAVX2 };
+#endif
+		default: return { PacketBoxScalar, PacketTriangleScalar };
+		}
+	}
+}
+
+MeshBvh::MeshBvh()
+{
+	mKernel = BestKernel();
+}
+
+void MeshBvh::Build(const Source& source, const std::vector<Range>& ranges)
+{
+	mNodes.clear();
+	mTriangles.clear();
+	mDepth = 0;
+
+	// 收集三角形的顶点, 包围盒与质心
+	size_t triangleCount = 0;
+	for (const Range& range : ranges)
+		triangleCount += range.IndexCount / 3;
+	std::vector<BuildTriangle> triangles;
+	triangles.reserve(triangleCount);
+
+	const std::uint8_t* vertices = static_cast<const std::uint8_t*>(source.Vertices);
+	auto index = [&source](std::uint32_t i) -> std::uint32_t {
+		return source.Index16 ? static_cast<const std::uint16_t*>(source.Indices)[i] : static_cast<const std::uint32_t*>(source.Indices)[i];
+	};
+
+	for (const Range& range : ranges) {
+		for (std::uint32_t k = 0; k + 3 <= range.IndexCount; k += 3) {
+			const std::uint32_t first = range.StartIndexLocation + k;
+
+			BuildTriangle t;
+			for (int c = 0; c < 3; ++c) {
+				const std::uint32_t v = (std::uint32_t)((std::int64_t)index(first + c) + range.BaseVertexLocation);
+				assert(v < source.VertexCount);
+				std::memcpy(t.V[c], vertices + (size_t)v * source.VertexStride + source.PositionOffset, sizeof(float) * 3);
+				t.Bounds.Grow(t.V[c]);
+			}
+			for (int a = 0; a < 3; ++a)
+				t.Centroid[a] = (t.V[0][a] + t.V[1][a] + t.V[2][a]) * (1.0f / 3.0f);
+			t.Id = first / 3;
+			triangles.push_back(t);
+		}
+	}
+
+	if (triangles.empty())
+		return;
+
+	// 节点数不超过 2 * 三角形数 - 1
+	mNodes.reserve(triangles.size() * 2);
+	mNodes.push_back(Node());
+
+	std::vector<BuildTask> tasks;
+	tasks.push_back({ 0, 0, (std::uint32_t)triangles.size(), 1 });
+
+	while (!tasks.empty()) {
+		const BuildTask task = tasks.back();
+		tasks.pop_back();
+		mDepth = std::max(mDepth, task.Depth);
+
+		// 节点包围盒与质心包围盒
+		Box bounds;
+		Box centroids;
+		for (std::uint32_t i = task.Begin; i < task.End; ++i) {
+			bounds.Grow(triangles[i].Bounds);
+			centroids.Grow(triangles[i].Centroid);
+		}
+
+		Node& node = mNodes[task.Node];
+		node.BoundsMin = XMFLOAT3(bounds.Min[0], bounds.Min[1], bounds.Min[2]);
+		node.BoundsMax = XMFLOAT3(bounds.Max[0], bounds.Max[1], bounds.Max[2]);
+		node.First = task.Begin;
+		node.Count = task.End - task.Begin;
+
+		const std::uint32_t count = task.End - task.Begin;
+		if (count <= 1 || task.Depth >= MaxDepth)
+			continue;
+
+		/* 在三个轴上各把质心范围等分成BinCount个桶, 依次尝试每个桶边界作为分割面,
+		* 代价 = 左侧三角形数 * 左侧表面积 + 右侧三角形数 * 右侧表面积, 取最小者 */
+		float bestCost = FLT_MAX;
+		int bestAxis = -1;
+		int bestSplit = 0;
+		for (int axis = 0; axis < 3; ++axis) {
+			const float extent = centroids.Max[axis] - centroids.Min[axis];
+			if (extent <= 0.0f)
+				continue;
+
+			const float scale = BinCount / extent;
+			Box binBounds[BinCount];
+			std::uint32_t binCount[BinCount] = {};
+			for (std::uint32_t i = task.Begin; i < task.End; ++i) {
+				const int b = BinIndex(triangles[i], axis, centroids.Min[axis], scale);
+				++binCount[b];
+				binBounds[b].Grow(triangles[i].Bounds);
+			}
+
+			// 自右向左累积出每个分割面右侧的代价
+			float rightCost[BinCount];
+			Box right;
+			std::uint32_t rightCount = 0;
+			for (int b = BinCount - 1; b > 0; --b) {
+				right.Grow(binBounds[b]);
+				rightCount += binCount[b];
+				rightCost[b] = rightCount * right.HalfArea();
+			}
+
+			Box left;
+			std::uint32_t leftCount = 0;
+			for (int b = 0; b < BinCount - 1; ++b) {
+				left.Grow(binBounds[b]);
+				leftCount += binCount[b];
+				const float cost = leftCount * left.HalfArea() + rightCost[b + 1];
+				if (leftCount > 0 && leftCount < count && cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+
+		// 分割不比整个节点作叶子更划算, 且三角形不多时作叶子; 质心全部重合时无法分割, 只能作叶子
+		const float area = bounds.HalfArea();
+		if (bestAxis < 0 || (TraversalCost * area + bestCost >= count * area && count <= (std::uint32_t)MaxLeafSize))
+			continue;
+
+		const float minCentroid = centroids.Min[bestAxis];
+		const float scale = BinCount / (centroids.Max[bestAxis] - minCentroid);
+		auto middle = std::partition(triangles.begin() + task.Begin, triangles.begin() + task.End,
+			[&](const BuildTriangle& t) { return BinIndex(t, bestAxis, minCentroid, scale) <= bestSplit; });
+		const std::uint32_t mid = (std::uint32_t)(middle - triangles.begin());
+		if (mid == task.Begin || mid == task.End)
+			continue;
+
+		// 两个子节点相邻存放; push_back之后node引用可能失效, 用下标访问
+		const std::uint32_t left = (std::uint32_t)mNodes.size();
+		mNodes[task.Node].First = left;
+		mNodes[task.Node].Count = 0;
+		mNodes.push_back(Node());
+		mNodes.push_back(Node());
+
+		tasks.push_back({ left + 1, mid, task.End, task.Depth + 1 });
+		tasks.push_back({ left, task.Begin, mid, task.Depth + 1 });
+	}
+
+	// 按叶子顺序存下三角形
+	mTriangles.resize(triangles.size());
+	for (size_t i = 0; i < triangles.size(); ++i) {
+		const BuildTriangle& src = triangles[i];
+		Triangle& dst = mTriangles[i];
+		dst.V0 = XMFLOAT3(src.V[0][0], src.V[0][1], src.V[0][2]);
+		dst.Edge1 = XMFLOAT3(src.V[1][0] - src.V[0][0], src.V[1][1] - src.V[0][1], src.V[1][2] - src.V[0][2]);
+		dst.Edge2 = XMFLOAT3(src.V[2][0] - src.V[0][0], src.V[2][1] - src.V[0][1], src.V[2][2] - src.V[0][2]);
+		dst.Id = src.Id;
+	}
+}
+
+bool MeshBvh::Intersect(FXMVECTOR origin, FXMVECTOR direction, Hit& hit, float tMax, std::uint32_t firstTriangle, std::uint32_t triangleCount)const
+{
+	if (mNodes.empty())
+		return false;
+
+	XMFLOAT3 o3, d3;
+	XMStoreFloat3(&o3, origin);
+	XMStoreFloat3(&d3, direction);
+	const float o[3] = { o3.x, o3.y, o3.z };
+	const float d[3] = { d3.x, d3.y, d3.z };
+
+	const float invD[3] = { SafeReciprocal(d[0]), SafeReciprocal(d[1]), SafeReciprocal(d[2]) };
+
+	struct Entry
+	{
+		std::uint32_t Node;
+		float T;// 射线进入该节点包围盒时的t
+	};
+	Entry stack[MaxDepth + 1];
+	int top = 0;
+
+	float best = tMax;
+	bool found = false;
+
+	float t = RayBox(&mNodes[0].BoundsMin.x, &mNodes[0].BoundsMax.x, o, invD, best);
+	if (t != FLT_MAX)
+		stack[top++] = { 0, t };
+
+	while (top > 0) {
+		const Entry entry = stack[--top];
+		if (entry.T > best)
+			continue;
+
+		const Node& node = mNodes[entry.Node];
+		if (node.Count > 0) {
+			for (std::uint32_t i = node.First; i < node.First + node.Count; ++i) {
+				const Triangle& tri = mTriangles[i];
+				if (triangleCount != 0 && tri.Id - firstTriangle >= triangleCount)
+					continue;
+
+				float tHit, u, v;
+				if (RayTriangle(o, d, &tri.V0.x, &tri.Edge1.x, &tri.Edge2.x, best, tHit, u, v)) {
+					best = tHit;
+					found = true;
+					hit.Triangle = tri.Id;
+					hit.T = tHit;
+					hit.U = u;
+					hit.V = v;
+				}
+			}
+			continue;
+		}
+
+		// 先压远的子节点, 让近的先出栈; 找到交点后更远的节点会被entry.T > best剔除
+		const float tLeft = RayBox(&mNodes[node.First].BoundsMin.x, &mNodes[node.First].BoundsMax.x, o, invD, best);
+		const float tRight = RayBox(&mNodes[node.First + 1].BoundsMin.x, &mNodes[node.First + 1].BoundsMax.x, o, invD, best);
+		const Entry left = { node.First, tLeft };
+		const Entry right = { node.First + 1, tRight };
+		const Entry& nearChild = (tLeft <= tRight) ? left : right;
+		const Entry& farChild = (tLeft <= tRight) ? right : left;
+		if (farChild.T != FLT_MAX)
+			stack[top++] = farChild;
+		if (nearChild.T != FLT_MAX)
+			stack[top++] = nearChild;
+	}
+
+	return found;
+}
+
+void MeshBvh::IntersectBatch(const Ray* rays, std::uint32_t count, Hit* hits, std::uint32_t firstTriangle, std::uint32_t triangleCount)const
+{
+	const PacketKernels kernels = GetPacketKernels(mKernel);
+
+	for (std::uint32_t base = 0; base < count; base += PacketWidth) {
+		const int lanes = (int)std::min<std::uint32_t>(count - base, PacketWidth);
+
+		RayPacket packet;
+		for (int k = 0; k < PacketWidth; ++k) {
+			if (k < lanes) {
+				const Ray& ray = rays[base + k];
+				packet.Ox[k] = ray.Origin.x;
+				packet.Oy[k] = ray.Origin.y;
+				packet.Oz[k] = ray.Origin.z;
+				packet.Dx[k] = ray.Direction.x;
+				packet.Dy[k] = ray.Direction.y;
+				packet.Dz[k] = ray.Direction.z;
+				packet.TMax[k] = ray.TMax;
+			}
+			else {
+				packet.Ox[k] = packet.Oy[k] = packet.Oz[k] = 0.0f;
+				packet.Dx[k] = packet.Dy[k] = packet.Dz[k] = 1.0f;
+				packet.TMax[k] = -1.0f;
+			}
+			packet.InvDx[k] = SafeReciprocal(packet.Dx[k]);
+			packet.InvDy[k] = SafeReciprocal(packet.Dy[k]);
+			packet.InvDz[k] = SafeReciprocal(packet.Dz[k]);
+			packet.U[k] = packet.V[k] = 0.0f;
+			packet.Triangle[k] = NoHit;
+		}
+
+		std::uint32_t stack[MaxDepth + 1];
+		int top = 0;
+		float tNear;
+		if (!mNodes.empty() && kernels.Box(packet, &mNodes[0].BoundsMin.x, &mNodes[0].BoundsMax.x, tNear) != 0)
+			stack[top++] = 0;
+
+		while (top > 0) {
+			const Node& node = mNodes[stack[--top]];
+			if (node.Count > 0) {
+				// 入栈之后包内射线可能已找到更近的交点, 先用当前的TMax重测叶子的包围盒
+				if (kernels.Box(packet, &node.BoundsMin.x, &node.BoundsMax.x, tNear) == 0)
+					continue;
+
+				for (std::uint32_t i = node.First; i < node.First + node.Count; ++i) {
+					const Triangle& tri = mTriangles[i];
+					if (triangleCount != 0 && tri.Id - firstTriangle >= triangleCount)
+						continue;
+					kernels.Triangle(packet, &tri.V0.x, &tri.Edge1.x, &tri.Edge2.x, tri.Id);
+				}
+				continue;
+			}
+
+			// 整包的最小进入t较小的子节点先出栈
+			const Node& left = mNodes[node.First];
+			const Node& right = mNodes[node.First + 1];
+			float tLeft, tRight;
+			const unsigned hitLeft = kernels.Box(packet, &left.BoundsMin.x, &left.BoundsMax.x, tLeft);
+			const unsigned hitRight = kernels.Box(packet, &right.BoundsMin.x, &right.BoundsMax.x, tRight);
+			if (tLeft <= tRight) {
+				if (hitRight)
+					stack[top++] = node.First + 1;
+				if (hitLeft)
+					stack[top++] = node.First;
+			}
+			else {
+				if (hitLeft)
+					stack[top++] = node.First;
+				if (hitRight)
+					stack[top++] = node.First + 1;
+			}
+		}
+
+		for (int k = 0; k < lanes; ++k) {
+			Hit& hit = hits[base + k];
+			hit.Triangle = packet.Triangle[k];
+			hit.T = packet.TMax[k];
+			hit.U = packet.U[k];
+			hit.V = packet.V[k];
+		}
+	}
+}
+
+bool MeshBvh::IsKernelSupported(Kernel kernel)
+{
+	switch (kernel) {
+	case Kernel::Scalar:
+		return true;
+	case Kernel::SSE4:
+		return GetCpuFeatures().SSE41;
+	case Kernel::AVX2:
+		return GetCpuFeatures().AVX2;
+	default:
+		return false;
+	}
+}
+
+MeshBvh::Kernel MeshBvh::BestKernel()
+{
+	if (IsKernelSupported(Kernel::AVX2))
+		return Kernel::AVX2;
+	if (IsKernelSupported(Kernel::SSE4))
+		return Kernel::SSE4;
+	return Kernel::Scalar;
+}
+
+bool MeshBvh::SetKernel(Kernel kernel)
+{
+	if (!IsKernelSupported(kernel))
+		return false;
+
+	mKernel = kernel;
+	return true;
+}
+
+BoundingBox MeshBvh::Bounds()const
+{
+	BoundingBox box;
+	if (mNodes.empty())
+		return box;
+
+	XMVECTOR vMin = XMLoadFloat3(&mNodes[0].BoundsMin);
+	XMVECTOR vMax = XMLoadFloat3(&mNodes[0].BoundsMax);
+	XMStoreFloat3(&box.Center, 0.5f * (vMin + vMax));
+	XMStoreFloat3(&box.Extents, 0.5f * (vMax - vMin));
+	return box;
+}
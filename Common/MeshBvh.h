@@ -0,0 +1,140 @@
+﻿//***************************************************************************************
+// MeshBvh.h
+//
+// 网格三角形的包围体层次(BVH), 用于拾取等射线查询.
+// 按表面积启发式(SAH, 分桶近似)自顶向下建树, 建好后只读, 可被多个线程同时查询.
+// 射线查询先与节点包围盒求交, 由近及远地遍历子节点, 只对叶子里的少数三角形做精确求交,
+// 单条射线的代价约为O(log n), 而不是逐个三角形测试的O(n).
+// 大量射线可用IntersectBatch成包(packet)查询: 每8条射线共同遍历, 盒与三角形测试用SSE4(4路)/AVX2(8路)内核.
+// 本文件不依赖D3D, 输入为CPU端的顶点/索引内存(即MeshGeometry::VertexBufferCPU/IndexBufferCPU).
+//***************************************************************************************
+
+#pragma once
+
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+class MeshBvh
+{
+public:
+	// 成包查询的内核
+	enum class Kernel
+	{
+		Scalar,
+		SSE4,	// x86/x64, 每条指令处理4条射线
+		AVX2	// x86/x64, 每条指令处理8条射线
+	};
+
+	/* 顶点与索引的内存布局; 位置为每个顶点PositionOffset字节处的float3 */
+	struct Source
+	{
+		const void* Vertices = nullptr;
+		std::uint32_t VertexStride = 0;
+		std::uint32_t PositionOffset = 0;
+		std::uint32_t VertexCount = 0;
+		const void* Indices = nullptr;
+		bool Index16 = false;	// true为16位索引, 否则为32位
+	};
+
+	/* 参与建树的一段索引, 与SubmeshGeometry的绘制参数一致 */
+	struct Range
+	{
+		std::uint32_t IndexCount = 0;
+		std::uint32_t StartIndexLocation = 0;
+		std::int32_t BaseVertexLocation = 0;
+	};
+
+	/* 射线命中结果
+	* Triangle为三角形在整个索引缓冲区中的序号(首个索引位置 / 3), 可直接用于StartIndexLocation = 3 * Triangle
+	* 命中点 = origin + T * direction = (1 - U - V) * v0 + U * v1 + V * v2 */
+	struct Hit
+	{
+		std::uint32_t Triangle = 0;
+		float T = 0.0f;
+		float U = 0.0f;
+		float V = 0.0f;
+	};
+
+	// IntersectBatch中未命中射线的Hit::Triangle
+	static const std::uint32_t NoHit = 0xffffffff;
+
+	/* IntersectBatch的一条射线, 含义同Intersect的参数 */
+	struct Ray
+	{
+		DirectX::XMFLOAT3 Origin;
+		float TMax = FLT_MAX;
+		DirectX::XMFLOAT3 Direction;
+	};
+
+	// 一个射线包的射线数
+	static const int PacketWidth = 8;
+
+	// 叶子节点最多容纳的三角形数, 以及树的最大深度(遍历栈的大小)
+	static const int MaxLeafSize = 8;
+	static const int MaxDepth = 64;
+
+public:
+	MeshBvh();
+	MeshBvh(const MeshBvh& rhs) = delete;
+	MeshBvh& operator=(const MeshBvh& rhs) = delete;
+
+	/* 由source中ranges所指的三角形建树, 会替换掉之前的内容; 建好后不再引用source的内存 */
+	void Build(const Source& source, const std::vector<Range>& ranges);
+
+	/* 求射线与网格最近的交点, 射线须与建树时的顶点处于同一(局部)空间
+	* direction不必归一化, T以direction的长度为单位; 只接受[0, tMax)内的交点
+	* triangleCount不为0时只考虑序号在[firstTriangle, firstTriangle + triangleCount)内的三角形
+	* 两面都可命中, 与DirectX::TriangleTests::Intersects一致 */
+	bool Intersect(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, Hit& hit,
+		float tMax = FLT_MAX, std::uint32_t firstTriangle = 0, std::uint32_t triangleCount = 0)const;
+
+	/* 批量求count条射线各自的最近交点, hits[i]对应rays[i]; 未命中时hits[i].Triangle为NoHit, T为rays[i].TMax
+	* 射线按输入顺序每PacketWidth条组成一个包: 包内任一射线与节点包围盒相交就进入该节点,
+	* 包围盒与三角形测试都对整包同时进行. 结果与逐条调用Intersect相同
+	* 包内射线的起点与方向相近(例如屏幕上相邻的像素)时效率最高, 方向杂乱时包会访问各射线所需节点的并集 */
+	void IntersectBatch(const Ray* rays, std::uint32_t count, Hit* hits,
+		std::uint32_t firstTriangle = 0, std::uint32_t triangleCount = 0)const;
+
+	// 当前CPU能否运行指定内核
+	static bool IsKernelSupported(Kernel kernel);
+	// 当前CPU支持的最快内核, 构造时默认使用
+	static Kernel BestKernel();
+
+	// 切换IntersectBatch的内核; CPU不支持时返回false, 保持原内核不变
+	bool SetKernel(Kernel kernel);
+	Kernel GetKernel()const { return mKernel; }
+
+	DirectX::BoundingBox Bounds()const;
+	std::uint32_t TriangleCount()const { return (std::uint32_t)mTriangles.size(); }
+	std::uint32_t NodeCount()const { return (std::uint32_t)mNodes.size(); }
+	int Depth()const { return mDepth; }
+
+private:
+	/* 32字节的节点: Count > 0为叶子, 三角形为mTriangles[First, First + Count)
+	* 否则为内部节点, 两个子节点相邻存放在mNodes[First]与mNodes[First + 1] */
+	struct Node
+	{
+		DirectX::XMFLOAT3 BoundsMin;
+		std::uint32_t First;
+		DirectX::XMFLOAT3 BoundsMax;
+		std::uint32_t Count;
+	};
+
+	/* 按叶子顺序排好的三角形, 存v0与两条边, 求交时不必再经索引取顶点 */
+	struct Triangle
+	{
+		DirectX::XMFLOAT3 V0;
+		DirectX::XMFLOAT3 Edge1;// v1 - v0
+		DirectX::XMFLOAT3 Edge2;// v2 - v0
+		std::uint32_t Id;
+	};
+
+private:
+	std::vector<Node> mNodes;
+	std::vector<Triangle> mTriangles;
+	int mDepth = 0;
+	Kernel mKernel = Kernel::Scalar;
+};
@@ -0,0 +1,323 @@
+﻿//***************************************************************************************
+// MeshFile.cpp
+//***************************************************************************************
+
+#include "MeshFile.h"
+#include "IndexPacking.h"
+#include <cstring>
+#include <fstream>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const MeshFile::uint64 SectionAlignment = 16;
+
+	MeshFile::uint64 AlignUp(MeshFile::uint64 offset)
+	{
+		return (offset + SectionAlignment - 1) & ~(SectionAlignment - 1);
+	}
+}
+
+MeshFile::~MeshFile()
+{
+	Close();
+}
+
+MeshFile::uint64 MeshFile::Hash(const void* data, size_t byteSize, uint64 seed)
+{
+	const std::uint8_t* p = static_cast<const std::uint8_t*>(data);
+	uint64 h = seed;
+	for (size_t i = 0; i < byteSize; ++i) {
+		h ^= p[i];
+		h *= 0x100000001b3ull;
+	}
+	return h;
+}
+
+MeshFile::uint32 MeshFile::LayoutStride(const char* layout)
+{
+	uint32 stride = 0;
+	for (const char* c = layout; *c != '\0'; ++c) {
+		switch (*c) {
+		case 'P': stride += 12; break;// float3 Pos
+		case 'N': stride += 12; break;// float3 Normal
+		case 'T': stride += 8;  break;// float2 TexC
+		case 'U': stride += 12; break;// float3 TangentU
+		default: return 0;
+		}
+	}
+	return stride;
+}
+
+bool MeshFile::Write(
+	const std::string& filename,
+	const char* layout,
+	uint32 vertexStride,
+	const void* vertices,
+	uint32 vertexCount,
+	const uint32* indices,
+	uint32 indexCount,
+	const std::vector<Submesh>& submeshes,
+	bool compressIndices)
+{
+	if (std::strlen(layout) > MaxLayoutLength || LayoutStride(layout) != vertexStride)
+		return false;
+
+	// 索引是相对各子网格BaseVertexLocation的, 只要都不超过65535就能用16位, 与总顶点数无关
+	bool fits16 = true;
+	for (uint32 i = 0; i < indexCount && fits16; ++i)
+		fits16 = indices[i] <= 0xffff;
+	const bool hasIndices16 = fits16 && !compressIndices;
+
+	std::vector<std::uint8_t> compressed;
+	if (compressIndices)
+		IndexPacking::Encode(indices, indexCount, compressed);
+
+	// 按 头部|顶点|32位索引(或压缩编码)|16位索引|子网格表 的顺序排布, 每段16字节对齐
+	Header header = {};
+	header.Magic = Magic;
+	header.Version = Version;
+	header.HeaderSize = sizeof(Header);
+	header.Flags = (fits16 ? FlagHasIndices16 : 0) | (compressIndices ? FlagCompressedIndices : 0);
+	std::memcpy(header.Layout, layout, std::strlen(layout));
+	header.VertexStride = vertexStride;
+	header.VertexCount = vertexCount;
+	header.IndexCount = indexCount;
+	header.SubmeshCount = (uint32)submeshes.size();
+
+	uint64 offset = AlignUp(sizeof(Header));
+	header.VertexOffset = offset;
+	offset = AlignUp(offset + (uint64)vertexCount * vertexStride);
+	header.Index32Offset = offset;
+	if (compressIndices) {
+		header.CompressedIndexSize = compressed.size();
+		offset = AlignUp(offset + compressed.size());
+	}
+	else {
+		offset = AlignUp(offset + (uint64)indexCount * sizeof(uint32));
+	}
+	if (hasIndices16) {
+		header.Index16Offset = offset;
+		offset = AlignUp(offset + (uint64)indexCount * sizeof(uint16));
+	}
+	header.SubmeshOffset = offset;
+	offset += submeshes.size() * sizeof(Submesh);
+	header.FileSize = offset;
+
+	// 先在内存里拼出整块文件, 再一次写盘
+	std::vector<std::uint8_t> file((size_t)header.FileSize, 0);
+	std::memcpy(&file[(size_t)header.VertexOffset], vertices, (size_t)vertexCount * vertexStride);
+	if (compressIndices)
+		std::memcpy(&file[(size_t)header.Index32Offset], compressed.data(), compressed.size());
+	else
+		std::memcpy(&file[(size_t)header.Index32Offset], indices, (size_t)indexCount * sizeof(uint32));
+	if (hasIndices16) {
+		uint16* indices16 = reinterpret_cast<uint16*>(&file[(size_t)header.Index16Offset]);
+		for (uint32 i = 0; i < indexCount; ++i)
+			indices16[i] = static_cast<uint16>(indices[i]);
+	}
+	if (!submeshes.empty())
+		std::memcpy(&file[(size_t)header.SubmeshOffset], submeshes.data(), submeshes.size() * sizeof(Submesh));
+
+	header.ContentHash = Hash(&file[sizeof(Header)], file.size() - sizeof(Header));
+	std::memcpy(&file[0], &header, sizeof(Header));
+
+	std::ofstream fout(filename, std::ios::binary);
+	if (!fout)
+		return false;
+	fout.write(reinterpret_cast<const char*>(file.data()), (std::streamsize)file.size());
+	fout.close();
+	return !fout.fail();
+}
+
+bool MeshFile::Open(const std::string& filename, bool verifyHash)
+{
+	Close();
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize = {};
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(Header)) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		CloseHandle(file);
+		return false;
+	}
+
+	const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	mFile = file;
+	mMapping = mapping;
+	mData = static_cast<const std::uint8_t*>(view);
+	mSize = (size_t)fileSize.QuadPart;
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (::fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+		::close(fd);
+		return false;
+	}
+
+	void* view = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (view == MAP_FAILED) {
+		::close(fd);
+		return false;
+	}
+
+	mFile = fd;
+	mData = static_cast<const std::uint8_t*>(view);
+	mSize = (size_t)st.st_size;
+#endif
+
+	if (!Validate(verifyHash)) {
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MeshFile::Close()
+{
+#if defined(_WIN32)
+	if (mData != nullptr)
+		UnmapViewOfFile(mData);
+	if (mMapping != nullptr)
+		CloseHandle(mMapping);
+	if (mFile != nullptr)
+		CloseHandle(mFile);
+	mMapping = nullptr;
+	mFile = nullptr;
+#else
+	if (mData != nullptr)
+		::munmap(const_cast<std::uint8_t*>(mData), mSize);
+	if (mFile >= 0)
+		::close(mFile);
+	mFile = -1;
+#endif
+	mData = nullptr;
+	mSize = 0;
+}
+
+bool MeshFile::HasLayout(const char* layout, uint32 vertexStride)const
+{
+	return IsOpen() &&
+		std::strncmp(GetHeader().Layout, layout, MaxLayoutLength + 1) == 0 &&
+		GetHeader().VertexStride == vertexStride;
+}
+
+const MeshFile::uint32* MeshFile::Indices32()const
+{
+	if (IsIndexCompressed())
+		return nullptr;
+	return reinterpret_cast<const uint32*>(mData + GetHeader().Index32Offset);
+}
+
+const MeshFile::uint16* MeshFile::Indices16()const
+{
+	if (!HasIndices16() || IsIndexCompressed())
+		return nullptr;
+	return reinterpret_cast<const uint16*>(mData + GetHeader().Index16Offset);
+}
+
+bool MeshFile::ReadIndices(uint32* dst)const
+{
+	const Header& h = GetHeader();
+	if (IsIndexCompressed())
+		return IndexPacking::Decode(mData + h.Index32Offset, (size_t)h.CompressedIndexSize, dst, h.IndexCount);
+
+	std::memcpy(dst, Indices32(), (size_t)h.IndexCount * sizeof(uint32));
+	return true;
+}
+
+bool MeshFile::ReadIndices(uint16* dst)const
+{
+	const Header& h = GetHeader();
+	if (!HasIndices16())
+		return false;
+	if (IsIndexCompressed())
+		return IndexPacking::Decode(mData + h.Index32Offset, (size_t)h.CompressedIndexSize, dst, h.IndexCount);
+
+	std::memcpy(dst, Indices16(), (size_t)h.IndexCount * sizeof(uint16));
+	return true;
+}
+
+bool MeshFile::Validate(bool verifyHash)const
+{
+	const Header& h = GetHeader();
+	if (h.Magic != Magic || h.Version != Version || h.HeaderSize != sizeof(Header) || h.FileSize != mSize)
+		return false;
+
+	if (h.Layout[MaxLayoutLength] != '\0' || LayoutStride(h.Layout) != h.VertexStride)
+		return false;
+
+	// 每一段都必须完整落在文件内, 防止截断的文件让后续CopyMemory越界
+	auto inside = [this](uint64 offset, uint64 byteSize) {
+		return offset <= mSize && byteSize <= mSize - offset;
+	};
+	const bool compressed = (h.Flags & FlagCompressedIndices) != 0;
+	const uint64 indexBytes = compressed ? h.CompressedIndexSize : (uint64)h.IndexCount * sizeof(uint32);
+	if (!inside(h.VertexOffset, (uint64)h.VertexCount * h.VertexStride) ||
+		!inside(h.Index32Offset, indexBytes) ||
+		!inside(h.SubmeshOffset, (uint64)h.SubmeshCount * sizeof(Submesh)))
+		return false;
+	if ((h.Flags & FlagHasIndices16) && !compressed && !inside(h.Index16Offset, (uint64)h.IndexCount * sizeof(uint16)))
+		return false;
+
+	// 子网格的索引区间与BaseVertexLocation会被原样交给DrawIndexedInstanced, 名字会被当作C字符串使用
+	const Submesh* submeshes = Submeshes();
+	for (uint32 i = 0; i < h.SubmeshCount; ++i) {
+		const Submesh& s = submeshes[i];
+		if (std::memchr(s.Name, '\0', sizeof(s.Name)) == nullptr)
+			return false;
+		if ((uint64)s.StartIndexLocation + s.IndexCount > h.IndexCount)
+			return false;
+		if (s.BaseVertexLocation < 0 || (uint32)s.BaseVertexLocation > h.VertexCount ||
+			(s.IndexCount > 0 && (uint32)s.BaseVertexLocation == h.VertexCount))
+			return false;
+	}
+
+	if (verifyHash && Hash(mData + h.HeaderSize, mSize - h.HeaderSize) != h.ContentHash)
+		return false;
+
+	// 已经完整读过一遍负载时, 顺带确认每个索引加上所属子网格的BaseVertexLocation后都落在顶点数组内
+	if (verifyHash && !compressed) {
+		const uint32* indices = Indices32();
+		for (uint32 i = 0; i < h.SubmeshCount; ++i) {
+			const Submesh& s = submeshes[i];
+			const uint32 limit = h.VertexCount - (uint32)s.BaseVertexLocation;
+			for (uint32 j = 0; j < s.IndexCount; ++j) {
+				if (indices[s.StartIndexLocation + j] >= limit)
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
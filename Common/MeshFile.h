@@ -0,0 +1,140 @@
+﻿//***************************************************************************************
+// MeshFile.h
+//
+// .m3db 二进制网格缓存: 把 Models/*.txt 这类文本模型离线转换成可直接内存映射的二进制文件.
+// 文件内存有交错排布的顶点, 32位与16位两份索引, 预先算好的子网格包围盒, 以及整块负载的内容哈希.
+// 加载时只做映射和头部校验, 不再逐个token解析文本, 也不再逐顶点地重算包围盒.
+// 索引也可以改存IndexPacking的压缩编码(每个三角形约1~2字节), 加载时由ReadIndices解码.
+// 本文件不依赖D3D, 离线转换工具(Tools/MeshConverter)与各章节程序共用.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class MeshFile
+{
+public:
+	using uint16 = std::uint16_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	static const uint32 Magic = 0x4244334D;  // "M3DB"
+	static const uint32 Version = 2;		  // 格式有变动时递增, 旧文件会被拒绝并退回文本加载
+	static const uint32 MaxLayoutLength = 7; // 顶点布局字符串最大长度(不含结尾0)
+
+	// Header::Flags
+	static const uint32 FlagHasIndices16 = 0x1;	 // 所有索引都不超过65535, 可以读成16位索引; 未压缩时额外存有一份16位索引
+	static const uint32 FlagCompressedIndices = 0x2;// 索引段是IndexPacking::Encode的压缩编码, 没有原始的32/16位索引
+
+	/* 文件头, 位于文件起始处; 所有偏移量都相对于文件起始, 且按16字节对齐
+	* Layout是顶点布局字符串, 每个字符代表一个属性, 顺序即内存顺序:
+	*   P = float3 Pos, N = float3 Normal, T = float2 TexC, U = float3 TangentU
+	* 程序读取时要求Layout与VertexStride都与自身的Vertex结构体一致 */
+	struct Header
+	{
+		uint32 Magic;
+		uint32 Version;
+		uint32 HeaderSize;
+		uint32 Flags;
+		char   Layout[MaxLayoutLength + 1];
+		uint32 VertexStride;
+		uint32 VertexCount;
+		uint32 IndexCount;
+		uint32 SubmeshCount;
+		uint64 VertexOffset;
+		uint64 Index32Offset;   // 压缩时为压缩编码的起点
+		uint64 Index16Offset;   // 没有16位索引或压缩时为0
+		uint64 CompressedIndexSize;// 压缩编码的字节数, 未压缩时为0
+		uint64 SubmeshOffset;
+		uint64 FileSize;
+		uint64 ContentHash;     // HeaderSize之后全部负载的FNV-1a哈希
+	};
+
+	/* 子网格描述, 与SubmeshGeometry一一对应; Center/Extents即DirectX::BoundingBox的c和e */
+	struct Submesh
+	{
+		char   Name[32];
+		uint32 IndexCount;
+		uint32 StartIndexLocation;
+		std::int32_t BaseVertexLocation;
+		float  Center[3];
+		float  Extents[3];
+	};
+
+public:
+	MeshFile() = default;
+	MeshFile(const MeshFile& rhs) = delete;
+	MeshFile& operator=(const MeshFile& rhs) = delete;
+	~MeshFile();
+
+	/* 64位FNV-1a, 用作内容哈希; seed可以串接多段数据 */
+	static uint64 Hash(const void* data, size_t byteSize, uint64 seed = 0xcbf29ce484222325ull);
+
+	/* 按布局字符串计算单顶点字节数; 含未知属性时返回0 */
+	static uint32 LayoutStride(const char* layout);
+
+	/* 离线写出.m3db文件
+	* vertices须按layout交错排布, 每顶点vertexStride字节
+	* 所有索引都不超过65535时自动额外写出一份16位索引
+	* compressIndices为true时索引只存压缩编码, 文件更小, 但加载时要用ReadIndices解码
+	* 成功返回true */
+	static bool Write(
+		const std::string& filename,
+		const char* layout,
+		uint32 vertexStride,
+		const void* vertices,
+		uint32 vertexCount,
+		const uint32* indices,
+		uint32 indexCount,
+		const std::vector<Submesh>& submeshes,
+		bool compressIndices = false);
+
+	/* 内存映射打开文件并校验头部; verifyHash为true时顺带校验内容哈希(需要完整读一遍负载)
+	* 文件不存在, 版本不符或数据损坏时返回false, 调用方可退回到文本加载 */
+	bool Open(const std::string& filename, bool verifyHash = false);
+	void Close();
+
+	bool IsOpen()const { return mData != nullptr; }
+
+	/* 检查文件里的顶点格式是否与调用方的Vertex结构体一致 */
+	bool HasLayout(const char* layout, uint32 vertexStride)const;
+
+	const Header& GetHeader()const { return *reinterpret_cast<const Header*>(mData); }
+
+	// 下列指针均直接指向映射内存, 在Close()之前有效, 可直接交给CopyMemory / CreateDefaultBuffer
+	const void* Vertices()const { return mData + GetHeader().VertexOffset; }
+	uint32 VertexBufferByteSize()const { return GetHeader().VertexCount * GetHeader().VertexStride; }
+
+	const uint32* Indices32()const;// 索引被压缩时返回nullptr
+	const uint16* Indices16()const;// 没有16位索引或索引被压缩时返回nullptr
+	uint32 IndexCount()const { return GetHeader().IndexCount; }
+
+	bool IsIndexCompressed()const { return (GetHeader().Flags & FlagCompressedIndices) != 0; }
+	bool HasIndices16()const { return (GetHeader().Flags & FlagHasIndices16) != 0; }
+
+	/* 把全部IndexCount()个索引写进dst(例如ID3DBlob的内存): 未压缩时直接拷贝, 压缩时解码
+	* 16位版本要求HasIndices16(); 压缩数据损坏时返回false */
+	bool ReadIndices(uint32* dst)const;
+	bool ReadIndices(uint16* dst)const;
+
+	const Submesh* Submeshes()const { return reinterpret_cast<const Submesh*>(mData + GetHeader().SubmeshOffset); }
+	uint32 SubmeshCount()const { return GetHeader().SubmeshCount; }
+
+private:
+	bool Validate(bool verifyHash)const;
+
+private:
+	const std::uint8_t* mData = nullptr;// 映射出的文件起始地址
+	size_t mSize = 0;
+
+#if defined(_WIN32)
+	void* mFile = nullptr;	  // HANDLE
+	void* mMapping = nullptr; // HANDLE
+#else
+	int mFile = -1;
+#endif
+};
@@ -0,0 +1,513 @@
+﻿//***************************************************************************************
+// MeshOptimizer.cpp
+//***************************************************************************************
+
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	struct Vec3
+	{
+		float X, Y, Z;
+	};
+
+	inline Vec3 Sub(const Vec3& a, const Vec3& b) { return { a.X - b.X, a.Y - b.Y, a.Z - b.Z }; }
+	inline Vec3 Cross(const Vec3& a, const Vec3& b) { return { a.Y*b.Z - a.Z*b.Y, a.Z*b.X - a.X*b.Z, a.X*b.Y - a.Y*b.X }; }
+	inline float Dot(const Vec3& a, const Vec3& b) { return a.X*b.X + a.Y*b.Y + a.Z*b.Z; }
+
+	inline Vec3 PositionOf(const MeshOptimizer::Source& source, std::uint32_t index)
+	{
+		Vec3 p;
+		std::memcpy(&p, static_cast<const std::uint8_t*>(source.Vertices) + (size_t)index * source.VertexStride + source.PositionOffset, sizeof(Vec3));
+		return p;
+	}
+
+	/// Forsyth, Linear-Speed Vertex Cache Optimisation中的打分参数
+	const float CacheDecayPower = 1.5f;
+	const float LastTriangleScore = 0.75f;
+	const float ValenceBoostScale = 2.0f;
+	const float ValenceBoostPower = 0.5f;
+	const std::uint32_t MaxPrecomputedValence = 32;
+
+	/* 顶点分数: 越靠近缓存前端, 剩余未输出的三角形越少, 分数越高; 没有剩余三角形的顶点为-1
+	* 刚输出的三角形的3个顶点得固定分, 避免算法倾向于按条带方向来回摆动 */
+	class VertexScorer
+	{
+	public:
+		VertexScorer()
+		{
+			const std::uint32_t cacheSize = MeshOptimizer::CacheSize;
+			for (std::uint32_t i = 0; i < cacheSize; ++i) {
+				if (i < 3)
+					mCacheScore[i] = LastTriangleScore;
+				else
+					mCacheScore[i] = powf(1.0f - (float)(i - 3) / (float)(cacheSize - 3), CacheDecayPower);
+			}
+			mValenceScore[0] = 0.0f;
+			for (std::uint32_t v = 1; v < MaxPrecomputedValence; ++v)
+				mValenceScore[v] = ValenceBoostScale * powf((float)v, -ValenceBoostPower);
+		}
+
+		float Score(int cachePosition, std::uint32_t liveTriangles)const
+		{
+			if (liveTriangles == 0)
+				return -1.0f;
+
+			float score = (cachePosition >= 0) ? mCacheScore[cachePosition] : 0.0f;
+			score += (liveTriangles < MaxPrecomputedValence) ? mValenceScore[liveTriangles] :
+				ValenceBoostScale * powf((float)liveTriangles, -ValenceBoostPower);
+			return score;
+		}
+
+	private:
+		float mCacheScore[MeshOptimizer::CacheSize];
+		float mValenceScore[MaxPrecomputedValence];
+	};
+
+	/* 用时间戳模拟的FIFO缓存: 顶点进入缓存时记下当时的时间戳, 此后再有size个顶点进入它就被挤出
+	* 命中不刷新时间戳, 与硬件FIFO的行为一致; Reset只需把当前时间推后size + 1 */
+	class FifoCache
+	{
+	public:
+		FifoCache(std::uint32_t vertexCount, std::uint32_t size)
+			: mTimestamps(vertexCount, 0), mSize(size), mTime(size + 1) {}
+
+		// 返回未命中的顶点数
+		std::uint32_t Access(std::uint32_t a, std::uint32_t b, std::uint32_t c)
+		{
+			return Access(a) + Access(b) + Access(c);
+		}
+
+		std::uint32_t Access(std::uint32_t v)
+		{
+			if (mTime - mTimestamps[v] <= mSize)
+				return 0;
+			mTimestamps[v] = mTime++;
+			return 1;
+		}
+
+		void Reset() { mTime += mSize + 1; }
+
+	private:
+		std::vector<std::uint32_t> mTimestamps;
+		std::uint32_t mSize;
+		std::uint32_t mTime;
+	};
+
+	inline std::uint32_t CountReferenced(const std::uint32_t* indices, std::uint32_t indexCount, std::uint32_t vertexCount)
+	{
+		std::vector<std::uint8_t> used(vertexCount, 0);
+		std::uint32_t count = 0;
+		for (std::uint32_t i = 0; i < indexCount; ++i) {
+			count += used[indices[i]] ^ 1;
+			used[indices[i]] = 1;
+		}
+		return count;
+	}
+}
+
+void MeshOptimizer::OptimizeVertexCache(const std::uint32_t* indices, std::uint32_t indexCount, std::uint32_t vertexCount,
+	std::uint32_t* destination)
+{
+	const std::uint32_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	static const VertexScorer scorer;
+
+	// 输入先拷一份, 允许destination与indices相同
+	std::vector<std::uint32_t> input(indices, indices + triangleCount * 3);
+
+	/// 每个顶点未输出的三角形表(CSR): mAdjacency[offset[v], offset[v] + live[v])
+	std::vector<std::uint32_t> live(vertexCount, 0);
+	for (std::uint32_t index : input)
+		++live[index];
+
+	std::vector<std::uint32_t> offsets(vertexCount + 1, 0);
+	for (std::uint32_t v = 0; v < vertexCount; ++v)
+		offsets[v + 1] = offsets[v] + live[v];
+
+	std::vector<std::uint32_t> adjacency(input.size());
+	{
+		std::vector<std::uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (std::uint32_t t = 0; t < triangleCount; ++t) {
+			for (int k = 0; k < 3; ++k)
+				adjacency[fill[input[t * 3 + k]]++] = t;
+		}
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (std::uint32_t v = 0; v < vertexCount; ++v)
+		vertexScore[v] = scorer.Score(-1, live[v]);
+
+	std::vector<float> triangleScore(triangleCount);
+	std::vector<std::uint8_t> emitted(triangleCount, 0);
+	std::uint32_t bestTriangle = 0;
+	for (std::uint32_t t = 0; t < triangleCount; ++t) {
+		triangleScore[t] = vertexScore[input[t * 3 + 0]] + vertexScore[input[t * 3 + 1]] + vertexScore[input[t * 3 + 2]];
+		if (triangleScore[t] > triangleScore[bestTriangle])
+			bestTriangle = t;
+	}
+
+	// 缓存多留3项, 放刚被挤出的顶点, 以便把它们的分数也更新掉
+	std::uint32_t cache[CacheSize + 3];
+	std::uint32_t newCache[CacheSize + 3];
+	std::uint32_t cacheCount = 0;
+	std::uint32_t inputCursor = 0;
+
+	for (std::uint32_t out = 0; out < triangleCount; ++out) {
+		// 缓存里的顶点都没有剩余三角形时, 按输入顺序取下一个未输出的三角形重新开始
+		if (bestTriangle == ~0u) {
+			while (emitted[inputCursor])
+				++inputCursor;
+			bestTriangle = inputCursor;
+		}
+
+		const std::uint32_t t = bestTriangle;
+		const std::uint32_t* tri = &input[t * 3];
+		destination[out * 3 + 0] = tri[0];
+		destination[out * 3 + 1] = tri[1];
+		destination[out * 3 + 2] = tri[2];
+		emitted[t] = 1;
+
+		// 把三角形从其顶点的表中移除
+		for (int k = 0; k < 3; ++k) {
+			const std::uint32_t v = tri[k];
+			std::uint32_t* list = &adjacency[offsets[v]];
+			for (std::uint32_t i = 0; i < live[v]; ++i) {
+				if (list[i] == t) {
+					list[i] = list[live[v] - 1];
+					--live[v];
+					break;
+				}
+			}
+		}
+
+		/// 新缓存: 本三角形的顶点在最前, 其后是原缓存中的其他顶点(LRU)
+		std::uint32_t newCount = 0;
+		for (int k = 0; k < 3; ++k)
+			newCache[newCount++] = tri[k];
+		for (std::uint32_t i = 0; i < cacheCount; ++i) {
+			const std::uint32_t v = cache[i];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				newCache[newCount++] = v;
+		}
+
+		for (std::uint32_t i = 0; i < newCount; ++i) {
+			const std::uint32_t v = newCache[i];
+			cachePosition[v] = (i < CacheSize) ? (int)i : -1;
+
+			const float score = scorer.Score(cachePosition[v], live[v]);
+			const float delta = score - vertexScore[v];
+			vertexScore[v] = score;
+
+			const std::uint32_t* list = &adjacency[offsets[v]];
+			for (std::uint32_t j = 0; j < live[v]; ++j)
+				triangleScore[list[j]] += delta;
+		}
+
+		cacheCount = std::min(newCount, (std::uint32_t)CacheSize);
+		std::memcpy(cache, newCache, cacheCount * sizeof(std::uint32_t));
+
+		// 下一个三角形只在缓存中顶点的剩余三角形里找
+		bestTriangle = ~0u;
+		float bestScore = -FLT_MAX;
+		for (std::uint32_t i = 0; i < cacheCount; ++i) {
+			const std::uint32_t v = cache[i];
+			const std::uint32_t* list = &adjacency[offsets[v]];
+			for (std::uint32_t j = 0; j < live[v]; ++j) {
+				if (triangleScore[list[j]] > bestScore) {
+					bestScore = triangleScore[list[j]];
+					bestTriangle = list[j];
+				}
+			}
+		}
+	}
+}
+
+void MeshOptimizer::OptimizeOverdraw(const Source& source, const std::uint32_t* indices, std::uint32_t indexCount,
+	std::uint32_t* destination, float threshold)
+{
+	const std::uint32_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	std::vector<std::uint32_t> input(indices, indices + triangleCount * 3);
+	FifoCache cache(source.VertexCount, FifoSize);
+
+	/// 硬边界: 3个顶点都未命中的三角形, 缓存在此处相当于被清空, 前后两段的顺序互不影响
+	std::vector<std::uint32_t> hard;
+	for (std::uint32_t t = 0; t < triangleCount; ++t) {
+		if (cache.Access(input[t * 3 + 0], input[t * 3 + 1], input[t * 3 + 2]) == 3)
+			hard.push_back(t);
+	}
+	if (hard.empty() || hard[0] != 0)
+		hard.insert(hard.begin(), 0);
+	hard.push_back(triangleCount);
+
+	/// 软边界: 在每个硬簇内, 当前缀的ACMR降到整簇ACMR的threshold倍以内时就切开,
+	/// 并把缓存清空重新计算, 保证每个小簇单独绘制时的缓存效率与原簇相近
+	std::vector<std::uint32_t> clusters;
+	for (size_t c = 0; c + 1 < hard.size(); ++c) {
+		const std::uint32_t begin = hard[c];
+		const std::uint32_t end = hard[c + 1];
+
+		cache.Reset();
+		std::uint32_t misses = 0;
+		for (std::uint32_t t = begin; t < end; ++t)
+			misses += cache.Access(input[t * 3 + 0], input[t * 3 + 1], input[t * 3 + 2]);
+		const float clusterThreshold = threshold * (float)misses / (float)(end - begin);
+
+		clusters.push_back(begin);
+		cache.Reset();
+		std::uint32_t runningMisses = 0;
+		std::uint32_t runningTriangles = 0;
+		for (std::uint32_t t = begin; t < end; ++t) {
+			runningMisses += cache.Access(input[t * 3 + 0], input[t * 3 + 1], input[t * 3 + 2]);
+			++runningTriangles;
+			if ((float)runningMisses <= clusterThreshold * (float)runningTriangles && t + 1 < end) {
+				clusters.push_back(t + 1);
+				cache.Reset();
+				runningMisses = 0;
+				runningTriangles = 0;
+			}
+		}
+	}
+	const std::uint32_t clusterCount = (std::uint32_t)clusters.size();
+	clusters.push_back(triangleCount);
+
+	/// 每簇按面积加权的中心与法线; 中心离网格中心越远且法线越朝外, 越可能挡住别的簇, 越先画
+	Vec3 meshCenter = { 0.0f, 0.0f, 0.0f };
+	for (std::uint32_t index : input) {
+		const Vec3 p = PositionOf(source, index);
+		meshCenter.X += p.X; meshCenter.Y += p.Y; meshCenter.Z += p.Z;
+	}
+	const float invCount = 1.0f / (float)input.size();
+	meshCenter = { meshCenter.X * invCount, meshCenter.Y * invCount, meshCenter.Z * invCount };
+
+	std::vector<float> keys(clusterCount);
+	for (std::uint32_t c = 0; c < clusterCount; ++c) {
+		Vec3 center = { 0.0f, 0.0f, 0.0f };
+		Vec3 normal = { 0.0f, 0.0f, 0.0f };
+		float area = 0.0f;
+		for (std::uint32_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+			const Vec3 p0 = PositionOf(source, input[t * 3 + 0]);
+			const Vec3 p1 = PositionOf(source, input[t * 3 + 1]);
+			const Vec3 p2 = PositionOf(source, input[t * 3 + 2]);
+			const Vec3 n = Cross(Sub(p1, p0), Sub(p2, p0));// D3D以顺时针为正面, 此叉积指向正面一侧
+			const float a = sqrtf(Dot(n, n));
+
+			center.X += (p0.X + p1.X + p2.X) * a;
+			center.Y += (p0.Y + p1.Y + p2.Y) * a;
+			center.Z += (p0.Z + p1.Z + p2.Z) * a;
+			normal.X += n.X; normal.Y += n.Y; normal.Z += n.Z;
+			area += a;
+		}
+
+		const float normalLength = sqrtf(Dot(normal, normal));
+		if (area > 0.0f && normalLength > 0.0f) {
+			const float invArea = 1.0f / (3.0f * area);
+			center = { center.X * invArea, center.Y * invArea, center.Z * invArea };
+			keys[c] = Dot(Sub(center, meshCenter), normal) / normalLength;
+		}
+		else {
+			keys[c] = 0.0f;
+		}
+	}
+
+	std::vector<std::uint32_t> order(clusterCount);
+	for (std::uint32_t c = 0; c < clusterCount; ++c)
+		order[c] = c;
+	std::stable_sort(order.begin(), order.end(), [&keys](std::uint32_t a, std::uint32_t b) { return keys[a] > keys[b]; });
+
+	std::uint32_t out = 0;
+	for (std::uint32_t c : order) {
+		const std::uint32_t first = clusters[c] * 3;
+		const std::uint32_t last = clusters[c + 1] * 3;
+		std::memcpy(destination + out, &input[first], (last - first) * sizeof(std::uint32_t));
+		out += last - first;
+	}
+}
+
+std::uint32_t MeshOptimizer::OptimizeVertexFetch(void* vertices, std::uint32_t vertexCount, std::uint32_t vertexStride,
+	std::uint32_t* indices, std::uint32_t indexCount)
+{
+	/// remap[旧序号] = 新序号
+	std::vector<std::uint32_t> remap(vertexCount, ~0u);
+	std::uint32_t next = 0;
+	for (std::uint32_t i = 0; i < indexCount; ++i) {
+		std::uint32_t& r = remap[indices[i]];
+		if (r == ~0u)
+			r = next++;
+		indices[i] = r;
+	}
+
+	const std::uint32_t referenced = next;
+	for (std::uint32_t v = 0; v < vertexCount; ++v) {
+		if (remap[v] == ~0u)
+			remap[v] = next++;
+	}
+
+	std::uint8_t* data = static_cast<std::uint8_t*>(vertices);
+	std::vector<std::uint8_t> copy(data, data + (size_t)vertexCount * vertexStride);
+	for (std::uint32_t v = 0; v < vertexCount; ++v)
+		std::memcpy(data + (size_t)remap[v] * vertexStride, &copy[(size_t)v * vertexStride], vertexStride);
+
+	return referenced;
+}
+
+void MeshOptimizer::Optimize(void* vertices, std::uint32_t vertexCount, std::uint32_t vertexStride, std::uint32_t positionOffset,
+	std::uint32_t* indices, std::uint32_t indexCount)
+{
+	Source source;
+	source.Vertices = vertices;
+	source.VertexStride = vertexStride;
+	source.PositionOffset = positionOffset;
+	source.VertexCount = vertexCount;
+
+	OptimizeVertexCache(indices, indexCount, vertexCount, indices);
+	OptimizeOverdraw(source, indices, indexCount, indices);
+	OptimizeVertexFetch(vertices, vertexCount, vertexStride, indices, indexCount);
+}
+
+MeshOptimizer::VertexCacheStats MeshOptimizer::AnalyzeVertexCache(const std::uint32_t* indices, std::uint32_t indexCount,
+	std::uint32_t vertexCount, std::uint32_t fifoSize)
+{
+	VertexCacheStats stats;
+	stats.TriangleCount = indexCount / 3;
+	if (stats.TriangleCount == 0)
+		return stats;
+
+	FifoCache cache(vertexCount, fifoSize);
+	for (std::uint32_t i = 0; i < stats.TriangleCount * 3; ++i)
+		stats.VerticesTransformed += cache.Access(indices[i]);
+
+	stats.VertexCount = CountReferenced(indices, stats.TriangleCount * 3, vertexCount);
+	stats.Acmr = (float)stats.VerticesTransformed / (float)stats.TriangleCount;
+	stats.Atvr = (float)stats.VerticesTransformed / (float)stats.VertexCount;
+	return stats;
+}
+
+MeshOptimizer::VertexFetchStats MeshOptimizer::AnalyzeVertexFetch(const std::uint32_t* indices, std::uint32_t indexCount,
+	std::uint32_t vertexCount, std::uint32_t vertexStride)
+{
+	VertexFetchStats stats;
+	if (indexCount == 0 || vertexStride == 0)
+		return stats;
+
+	/// 缓存行同样用时间戳近似LRU: 行最后一次被访问后又访问过超过CacheLines个行时视为已被挤出
+	const std::uint32_t CacheLines = FetchCacheBytes / FetchLineSize;
+	const size_t lineCount = ((size_t)vertexCount * vertexStride + FetchLineSize - 1) / FetchLineSize;
+	std::vector<std::uint32_t> lineTimestamps(lineCount, 0);
+	std::uint32_t time = CacheLines + 1;
+
+	FifoCache vertexCache(vertexCount, FifoSize);
+	for (std::uint32_t i = 0; i < indexCount; ++i) {
+		const std::uint32_t v = indices[i];
+		if (vertexCache.Access(v) == 0)
+			continue;
+
+		const size_t firstLine = (size_t)v * vertexStride / FetchLineSize;
+		const size_t lastLine = ((size_t)v * vertexStride + vertexStride - 1) / FetchLineSize;
+		for (size_t line = firstLine; line <= lastLine; ++line) {
+			if (time - lineTimestamps[line] > CacheLines)
+				stats.BytesFetched += FetchLineSize;
+			lineTimestamps[line] = time++;
+		}
+	}
+
+	const std::uint32_t referenced = CountReferenced(indices, indexCount, vertexCount);
+	stats.Overfetch = (float)stats.BytesFetched / (float)((std::uint64_t)referenced * vertexStride);
+	return stats;
+}
+
+MeshOptimizer::OverdrawStats MeshOptimizer::AnalyzeOverdraw(const Source& source, const std::uint32_t* indices, std::uint32_t indexCount)
+{
+	OverdrawStats stats;
+	const std::uint32_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return stats;
+
+	Vec3 boundsMin = { FLT_MAX, FLT_MAX, FLT_MAX };
+	Vec3 boundsMax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (std::uint32_t i = 0; i < triangleCount * 3; ++i) {
+		const Vec3 p = PositionOf(source, indices[i]);
+		boundsMin = { std::min(boundsMin.X, p.X), std::min(boundsMin.Y, p.Y), std::min(boundsMin.Z, p.Z) };
+		boundsMax = { std::max(boundsMax.X, p.X), std::max(boundsMax.Y, p.Y), std::max(boundsMax.Z, p.Z) };
+	}
+	const float extent = std::max(std::max(boundsMax.X - boundsMin.X, boundsMax.Y - boundsMin.Y), boundsMax.Z - boundsMin.Z);
+	if (extent <= 0.0f)
+		return stats;
+	const float scale = (float)(OverdrawResolution - 1) / extent;
+
+	/// 六个视角的左手系基(right, up, forward), right x up = forward, 因此投影后绕序不变
+	const Vec3 views[6][3] =
+	{
+		{ { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } },
+		{ { -1, 0, 0 }, { 0, 1, 0 }, { 0, 0, -1 } },
+		{ { 0, 0, -1 }, { 0, 1, 0 }, { 1, 0, 0 } },
+		{ { 0, 0, 1 }, { 0, 1, 0 }, { -1, 0, 0 } },
+		{ { 1, 0, 0 }, { 0, 0, -1 }, { 0, 1, 0 } },
+		{ { 1, 0, 0 }, { 0, 0, 1 }, { 0, -1, 0 } },
+	};
+
+	const int R = OverdrawResolution;
+	std::vector<float> depth((size_t)R * R);
+	const Vec3 center = { 0.5f * (boundsMin.X + boundsMax.X), 0.5f * (boundsMin.Y + boundsMax.Y), 0.5f * (boundsMin.Z + boundsMax.Z) };
+
+	for (const auto& view : views) {
+		std::fill(depth.begin(), depth.end(), FLT_MAX);
+
+		for (std::uint32_t t = 0; t < triangleCount; ++t) {
+			float sx[3], sy[3], sz[3];
+			for (int k = 0; k < 3; ++k) {
+				const Vec3 p = Sub(PositionOf(source, indices[t * 3 + k]), center);
+				sx[k] = Dot(p, view[0]) * scale + 0.5f * (float)R;
+				sy[k] = Dot(p, view[1]) * scale + 0.5f * (float)R;
+				sz[k] = Dot(p, view[2]);
+			}
+
+			// y朝上时顺时针三角形的有向面积为负; 正面积(背面)与退化三角形被剔除
+			const float area = (sx[1] - sx[0]) * (sy[2] - sy[0]) - (sx[2] - sx[0]) * (sy[1] - sy[0]);
+			if (area >= 0.0f)
+				continue;
+			const float invArea = 1.0f / area;
+
+			const int x0 = std::max(0, (int)floorf(std::min(std::min(sx[0], sx[1]), sx[2])));
+			const int x1 = std::min(R - 1, (int)ceilf(std::max(std::max(sx[0], sx[1]), sx[2])));
+			const int y0 = std::max(0, (int)floorf(std::min(std::min(sy[0], sy[1]), sy[2])));
+			const int y1 = std::min(R - 1, (int)ceilf(std::max(std::max(sy[0], sy[1]), sy[2])));
+
+			for (int y = y0; y <= y1; ++y) {
+				const float py = (float)y + 0.5f;
+				for (int x = x0; x <= x1; ++x) {
+					const float px = (float)x + 0.5f;
+					// 重心坐标, 三个都不小于0时像素中心在三角形内
+					const float w0 = ((sx[1] - px) * (sy[2] - py) - (sx[2] - px) * (sy[1] - py)) * invArea;
+					const float w1 = ((sx[2] - px) * (sy[0] - py) - (sx[0] - px) * (sy[2] - py)) * invArea;
+					const float w2 = 1.0f - w0 - w1;
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+						continue;
+
+					const float z = w0 * sz[0] + w1 * sz[1] + w2 * sz[2];
+					float& d = depth[(size_t)y * R + x];
+					if (z < d) {
+						d = z;
+						++stats.PixelsShaded;
+					}
+				}
+			}
+		}
+
+		for (float d : depth)
+			stats.PixelsCovered += (d != FLT_MAX) ? 1 : 0;
+	}
+
+	stats.Overdraw = (stats.PixelsCovered > 0) ? (float)stats.PixelsShaded / (float)stats.PixelsCovered : 0.0f;
+	return stats;
+}
@@ -0,0 +1,97 @@
+﻿//***************************************************************************************
+// MeshOptimizer.h
+//
+// 网格三角形与顶点顺序的优化, 用于离线转换或加载时; 只改变绘制顺序, 不改变网格的形状与三角形集合.
+// 通常依次执行三步(即Optimize):
+//   1. OptimizeVertexCache: 按Forsyth的线性速度算法重排三角形, 让相邻的三角形共用刚变换过的顶点,
+//      提高顶点着色后缓存(post-transform cache)的命中率
+//   2. OptimizeOverdraw: 把上一步的结果切成缓存命中率相差不大的若干簇, 朝外的簇先画,
+//      让深度测试尽早挡掉被遮住的像素(Sander等, Fast Triangle Reordering for Vertex Locality and Reduced Overdraw)
+//   3. OptimizeVertexFetch: 按索引中首次出现的顺序重排顶点, 让输入装配器取顶点时大致顺序访问内存
+// Analyze*在CPU上模拟FIFO顶点缓存, 按缓存行取顶点的内存缓存与一个小光栅化器, 用于比较优化前后的效果.
+// 本文件不依赖D3D, 输入为CPU端的顶点/索引内存(例如GeometryGenerator::MeshData或MeshFile).
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class MeshOptimizer
+{
+public:
+	/* 顶点的内存布局; 位置为每个顶点PositionOffset字节处的float3 */
+	struct Source
+	{
+		const void* Vertices = nullptr;
+		std::uint32_t VertexStride = 0;
+		std::uint32_t PositionOffset = 0;
+		std::uint32_t VertexCount = 0;
+	};
+
+	/* 顶点缓存模拟的结果 */
+	struct VertexCacheStats
+	{
+		std::uint32_t VerticesTransformed = 0;// 缓存未命中次数, 即顶点着色器的执行次数
+		std::uint32_t VertexCount = 0;// 被索引引用到的不同顶点数
+		std::uint32_t TriangleCount = 0;
+		float Acmr = 0.0f;// 每个三角形平均的缓存未命中数, 规则网格的下限约为0.5, 上限为3
+		float Atvr = 0.0f;// 每个顶点平均的变换次数, 下限为1
+	};
+
+	/* 取顶点模拟的结果 */
+	struct VertexFetchStats
+	{
+		std::uint64_t BytesFetched = 0;// 从内存读入的字节数, 按FetchLineSize字节的缓存行计
+		float Overfetch = 0.0f;// BytesFetched / (被引用的顶点数 * 步长), 下限约为1
+	};
+
+	/* 过度绘制模拟的结果 */
+	struct OverdrawStats
+	{
+		std::uint64_t PixelsCovered = 0;// 至少被一个三角形覆盖的像素
+		std::uint64_t PixelsShaded = 0;// 通过深度测试, 即执行了像素着色器的次数
+		float Overdraw = 0.0f;// PixelsShaded / PixelsCovered, 下限为1
+	};
+
+	// OptimizeVertexCache按此大小的LRU缓存给顶点打分
+	static const std::uint32_t CacheSize = 32;
+	// Analyze*与OptimizeOverdraw模拟的FIFO顶点缓存大小, 与多数GPU相近
+	static const std::uint32_t FifoSize = 16;
+	// AnalyzeVertexFetch模拟的缓存行大小与缓存容量(字节)
+	static const std::uint32_t FetchLineSize = 64;
+	static const std::uint32_t FetchCacheBytes = 16 * 1024;
+	// AnalyzeOverdraw每个视角的分辨率
+	static const int OverdrawResolution = 256;
+
+public:
+	/* 重排indices中的三角形(三角形内的绕序不变), 结果写入destination, 可与indices相同
+	* 所有索引须小于vertexCount */
+	static void OptimizeVertexCache(const std::uint32_t* indices, std::uint32_t indexCount, std::uint32_t vertexCount,
+		std::uint32_t* destination);
+
+	/* 在缓存优化过的indices上再按过度绘制重排簇, 结果写入destination, 可与indices相同
+	* 每簇的ACMR不超过它所在原簇的threshold倍; threshold越大簇越小, 排序越细, 缓存命中率越低 */
+	static void OptimizeOverdraw(const Source& source, const std::uint32_t* indices, std::uint32_t indexCount,
+		std::uint32_t* destination, float threshold = 1.05f);
+
+	/* 按indices中首次出现的顺序原地重排vertices中的顶点, 并改写indices; 未被引用的顶点保持原有相对顺序放在最后
+	* 返回被引用的顶点数 */
+	static std::uint32_t OptimizeVertexFetch(void* vertices, std::uint32_t vertexCount, std::uint32_t vertexStride,
+		std::uint32_t* indices, std::uint32_t indexCount);
+
+	/* 依次执行上面三步, 原地修改顶点与索引 */
+	static void Optimize(void* vertices, std::uint32_t vertexCount, std::uint32_t vertexStride, std::uint32_t positionOffset,
+		std::uint32_t* indices, std::uint32_t indexCount);
+
+	/* 按indices的顺序模拟fifoSize项的FIFO顶点缓存 */
+	static VertexCacheStats AnalyzeVertexCache(const std::uint32_t* indices, std::uint32_t indexCount, std::uint32_t vertexCount,
+		std::uint32_t fifoSize = FifoSize);
+
+	/* 模拟FIFO顶点缓存未命中时从顶点缓冲区读取顶点的内存流量; 缓存行按近似LRU替换 */
+	static VertexFetchStats AnalyzeVertexFetch(const std::uint32_t* indices, std::uint32_t indexCount, std::uint32_t vertexCount,
+		std::uint32_t vertexStride);
+
+	/* 沿±x, ±y, ±z六个方向正交投影光栅化网格(剔除背面, 前面为顺时针), 按提交顺序做深度测试并统计着色次数 */
+	static OverdrawStats AnalyzeOverdraw(const Source& source, const std::uint32_t* indices, std::uint32_t indexCount);
+};
@@ -0,0 +1,352 @@
+﻿//***************************************************************************************
+// MeshSimplifier.cpp
+//***************************************************************************************
+
+#include "MeshSimplifier.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+
+namespace
+{
+	struct Vec3
+	{
+		double X, Y, Z;
+	};
+
+	inline Vec3 Sub(const Vec3& a, const Vec3& b) { return { a.X - b.X, a.Y - b.Y, a.Z - b.Z }; }
+	inline Vec3 Cross(const Vec3& a, const Vec3& b) { return { a.Y*b.Z - a.Z*b.Y, a.Z*b.X - a.X*b.Z, a.X*b.Y - a.Y*b.X }; }
+	inline double Dot(const Vec3& a, const Vec3& b) { return a.X*b.X + a.Y*b.Y + a.Z*b.Z; }
+
+	/* 对称4x4误差矩阵的10个独立元素, 以及累计的面积权重
+	* 点p的误差为(p, 1)^T Q (p, 1), 即到各平面距离平方的加权和 */
+	struct Quadric
+	{
+		double A2, AB, AC, AD, B2, BC, BD, C2, CD, D2;
+		double Weight;
+
+		void AddPlane(const Vec3& n, double d, double w)
+		{
+			A2 += w*n.X*n.X; AB += w*n.X*n.Y; AC += w*n.X*n.Z; AD += w*n.X*d;
+			B2 += w*n.Y*n.Y; BC += w*n.Y*n.Z; BD += w*n.Y*d;
+			C2 += w*n.Z*n.Z; CD += w*n.Z*d;
+			D2 += w*d*d;
+			Weight += w;
+		}
+
+		void Add(const Quadric& q)
+		{
+			A2 += q.A2; AB += q.AB; AC += q.AC; AD += q.AD;
+			B2 += q.B2; BC += q.BC; BD += q.BD;
+			C2 += q.C2; CD += q.CD;
+			D2 += q.D2;
+			Weight += q.Weight;
+		}
+
+		// 按权重归一化后的均方距离
+		double Error(const Vec3& p)const
+		{
+			const double e =
+				A2*p.X*p.X + 2.0*AB*p.X*p.Y + 2.0*AC*p.X*p.Z + 2.0*AD*p.X +
+				B2*p.Y*p.Y + 2.0*BC*p.Y*p.Z + 2.0*BD*p.Y +
+				C2*p.Z*p.Z + 2.0*CD*p.Z +
+				D2;
+			return (Weight > 0.0) ? std::max(e, 0.0) / Weight : 0.0;
+		}
+	};
+
+	inline double CollapseError(const Quadric& a, const Quadric& b, const Vec3& p)
+	{
+		Quadric q = a;
+		q.Add(b);
+		return q.Error(p);
+	}
+
+	/* 把From并入To的候选折叠; 顶点的版本号在入队后变了即为过期项 */
+	struct Collapse
+	{
+		double Error;
+		std::uint32_t From;
+		std::uint32_t To;
+		std::uint32_t FromVersion;
+		std::uint32_t ToVersion;
+
+		bool operator>(const Collapse& rhs)const { return Error > rhs.Error; }
+	};
+
+	inline std::uint64_t EdgeKey(std::uint32_t a, std::uint32_t b)
+	{
+		return (a < b) ? ((std::uint64_t)a << 32 | b) : ((std::uint64_t)b << 32 | a);
+	}
+
+	struct PositionKey
+	{
+		std::uint32_t Bits[3];
+		bool operator==(const PositionKey& rhs)const { return std::memcmp(Bits, rhs.Bits, sizeof(Bits)) == 0; }
+	};
+
+	struct PositionKeyHash
+	{
+		size_t operator()(const PositionKey& key)const
+		{
+			std::uint64_t h = 0xcbf29ce484222325ull;
+			for (std::uint32_t bits : key.Bits)
+				h = (h ^ bits) * 0x100000001b3ull;
+			return (size_t)h;
+		}
+	};
+
+	// 两个方向中误差较小且允许的折叠; 都不允许时返回false
+	bool BestCollapse(std::uint32_t a, std::uint32_t b, const std::vector<Vec3>& positions, const std::vector<Quadric>& quadrics,
+		const std::vector<std::uint8_t>& locked, const std::vector<std::uint8_t>& seam, const std::vector<std::uint32_t>& versions, Collapse& best)
+	{
+		bool found = false;
+		if (!locked[a] && !seam[b]) {
+			best = { CollapseError(quadrics[a], quadrics[b], positions[b]), a, b, versions[a], versions[b] };
+			found = true;
+		}
+		if (!locked[b] && !seam[a]) {
+			const double error = CollapseError(quadrics[b], quadrics[a], positions[a]);
+			if (!found || error < best.Error)
+				best = { error, b, a, versions[b], versions[a] };
+			found = true;
+		}
+		return found;
+	}
+}
+
+float MeshSimplifier::Simplify(const Source& source, const std::uint32_t* indices, std::uint32_t indexCount,
+	std::uint32_t targetIndexCount, float maxError, std::vector<std::uint32_t>& result)
+{
+	const std::uint32_t vertexCount = source.VertexCount;
+	const std::uint32_t triangleCount = indexCount / 3;
+
+	/// 读出位置, 并把位置完全相同的顶点合并到同一个拓扑点(取其中序号最小的顶点)
+	std::vector<Vec3> positions(vertexCount);
+	std::vector<std::uint32_t> weld(vertexCount);
+	std::vector<std::uint8_t> seam(vertexCount, 0);
+	{
+		const std::uint8_t* base = static_cast<const std::uint8_t*>(source.Vertices) + source.PositionOffset;
+		std::unordered_map<PositionKey, std::uint32_t, PositionKeyHash> firstVertex;
+		firstVertex.reserve(vertexCount);
+		for (std::uint32_t v = 0; v < vertexCount; ++v) {
+			float p[3];
+			std::memcpy(p, base + (size_t)v * source.VertexStride, sizeof(p));
+			positions[v] = { p[0], p[1], p[2] };
+
+			PositionKey key;
+			std::memcpy(key.Bits, p, sizeof(key.Bits));
+			auto it = firstVertex.emplace(key, v).first;
+			weld[v] = it->second;
+			if (it->second != v) {
+				// 位置重复的顶点各自带有不同的属性, 整组都不能移动
+				seam[v] = 1;
+				seam[it->second] = 1;
+			}
+		}
+	}
+
+	/// 工作用三角形: corners为原始顶点序号(输出用), welded为拓扑点序号(邻接与误差用)
+	std::vector<std::uint32_t> corners(indices, indices + (size_t)triangleCount * 3);
+	std::vector<std::uint32_t> welded((size_t)triangleCount * 3);
+	std::vector<std::uint8_t> alive(triangleCount, 1);
+	std::uint32_t aliveCount = 0;
+	for (std::uint32_t t = 0; t < triangleCount; ++t) {
+		for (int k = 0; k < 3; ++k)
+			welded[3 * t + k] = weld[corners[3 * t + k]];
+		const std::uint32_t* w = &welded[3 * t];
+		if (w[0] == w[1] || w[1] == w[2] || w[2] == w[0])
+			alive[t] = 0;
+		else
+			++aliveCount;
+	}
+
+	/// 每个拓扑点的误差矩阵: 周围三角形所在平面按面积加权之和
+	std::vector<Quadric> quadrics(vertexCount);
+	std::memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+	for (std::uint32_t t = 0; t < triangleCount; ++t) {
+		if (!alive[t])
+			continue;
+		const std::uint32_t* w = &welded[3 * t];
+		Vec3 n = Cross(Sub(positions[w[1]], positions[w[0]]), Sub(positions[w[2]], positions[w[0]]));
+		const double length = std::sqrt(Dot(n, n));
+		if (length <= 0.0)
+			continue;
+		n = { n.X / length, n.Y / length, n.Z / length };
+		const double d = -Dot(n, positions[w[0]]);
+		for (int k = 0; k < 3; ++k)
+			quadrics[w[k]].AddPlane(n, d, 0.5 * length);
+	}
+
+	/// 只属于一个三角形的边是开放边界, 属于两个以上的是非流形边, 两端都锁定
+	std::vector<std::uint8_t> locked(seam);
+	std::unordered_map<std::uint64_t, std::uint32_t> edgeUse;
+	edgeUse.reserve((size_t)aliveCount * 2);
+	for (std::uint32_t t = 0; t < triangleCount; ++t) {
+		if (!alive[t])
+			continue;
+		const std::uint32_t* w = &welded[3 * t];
+		for (int k = 0; k < 3; ++k)
+			++edgeUse[EdgeKey(w[k], w[(k + 1) % 3])];
+	}
+	for (const auto& edge : edgeUse) {
+		if (edge.second != 2) {
+			locked[(std::uint32_t)(edge.first >> 32)] = 1;
+			locked[(std::uint32_t)edge.first] = 1;
+		}
+	}
+
+	// 各拓扑点所属的三角形; 折叠后并入目标点, 其中已删除的三角形用到时跳过
+	std::vector<std::vector<std::uint32_t>> vertexTriangles(vertexCount);
+	for (std::uint32_t t = 0; t < triangleCount; ++t) {
+		if (!alive[t])
+			continue;
+		for (int k = 0; k < 3; ++k)
+			vertexTriangles[welded[3 * t + k]].push_back(t);
+	}
+
+	std::vector<std::uint32_t> versions(vertexCount, 0);
+	std::vector<std::uint8_t> removed(vertexCount, 0);
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+	for (const auto& edge : edgeUse) {
+		Collapse collapse;
+		if (BestCollapse((std::uint32_t)(edge.first >> 32), (std::uint32_t)edge.first, positions, quadrics, locked, seam, versions, collapse))
+			queue.push(collapse);
+	}
+
+	// 收集邻点用的标记, 以递增的stamp区分每次收集
+	std::vector<std::uint32_t> mark(vertexCount, 0);
+	std::uint32_t stamp = 0;
+	std::vector<std::uint32_t> neighbors;
+
+	const std::uint32_t targetTriangles = targetIndexCount / 3;
+	const double maxError2 = (double)maxError * maxError;
+	double worstError = 0.0;
+
+	while (aliveCount > targetTriangles && !queue.empty()) {
+		const Collapse collapse = queue.top();
+		queue.pop();
+
+		const std::uint32_t from = collapse.From;
+		const std::uint32_t to = collapse.To;
+		if (removed[from] || removed[to] || versions[from] != collapse.FromVersion || versions[to] != collapse.ToVersion)
+			continue;
+		if (collapse.Error > maxError2)
+			break;
+
+		/// 流形检查: from与to共同的邻点必须恰好是共享这条边的三角形的第三个顶点, 否则折叠会产生重复面或非流形边
+		++stamp;
+		int sharedTriangles = 0;
+		for (std::uint32_t t : vertexTriangles[to]) {
+			if (!alive[t])
+				continue;
+			for (int k = 0; k < 3; ++k)
+				mark[welded[3 * t + k]] = stamp;
+		}
+		int commonNeighbors = 0;
+		++stamp;
+		bool valid = true;
+		for (std::uint32_t t : vertexTriangles[from]) {
+			if (!alive[t])
+				continue;
+			const std::uint32_t* w = &welded[3 * t];
+			const bool hasTo = (w[0] == to || w[1] == to || w[2] == to);
+			if (hasTo) {
+				++sharedTriangles;
+				continue;
+			}
+
+			/// 翻转检查: from移到to的位置后, 三角形的法线不能反向或退化
+			Vec3 p[3];
+			for (int k = 0; k < 3; ++k)
+				p[k] = positions[w[k]];
+			const Vec3 before = Cross(Sub(p[1], p[0]), Sub(p[2], p[0]));
+			for (int k = 0; k < 3; ++k) {
+				if (w[k] == from)
+					p[k] = positions[to];
+			}
+			const Vec3 after = Cross(Sub(p[1], p[0]), Sub(p[2], p[0]));
+			const double dot = Dot(before, after);
+			if (dot <= 0.0 || dot * dot < 0.04 * Dot(before, before) * Dot(after, after)) {
+				valid = false;
+				break;
+			}
+		}
+		if (!valid)
+			continue;
+
+		const std::uint32_t toStamp = stamp - 1;
+		for (std::uint32_t t : vertexTriangles[from]) {
+			if (!alive[t])
+				continue;
+			for (int k = 0; k < 3; ++k) {
+				const std::uint32_t v = welded[3 * t + k];
+				if (v != from && v != to && mark[v] == toStamp) {
+					mark[v] = stamp;
+					++commonNeighbors;
+				}
+			}
+		}
+		if (commonNeighbors != sharedTriangles)
+			continue;
+
+		/// 执行折叠: 共享这条边的三角形退化删除, 其余三角形中的from换成to
+		for (std::uint32_t t : vertexTriangles[from]) {
+			if (!alive[t])
+				continue;
+			std::uint32_t* w = &welded[3 * t];
+			if (w[0] == to || w[1] == to || w[2] == to) {
+				alive[t] = 0;
+				--aliveCount;
+				continue;
+			}
+			for (int k = 0; k < 3; ++k) {
+				if (w[k] == from) {
+					w[k] = to;
+					corners[3 * t + k] = to;// from与to都不在接缝上, 拓扑点即原始顶点
+				}
+			}
+			vertexTriangles[to].push_back(t);
+		}
+		vertexTriangles[from].clear();
+		vertexTriangles[from].shrink_to_fit();
+
+		quadrics[to].Add(quadrics[from]);
+		removed[from] = 1;
+		++versions[to];
+		worstError = std::max(worstError, collapse.Error);
+
+		// 顺便去掉to的列表中已删除的三角形, 并重新评估to周围的边
+		auto& toTriangles = vertexTriangles[to];
+		toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(),
+			[&](std::uint32_t t) { return !alive[t]; }), toTriangles.end());
+
+		++stamp;
+		neighbors.clear();
+		for (std::uint32_t t : toTriangles) {
+			for (int k = 0; k < 3; ++k) {
+				const std::uint32_t v = welded[3 * t + k];
+				if (v != to && mark[v] != stamp) {
+					mark[v] = stamp;
+					neighbors.push_back(v);
+				}
+			}
+		}
+		for (std::uint32_t v : neighbors) {
+			Collapse next;
+			if (BestCollapse(v, to, positions, quadrics, locked, seam, versions, next))
+				queue.push(next);
+		}
+	}
+
+	result.clear();
+	result.reserve((size_t)aliveCount * 3);
+	for (std::uint32_t t = 0; t < triangleCount; ++t) {
+		if (alive[t])
+			result.insert(result.end(), &corners[3 * t], &corners[3 * t] + 3);
+	}
+	return (float)std::sqrt(worstError);
+}
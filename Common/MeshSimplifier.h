@@ -0,0 +1,36 @@
+﻿//***************************************************************************************
+// MeshSimplifier.h
+//
+// 基于二次误差度量(QEM, Garland & Heckbert)的边折叠网格简化, 用于离线或加载时生成各级LOD.
+// 只做半边折叠: 边的一端并入另一端已有的顶点, 不产生新顶点, 因此简化结果只是另一份索引,
+// 与原网格共用同一个顶点缓冲区, 可作为同一MeshGeometry中额外的DrawArgs子网格.
+// 位置相同的顶点(纹理接缝, 法线硬边处的重复顶点)按同一个拓扑点处理; 接缝和开放边界上的顶点保持不动,
+// 避免网格被撕开或轮廓向内收缩. 折叠前检查三角形翻转与流形性.
+// 本文件不依赖D3D, 输入为CPU端的顶点/索引内存(例如GeometryGenerator::MeshData或MeshFile).
+//***************************************************************************************
+
+#pragma once
+
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+class MeshSimplifier
+{
+public:
+	/* 顶点的内存布局; 位置为每个顶点PositionOffset字节处的float3 */
+	struct Source
+	{
+		const void* Vertices = nullptr;
+		std::uint32_t VertexStride = 0;
+		std::uint32_t PositionOffset = 0;
+		std::uint32_t VertexCount = 0;
+	};
+
+	/* 简化indices中的三角形列表, 结果索引写入result(原有内容被替换), 仍引用source中的顶点
+	* 三角形数降到targetIndexCount / 3以下, 或下一次折叠的误差会超过maxError时停止
+	* 误差是被折叠区域内各原始三角形平面到新位置的(按面积加权的)均方根距离, 与模型同单位
+	* 剩余三角形保持原有的相对顺序与绕序; 返回实际执行过的折叠中最大的误差 */
+	static float Simplify(const Source& source, const std::uint32_t* indices, std::uint32_t indexCount,
+		std::uint32_t targetIndexCount, float maxError, std::vector<std::uint32_t>& result);
+};
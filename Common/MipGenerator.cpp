@@ -0,0 +1,335 @@
+﻿//***************************************************************************************
+// MipGenerator.cpp
+//***************************************************************************************
+
+#include "MipGenerator.h"
+#include "CpuFeatures.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	using uint32 = std::uint32_t;
+
+	/// sRGB与线性空间的转换(IEC 61966-2-1)
+	float SRGBToLinear(float s)
+	{
+		return (s <= 0.04045f) ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+	}
+
+	// 8位sRGB值解码后的线性值
+	const float* SRGBDecodeTable()
+	{
+		struct Table
+		{
+			float Values[256];
+			Table()
+			{
+				for (int i = 0; i < 256; ++i)
+					Values[i] = SRGBToLinear(i / 255.0f);
+			}
+		};
+		static const Table table;
+		return table.Values;
+	}
+
+	/* 线性值编码为8位sRGB: Thresholds[k]是sRGB值k + 0.5对应的线性值,
+	* 不超过线性值v的阈值个数即为四舍五入后的编码, 与先算pow再取整的结果相同 */
+	std::uint8_t LinearToSRGB8(float v)
+	{
+		struct Table
+		{
+			float Thresholds[255];
+			Table()
+			{
+				for (int k = 0; k < 255; ++k)
+					Thresholds[k] = SRGBToLinear((k + 0.5f) / 255.0f);
+			}
+		};
+		static const Table table;
+		return (std::uint8_t)(std::upper_bound(table.Thresholds, table.Thresholds + 255, v) - table.Thresholds);
+	}
+
+	std::uint8_t UnitToUNorm8(float v)
+	{
+		v = std::min(std::max(v, 0.0f), 1.0f);
+		return (std::uint8_t)(v * 255.0f + 0.5f);
+	}
+
+	/* 一个输出像素在某一轴上所覆盖的源像素: 从First开始的Count(1 ~ 3)个, 按覆盖面积加权, 权重和为1
+	* 源边长为偶数时恰为两个各占一半; 奇数时输出像素覆盖srcSize / dstSize个源像素, 两端的源像素只覆盖一部分 */
+	struct AxisTaps
+	{
+		uint32 First = 0;
+		uint32 Count = 0;
+		float Weight[3] = { 0.0f, 0.0f, 0.0f };
+	};
+
+	std::vector<AxisTaps> BuildTaps(uint32 srcSize, uint32 dstSize)
+	{
+		std::vector<AxisTaps> taps(dstSize);
+		const double scale = (double)srcSize / dstSize;
+		for (uint32 i = 0; i < dstSize; ++i) {
+			const double begin = i * scale;
+			const double end = (i + 1) * scale;
+			AxisTaps& t = taps[i];
+			t.First = (uint32)begin;
+			for (uint32 s = t.First; s < srcSize && s < end && t.Count < 3; ++s) {
+				const double overlap = std::min<double>(s + 1, end) - std::max<double>(s, begin);
+				t.Weight[t.Count++] = (float)(overlap / scale);
+			}
+		}
+		return taps;
+	}
+
+	/* 滤波一行输出: rows为参与的源行(最多3行), rowWeights为各行的权重
+	* 每个像素4个float, 输出dst[x] = sum(rowWeights[r] * xTaps[x].Weight[k] * rows[r][xTaps[x].First + k]) */
+	using FilterRowFn = void(*)(const float* const* rows, const float* rowWeights, uint32 rowCount,
+		const AxisTaps* xTaps, float* dst, uint32 dstWidth);
+
+	void FilterRowScalar(const float* const* rows, const float* rowWeights, uint32 rowCount,
+		const AxisTaps* xTaps, float* dst, uint32 dstWidth)
+	{
+		for (uint32 x = 0; x < dstWidth; ++x) {
+			const AxisTaps& t = xTaps[x];
+			float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+			for (uint32 r = 0; r < rowCount; ++r) {
+				const float* src = rows[r] + 4 * t.First;
+				for (uint32 k = 0; k < t.Count; ++k) {
+					const float w = rowWeights[r] * t.Weight[k];
+					for (int c = 0; c < 4; ++c)
+						acc[c] += w * src[4 * k + c];
+				}
+			}
+			for (int c = 0; c < 4; ++c)
+				dst[4 * x + c] = acc[c];
+		}
+	}
+
+#if defined(CPU_X86)
+	CPU_TARGET_SSE4 void FilterRowSSE4(const float* const* rows, const float* rowWeights, uint32 rowCount,
+		const AxisTaps* xTaps, float* dst, uint32 dstWidth)
+	{
+		// 最常见的情况: 两行, 每个输出像素取两个源像素, 即2x2平均
+		if (rowCount == 2) {
+			const float* r0 = rows[0];
+			const float* r1 = rows[1];
+			const __m128 w0 = _mm_set1_ps(rowWeights[0]);
+			const __m128 w1 = _mm_set1_ps(rowWeights[1]);
+			for (uint32 x = 0; x < dstWidth; ++x) {
+				const AxisTaps& t = xTaps[x];
+				__m128 acc = _mm_setzero_ps();
+				for (uint32 k = 0; k < t.Count; ++k) {
+					const __m128 wk = _mm_set1_ps(t.Weight[k]);
+					const __m128 column = _mm_add_ps(_mm_mul_ps(w0, _mm_loadu_ps(r0 + 4 * (t.First + k))),
+						_mm_mul_ps(w1, _mm_loadu_ps(r1 + 4 * (t.First + k))));
+					acc = _mm_add_ps(acc, _mm_mul_ps(wk, column));
+				}
+				_mm_storeu_ps(dst + 4 * x, acc);
+			}
+			return;
+		}
+
+		for (uint32 x = 0; x < dstWidth; ++x) {
+			const AxisTaps& t = xTaps[x];
+			__m128 acc = _mm_setzero_ps();
+			for (uint32 r = 0; r < rowCount; ++r) {
+				const float* src = rows[r] + 4 * t.First;
+				const __m128 wr = _mm_set1_ps(rowWeights[r]);
+				for (uint32 k = 0; k < t.Count; ++k) {
+					const __m128 w = _mm_mul_ps(wr, _mm_set1_ps(t.Weight[k]));
+					acc = _mm_add_ps(acc, _mm_mul_ps(w, _mm_loadu_ps(src + 4 * k)));
+				}
+			}
+			_mm_storeu_ps(dst + 4 * x, acc);
+		}
+	}
+#endif
+
+#if defined(CPU_NEON)
+	void FilterRowNEON(const float* const* rows, const float* rowWeights, uint32 rowCount,
+		const AxisTaps* xTaps, float* dst, uint32 dstWidth)
+	{
+		for (uint32 x = 0; x < dstWidth; ++x) {
+			const AxisTaps& t = xTaps[x];
+			float32x4_t acc = vdupq_n_f32(0.0f);
+			for (uint32 r = 0; r < rowCount; ++r) {
+				const float* src = rows[r] + 4 * t.First;
+				for (uint32 k = 0; k < t.Count; ++k)
+					acc = vfmaq_n_f32(acc, vld1q_f32(src + 4 * k), rowWeights[r] * t.Weight[k]);
+			}
+			vst1q_f32(dst + 4 * x, acc);
+		}
+	}
+#endif
+
+	FilterRowFn GetFilterRow(MipGenerator::Kernel kernel)
+	{
+		switch (kernel) {
+#if defined(CPU_X86)
+		case MipGenerator::Kernel::SSE4: return FilterRowSSE4;
+#endif
+#if defined(CPU_NEON)
+		case MipGenerator::Kernel::NEON: return FilterRowNEON;
+#endif
+		default: return FilterRowScalar;
+		}
+	}
+
+	// 把[0,1]编码的法线重新归一化, 零向量保持不变
+	void RenormalizeRow(float* pixels, uint32 width)
+	{
+		for (uint32 x = 0; x < width; ++x) {
+			float* p = pixels + 4 * x;
+			const float nx = 2.0f * p[0] - 1.0f;
+			const float ny = 2.0f * p[1] - 1.0f;
+			const float nz = 2.0f * p[2] - 1.0f;
+			const float lengthSq = nx * nx + ny * ny + nz * nz;
+			if (lengthSq < 1e-12f)
+				continue;
+			const float invLength = 1.0f / std::sqrt(lengthSq);
+			p[0] = 0.5f * nx * invLength + 0.5f;
+			p[1] = 0.5f * ny * invLength + 0.5f;
+			p[2] = 0.5f * nz * invLength + 0.5f;
+		}
+	}
+}
+
+MipGenerator::MipGenerator()
+{
+	mKernel = BestKernel();
+}
+
+bool MipGenerator::IsKernelSupported(Kernel kernel)
+{
+	switch (kernel) {
+	case Kernel::Scalar:
+		return true;
+#if defined(CPU_X86)
+	case Kernel::SSE4:
+		return GetCpuFeatures().SSE41;
+#endif
+#if defined(CPU_NEON)
+	case Kernel::NEON:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+MipGenerator::Kernel MipGenerator::BestKernel()
+{
+	if (IsKernelSupported(Kernel::SSE4))
+		return Kernel::SSE4;
+	if (IsKernelSupported(Kernel::NEON))
+		return Kernel::NEON;
+	return Kernel::Scalar;
+}
+
+bool MipGenerator::SetKernel(Kernel kernel)
+{
+	if (!IsKernelSupported(kernel))
+		return false;
+	mKernel = kernel;
+	return true;
+}
+
+void MipGenerator::SetThreadPool(ThreadPool* pool)
+{
+	mThreadPool = pool;
+}
+
+std::uint32_t MipGenerator::FullMipCount(std::uint32_t width, std::uint32_t height)
+{
+	std::uint32_t size = std::max(width, height);
+	std::uint32_t count = 1;
+	while (size > 1) {
+		size >>= 1;
+		++count;
+	}
+	return count;
+}
+
+void MipGenerator::Generate(const std::uint8_t* rgba, std::uint32_t width, std::uint32_t height, size_t rowPitch,
+	std::vector<Level>& levels, std::uint32_t maxLevels)const
+{
+	levels.clear();
+	if (rgba == nullptr || width == 0 || height == 0)
+		return;
+
+	std::uint32_t levelCount = FullMipCount(width, height);
+	if (maxLevels != 0)
+		levelCount = std::min(levelCount, maxLevels);
+	levels.resize(levelCount);
+
+	/// 第0级: 解码到线性空间
+	Level& base = levels[0];
+	base.Width = width;
+	base.Height = height;
+	base.Pixels.resize((size_t)width * height * 4);
+
+	const float* decode = SRGBDecodeTable();
+	ThreadPool& pool = mThreadPool ? *mThreadPool : ThreadPool::Default();
+	pool.ParallelFor(0, (int)height, 0, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			const std::uint8_t* src = rgba + (size_t)y * rowPitch;
+			float* dst = base.Pixels.data() + (size_t)y * width * 4;
+			for (std::uint32_t x = 0; x < width; ++x) {
+				for (int c = 0; c < 3; ++c)
+					dst[4 * x + c] = mSRGB ? decode[src[4 * x + c]] : src[4 * x + c] / 255.0f;
+				dst[4 * x + 3] = src[4 * x + 3] / 255.0f;
+			}
+		}
+	});
+
+	/// 之后每级由上一级的线性结果生成
+	for (std::uint32_t i = 1; i < levelCount; ++i) {
+		Level& level = levels[i];
+		level.Width = std::max(1u, levels[i - 1].Width >> 1);
+		level.Height = std::max(1u, levels[i - 1].Height >> 1);
+		level.Pixels.resize((size_t)level.Width * level.Height * 4);
+		Downsample(levels[i - 1], level);
+	}
+}
+
+void MipGenerator::Downsample(const Level& src, Level& dst)const
+{
+	const std::vector<AxisTaps> xTaps = BuildTaps(src.Width, dst.Width);
+	const std::vector<AxisTaps> yTaps = BuildTaps(src.Height, dst.Height);
+	const FilterRowFn filterRow = GetFilterRow(mKernel);
+
+	ThreadPool& pool = mThreadPool ? *mThreadPool : ThreadPool::Default();
+	pool.ParallelFor(0, (int)dst.Height, 0, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			const AxisTaps& t = yTaps[y];
+			const float* rows[3];
+			for (uint32 k = 0; k < t.Count; ++k)
+				rows[k] = src.Pixels.data() + (size_t)(t.First + k) * src.Width * 4;
+
+			float* out = dst.Pixels.data() + (size_t)y * dst.Width * 4;
+			filterRow(rows, t.Weight, t.Count, xTaps.data(), out, dst.Width);
+			if (mRenormalize)
+				RenormalizeRow(out, dst.Width);
+		}
+	});
+}
+
+void MipGenerator::ToRGBA8(const Level& level, std::vector<std::uint8_t>& rgba)const
+{
+	rgba.resize((size_t)level.Width * level.Height * 4);
+
+	ThreadPool& pool = mThreadPool ? *mThreadPool : ThreadPool::Default();
+	pool.ParallelFor(0, (int)level.Height, 0, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			const float* src = level.Pixels.data() + (size_t)y * level.Width * 4;
+			std::uint8_t* dst = rgba.data() + (size_t)y * level.Width * 4;
+			for (std::uint32_t x = 0; x < level.Width; ++x) {
+				for (int c = 0; c < 3; ++c)
+					dst[4 * x + c] = mSRGB ? LinearToSRGB8(src[4 * x + c]) : UnitToUNorm8(src[4 * x + c]);
+				dst[4 * x + 3] = UnitToUNorm8(src[4 * x + 3]);
+			}
+		}
+	});
+}
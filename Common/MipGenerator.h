@@ -0,0 +1,85 @@
+﻿//***************************************************************************************
+// MipGenerator.h
+//
+// 在CPU上由一张RGBA8图像生成整条mip链, 供离线烘焙纹理(TextureBaker)使用.
+// 颜色纹理先由sRGB解码到线性空间再做盒式滤波, 得到的每一级以线性float保存, 下一级由上一级的float结果生成,
+// 只在输出时编码回sRGB并量化为8位, 因此不会像直接平均sRGB值那样使缩小后的纹理偏暗.
+// 奇数边长的一级按面积加权取3个源像素, 不丢掉最后一行/列; 法线贴图可在每级滤波后重新归一化.
+// 滤波内核有Scalar/SSE4/NEON三种, 每个像素的RGBA恰好占一个128位寄存器; 构造时自动选CPU支持的最快内核.
+// 本文件不依赖D3D.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+class MipGenerator
+{
+public:
+	// 滤波内核
+	enum class Kernel
+	{
+		Scalar,
+		SSE4,	// x86/x64
+		NEON	// ARM64
+	};
+
+	/* 一级mip: 线性空间的RGBA, 每像素4个float, 行主序, 无行间填充 */
+	struct Level
+	{
+		std::uint32_t Width = 0;
+		std::uint32_t Height = 0;
+		std::vector<float> Pixels;
+	};
+
+public:
+	MipGenerator();
+	MipGenerator(const MipGenerator& rhs) = delete;
+	MipGenerator& operator=(const MipGenerator& rhs) = delete;
+
+	/* 颜色是否按sRGB编码(默认true); false时视为线性数据(法线贴图, 高度图等), 不做伽马转换
+	* alpha始终是线性的 */
+	void SetSRGB(bool srgb) { mSRGB = srgb; }
+	bool IsSRGB()const { return mSRGB; }
+
+	/* 为true时把RGB视为[0,1]编码的单位向量, 每级滤波后重新归一化(法线贴图), 默认false */
+	void SetRenormalize(bool renormalize) { mRenormalize = renormalize; }
+	bool IsRenormalize()const { return mRenormalize; }
+
+	/* 由rowPitch字节一行的RGBA8图像生成mip链, levels[0]为原图
+	* maxLevels为0时一直生成到1x1, 否则最多maxLevels级 */
+	void Generate(const std::uint8_t* rgba, std::uint32_t width, std::uint32_t height, size_t rowPitch,
+		std::vector<Level>& levels, std::uint32_t maxLevels = 0)const;
+
+	/* 把一级编码回RGBA8(按SetSRGB的设置), 每行width * 4字节 */
+	void ToRGBA8(const Level& level, std::vector<std::uint8_t>& rgba)const;
+
+	// width x height的完整mip链的级数
+	static std::uint32_t FullMipCount(std::uint32_t width, std::uint32_t height);
+
+	// 当前CPU能否运行指定内核
+	static bool IsKernelSupported(Kernel kernel);
+	// 当前CPU支持的最快内核
+	static Kernel BestKernel();
+
+	// 切换内核; CPU不支持时返回false, 保持原内核不变
+	bool SetKernel(Kernel kernel);
+	Kernel GetKernel()const { return mKernel; }
+
+	// 并行计算所用的线程池, 默认为ThreadPool::Default(); 传nullptr恢复默认
+	void SetThreadPool(ThreadPool* pool);
+
+private:
+	// 由src生成下一级dst(尺寸已设好)
+	void Downsample(const Level& src, Level& dst)const;
+
+private:
+	bool mSRGB = true;
+	bool mRenormalize = false;
+	Kernel mKernel = Kernel::Scalar;
+	ThreadPool* mThreadPool = nullptr;
+};
@@ -0,0 +1,456 @@
+﻿//***************************************************************************************
+// OcclusionCuller.cpp
+//***************************************************************************************
+
+#include "OcclusionCuller.h"
+#include "InstanceCuller.h"
+#include "CpuFeatures.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace
+{
+	struct ClipVertex
+	{
+		float X, Y, Z, W;
+	};
+
+	inline ClipVertex TransformPoint(const XMFLOAT3& p, const XMFLOAT4X4& m)
+	{
+		return {
+			p.x*m.m[0][0] + p.y*m.m[1][0] + p.z*m.m[2][0] + m.m[3][0],
+			p.x*m.m[0][1] + p.y*m.m[1][1] + p.z*m.m[2][1] + m.m[3][1],
+			p.x*m.m[0][2] + p.y*m.m[1][2] + p.z*m.m[2][2] + m.m[3][2],
+			p.x*m.m[0][3] + p.y*m.m[1][3] + p.z*m.m[2][3] + m.m[3][3] };
+	}
+
+	/* 用D3D齐次裁剪空间的近平面z >= 0裁剪三角形, 输出0或3~4个顶点的凸多边形
+	* 只裁近平面: 其余平面外的部分在光栅化时按屏幕范围截掉 */
+	int ClipNear(const ClipVertex in[3], ClipVertex out[4])
+	{
+		int count = 0;
+		for (int i = 0; i < 3; ++i) {
+			const ClipVertex& a = in[i];
+			const ClipVertex& b = in[(i + 1) % 3];
+			const bool insideA = a.Z >= 0.0f;
+			const bool insideB = b.Z >= 0.0f;
+			if (insideA)
+				out[count++] = a;
+			if (insideA != insideB) {
+				const float t = a.Z / (a.Z - b.Z);
+				out[count++] = { a.X + t*(b.X - a.X), a.Y + t*(b.Y - a.Y), 0.0f, a.W + t*(b.W - a.W) };
+			}
+		}
+		return count;
+	}
+
+	/* 光栅化一行中的count个像素: 第k个像素的三个边函数为e + k * s, 深度为z + k * dz
+	* 三个边函数都不小于0的像素在内部, 深度取较近者. 各内核的运算顺序相同, 结果逐位一致 */
+	typedef void(*SpanFn)(float* depth, int count, const float e[3], const float s[3], float z, float dz);
+
+	void SpanScalar(float* depth, int count, const float e[3], const float s[3], float z, float dz)
+	{
+		for (int k = 0; k < count; ++k) {
+			const float fk = (float)k;
+			const bool inside = (e[0] + fk*s[0] >= 0.0f) && (e[1] + fk*s[1] >= 0.0f) && (e[2] + fk*s[2] >= 0.0f);
+			const float pixelZ = z + fk*dz;
+			if (inside && pixelZ < depth[k])
+				depth[k] = pixelZ;
+		}
+	}
+
+#if defined(CPU_X86)
+	CPU_TARGET_SSE4 void SpanSSE4(float* depth, int count, const float e[3], const float s[3], float z, float dz)
+	{
+		const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+		const __m128 zero = _mm_setzero_ps();
+		int k = 0;
+		for (; k + 4 <= count; k += 4) {
+			const __m128 fk = _mm_add_ps(_mm_set1_ps((float)k), lanes);
+			__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_set1_ps(e[0]), _mm_mul_ps(fk, _mm_set1_ps(s[0]))), zero);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_set1_ps(e[1]), _mm_mul_ps(fk, _mm_set1_ps(s[1]))), zero));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_set1_ps(e[2]), _mm_mul_ps(fk, _mm_set1_ps(s[2]))), zero));
+			if (_mm_movemask_ps(inside) == 0)
+				continue;
+
+			const __m128 pixelZ = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(fk, _mm_set1_ps(dz)));
+			const __m128 old = _mm_loadu_ps(depth + k);
+			_mm_storeu_ps(depth + k, _mm_blendv_ps(old, _mm_min_ps(old, pixelZ), inside));
+		}
+
+		for (; k < count; ++k) {
+			const float fk = (float)k;
+			const bool inside = (e[0] + fk*s[0] >= 0.0f) && (e[1] + fk*s[1] >= 0.0f) && (e[2] + fk*s[2] >= 0.0f);
+			const float pixelZ = z + fk*dz;
+			if (inside && pixelZ < depth[k])
+				depth[k] = pixelZ;
+		}
+	}
+
+	CPU_TARGET_AVX2 void SpanAVX2(float* depth, int count, const float e[3], const float s[3], float z, float dz)
+	{
+		const __m256 lanes = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+		const __m256 zero = _mm256_setzero_ps();
+		int k = 0;
+		for (; k + 8 <= count; k += 8) {
+			const __m256 fk = _mm256_add_ps(_mm256_set1_ps((float)k), lanes);
+			__m256 inside = _mm256_cmp_ps(_mm256_add_ps(_mm256_set1_ps(e[0]), _mm256_mul_ps(fk, _mm256_set1_ps(s[0]))), zero, _CMP_GE_OQ);
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(_mm256_set1_ps(e[1]), _mm256_mul_ps(fk, _mm256_set1_ps(s[1]))), zero, _CMP_GE_OQ));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(_mm256_set1_ps(e[2]), _mm256_mul_ps(fk, _mm256_set1_ps(s[2]))), zero, _CMP_GE_OQ));
+			if (_mm256_movemask_ps(inside) == 0)
+				continue;
+
+			const __m256 pixelZ = _mm256_add_ps(_mm256_set1_ps(z), _mm256_mul_ps(fk, _mm256_set1_ps(dz)));
+			const __m256 old = _mm256_loadu_ps(depth + k);
+			_mm256_storeu_ps(depth + k, _mm256_blendv_ps(old, _mm256_min_ps(old, pixelZ), inside));
+		}
+
+		for (; k < count; ++k) {
+			const float fk = (float)k;
+			const bool inside = (e[0] + fk*s[0] >= 0.0f) && (e[1] + fk*s[1] >= 0.0f) && (e[2] + fk*s[2] >= 0.0f);
+			const float pixelZ = z + fk*dz;
+			if (inside && pixelZ < depth[k])
+				depth[k] = pixelZ;
+		}
+	}
+#endif
+
+	SpanFn GetSpanFn(OcclusionCuller::Kernel kernel)
+	{
+		switch (kernel) {
+#if defined(CPU_X86)
+		case OcclusionCuller::Kernel::SSE4: return SpanSSE4;
+		case OcclusionCuller::Kernel::AVX2: return SpanAVX2;
+#endif
+		default: return SpanScalar;
+		}
+	}
+}
+
+OcclusionCuller::OcclusionCuller(int width, int height)
+{
+	mKernel = BestKernel();
+	mThreadPool = &ThreadPool::Default();
+	XMStoreFloat4x4(&mViewProj, XMMatrixIdentity());
+	Resize(width, height);
+}
+
+void OcclusionCuller::Resize(int width, int height)
+{
+	width = std::max(width, 1);
+	height = std::max(height, 1);
+
+	mLevels.clear();
+	mLevelWidth.clear();
+	mLevelHeight.clear();
+	for (;;) {
+		mLevels.emplace_back((size_t)width * height, 1.0f);
+		mLevelWidth.push_back(width);
+		mLevelHeight.push_back(height);
+		if (width == 1 && height == 1)
+			break;
+		width = std::max(1, (width + 1) / 2);
+		height = std::max(1, (height + 1) / 2);
+	}
+}
+
+void OcclusionCuller::BeginFrame(FXMMATRIX viewProj)
+{
+	XMStoreFloat4x4(&mViewProj, viewProj);
+	mOccluders.clear();
+}
+
+void OcclusionCuller::AddOccluder(const OccluderMesh* mesh, FXMMATRIX world)
+{
+	Occluder occluder;
+	occluder.Mesh = mesh;
+	XMStoreFloat4x4(&occluder.WorldViewProj, XMMatrixMultiply(world, XMLoadFloat4x4(&mViewProj)));
+	mOccluders.push_back(occluder);
+}
+
+void OcclusionCuller::Render()
+{
+	// 每个输入三角形经近平面裁剪后最多成为2个三角形, 按此为各遮挡体预留区间
+	const int occluderCount = (int)mOccluders.size();
+	mTriangleOffsets.resize(occluderCount);
+	mTriangleCounts.resize(occluderCount);
+	std::uint32_t total = 0;
+	for (int o = 0; o < occluderCount; ++o) {
+		mTriangleOffsets[o] = total;
+		total += 2 * (std::uint32_t)(mOccluders[o].Mesh->Indices.size() / 3);
+	}
+	mTriangles.resize(total);
+
+	mThreadPool->ParallelFor(0, occluderCount, 1, [&](int begin, int end)
+	{
+		for (int o = begin; o < end; ++o)
+			SetupOccluder(o);
+	});
+
+	// 各行带互不重叠, 每个任务先清空再画自己的行
+	const int height = Height();
+	const int bandCount = (height + BandHeight - 1) / BandHeight;
+	mThreadPool->ParallelFor(0, bandCount, 1, [&](int begin, int end)
+	{
+		for (int b = begin; b < end; ++b)
+			RasterizeBand(b * BandHeight, std::min(height, (b + 1) * BandHeight));
+	});
+
+	BuildHiZ();
+
+	mRasterizedTriangles = 0;
+	for (int o = 0; o < occluderCount; ++o)
+		mRasterizedTriangles += (int)mTriangleCounts[o];
+}
+
+void OcclusionCuller::SetupOccluder(int occluder)
+{
+	const Occluder& occ = mOccluders[occluder];
+	const std::vector<XMFLOAT3>& positions = occ.Mesh->Positions;
+	const std::vector<std::uint32_t>& indices = occ.Mesh->Indices;
+	ScreenTriangle* out = mTriangles.data() + mTriangleOffsets[occluder];
+
+	const float width = (float)Width();
+	const float height = (float)Height();
+
+	std::uint32_t count = 0;
+	for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+		const ClipVertex clip[3] = {
+			TransformPoint(positions[indices[t + 0]], occ.WorldViewProj),
+			TransformPoint(positions[indices[t + 1]], occ.WorldViewProj),
+			TransformPoint(positions[indices[t + 2]], occ.WorldViewProj) };
+
+		// 整个三角形都在某个侧平面之外的直接跳过
+		if ((clip[0].X < -clip[0].W && clip[1].X < -clip[1].W && clip[2].X < -clip[2].W) ||
+			(clip[0].X > clip[0].W && clip[1].X > clip[1].W && clip[2].X > clip[2].W) ||
+			(clip[0].Y < -clip[0].W && clip[1].Y < -clip[1].W && clip[2].Y < -clip[2].W) ||
+			(clip[0].Y > clip[0].W && clip[1].Y > clip[1].W && clip[2].Y > clip[2].W))
+			continue;
+
+		ClipVertex polygon[4];
+		const int vertexCount = ClipNear(clip, polygon);
+		if (vertexCount < 3)
+			continue;
+
+		// 透视除法并映射到像素坐标: x向右, y向下, 像素(i, j)的中心在(i + 0.5, j + 0.5)
+		float sx[4], sy[4], sz[4];
+		for (int v = 0; v < vertexCount; ++v) {
+			const float invW = 1.0f / polygon[v].W;
+			sx[v] = (polygon[v].X * invW * 0.5f + 0.5f) * width;
+			sy[v] = (0.5f - polygon[v].Y * invW * 0.5f) * height;
+			sz[v] = polygon[v].Z * invW;
+		}
+
+		// 以扇形拆成三角形
+		for (int v = 1; v + 1 < vertexCount; ++v) {
+			const int ids[3] = { 0, v, v + 1 };
+			ScreenTriangle tri;
+			for (int k = 0; k < 3; ++k) {
+				tri.X[k] = sx[ids[k]];
+				tri.Y[k] = sy[ids[k]];
+				tri.Z[k] = sz[ids[k]];
+			}
+
+			// y向下的屏幕上顺时针的三角形面积为正; 背面与退化三角形不画
+			const float area = (tri.X[1] - tri.X[0]) * (tri.Y[2] - tri.Y[0]) - (tri.X[2] - tri.X[0]) * (tri.Y[1] - tri.Y[0]);
+			if (!(area > 0.0f))
+				continue;
+
+			// 中心落在[minY, maxY]内的像素行
+			const float minY = std::min(tri.Y[0], std::min(tri.Y[1], tri.Y[2]));
+			const float maxY = std::max(tri.Y[0], std::max(tri.Y[1], tri.Y[2]));
+			tri.MinY = (int)std::max(0.0f, std::ceil(minY - 0.5f));
+			tri.MaxY = (int)std::min(height - 1.0f, std::floor(maxY - 0.5f));
+			if (tri.MinY > tri.MaxY)
+				continue;
+
+			out[count++] = tri;
+		}
+	}
+	mTriangleCounts[occluder] = count;
+}
+
+void OcclusionCuller::RasterizeBand(int rowBegin, int rowEnd)
+{
+	const int width = Width();
+	float* depth = mLevels[0].data();
+	std::fill(depth + (size_t)rowBegin * width, depth + (size_t)rowEnd * width, 1.0f);
+
+	const SpanFn span = GetSpanFn(mKernel);
+	for (size_t o = 0; o < mOccluders.size(); ++o) {
+		const ScreenTriangle* triangles = mTriangles.data() + mTriangleOffsets[o];
+		for (std::uint32_t t = 0; t < mTriangleCounts[o]; ++t) {
+			const ScreenTriangle& tri = triangles[t];
+			if (tri.MaxY < rowBegin || tri.MinY >= rowEnd)
+				continue;
+
+			const float minX = std::min(tri.X[0], std::min(tri.X[1], tri.X[2]));
+			const float maxX = std::max(tri.X[0], std::max(tri.X[1], tri.X[2]));
+			const int x0 = (int)std::max(0.0f, std::ceil(minX - 0.5f));
+			const int x1 = (int)std::min(width - 1.0f, std::floor(maxX - 0.5f));
+			if (x0 > x1)
+				continue;
+
+			/* 边k从顶点k到顶点k+1: E_k(p) = (xb - xa)(py - ya) - (yb - ya)(px - xa), 三角形内部三者均不小于0
+			* 沿x每走一个像素E_k增加s_k = -(yb - ya); 深度按重心坐标插值, 在屏幕空间是线性的 */
+			float s[3], dy[3];
+			for (int k = 0; k < 3; ++k) {
+				const int b = (k + 1) % 3;
+				s[k] = -(tri.Y[b] - tri.Y[k]);
+				dy[k] = tri.X[b] - tri.X[k];
+			}
+			const float area = (tri.X[1] - tri.X[0]) * (tri.Y[2] - tri.Y[0]) - (tri.X[2] - tri.X[0]) * (tri.Y[1] - tri.Y[0]);
+			const float invArea = 1.0f / area;
+			// E_1对应顶点0的权重, E_2对应顶点1, E_0对应顶点2
+			const float dz = (s[1]*tri.Z[0] + s[2]*tri.Z[1] + s[0]*tri.Z[2]) * invArea;
+
+			const int y0 = std::max(tri.MinY, rowBegin);
+			const int y1 = std::min(tri.MaxY, rowEnd - 1);
+			const float px = x0 + 0.5f;
+			for (int y = y0; y <= y1; ++y) {
+				const float py = y + 0.5f;
+				float e[3];
+				for (int k = 0; k < 3; ++k)
+					e[k] = dy[k] * (py - tri.Y[k]) + s[k] * (px - tri.X[k]);
+
+				const float z = (e[1]*tri.Z[0] + e[2]*tri.Z[1] + e[0]*tri.Z[2]) * invArea;
+				span(depth + (size_t)y * width + x0, x1 - x0 + 1, e, s, z, dz);
+			}
+		}
+	}
+}
+
+void OcclusionCuller::BuildHiZ()
+{
+	// 每个纹素取上一级2x2个纹素中最远的深度; 奇数尺寸时边上的纹素只有1列或1行
+	for (size_t level = 1; level < mLevels.size(); ++level) {
+		const float* src = mLevels[level - 1].data();
+		const int srcWidth = mLevelWidth[level - 1];
+		const int srcHeight = mLevelHeight[level - 1];
+		float* dst = mLevels[level].data();
+		const int dstWidth = mLevelWidth[level];
+		const int dstHeight = mLevelHeight[level];
+
+		for (int y = 0; y < dstHeight; ++y) {
+			const float* row0 = src + (size_t)(2 * y) * srcWidth;
+			const float* row1 = src + (size_t)std::min(2 * y + 1, srcHeight - 1) * srcWidth;
+			for (int x = 0; x < dstWidth; ++x) {
+				const int x0 = 2 * x;
+				const int x1 = std::min(2 * x + 1, srcWidth - 1);
+				dst[y * dstWidth + x] = std::max(std::max(row0[x0], row0[x1]), std::max(row1[x0], row1[x1]));
+			}
+		}
+	}
+}
+
+bool OcclusionCuller::IsVisible(const BoundingBox& worldBounds)const
+{
+	// 8个角点 = 中心 ± 各轴半长, 在裁剪空间里同样是线性组合
+	const ClipVertex center = TransformPoint(worldBounds.Center, mViewProj);
+	const XMFLOAT3& e = worldBounds.Extents;
+	const float axes[3][4] = {
+		{ e.x*mViewProj.m[0][0], e.x*mViewProj.m[0][1], e.x*mViewProj.m[0][2], e.x*mViewProj.m[0][3] },
+		{ e.y*mViewProj.m[1][0], e.y*mViewProj.m[1][1], e.y*mViewProj.m[1][2], e.y*mViewProj.m[1][3] },
+		{ e.z*mViewProj.m[2][0], e.z*mViewProj.m[2][1], e.z*mViewProj.m[2][2], e.z*mViewProj.m[2][3] } };
+
+	const float width = (float)Width();
+	const float height = (float)Height();
+	float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+	for (int corner = 0; corner < 8; ++corner) {
+		float c[4] = { center.X, center.Y, center.Z, center.W };
+		for (int a = 0; a < 3; ++a) {
+			const float sign = (corner & (1 << a)) ? 1.0f : -1.0f;
+			for (int k = 0; k < 4; ++k)
+				c[k] += sign * axes[a][k];
+		}
+
+		// 与近平面相交或在其后方, 无法可靠地投影, 视为可见
+		if (c[2] < 0.0f || c[3] <= 0.0f)
+			return true;
+
+		const float invW = 1.0f / c[3];
+		const float sx = (c[0] * invW * 0.5f + 0.5f) * width;
+		const float sy = (0.5f - c[1] * invW * 0.5f) * height;
+		minX = std::min(minX, sx);
+		maxX = std::max(maxX, sx);
+		minY = std::min(minY, sy);
+		maxY = std::max(maxY, sy);
+		minZ = std::min(minZ, c[2] * invW);
+	}
+
+	// 屏幕之外或远平面之外的交给视锥体剔除
+	if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height || minZ > 1.0f)
+		return true;
+
+	// 包围盒投影所接触的像素矩形
+	const int x0 = (int)std::max(0.0f, std::floor(minX));
+	const int x1 = (int)std::min(width - 1.0f, std::floor(maxX));
+	const int y0 = (int)std::max(0.0f, std::floor(minY));
+	const int y1 = (int)std::min(height - 1.0f, std::floor(maxY));
+
+	// 选矩形在每个方向上最多跨2个纹素的那一级
+	int level = 0;
+	while (level + 1 < LevelCount() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+		++level;
+
+	const float* data = mLevels[level].data();
+	const int levelWidth = mLevelWidth[level];
+	float farthest = 0.0f;
+	for (int y = y0 >> level; y <= (y1 >> level); ++y) {
+		for (int x = x0 >> level; x <= (x1 >> level); ++x)
+			farthest = std::max(farthest, data[y * levelWidth + x]);
+	}
+	return minZ <= farthest;
+}
+
+std::uint32_t OcclusionCuller::FilterVisible(const InstanceCuller& culler, std::uint32_t* indices, std::uint32_t count)const
+{
+	std::uint32_t n = 0;
+	for (std::uint32_t i = 0; i < count; ++i) {
+		const std::uint32_t index = indices[i];
+		if (IsVisible(culler.GetBounds(index)))
+			indices[n++] = index;
+	}
+	return n;
+}
+
+bool OcclusionCuller::IsKernelSupported(Kernel kernel)
+{
+	switch (kernel) {
+	case Kernel::Scalar:
+		return true;
+	case Kernel::SSE4:
+		return GetCpuFeatures().SSE41;
+	case Kernel::AVX2:
+		return GetCpuFeatures().AVX2;
+	default:
+		return false;
+	}
+}
+
+OcclusionCuller::Kernel OcclusionCuller::BestKernel()
+{
+	if (IsKernelSupported(Kernel::AVX2))
+		return Kernel::AVX2;
+	if (IsKernelSupported(Kernel::SSE4))
+		return Kernel::SSE4;
+	return Kernel::Scalar;
+}
+
+bool OcclusionCuller::SetKernel(Kernel kernel)
+{
+	if (!IsKernelSupported(kernel))
+		return false;
+
+	mKernel = kernel;
+	return true;
+}
+
+void OcclusionCuller::SetThreadPool(ThreadPool* pool)
+{
+	mThreadPool = (pool != nullptr) ? pool : &ThreadPool::Default();
+}
@@ -0,0 +1,132 @@
+﻿//***************************************************************************************
+// OcclusionCuller.h
+//
+// CPU端的遮挡剔除: 用软件光栅化把选定的遮挡体网格画进一张低分辨率深度缓冲区,
+// 再由它逐级取2x2最大值建出层次Z(Hi-Z)金字塔; 物体包围盒投影到屏幕后,
+// 在覆盖其屏幕矩形只需约2x2个纹素的那一级上比较: 包围盒最近的深度比这些纹素中最远的深度还远, 即被完全遮挡.
+// 光栅化按屏幕上的行带(band)分给线程池并行, 每行的像素由Scalar/SSE4/AVX2内核每次处理1/4/8个.
+// 不依赖D3D, 可在无窗口的环境下测试.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+class InstanceCuller;
+class ThreadPool;
+
+class OcclusionCuller
+{
+public:
+	// 光栅化内核
+	enum class Kernel
+	{
+		Scalar,
+		SSE4,	// x86/x64, 每条指令处理4个像素
+		AVX2	// x86/x64, 每条指令处理8个像素
+	};
+
+	/* 遮挡体网格: 局部空间的顶点位置与三角形索引
+	* 须完全位于所代表的物体内部(例如物体的内接盒), 这样画出的深度不会比真实物体更近, 剔除才是保守的
+	* 按D3D的约定以顺时针为正面, 背面三角形不画 */
+	struct OccluderMesh
+	{
+		std::vector<DirectX::XMFLOAT3> Positions;
+		std::vector<std::uint32_t> Indices;
+	};
+
+	// 光栅化时每个并行任务处理的行数
+	static const int BandHeight = 16;
+
+public:
+	OcclusionCuller(int width = 256, int height = 128);
+	OcclusionCuller(const OcclusionCuller& rhs) = delete;
+	OcclusionCuller& operator=(const OcclusionCuller& rhs) = delete;
+
+	// 深度缓冲区的分辨率; 只需与视口的宽高比一致, 不必与后台缓冲区一样大
+	void Resize(int width, int height);
+	int Width()const { return mLevelWidth[0]; }
+	int Height()const { return mLevelHeight[0]; }
+
+	/* 开始新的一帧: 清空遮挡体列表, 记下本帧的观察投影矩阵 */
+	void BeginFrame(DirectX::FXMMATRIX viewProj);
+
+	/* 加入一个遮挡体; mesh须保持有效直到Render返回 */
+	void AddOccluder(const OccluderMesh* mesh, DirectX::FXMMATRIX world);
+	int OccluderCount()const { return (int)mOccluders.size(); }
+
+	/* 并行地变换、裁剪并光栅化所有遮挡体, 然后建出Hi-Z金字塔; 之后才能调用IsVisible */
+	void Render();
+
+	// 上次Render实际光栅化的三角形数(经近平面裁剪与背面剔除后)
+	int RasterizedTriangleCount()const { return mRasterizedTriangles; }
+
+	/* 世界空间的包围盒是否可能可见; 只有确定被遮挡时才返回false
+	* 与近平面相交的包围盒总视为可见 */
+	bool IsVisible(const DirectX::BoundingBox& worldBounds)const;
+
+	/* 就地过滤indices中的实例序号(包围盒取自culler), 去掉被遮挡的, 保持原有顺序, 返回剩下的个数
+	* 可作为InstanceCuller::CullParallel的过滤函数, 在多个线程上同时调用 */
+	std::uint32_t FilterVisible(const InstanceCuller& culler, std::uint32_t* indices, std::uint32_t count)const;
+
+	// Hi-Z金字塔: 第0级为深度缓冲区本身, 行主序; 每个值为该纹素覆盖范围内最远的深度(0为近平面, 1为远平面)
+	int LevelCount()const { return (int)mLevels.size(); }
+	int LevelWidth(int level)const { return mLevelWidth[level]; }
+	int LevelHeight(int level)const { return mLevelHeight[level]; }
+	const float* LevelData(int level)const { return mLevels[level].data(); }
+
+	// 当前CPU能否运行指定内核
+	static bool IsKernelSupported(Kernel kernel);
+	// 当前CPU支持的最快内核, 构造时默认使用
+	static Kernel BestKernel();
+
+	// 切换内核; CPU不支持时返回false, 保持原内核不变
+	bool SetKernel(Kernel kernel);
+	Kernel GetKernel()const { return mKernel; }
+
+	// 光栅化所用的线程池, 默认为ThreadPool::Default(); 传nullptr恢复默认
+	void SetThreadPool(ThreadPool* pool);
+
+private:
+	struct Occluder
+	{
+		const OccluderMesh* Mesh;
+		DirectX::XMFLOAT4X4 WorldViewProj;
+	};
+
+	/* 经过近平面裁剪与透视除法的屏幕空间三角形, 已是顺时针(面积为正) */
+	struct ScreenTriangle
+	{
+		float X[3];
+		float Y[3];
+		float Z[3];
+		int MinY;// 覆盖的像素行[MinY, MaxY], 已限制在屏幕内
+		int MaxY;
+	};
+
+	// 变换并裁剪第occluder个遮挡体, 结果写入mTriangles中它自己的区间
+	void SetupOccluder(int occluder);
+	// 把所有三角形在[rowBegin, rowEnd)行内的部分画进深度缓冲区
+	void RasterizeBand(int rowBegin, int rowEnd);
+	void BuildHiZ();
+
+private:
+	std::vector<std::vector<float>> mLevels;
+	std::vector<int> mLevelWidth;
+	std::vector<int> mLevelHeight;
+
+	DirectX::XMFLOAT4X4 mViewProj;
+	std::vector<Occluder> mOccluders;
+
+	// 各遮挡体的三角形在mTriangles中的起点(每个输入三角形最多裁成2个)与实际个数
+	std::vector<std::uint32_t> mTriangleOffsets;
+	std::vector<std::uint32_t> mTriangleCounts;
+	std::vector<ScreenTriangle> mTriangles;
+	int mRasterizedTriangles = 0;
+
+	Kernel mKernel = Kernel::Scalar;
+	ThreadPool* mThreadPool = nullptr;
+};
@@ -0,0 +1,276 @@
+﻿//***************************************************************************************
+// StreamedTextures.cpp
+//***************************************************************************************
+
+#include "StreamedTextures.h"
+#include "ThreadPool.h"
+#include <thread>
+
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+	HRESULT ParseResultToHRESULT(DdsParser::Result result)
+	{
+		switch (result)
+		{
+		case DdsParser::Result::Ok:
+			return S_OK;
+		case DdsParser::Result::InvalidArgument:
+			return E_INVALIDARG;
+		case DdsParser::Result::UnsupportedFormat:
+		case DdsParser::Result::UnsupportedDimension:
+		case DdsParser::Result::TooLarge:
+			return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+		case DdsParser::Result::Truncated:
+			return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+		default:
+			return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+		}
+	}
+}
+
+StreamedTextures::StreamedTextures(ID3D12Device* device, ID3D12DescriptorHeap* srvHeap, UINT firstSlot, ThreadPool* pool)
+	: mDevice(device), mSrvHeap(srvHeap), mFirstSlot(firstSlot),
+	mThreadPool(pool != nullptr ? pool : &ThreadPool::Default()), mStreamer(this)
+{
+	mDescriptorSize = mDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+}
+
+StreamedTextures::~StreamedTextures()
+{
+	// 预读任务引用着Texture, 须等它们结束
+	while (mPrefetching.load() > 0)
+		std::this_thread::yield();
+}
+
+HRESULT StreamedTextures::Add(ID3D12GraphicsCommandList* cmdList, const std::wstring& filename, UINT64 fence, TextureId& id)
+{
+	id = TextureStreamer::InvalidTexture;
+
+	std::unique_ptr<Texture> texture(new Texture);
+	texture->Filename = filename;
+	if (!texture->File.Open(filename))
+		return HRESULT_FROM_WIN32(texture->File.ErrorCode());
+
+	DdsParser::Info& info = texture->Info;
+	DdsParser::Result result = DdsParser::ParseHeader(texture->File.Data(), texture->File.Size(), info);
+	if (result == DdsParser::Result::Ok) {
+		texture->Subresources.resize(info.SubresourceCount());
+		result = DdsParser::GetSubresources(texture->File.Data(), texture->File.Size(), info, 0,
+			texture->Subresources.data(), texture->Subresources.size());
+	}
+	if (result != DdsParser::Result::Ok)
+		return ParseResultToHRESULT(result);
+
+	// 先上传尾部, 成功后再注册, 免得TextureStreamer里留下没有资源的纹理
+	const std::uint32_t tailMip = mStreamer.TailMip(info);
+	if (tailMip >= info.MipCount)
+		return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+
+	HRESULT hr = Record(cmdList, *texture, tailMip, nullptr, 0, texture->Resource, texture->Upload);
+	if (FAILED(hr))
+		return hr;
+	texture->ResidentMip = tailMip;
+	texture->Fence = fence;
+
+	id = mStreamer.Add(info);
+	CreateSrv(*texture, texture->Resource.Get(), tailMip, mFirstSlot + 2 * id);
+	mTextures.push_back(std::move(texture));
+	return S_OK;
+}
+
+UINT StreamedTextures::SrvIndex(TextureId id)const
+{
+	return mFirstSlot + 2 * id + mTextures[id]->Slot;
+}
+
+bool StreamedTextures::BeginChange(TextureId id, std::uint32_t firstMip)
+{
+	Texture& texture = *mTextures[id];
+	// 上一次的上传堆还没释放时不开始新的变化, Record会覆盖它
+	if (texture.Changing || texture.Upload != nullptr)
+		return false;
+
+	texture.Changing = true;
+	texture.Recorded = false;
+	texture.Failed = false;
+	texture.TargetMip = firstMip;
+
+	// 调出只需从旧资源拷贝
+	if (firstMip >= texture.ResidentMip) {
+		texture.Prefetched.store(true);
+		return true;
+	}
+
+	// 调入: 在线程池上把新mip所在的页读进内存, Execute记录上传时就不会在渲染线程上缺页
+	texture.Prefetched.store(false);
+	++mPrefetching;
+	Texture* target = &texture;
+	const std::uint32_t endMip = texture.ResidentMip;
+	mThreadPool->Submit([this, target, firstMip, endMip]() {
+		const DdsParser::Info& info = target->Info;
+		for (UINT slice = 0; slice < info.ArraySize; ++slice) {
+			for (std::uint32_t mip = firstMip; mip < endMip; ++mip) {
+				const DdsParser::Subresource& sub = target->Subresources[slice * info.MipCount + mip];
+				target->File.Touch((size_t)sub.Offset, (size_t)(sub.SlicePitch * sub.Depth));
+			}
+		}
+		target->Prefetched.store(true, std::memory_order_release);
+		--mPrefetching;
+	});
+	return true;
+}
+
+void StreamedTextures::Execute(ID3D12GraphicsCommandList* cmdList, UINT64 fence)
+{
+	for (UINT id = 0; id < (UINT)mTextures.size(); ++id) {
+		Texture& texture = *mTextures[id];
+		if (!texture.Changing || texture.Recorded || !texture.Prefetched.load(std::memory_order_acquire))
+			continue;
+
+		HRESULT hr = Record(cmdList, texture, texture.TargetMip, texture.Resource.Get(), texture.ResidentMip,
+			texture.NewResource, texture.Upload);
+		texture.Recorded = true;
+		texture.Fence = fence;
+		if (FAILED(hr)) {
+			// 驻留不变, 等本帧的围栏完成后由Retire报告失败
+			texture.Failed = true;
+			continue;
+		}
+
+		// 新SRV写进另一个槽, 之后的帧改用它; 旧槽仍指向旧资源, 直到Retire
+		texture.Slot ^= 1;
+		CreateSrv(texture, texture.NewResource.Get(), texture.TargetMip, mFirstSlot + 2 * id + texture.Slot);
+	}
+}
+
+void StreamedTextures::Retire(UINT64 completedFence)
+{
+	for (UINT id = 0; id < (UINT)mTextures.size(); ++id) {
+		Texture& texture = *mTextures[id];
+		if (completedFence < texture.Fence)
+			continue;
+
+		if (!texture.Changing) {
+			texture.Upload.Reset();
+			continue;
+		}
+		if (!texture.Recorded)
+			continue;
+
+		if (!texture.Failed) {
+			texture.Resource = texture.NewResource;
+			texture.ResidentMip = texture.TargetMip;
+		}
+		texture.NewResource.Reset();
+		texture.Upload.Reset();
+		texture.Changing = false;
+		texture.Recorded = false;
+		mStreamer.Complete(id, texture.TargetMip, !texture.Failed);
+	}
+}
+
+HRESULT StreamedTextures::Record(ID3D12GraphicsCommandList* cmdList, Texture& texture, std::uint32_t firstMip,
+	ID3D12Resource* oldResource, std::uint32_t oldMip, ComPtr<ID3D12Resource>& newResource, ComPtr<ID3D12Resource>& upload)
+{
+	const DdsParser::Info& info = texture.Info;
+	const UINT mipCount = info.MipCount - firstMip;
+	const UINT arraySize = info.ArraySize;
+	const UINT width = (info.Width >> firstMip) > 0 ? (info.Width >> firstMip) : 1;
+	const UINT height = (info.Height >> firstMip) > 0 ? (info.Height >> firstMip) : 1;
+
+	D3D12_RESOURCE_DESC texDesc = CD3DX12_RESOURCE_DESC::Tex2D(info.Format, width, height, (UINT16)arraySize, (UINT16)mipCount);
+	HRESULT hr = mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+		D3D12_HEAP_FLAG_NONE,
+		&texDesc,
+		D3D12_RESOURCE_STATE_COPY_DEST,
+		nullptr,
+		IID_PPV_ARGS(newResource.ReleaseAndGetAddressOf()));
+	if (FAILED(hr))
+		return hr;
+
+	/// 旧资源里没有的[firstMip, uploadEnd)从文件上传, 每个切片是一段连续的子资源
+	const std::uint32_t uploadEnd = (oldResource != nullptr) ? oldMip : info.MipCount;
+	if (firstMip < uploadEnd) {
+		const UINT count = uploadEnd - firstMip;
+		const UINT64 alignment = D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT;
+		const UINT64 sliceSize = (GetRequiredIntermediateSize(newResource.Get(), 0, count) + alignment - 1) & ~(alignment - 1);
+
+		hr = mDevice->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(sliceSize * arraySize),
+			D3D12_RESOURCE_STATE_GENERIC_READ,
+			nullptr,
+			IID_PPV_ARGS(upload.ReleaseAndGetAddressOf()));
+		if (FAILED(hr)) {
+			newResource.Reset();
+			return hr;
+		}
+
+		std::vector<D3D12_SUBRESOURCE_DATA> data(count);
+		for (UINT slice = 0; slice < arraySize; ++slice) {
+			for (UINT i = 0; i < count; ++i) {
+				const DdsParser::Subresource& sub = texture.Subresources[slice * info.MipCount + firstMip + i];
+				data[i].pData = sub.Data;
+				data[i].RowPitch = (LONG_PTR)sub.RowPitch;
+				data[i].SlicePitch = (LONG_PTR)sub.SlicePitch;
+			}
+			UpdateSubresources(cmdList, newResource.Get(), upload.Get(), sliceSize * slice, slice * mipCount, count, data.data());
+		}
+	}
+
+	/// 两个资源共有的mip在GPU上拷贝
+	if (oldResource != nullptr) {
+		const std::uint32_t copyFirst = (firstMip > oldMip) ? firstMip : oldMip;
+		const UINT oldMipCount = info.MipCount - oldMip;
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(oldResource,
+			D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE));
+		for (UINT slice = 0; slice < arraySize; ++slice) {
+			for (std::uint32_t mip = copyFirst; mip < info.MipCount; ++mip) {
+				CD3DX12_TEXTURE_COPY_LOCATION dst(newResource.Get(), slice * mipCount + (mip - firstMip));
+				CD3DX12_TEXTURE_COPY_LOCATION src(oldResource, slice * oldMipCount + (mip - oldMip));
+				cmdList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+			}
+		}
+		cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(oldResource,
+			D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+	}
+
+	cmdList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(newResource.Get(),
+		D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+	return S_OK;
+}
+
+void StreamedTextures::CreateSrv(const Texture& texture, ID3D12Resource* resource, std::uint32_t firstMip, UINT slotIndex)
+{
+	const DdsParser::Info& info = texture.Info;
+	const UINT mipLevels = info.MipCount - firstMip;
+
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = info.Format;
+	if (info.IsCubeMap && info.ArraySize > 6) {
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURECUBEARRAY;
+		srvDesc.TextureCubeArray.MipLevels = mipLevels;
+		srvDesc.TextureCubeArray.NumCubes = info.ArraySize / 6;
+	}
+	else if (info.IsCubeMap) {
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURECUBE;
+		srvDesc.TextureCube.MipLevels = mipLevels;
+	}
+	else if (info.ArraySize > 1) {
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+		srvDesc.Texture2DArray.MipLevels = mipLevels;
+		srvDesc.Texture2DArray.ArraySize = info.ArraySize;
+	}
+	else {
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = mipLevels;
+	}
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE handle(mSrvHeap->GetCPUDescriptorHandleForHeapStart(), slotIndex, mDescriptorSize);
+	mDevice->CreateShaderResourceView(resource, &srvDesc, handle);
+}
@@ -0,0 +1,98 @@
+﻿//***************************************************************************************
+// StreamedTextures.h
+//
+// TextureStreamer的D3D12后端: 每个纹理是一个只含已驻留mip[ResidentMip, MipCount)的提交资源.
+// 驻留变化时新建一个对应新范围的资源, 共有的mip在GPU上从旧资源拷贝, 新调入的mip直接从内存映射的DDS文件上传
+// (读盘在线程池上预先完成, 见MappedFile::Touch), 于是调入只需上传新的一级, 调出不读盘.
+// 每个纹理占描述符堆中相邻的两个槽, 新资源的SRV写进当前未用的槽: 仍在GPU上执行的帧继续用旧槽与旧资源,
+// 等这些帧的围栏完成(Retire)后才释放旧资源, 所以不会改写正被GPU读取的描述符.
+// 使用方式(每帧):
+//   Update中等待帧资源的围栏之后: Retire(已完成的围栏值); 报告用量; Streamer().Update();
+//                               再用SrvIndex刷新材质的纹理序号, 变化了就让各帧资源的材质重新上传
+//   Draw中记录绘制命令之前:      Execute(cmdList, 本帧将Signal的围栏值)
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "DdsParser.h"
+#include "MappedFile.h"
+#include "TextureStreamer.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class ThreadPool;
+
+class StreamedTextures : public TextureStreamer::Backend
+{
+public:
+	using TextureId = TextureStreamer::TextureId;
+
+public:
+	/* 描述符从srvHeap的第firstSlot个开始, 每个纹理按注册顺序占两个; 预读在pool上进行, nullptr为ThreadPool::Default() */
+	StreamedTextures(ID3D12Device* device, ID3D12DescriptorHeap* srvHeap, UINT firstSlot, ThreadPool* pool = nullptr);
+	StreamedTextures(const StreamedTextures& rhs) = delete;
+	StreamedTextures& operator=(const StreamedTextures& rhs) = delete;
+	// 等待进行中的预读; 调用前GPU须已执行完全部命令
+	~StreamedTextures();
+
+	TextureStreamer& Streamer() { return mStreamer; }
+
+	/* 映射filename, 只上传尾部mip(记录在cmdList上)并创建SRV; 文件保持映射, 供之后调入
+	* fence为执行cmdList之后Signal的围栏值. 成功时id为纹理编号 */
+	HRESULT Add(ID3D12GraphicsCommandList* cmdList, const std::wstring& filename, UINT64 fence, TextureId& id);
+
+	// 纹理当前的SRV在描述符堆中的序号; Execute之后才会变为新资源的槽
+	UINT SrvIndex(TextureId id)const;
+
+	/* 为预读完成的变化新建资源, 记录拷贝与上传命令, 并把新的SRV写进另一个槽; fence同Add */
+	void Execute(ID3D12GraphicsCommandList* cmdList, UINT64 fence);
+
+	/* GPU已完成到completedFence: 释放被替换的资源与上传堆, 把完成的变化告诉TextureStreamer */
+	void Retire(UINT64 completedFence);
+
+	// TextureStreamer::Backend
+	bool BeginChange(TextureId id, std::uint32_t firstMip)override;
+
+private:
+	struct Texture
+	{
+		std::wstring Filename;
+		MappedFile File;
+		DdsParser::Info Info;
+		std::vector<DdsParser::Subresource> Subresources;// 下标 = 切片 * MipCount + mip, 指向File
+
+		Microsoft::WRL::ComPtr<ID3D12Resource> Resource;// 含[ResidentMip, MipCount)
+		std::uint32_t ResidentMip = 0;
+		UINT Slot = 0;// 当前SRV用两个槽中的哪一个
+
+		/// 进行中的变化
+		bool Changing = false;
+		bool Recorded = false;	// 已在Execute中记录
+		bool Failed = false;
+		std::uint32_t TargetMip = 0;
+		std::atomic<bool> Prefetched{ false };
+		Microsoft::WRL::ComPtr<ID3D12Resource> NewResource;
+		Microsoft::WRL::ComPtr<ID3D12Resource> Upload;
+		UINT64 Fence = 0;		// 用到旧资源(与上传堆)的最后一帧
+	};
+
+	/* 新建含[firstMip, MipCount)的资源: 旧资源(含[oldMip, MipCount), 可为空)里有的mip从它拷贝, 其余从文件上传 */
+	HRESULT Record(ID3D12GraphicsCommandList* cmdList, Texture& texture, std::uint32_t firstMip,
+		ID3D12Resource* oldResource, std::uint32_t oldMip,
+		Microsoft::WRL::ComPtr<ID3D12Resource>& newResource, Microsoft::WRL::ComPtr<ID3D12Resource>& upload);
+
+	void CreateSrv(const Texture& texture, ID3D12Resource* resource, std::uint32_t firstMip, UINT slotIndex);
+
+private:
+	ID3D12Device* mDevice = nullptr;
+	ID3D12DescriptorHeap* mSrvHeap = nullptr;
+	UINT mFirstSlot = 0;
+	UINT mDescriptorSize = 0;
+	ThreadPool* mThreadPool = nullptr;
+
+	TextureStreamer mStreamer;
+	std::vector<std::unique_ptr<Texture>> mTextures;
+	std::atomic<int> mPrefetching{ 0 };
+};
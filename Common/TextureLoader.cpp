@@ -0,0 +1,143 @@
+﻿//***************************************************************************************
+// TextureLoader.cpp
+//***************************************************************************************
+
+#include "TextureLoader.h"
+#include "ThreadPool.h"
+
+using Microsoft::WRL::ComPtr;
+
+TextureLoader::TextureLoader(ThreadPool* pool)
+	: mThreadPool(pool)
+{
+}
+
+TextureLoader::~TextureLoader()
+{
+	// 工作线程上的任务还引用着this
+	std::unique_lock<std::mutex> lock(mMutex);
+	mCondition.wait(lock, [this] { return mPendingCount == 0; });
+}
+
+std::shared_future<TextureLoader::ImagePtr> TextureLoader::LoadAsync(const std::wstring& filename, Callback callback, size_t maxsize)
+{
+	auto request = std::make_shared<Request>();
+	request->Image = std::make_shared<Image>();
+	request->Image->Filename = filename;
+	request->OnComplete = std::move(callback);
+	request->MaxSize = maxsize;
+	std::shared_future<ImagePtr> future = request->Promise.get_future().share();
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		++mPendingCount;
+	}
+
+	ThreadPool& pool = (mThreadPool != nullptr) ? *mThreadPool : ThreadPool::Default();
+	pool.Submit([this, request]() {
+		// 不论Load是否抛出异常, 退出时都要递减计数, 否则析构函数与WaitAll会一直等下去
+		struct PendingGuard
+		{
+			TextureLoader* Loader;
+			~PendingGuard()
+			{
+				// 持锁通知: 析构函数一旦看到计数归零就可能销毁Loader
+				std::lock_guard<std::mutex> lock(Loader->mMutex);
+				--Loader->mPendingCount;
+				Loader->mCondition.notify_all();
+			}
+		} guard = { this };
+
+		// 工作线程上的异常没有人接, 转交给future; 回调照常派发, 看到的是失败的Result
+		std::exception_ptr error;
+		try {
+			Load(*request);
+		}
+		catch (...) {
+			error = std::current_exception();
+			request->Image->Result = E_FAIL;
+			request->Image->Data.subresources.clear();
+			request->Image->File.Close();
+		}
+
+		if (error)
+			request->Promise.set_exception(error);
+		else
+			request->Promise.set_value(request->Image);
+
+		if (request->OnComplete) {
+			std::lock_guard<std::mutex> lock(mMutex);
+			mCompleted.push_back(request);
+		}
+	});
+
+	return future;
+}
+
+void TextureLoader::Load(Request& request)
+{
+	Image& image = *request.Image;
+	if (!image.File.Open(image.Filename)) {
+		const unsigned long error = image.File.ErrorCode();
+		image.Result = (error != 0) ? HRESULT_FROM_WIN32(error) : E_FAIL;
+		return;
+	}
+
+	// 先把整个文件读进页缓存, 主线程随后往上传堆拷贝时就不会卡在磁盘上
+	image.File.Touch();
+
+	image.Result = DirectX::LoadDDSTextureDataFromMemory12(image.File.Data(), image.File.Size(), image.Data, request.MaxSize);
+	if (FAILED(image.Result))
+		image.File.Close();
+}
+
+int TextureLoader::DispatchCompleted()
+{
+	std::vector<std::shared_ptr<Request>> completed;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		completed.swap(mCompleted);
+	}
+
+	// 不持锁调用, 回调里可以再发起新的加载
+	for (const std::shared_ptr<Request>& request : completed)
+		request->OnComplete(request->Image);
+
+	return (int)completed.size();
+}
+
+void TextureLoader::WaitAll()
+{
+	// 回调里可能又发起了新的加载, 直到没有可派发的回调为止
+	do {
+		std::unique_lock<std::mutex> lock(mMutex);
+		mCondition.wait(lock, [this] { return mPendingCount == 0; });
+	} while (DispatchCompleted() > 0);
+}
+
+int TextureLoader::PendingCount()const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mPendingCount;
+}
+
+HRESULT TextureLoader::CreateTexture(ID3D12Device* device, ID3D12GraphicsCommandList* cmdList, Image& image, Texture& texture)
+{
+	if (FAILED(image.Result))
+		return image.Result;
+
+	HRESULT hr = DirectX::CreateDDSTextureFromData12(device, cmdList, image.Data, texture.Resource, texture.UploadHeap);
+	if (SUCCEEDED(hr))
+		texture.Filename = image.Filename;
+
+	// 像素已在上传堆里, 子资源指针随映射一起作废
+	image.Data.subresources.clear();
+	image.File.Close();
+	return hr;
+}
+
+HRESULT TextureLoader::CreateTexture(ID3D12Device* device, ID3D12GraphicsCommandList* cmdList,
+	const std::shared_future<ImagePtr>& load, Texture& texture)
+{
+	return CreateTexture(device, cmdList, *load.get(), texture);
+}
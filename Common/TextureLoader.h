@@ -0,0 +1,88 @@
+﻿//***************************************************************************************
+// TextureLoader.h
+//
+// 异步DDS纹理加载: 文件在线程池上内存映射并预读, 头部校验(GetDXGIFormat, GetSurfaceInfo)
+// 与各子资源(数组切片 x mip)的布局也在工作线程上算好, 子资源直接指向映射内存, 不拷贝像素.
+// 主线程只剩创建资源与记录上传命令(CreateTexture), 于是读盘与解析可以和几何体构建等工作重叠.
+// 完成结果通过std::shared_future取得, 也可以注册回调, 由主线程调用DispatchCompleted时依次执行.
+//***************************************************************************************
+
+#pragma once
+
+#include "d3dUtil.h"
+#include "DDSTextureLoader.h"
+#include "MappedFile.h"
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class ThreadPool;
+
+class TextureLoader
+{
+public:
+	/* 一个加载好的DDS文件; Data.subresources指向File的映射内存, File关闭前有效 */
+	struct Image
+	{
+		std::wstring Filename;
+		HRESULT Result = E_PENDING;// 映射或解析失败时为错误码
+		DirectX::DDS_TEXTURE_DATA12 Data;
+		MappedFile File;
+	};
+
+	using ImagePtr = std::shared_ptr<Image>;
+	using Callback = std::function<void(const ImagePtr& image)>;
+
+public:
+	// pool为nullptr时使用ThreadPool::Default()
+	explicit TextureLoader(ThreadPool* pool = nullptr);
+	TextureLoader(const TextureLoader& rhs) = delete;
+	TextureLoader& operator=(const TextureLoader& rhs) = delete;
+	// 等待所有未完成的加载, 尚未派发的回调不再调用
+	~TextureLoader();
+
+	/* 在线程池上映射, 预读并解析filename, 立即返回; future在解析完成(或失败)后就绪, 解析中抛出的异常由future.get()重新抛出
+	* callback不为空时, 由之后调用DispatchCompleted / WaitAll的线程按完成顺序调用
+	* maxsize含义同CreateDDSTextureFromFile12: 宽高超过它的mip会被跳过, 0表示不限 */
+	std::shared_future<ImagePtr> LoadAsync(const std::wstring& filename, Callback callback = nullptr, size_t maxsize = 0);
+
+	// 调用已完成请求的回调, 返回调用的个数; 应在持有命令列表的线程上调用
+	int DispatchCompleted();
+
+	// 等待全部请求完成, 再调用剩余的回调
+	void WaitAll();
+
+	// 尚未解析完成的请求数
+	int PendingCount()const;
+
+	/* 由解析好的image创建默认堆纹理与上传堆(写进texture.Resource / texture.UploadHeap), 并在cmdList上记录复制命令
+	* 像素在返回前已拷进上传堆, 随后即关闭image的文件映射; image加载失败时直接返回其错误码 */
+	static HRESULT CreateTexture(ID3D12Device* device, ID3D12GraphicsCommandList* cmdList, Image& image, Texture& texture);
+
+	// 等待load完成后同上; 加载时抛出的异常在这里重新抛出
+	static HRESULT CreateTexture(ID3D12Device* device, ID3D12GraphicsCommandList* cmdList,
+		const std::shared_future<ImagePtr>& load, Texture& texture);
+
+private:
+	struct Request
+	{
+		ImagePtr Image;
+		Callback OnComplete;
+		size_t MaxSize = 0;
+		std::promise<ImagePtr> Promise;
+	};
+
+	// 工作线程上执行: 映射, 预读并解析
+	static void Load(Request& request);
+
+private:
+	ThreadPool* mThreadPool = nullptr;
+
+	mutable std::mutex mMutex;
+	std::condition_variable mCondition;
+	int mPendingCount = 0;
+	std::vector<std::shared_ptr<Request>> mCompleted;// 已完成, 等待派发回调的请求
+};
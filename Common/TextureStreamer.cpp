@@ -0,0 +1,311 @@
+﻿//***************************************************************************************
+// TextureStreamer.cpp
+//***************************************************************************************
+
+#include "TextureStreamer.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+const TextureStreamer::TextureId TextureStreamer::InvalidTexture;
+const TextureStreamer::uint32 TextureStreamer::MaxMips;
+
+TextureStreamer::TextureStreamer(Backend* backend)
+	: mBackend(backend)
+{
+}
+
+bool TextureStreamer::Measure(const DdsParser::Info& info, Entry& e)const
+{
+	if (info.Dim != DdsParser::Dimension::Texture2D || info.Width == 0 || info.Height == 0 ||
+		info.MipCount == 0 || info.MipCount > MaxMips || info.ArraySize == 0)
+		return false;
+
+	e.MipCount = info.MipCount;
+	e.Width = info.Width;
+	e.Height = info.Height;
+
+	// 各级mip的字节数(含全部数组切片)从最粗的一级往回累加
+	uint64 mipBytes[MaxMips] = {};
+	e.TailMip = info.MipCount - 1;
+	for (uint32 mip = 0; mip < info.MipCount; ++mip) {
+		const uint32 w = std::max(1u, info.Width >> mip);
+		const uint32 h = std::max(1u, info.Height >> mip);
+		uint64 numBytes = 0;
+		if (!DdsParser::GetSurfaceInfo(w, h, info.Format, &numBytes, nullptr, nullptr))
+			return false;
+		mipBytes[mip] = numBytes * info.ArraySize;
+		if (std::max(w, h) <= mTailSize && mip < e.TailMip)
+			e.TailMip = mip;
+	}
+	e.SuffixBytes[info.MipCount] = 0;
+	for (uint32 mip = info.MipCount; mip-- > 0;)
+		e.SuffixBytes[mip] = e.SuffixBytes[mip + 1] + mipBytes[mip];
+
+	// 驻留的最精细一级就是D3D12资源的首级mip, 块压缩格式要求其宽高为4的倍数;
+	// 尾部以内有不满足的级别时, 尾部缩到它之前, 保证之后逐级调入的每一步都合法
+	if (DdsParser::IsBlockCompressed(info.Format)) {
+		for (uint32 mip = 0; mip <= e.TailMip; ++mip) {
+			if ((info.Width >> mip) % 4 != 0 || (info.Height >> mip) % 4 != 0) {
+				if (mip == 0)
+					return false;
+				e.TailMip = mip - 1;
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+TextureStreamer::uint32 TextureStreamer::TailMip(const DdsParser::Info& info)const
+{
+	Entry e;
+	return Measure(info, e) ? e.TailMip : MaxMips;
+}
+
+TextureStreamer::TextureId TextureStreamer::Add(const DdsParser::Info& info)
+{
+	Entry e;
+	if (!Measure(info, e))
+		return InvalidTexture;
+
+	e.Resident = e.Pending = e.Required = e.Needed = e.TailMip;
+	e.FrameMip = FLT_MAX;
+	mResidentBytes += e.SuffixBytes[e.TailMip];
+	mCommittedBytes += e.SuffixBytes[e.TailMip];
+	mStats.PeakCommitted = std::max(mStats.PeakCommitted, mCommittedBytes);
+
+	mTextures.push_back(e);
+	return (TextureId)(mTextures.size() - 1);
+}
+
+void TextureStreamer::BeginFrame(const XMFLOAT3& eyePos, float projScaleY, float viewportHeight)
+{
+	mEyePos = eyePos;
+	mPixelScale = projScaleY * viewportHeight * 0.5f;
+}
+
+float TextureStreamer::RequiredMip(uint32 width, uint32 height, float screenPixels, float uvScale)
+{
+	const float texels = (float)std::max(width, height) * uvScale;
+	if (screenPixels <= 0.0f || texels <= 0.0f)
+		return FLT_MAX;
+	return std::log2(texels / screenPixels);
+}
+
+void TextureStreamer::ReportUsage(TextureId id, const BoundingSphere& bounds, float uvScale)
+{
+	Entry& e = mTextures[id];
+
+	const float dx = bounds.Center.x - mEyePos.x;
+	const float dy = bounds.Center.y - mEyePos.y;
+	const float dz = bounds.Center.z - mEyePos.z;
+	const float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+
+	// 屏幕上的跨度取包围球直径的投影; 相机在球内时需要最精细的一级
+	float pixels = FLT_MAX;
+	float mip = -FLT_MAX;
+	if (distance > bounds.Radius) {
+		pixels = 2.0f * bounds.Radius * mPixelScale / distance;
+		mip = RequiredMip(e.Width, e.Height, pixels, uvScale);
+	}
+
+	e.FrameMip = std::min(e.FrameMip, mip);
+	e.FramePixels = std::max(e.FramePixels, pixels);
+	e.Used = true;
+}
+
+void TextureStreamer::ReportMip(TextureId id, uint32 mip)
+{
+	Entry& e = mTextures[id];
+	e.FrameMip = std::min(e.FrameMip, (float)mip);
+	e.Used = true;
+}
+
+void TextureStreamer::Update()
+{
+	ApplyCompletions();
+	++mFrame;
+
+	/// 所需的mip, 以及可以调入或有多余mip的纹理
+	std::vector<TextureId> streamIns;
+	std::vector<TextureId> surplus;
+	std::vector<float> priority(mTextures.size(), 0.0f);
+	uint64 targetBytes = 0;// 全部进行中的变化完成后的驻留字节数
+	for (TextureId id = 0; id < (TextureId)mTextures.size(); ++id) {
+		Entry& e = mTextures[id];
+
+		uint32 required = e.TailMip;
+		if (e.Used) {
+			const float mip = e.FrameMip + mMipBias;
+			// 先在浮点下夹到TailMip再转换: mip可能是FLT_MAX(没有有效的上报), 超出uint32的浮点转整数是未定义行为
+			required = (mip <= 0.0f) ? 0 : (mip < (float)e.TailMip) ? (uint32)mip : e.TailMip;
+			e.LastUsedFrame = mFrame;
+		}
+		e.Required = required;
+		// 变粗要等到最后一次需要更精细的一级之后EvictDelay帧
+		if (required <= e.Needed || mFrame - e.NeededFrame > mEvictDelay) {
+			e.Needed = required;
+			e.NeededFrame = mFrame;
+		}
+
+		priority[id] = e.FramePixels;
+		e.FrameMip = FLT_MAX;
+		e.FramePixels = 0.0f;
+		e.Used = false;
+
+		targetBytes += e.SuffixBytes[e.Pending];
+		if (e.Pending != e.Resident)
+			continue;
+		if (e.Resident > required)
+			streamIns.push_back(id);
+		else if (e.Resident < e.Needed)
+			surplus.push_back(id);
+	}
+
+	// 欠缺级数多的先调入, 同样多时屏幕上大的先调入
+	std::sort(streamIns.begin(), streamIns.end(), [&](TextureId a, TextureId b) {
+		const uint32 missingA = mTextures[a].Resident - mTextures[a].Required;
+		const uint32 missingB = mTextures[b].Resident - mTextures[b].Required;
+		if (missingA != missingB)
+			return missingA > missingB;
+		if (priority[a] != priority[b])
+			return priority[a] > priority[b];
+		return a < b;
+	});
+	// 最久未用的先调出
+	std::sort(surplus.begin(), surplus.end(), [&](TextureId a, TextureId b) {
+		if (mTextures[a].LastUsedFrame != mTextures[b].LastUsedFrame)
+			return mTextures[a].LastUsedFrame < mTextures[b].LastUsedFrame;
+		return a < b;
+	});
+
+	size_t nextSurplus = 0;
+	auto evictSurplus = [&]() {
+		while (nextSurplus < surplus.size()) {
+			const TextureId id = surplus[nextSurplus++];
+			const Entry& e = mTextures[id];
+			const uint64 freed = e.SuffixBytes[e.Resident] - e.SuffixBytes[e.Needed];
+			if (Begin(id, e.Needed)) {
+				++mStats.Evictions;
+				targetBytes -= freed;
+				return true;
+			}
+		}
+		return false;
+	};
+
+	/// 预算被调小: 先调出多余的mip, 不够再把屏幕上最小的纹理逐级调粗
+	if (targetBytes > mBudget) {
+		while (targetBytes > mBudget && mPendingCount < mMaxPending && evictSurplus()) {}
+
+		std::vector<TextureId> victims;
+		for (TextureId id = 0; id < (TextureId)mTextures.size(); ++id) {
+			const Entry& e = mTextures[id];
+			if (e.Pending == e.Resident && e.Resident < e.TailMip)
+				victims.push_back(id);
+		}
+		std::sort(victims.begin(), victims.end(), [&](TextureId a, TextureId b) {
+			if (priority[a] != priority[b])
+				return priority[a] < priority[b];
+			return a < b;
+		});
+		for (TextureId id : victims) {
+			if (targetBytes <= mBudget || mPendingCount >= mMaxPending)
+				break;
+			const Entry& e = mTextures[id];
+			const uint64 freed = e.SuffixBytes[e.Resident] - e.SuffixBytes[e.Resident + 1];
+			if (Begin(id, e.Resident + 1)) {
+				++mStats.Evictions;
+				targetBytes -= freed;
+			}
+		}
+	}
+
+	/// 按优先级逐级调入; 放不下时调出多余的mip腾出空间, 并停止本帧的调入, 以免低优先级的纹理抢先占用
+	for (TextureId id : streamIns) {
+		if (mPendingCount >= mMaxPending)
+			break;
+
+		const Entry& e = mTextures[id];
+		const uint32 target = e.Resident - 1;
+		const uint64 growth = e.SuffixBytes[target] - e.SuffixBytes[e.Resident];
+		// 调入期间新资源与旧资源并存
+		if (mCommittedBytes + e.SuffixBytes[target] > mBudget || targetBytes + growth > mBudget) {
+			while (targetBytes + growth > mBudget && mPendingCount < mMaxPending && evictSurplus()) {}
+			break;
+		}
+
+		if (Begin(id, target)) {
+			++mStats.StreamIns;
+			mStats.BytesStreamedIn += growth;
+			targetBytes += growth;
+		}
+	}
+}
+
+bool TextureStreamer::Begin(TextureId id, uint32 firstMip)
+{
+	Entry& e = mTextures[id];
+	if (!mBackend->BeginChange(id, firstMip)) {
+		++mStats.Failures;
+		return false;
+	}
+
+	e.Pending = firstMip;
+	++mPendingCount;
+	mCommittedBytes += e.SuffixBytes[firstMip];
+	mStats.PeakCommitted = std::max(mStats.PeakCommitted, mCommittedBytes);
+	return true;
+}
+
+void TextureStreamer::Complete(TextureId id, uint32 firstMip, bool success)
+{
+	std::lock_guard<std::mutex> lock(mCompletionMutex);
+	mCompletions.push_back({ id, firstMip, success });
+}
+
+void TextureStreamer::ApplyCompletions()
+{
+	{
+		std::lock_guard<std::mutex> lock(mCompletionMutex);
+		mCompletionsSwap.swap(mCompletions);
+	}
+
+	for (const Completion& c : mCompletionsSwap) {
+		if (c.Id >= mTextures.size())
+			continue;
+		Entry& e = mTextures[c.Id];
+		if (e.Pending == e.Resident || e.Pending != c.FirstMip)
+			continue;// 不是进行中的变化
+
+		// 成功时释放旧资源, 失败时释放新资源
+		if (c.Success) {
+			mCommittedBytes -= e.SuffixBytes[e.Resident];
+			mResidentBytes = mResidentBytes - e.SuffixBytes[e.Resident] + e.SuffixBytes[c.FirstMip];
+			e.Resident = c.FirstMip;
+		}
+		else {
+			mCommittedBytes -= e.SuffixBytes[c.FirstMip];
+			++mStats.Failures;
+		}
+		e.Pending = e.Resident;
+		--mPendingCount;
+	}
+	mCompletionsSwap.clear();
+}
+
+TextureStreamer::TextureState TextureStreamer::GetState(TextureId id)const
+{
+	const Entry& e = mTextures[id];
+	TextureState state;
+	state.MipCount = e.MipCount;
+	state.TailMip = e.TailMip;
+	state.ResidentMip = e.Resident;
+	state.PendingMip = e.Pending;
+	state.RequiredMip = e.Required;
+	state.ResidentBytes = e.SuffixBytes[e.Resident];
+	return state;
+}
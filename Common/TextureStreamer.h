@@ -0,0 +1,183 @@
+﻿//***************************************************************************************
+// TextureStreamer.h
+//
+// 纹理流式加载的驻留策略: 在显存预算内决定每个纹理驻留哪几级mip.
+// 纹理注册时只驻留不大于TailSize的低级mip(几KB), 之后按需要每次调入更精细的一级, 所以总是先有低分辨率的画面.
+// 每帧由渲染项的包围球求出屏幕上的像素跨度, 与纹理尺寸(乘以纹理坐标的缩放)相比得到所需的mip:
+//   mip = log2(纹理跨度的纹素数 / 屏幕跨度的像素数) + MipBias, 多个渲染项取最精细的一个.
+// 调入按欠缺的级数与屏幕跨度排优先级; 放不下时先调出最久未用纹理的多余mip(LRU), 仍放不下则等待.
+// 在最近EvictDelay帧内需要过的mip不算多余, 相机来回移动时不会反复调入调出.
+// 真正的资源创建, 读盘与上传由Backend完成, 完成后回调Complete; Backend换成只记账的假实现即可在CPU上测试整个策略
+// (见Tools/StreamingBench). D3D12的实现见StreamedTextures.h.
+// 预算按紧密排列的字节数计(DdsParser::GetSurfaceInfo), 不含显存对齐; 调入与调出期间新旧两份资源并存, 都计入已占用字节.
+// 不依赖D3D.
+//***************************************************************************************
+
+#pragma once
+
+#include "DdsParser.h"
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+class TextureStreamer
+{
+public:
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+	using TextureId = std::uint32_t;
+
+	static const TextureId InvalidTexture = 0xffffffff;
+	static const uint32 MaxMips = DdsParser::MaxMipLevels;
+
+	/* 执行驻留变化的一方. BeginChange在调用Update的线程上调用 */
+	class Backend
+	{
+	public:
+		virtual ~Backend() = default;
+
+		/* 开始把id的驻留mip改为[firstMip, MipCount): firstMip小于当前值为调入, 大于为调出
+		* 完成(或失败)后, 在任意线程上调用TextureStreamer::Complete; 返回false表示无法开始, 下次Update再试 */
+		virtual bool BeginChange(TextureId id, uint32 firstMip) = 0;
+	};
+
+	/* 一个纹理的状态, 供调试与统计 */
+	struct TextureState
+	{
+		uint32 MipCount = 0;
+		uint32 TailMip = 0;		// 始终驻留的最精细一级
+		uint32 ResidentMip = 0;	// 已驻留[ResidentMip, MipCount)
+		uint32 PendingMip = 0;	// 进行中的变化的目标, 没有变化时等于ResidentMip
+		uint32 RequiredMip = 0;	// 最近一次Update算出的所需mip
+		uint64 ResidentBytes = 0;
+	};
+
+	/* 累计的统计 */
+	struct Stats
+	{
+		uint64 StreamIns = 0;		// 开始的调入次数
+		uint64 Evictions = 0;		// 开始的调出次数
+		uint64 Failures = 0;		// Complete报告失败或BeginChange拒绝的次数
+		uint64 BytesStreamedIn = 0;	// 调入的新mip字节数
+		uint64 PeakCommitted = 0;	// CommittedBytes的最大值
+	};
+
+public:
+	explicit TextureStreamer(Backend* backend);
+	TextureStreamer(const TextureStreamer& rhs) = delete;
+	TextureStreamer& operator=(const TextureStreamer& rhs) = delete;
+
+	/* 注册一个二维纹理(可为数组或立方体), 返回其编号; 注册后Backend须已驻留[TailMip, MipCount)
+	* 块压缩格式的尾部不含宽高不是4的倍数的级别(它们不能作为资源的首级mip)
+	* 1D/3D纹理, 首级mip不合法或info不合法时返回InvalidTexture */
+	TextureId Add(const DdsParser::Info& info);
+
+	// Add会为info选定的尾部(始终驻留的最精细一级); 不能注册时返回MaxMips. Backend可据此在Add之前准备好尾部
+	uint32 TailMip(const DdsParser::Info& info)const;
+
+	// 预算(字节), 默认256MB; 调小后下次Update开始调出
+	void SetBudget(uint64 bytes) { mBudget = bytes; }
+	uint64 GetBudget()const { return mBudget; }
+
+	// 始终驻留的mip的最大边长, 默认64; 只影响之后Add的纹理
+	void SetTailSize(uint32 size) { mTailSize = size; }
+	uint32 GetTailSize()const { return mTailSize; }
+
+	// 同时进行的变化数上限, 默认4
+	void SetMaxPendingChanges(uint32 count) { mMaxPending = count; }
+	// 多余的mip在最后一次被需要后至少保留的帧数, 默认60
+	void SetEvictDelay(uint32 frames) { mEvictDelay = frames; }
+	// 加到所需mip上的偏移, 正值更模糊也更省显存, 默认0
+	void SetMipBias(float bias) { mMipBias = bias; }
+
+	/* 每帧报告用量之前设定相机位置, 投影矩阵的_22(即1 / tan(fovY / 2))与视口高度(像素) */
+	void BeginFrame(const DirectX::XMFLOAT3& eyePos, float projScaleY, float viewportHeight);
+
+	/* 报告本帧有一个包围球为bounds的可见物体使用了纹理id; uvScale为纹理在物体上重复的次数(TexTransform的缩放)
+	* 本帧未被报告的纹理视为不需要, 只保留尾部mip */
+	void ReportUsage(TextureId id, const DirectX::BoundingSphere& bounds, float uvScale = 1.0f);
+
+	// 直接报告所需的mip(例如由GPU反馈得到)
+	void ReportMip(TextureId id, uint32 mip);
+
+	/* 由width x height, 在物体上重复uvScale次的纹理铺满屏幕上screenPixels个像素的跨度时所需的mip(未加偏移, 不截断) */
+	static float RequiredMip(uint32 width, uint32 height, float screenPixels, float uvScale);
+
+	/* 处理已完成的变化, 按本帧报告的用量决定调入与调出并交给Backend; 每帧调用一次 */
+	void Update();
+
+	/* Backend完成变化后调用, 可在任意线程; success为false时驻留不变 */
+	void Complete(TextureId id, uint32 firstMip, bool success);
+
+	uint32 Count()const { return (uint32)mTextures.size(); }
+	TextureState GetState(TextureId id)const;
+	uint32 GetResidentMip(TextureId id)const { return mTextures[id].Resident; }
+
+	// 全部已完成驻留的字节数
+	uint64 ResidentBytes()const { return mResidentBytes; }
+	// 已驻留加上进行中的变化新建的资源字节数, 即当前实际占用
+	uint64 CommittedBytes()const { return mCommittedBytes; }
+	uint32 PendingCount()const { return mPendingCount; }
+	const Stats& GetStats()const { return mStats; }
+
+	// [firstMip, mipCount)的字节数
+	uint64 ResidentSize(TextureId id, uint32 firstMip)const { return mTextures[id].SuffixBytes[firstMip]; }
+
+private:
+	struct Entry
+	{
+		uint32 MipCount = 0;
+		uint32 TailMip = 0;
+		uint32 Resident = 0;
+		uint32 Pending = 0;
+		uint32 Width = 0;
+		uint32 Height = 0;
+		uint64 SuffixBytes[MaxMips + 1] = {};// SuffixBytes[m]为[m, MipCount)的字节数
+
+		float FrameMip = 0.0f;		// 本帧报告的最精细mip(未截断)
+		float FramePixels = 0.0f;	// 本帧最大的屏幕跨度, 作调入优先级
+		bool Used = false;
+
+		uint32 Required = 0;		// 本帧所需
+		uint32 Needed = 0;			// 最近EvictDelay帧内所需的最精细一级
+		uint64 NeededFrame = 0;
+		uint64 LastUsedFrame = 0;
+	};
+
+	struct Completion
+	{
+		TextureId Id;
+		uint32 FirstMip;
+		bool Success;
+	};
+
+	// 由info填写e的尺寸, 尾部与各级字节数; 不能注册时返回false
+	bool Measure(const DdsParser::Info& info, Entry& e)const;
+	void ApplyCompletions();
+	bool Begin(TextureId id, uint32 firstMip);
+
+private:
+	Backend* mBackend = nullptr;
+	std::vector<Entry> mTextures;
+
+	uint64 mBudget = 256ull << 20;
+	uint32 mTailSize = 64;
+	uint32 mMaxPending = 4;
+	uint32 mEvictDelay = 60;
+	float mMipBias = 0.0f;
+
+	DirectX::XMFLOAT3 mEyePos = { 0.0f, 0.0f, 0.0f };
+	float mPixelScale = 1.0f;// projScaleY * viewportHeight / 2
+
+	uint64 mFrame = 0;
+	uint64 mResidentBytes = 0;
+	uint64 mCommittedBytes = 0;
+	uint32 mPendingCount = 0;
+	Stats mStats;
+
+	std::mutex mCompletionMutex;
+	std::vector<Completion> mCompletions;
+	std::vector<Completion> mCompletionsSwap;
+};
@@ -0,0 +1,232 @@
+﻿//***************************************************************************************
+// ThreadPool.cpp
+//***************************************************************************************
+
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace
+{
+	// 当前线程所属的线程池与队列序号; 外部线程为nullptr
+	thread_local const ThreadPool* tCurrentPool = nullptr;
+	thread_local unsigned int tQueueIndex = 0;
+
+	// ParallelFor的调用线程取不到块后先自旋这么多次再阻塞, 避免为很快就结束的块付出一次睡眠唤醒
+	const int SpinCount = 64;
+}
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+	: mPendingTasks(0)
+{
+	if (threadCount == 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	const unsigned int workerCount = threadCount - 1;
+	for (unsigned int i = 0; i < workerCount + 1; ++i)
+		mQueues.push_back(std::make_unique<Queue>());
+
+	for (unsigned int i = 0; i < workerCount; ++i)
+		mWorkers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mStop = true;
+	}
+	mWakeCondition.notify_all();
+
+	for (std::thread& worker : mWorkers)
+		worker.join();
+}
+
+ThreadPool& ThreadPool::Default()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+unsigned int ThreadPool::CurrentQueueIndex()const
+{
+	return (tCurrentPool == this) ? tQueueIndex : (unsigned int)mWorkers.size();
+}
+
+void ThreadPool::ParallelFor(int begin, int end, int grain, const RangeFunc& body)
+{
+	const int count = end - begin;
+	if (count <= 0)
+		return;
+
+	const int threadCount = (int)ThreadCount();
+	if (grain <= 0)
+		grain = std::max(1, (count + threadCount * 4 - 1) / (threadCount * 4));
+
+	const int blockCount = (count + grain - 1) / grain;
+	if (threadCount == 1 || blockCount == 1) {
+		for (int b = begin; b < end; b += grain)
+			body(b, std::min(b + grain, end));
+		return;
+	}
+
+	Job job;
+	job.Body = &body;
+	job.Remaining.store(blockCount);
+
+	// 连续的块分给同一个队列, 让相邻的行尽量落在同一线程上, 减少行边界处的伪共享
+	const unsigned int queueCount = (unsigned int)mQueues.size();
+	const unsigned int self = CurrentQueueIndex();
+	for (unsigned int q = 0; q < queueCount; ++q) {
+		const int first = (int)((long long)blockCount * q / queueCount);
+		const int last = (int)((long long)blockCount * (q + 1) / queueCount);
+		if (first == last)
+			continue;
+
+		// 从调用线程自己的队列开始分配, 让它处理区间开头的块
+		Queue& queue = *mQueues[(self + q) % queueCount];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		for (int k = last - 1; k >= first; --k) {
+			Task task;
+			task.Owner = &job;
+			task.Begin = begin + k * grain;
+			task.End = std::min(task.Begin + grain, end);
+			queue.Tasks.push_back(task);
+		}
+	}
+
+	mPendingTasks.fetch_add(blockCount);
+	{
+		// 加锁后再通知, 避免与WorkerLoop中的等待条件检查错过唤醒
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+	}
+	mWakeCondition.notify_all();
+
+	// 调用线程也参与计算; 队列里取不到块时说明剩下的块都已在其它线程上执行,
+	// 短暂自旋后在Job上阻塞等待, 不再空转占用一个核
+	Task task;
+	int idle = 0;
+	while (job.Remaining.load(std::memory_order_acquire) > 0) {
+		if (PopLocal(self, task) || Steal(self, task)) {
+			Execute(task);
+			idle = 0;
+		}
+		else if (++idle < SpinCount) {
+			std::this_thread::yield();
+		}
+		else {
+			std::unique_lock<std::mutex> lock(job.Mutex);
+			job.Done.wait(lock, [&job] { return job.Remaining.load(std::memory_order_acquire) == 0; });
+		}
+	}
+
+	// 最后一个块在Mutex内递减并通知, 加一次锁等它离开后Job才能安全销毁
+	std::lock_guard<std::mutex> lock(job.Mutex);
+	if (job.Error)
+		std::rethrow_exception(job.Error);
+}
+
+void ThreadPool::Submit(TaskFunc task)
+{
+	if (mWorkers.empty()) {
+		task();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mSubmittedMutex);
+		mSubmitted.push_back(std::move(task));
+	}
+
+	mPendingTasks.fetch_add(1);
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+	}
+	mWakeCondition.notify_one();
+}
+
+void ThreadPool::WorkerLoop(unsigned int index)
+{
+	tCurrentPool = this;
+	tQueueIndex = index;
+
+	Task task;
+	TaskFunc submitted;
+	for (;;) {
+		// ParallelFor有调用线程在等, 优先于Submit提交的任务
+		if (PopLocal(index, task) || Steal(index, task)) {
+			Execute(task);
+			continue;
+		}
+		if (PopSubmitted(submitted)) {
+			submitted();
+			submitted = nullptr;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		mWakeCondition.wait(lock, [this] { return mStop || mPendingTasks.load() > 0; });
+		// 停止时先做完队列里剩下的任务(Submit提交的任务没有调用方在等待)
+		if (mStop && mPendingTasks.load() == 0)
+			return;
+	}
+}
+
+bool ThreadPool::PopLocal(unsigned int index, Task& task)
+{
+	Queue& queue = *mQueues[index];
+	std::lock_guard<std::mutex> lock(queue.Mutex);
+	if (queue.Tasks.empty())
+		return false;
+
+	task = queue.Tasks.back();
+	queue.Tasks.pop_back();
+	mPendingTasks.fetch_sub(1);
+	return true;
+}
+
+bool ThreadPool::Steal(unsigned int thief, Task& task)
+{
+	const unsigned int queueCount = (unsigned int)mQueues.size();
+	for (unsigned int i = 1; i < queueCount; ++i) {
+		Queue& queue = *mQueues[(thief + i) % queueCount];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if (queue.Tasks.empty())
+			continue;
+
+		task = queue.Tasks.front();
+		queue.Tasks.pop_front();
+		mPendingTasks.fetch_sub(1);
+		return true;
+	}
+	return false;
+}
+
+bool ThreadPool::PopSubmitted(TaskFunc& task)
+{
+	std::lock_guard<std::mutex> lock(mSubmittedMutex);
+	if (mSubmitted.empty())
+		return false;
+
+	task = std::move(mSubmitted.front());
+	mSubmitted.pop_front();
+	mPendingTasks.fetch_sub(1);
+	return true;
+}
+
+void ThreadPool::Execute(const Task& task)
+{
+	Job* job = task.Owner;
+	std::exception_ptr error;
+	try {
+		(*job->Body)(task.Begin, task.End);
+	}
+	catch (...) {
+		error = std::current_exception();
+	}
+
+	std::lock_guard<std::mutex> lock(job->Mutex);
+	if (error && !job->Error)
+		job->Error = error;
+	if (job->Remaining.fetch_sub(1, std::memory_order_release) == 1)
+		job->Done.notify_all();
+}
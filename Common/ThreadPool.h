@@ -0,0 +1,103 @@
+﻿//***************************************************************************************
+// ThreadPool.h
+//
+// 可移植的工作窃取(work-stealing)线程池, 只依赖C++标准库, Windows与Linux均可编译.
+// 用来替代只在MSVC上才有的 <ppl.h> / concurrency::parallel_for.
+// ParallelFor把区间按块(grain)切开, 连续的块分给同一个线程的队列以保持局部性;
+// 线程做完自己的块后从其它线程队列的另一端窃取, 调用线程本身也参与计算.
+// Submit提交不等待结果的单个任务(例如异步加载文件), 放在单独的队列里只由工作线程取走,
+// 所以在ParallelFor中等待的线程不会接手一个耗时很长的读盘任务.
+//***************************************************************************************
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	// 处理一个块[begin, end)
+	using RangeFunc = std::function<void(int begin, int end)>;
+	// Submit提交的任务
+	using TaskFunc = std::function<void()>;
+
+public:
+	/* threadCount为参与计算的线程总数(含调用线程), 0表示取硬件线程数
+	* threadCount为1时不创建工作线程, ParallelFor在调用线程上串行执行 */
+	explicit ThreadPool(unsigned int threadCount = 0);
+	ThreadPool(const ThreadPool& rhs) = delete;
+	ThreadPool& operator=(const ThreadPool& rhs) = delete;
+	~ThreadPool();
+
+	// 参与计算的线程总数(工作线程数 + 1个调用线程)
+	unsigned int ThreadCount()const { return (unsigned int)mWorkers.size() + 1; }
+
+	/* 并行执行body, 每次处理[begin, end)中不超过grain个连续元素
+	* grain <= 0 时自动取块大小, 使每个线程大约分到4块
+	* 返回时所有块都已执行完毕; 某个块抛出异常时其余块照常执行, 最后在调用线程上重新抛出第一个异常 */
+	void ParallelFor(int begin, int end, int grain, const RangeFunc& body);
+
+	/* 把task放进队列后立即返回, 由某个工作线程在没有ParallelFor的块可做时执行; task不应抛出异常
+	* 没有工作线程(threadCount为1)时直接在调用线程上执行; 析构前会执行完所有已提交的任务 */
+	void Submit(TaskFunc task);
+
+	/* 进程内共享的默认线程池, 首次使用时按硬件线程数创建 */
+	static ThreadPool& Default();
+
+private:
+	struct Job
+	{
+		const RangeFunc* Body = nullptr;
+		std::atomic<int> Remaining;// 尚未执行完的块数
+
+		// 递减Remaining与通知都在Mutex内进行, 调用线程据此确认没有线程还在访问Job后才销毁它
+		std::mutex Mutex;
+		std::condition_variable Done;
+		std::exception_ptr Error;// 第一个抛出的异常, 由Mutex保护
+	};
+
+	struct Task
+	{
+		Job* Owner = nullptr;
+		int Begin = 0;
+		int End = 0;
+	};
+
+	// 每个线程一个双端队列: 自己从尾部取, 其它线程从头部窃取
+	struct Queue
+	{
+		std::mutex Mutex;
+		std::deque<Task> Tasks;
+	};
+
+	void WorkerLoop(unsigned int index);
+
+	bool PopLocal(unsigned int index, Task& task);
+	bool Steal(unsigned int thief, Task& task);
+	bool PopSubmitted(TaskFunc& task);
+	void Execute(const Task& task);
+
+	// 当前线程在本池中的队列序号; 非本池线程使用最后一个队列
+	unsigned int CurrentQueueIndex()const;
+
+private:
+	std::vector<std::thread> mWorkers;
+	std::vector<std::unique_ptr<Queue>> mQueues;// mWorkers.size() + 1 个, 最后一个属于外部调用线程
+
+	// Submit提交的任务, 先进先出
+	std::mutex mSubmittedMutex;
+	std::deque<TaskFunc> mSubmitted;
+
+	std::atomic<int> mPendingTasks;// 所有队列中尚未被取走的块数与任务数
+	bool mStop = false;
+	std::mutex mSleepMutex;
+	std::condition_variable mWakeCondition;
+};
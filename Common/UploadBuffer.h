@@ -17,6 +17,7 @@ public:
 	* 2.创建出上传堆资源来匹配CPU端
 	* 3.用Map映射出上传堆资源里欲更新的数据*/
 	UploadBuffer(ID3D12Device* device, UINT elementCount, bool isConstantBuffer) :
+		mElementCount(elementCount),
 		mIsConstantBuffer(isConstantBuffer)
 	{
 		mElementByteSize = sizeof(T);// 缓存区结构体大小;若是常量缓存,则需要注意将其变为256整数倍
@@ -70,11 +71,39 @@ public:
 		memcpy(&mMappedData[elementIndex * mElementByteSize], &data, sizeof(T));
 	}
 
+	/* 把连续count个元素一次性拷贝到 从第firstElement号起的缓存里
+	* 非常量缓存的元素紧密排列, 整段只需一次memcpy; 常量缓存的元素按256B对齐, 只能逐个拷贝 */
+	void CopyRange(int firstElement, const T* data, int count)
+	{
+		assert(firstElement >= 0 && count >= 0 && (UINT)(firstElement + count) <= mElementCount);
+		if (!mIsConstantBuffer) {
+			memcpy(&mMappedData[firstElement * mElementByteSize], data, sizeof(T) * count);
+			return;
+		}
+		for (int i = 0; i < count; ++i)
+			CopyData(firstElement + i, data[i]);
+	}
+
+	/* 拿取映射出的可写数据指针, 供调用方就地写入ElementCount()个元素, 省去中间的T实例与逐元素拷贝
+	* 只用于非常量缓存(常量缓存的元素按256B对齐, 不能当作T数组访问)
+	* 上传堆一般是写合并内存: 只写不读, 尽量按地址顺序写 */
+	T* MappedData()
+	{
+		assert(!mIsConstantBuffer);
+		return reinterpret_cast<T*>(mMappedData);
+	}
+
+	UINT ElementCount()const
+	{
+		return mElementCount;
+	}
+
 private:
 	Microsoft::WRL::ComPtr<ID3D12Resource> mUploadBuffer;// 一种上传缓存资源(一般用于上传堆)
 
 	BYTE* mMappedData = nullptr;// 从某个上传堆型ComPtr资源里 映射出来的欲更新资源的'数据指针'
 
+	UINT mElementCount = 0;// 缓存区的元素个数
 	UINT mElementByteSize = 0;// 某种缓存区结构体大小;若恰好是Cubffer型缓存,则需要注意将其变为256整数倍
 	bool mIsConstantBuffer = false;
 };
\ No newline at end of file
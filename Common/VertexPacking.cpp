@@ -0,0 +1,286 @@
+﻿//***************************************************************************************
+// VertexPacking.cpp
+//***************************************************************************************
+
+#include "VertexPacking.h"
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	inline XMFLOAT3 LoadFloat3(const std::uint8_t* vertex, int offset)
+	{
+		XMFLOAT3 v;
+		std::memcpy(&v, vertex + offset, sizeof(XMFLOAT3));
+		return v;
+	}
+
+	inline XMFLOAT2 LoadFloat2(const std::uint8_t* vertex, int offset)
+	{
+		XMFLOAT2 v;
+		std::memcpy(&v, vertex + offset, sizeof(XMFLOAT2));
+		return v;
+	}
+
+	// SNORM16: 与D3D一致, -32768与-32767都解码为-1
+	inline float FromSnorm16(std::int16_t value)
+	{
+		return fmaxf((float)value / 32767.0f, -1.0f);
+	}
+
+	inline std::uint16_t ToUnorm16(float value)
+	{
+		value = fminf(fmaxf(value, 0.0f), 1.0f);
+		return (std::uint16_t)lrintf(value * 65535.0f);
+	}
+
+	// 位置所在轴向包围盒范围的比例[0, 1]; 厚度为0的轴(例如平面栅格的y)取中点
+	inline float ToBoundsFraction(float p, float center, float extent)
+	{
+		return (extent > 0.0f) ? 0.5f + 0.5f * (p - center) / extent : 0.5f;
+	}
+
+	// 用atan2(|a x b|, a . b)求夹角, 小角度时比acos精确得多
+	inline float AngleDegrees(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		const float la = a.x*a.x + a.y*a.y + a.z*a.z;
+		if (!(la > 0.0f) || !std::isfinite(la))
+			return 0.0f;
+
+		const float cx = a.y*b.z - a.z*b.y;
+		const float cy = a.z*b.x - a.x*b.z;
+		const float cz = a.x*b.y - a.y*b.x;
+		const float dot = a.x*b.x + a.y*b.y + a.z*b.z;
+		return atan2f(sqrtf(cx*cx + cy*cy + cz*cz), dot) * (180.0f / XM_PI);
+	}
+}
+
+BoundingBox VertexPacking::ComputeBounds(const void* vertices, std::uint32_t count, const Layout& layout)
+{
+	BoundingBox bounds(XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f));
+	if (count == 0 || layout.PositionOffset < 0)
+		return bounds;
+
+	const std::uint8_t* src = static_cast<const std::uint8_t*>(vertices);
+	XMFLOAT3 vMin(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 vMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (std::uint32_t i = 0; i < count; ++i) {
+		const XMFLOAT3 p = LoadFloat3(src + (size_t)i * layout.Stride, layout.PositionOffset);
+		vMin.x = fminf(vMin.x, p.x); vMin.y = fminf(vMin.y, p.y); vMin.z = fminf(vMin.z, p.z);
+		vMax.x = fmaxf(vMax.x, p.x); vMax.y = fmaxf(vMax.y, p.y); vMax.z = fmaxf(vMax.z, p.z);
+	}
+
+	bounds.Center = XMFLOAT3(0.5f * (vMin.x + vMax.x), 0.5f * (vMin.y + vMax.y), 0.5f * (vMin.z + vMax.z));
+	bounds.Extents = XMFLOAT3(0.5f * (vMax.x - vMin.x), 0.5f * (vMax.y - vMin.y), 0.5f * (vMax.z - vMin.z));
+	return bounds;
+}
+
+void VertexPacking::Encode(const void* vertices, std::uint32_t count, const Layout& layout, const BoundingBox& bounds,
+	PackedVertex* packed)
+{
+	const std::uint8_t* src = static_cast<const std::uint8_t*>(vertices);
+	for (std::uint32_t i = 0; i < count; ++i) {
+		const std::uint8_t* vertex = src + (size_t)i * layout.Stride;
+		PackedVertex& dst = packed[i];
+		std::memset(&dst, 0, sizeof(PackedVertex));
+
+		if (layout.PositionOffset >= 0) {
+			const XMFLOAT3 p = LoadFloat3(vertex, layout.PositionOffset);
+			dst.Position[0] = ToUnorm16(ToBoundsFraction(p.x, bounds.Center.x, bounds.Extents.x));
+			dst.Position[1] = ToUnorm16(ToBoundsFraction(p.y, bounds.Center.y, bounds.Extents.y));
+			dst.Position[2] = ToUnorm16(ToBoundsFraction(p.z, bounds.Center.z, bounds.Extents.z));
+		}
+		if (layout.NormalOffset >= 0)
+			EncodeOctahedral(LoadFloat3(vertex, layout.NormalOffset), dst.Normal);
+		if (layout.TexCOffset >= 0) {
+			const XMFLOAT2 uv = LoadFloat2(vertex, layout.TexCOffset);
+			dst.TexC[0] = FloatToHalf(uv.x);
+			dst.TexC[1] = FloatToHalf(uv.y);
+		}
+		if (layout.TangentUOffset >= 0)
+			EncodeOctahedral(LoadFloat3(vertex, layout.TangentUOffset), dst.TangentU);
+	}
+}
+
+void VertexPacking::Decode(const PackedVertex* packed, std::uint32_t count, const BoundingBox& bounds,
+	void* vertices, const Layout& layout)
+{
+	std::uint8_t* dst = static_cast<std::uint8_t*>(vertices);
+	for (std::uint32_t i = 0; i < count; ++i) {
+		std::uint8_t* vertex = dst + (size_t)i * layout.Stride;
+		const PackedVertex& src = packed[i];
+
+		if (layout.PositionOffset >= 0) {
+			// 与着色器中的Center + (q * 2 - 1) * Extents相同
+			XMFLOAT3 p;
+			p.x = bounds.Center.x + ((float)src.Position[0] / 65535.0f * 2.0f - 1.0f) * bounds.Extents.x;
+			p.y = bounds.Center.y + ((float)src.Position[1] / 65535.0f * 2.0f - 1.0f) * bounds.Extents.y;
+			p.z = bounds.Center.z + ((float)src.Position[2] / 65535.0f * 2.0f - 1.0f) * bounds.Extents.z;
+			std::memcpy(vertex + layout.PositionOffset, &p, sizeof(p));
+		}
+		if (layout.NormalOffset >= 0) {
+			const XMFLOAT3 n = DecodeOctahedral(src.Normal);
+			std::memcpy(vertex + layout.NormalOffset, &n, sizeof(n));
+		}
+		if (layout.TexCOffset >= 0) {
+			const XMFLOAT2 uv(HalfToFloat(src.TexC[0]), HalfToFloat(src.TexC[1]));
+			std::memcpy(vertex + layout.TexCOffset, &uv, sizeof(uv));
+		}
+		if (layout.TangentUOffset >= 0) {
+			const XMFLOAT3 t = DecodeOctahedral(src.TangentU);
+			std::memcpy(vertex + layout.TangentUOffset, &t, sizeof(t));
+		}
+	}
+}
+
+VertexPacking::ErrorStats VertexPacking::MeasureError(const void* vertices, std::uint32_t count, const Layout& layout,
+	const BoundingBox& bounds, const PackedVertex* packed)
+{
+	ErrorStats stats;
+	if (count == 0 || layout.Stride <= 0)
+		return stats;
+
+	// 逐个解码到与源相同布局的临时顶点里, 再与源比较
+	const std::uint8_t* src = static_cast<const std::uint8_t*>(vertices);
+	std::vector<std::uint8_t> decoded((size_t)layout.Stride);
+
+	double sumSquared = 0.0;
+	for (std::uint32_t i = 0; i < count; ++i) {
+		const std::uint8_t* vertex = src + (size_t)i * layout.Stride;
+		std::memcpy(decoded.data(), vertex, layout.Stride);
+		Decode(&packed[i], 1, bounds, decoded.data(), layout);
+
+		if (layout.PositionOffset >= 0) {
+			const XMFLOAT3 a = LoadFloat3(vertex, layout.PositionOffset);
+			const XMFLOAT3 b = LoadFloat3(decoded.data(), layout.PositionOffset);
+			const float d2 = (a.x - b.x)*(a.x - b.x) + (a.y - b.y)*(a.y - b.y) + (a.z - b.z)*(a.z - b.z);
+			stats.MaxPositionError = fmaxf(stats.MaxPositionError, sqrtf(d2));
+			sumSquared += d2;
+		}
+		if (layout.NormalOffset >= 0) {
+			const float e = AngleDegrees(LoadFloat3(vertex, layout.NormalOffset), LoadFloat3(decoded.data(), layout.NormalOffset));
+			stats.MaxNormalError = fmaxf(stats.MaxNormalError, e);
+		}
+		if (layout.TexCOffset >= 0) {
+			const XMFLOAT2 a = LoadFloat2(vertex, layout.TexCOffset);
+			const XMFLOAT2 b = LoadFloat2(decoded.data(), layout.TexCOffset);
+			stats.MaxTexCError = fmaxf(stats.MaxTexCError, fmaxf(fabsf(a.x - b.x), fabsf(a.y - b.y)));
+		}
+		if (layout.TangentUOffset >= 0) {
+			const float e = AngleDegrees(LoadFloat3(vertex, layout.TangentUOffset), LoadFloat3(decoded.data(), layout.TangentUOffset));
+			stats.MaxTangentError = fmaxf(stats.MaxTangentError, e);
+		}
+	}
+
+	stats.RmsPositionError = (float)sqrt(sumSquared / count);
+	return stats;
+}
+
+std::uint16_t VertexPacking::FloatToHalf(float value)
+{
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	const std::uint32_t sign = (bits >> 16) & 0x8000;
+	bits &= 0x7fffffff;
+
+	if (bits >= 0x47800000)// |value| >= 65536, 无穷大或NaN
+		return (std::uint16_t)(sign | ((bits > 0x7f800000) ? 0x7e00 : 0x7c00));
+
+	if (bits < 0x38800000) {
+		// 小于最小的规格化half(2^-14): 加上一个指数合适的数, 让浮点加法按当前(就近)舍入把尾数对齐到最低10位
+		const std::uint32_t magicBits = ((127 - 15) + (23 - 10) + 1) << 23;
+		float magic, f;
+		std::memcpy(&magic, &magicBits, sizeof(magic));
+		std::memcpy(&f, &bits, sizeof(f));
+		f += magic;
+		std::uint32_t result;
+		std::memcpy(&result, &f, sizeof(result));
+		return (std::uint16_t)(sign | (result - magicBits));
+	}
+
+	// 规格化数: 调整指数偏移, 加上舍入偏置(尾数为奇数时多加1, 即就近舍入到偶数); 进位溢出时正好得到无穷大
+	const std::uint32_t mantissaOdd = (bits >> 13) & 1;
+	bits += ((std::uint32_t)(15 - 127) << 23) + 0xfff + mantissaOdd;
+	return (std::uint16_t)(sign | (bits >> 13));
+}
+
+float VertexPacking::HalfToFloat(std::uint16_t value)
+{
+	const std::uint32_t sign = (std::uint32_t)(value & 0x8000) << 16;
+	const std::uint32_t exponent = (value >> 10) & 0x1f;
+	const std::uint32_t mantissa = value & 0x3ff;
+
+	std::uint32_t bits;
+	if (exponent == 0) {
+		// 0或非规格化数: mantissa * 2^-24, 在float中可精确表示
+		const float f = (float)mantissa * (1.0f / 16777216.0f);
+		std::memcpy(&bits, &f, sizeof(bits));
+		bits |= sign;
+	}
+	else if (exponent == 31) {
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	}
+	else {
+		bits = sign | ((exponent + (127 - 15)) << 23) | (mantissa << 13);
+	}
+
+	float result;
+	std::memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+void VertexPacking::EncodeOctahedral(const XMFLOAT3& v, std::int16_t encoded[2])
+{
+	/// 单位球投影到八面体|x| + |y| + |z| = 1上, 下半部分(z < 0)沿对角线翻折到外侧的4个三角形, 展开成[-1, 1]^2的正方形
+	const float l1 = fabsf(v.x) + fabsf(v.y) + fabsf(v.z);
+	if (!(l1 > 0.0f) || !std::isfinite(l1)) {
+		encoded[0] = 0;
+		encoded[1] = 0;
+		return;
+	}
+
+	float x = v.x / l1;
+	float y = v.y / l1;
+	if (v.z < 0.0f) {
+		const float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		const float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = fx;
+		y = fy;
+	}
+
+	/// 直接舍入的误差在翻折处可达两倍; 在相邻的4个量化点里选解码后与v夹角最小的一个
+	const float length = sqrtf(v.x*v.x + v.y*v.y + v.z*v.z);
+	const float baseX = floorf(fminf(fmaxf(x, -1.0f), 1.0f) * 32767.0f);
+	const float baseY = floorf(fminf(fmaxf(y, -1.0f), 1.0f) * 32767.0f);
+	float bestDot = -FLT_MAX;
+	for (int i = 0; i < 4; ++i) {
+		const float qx = fminf(fmaxf(baseX + (float)(i & 1), -32767.0f), 32767.0f);
+		const float qy = fminf(fmaxf(baseY + (float)(i >> 1), -32767.0f), 32767.0f);
+		const std::int16_t candidate[2] = { (std::int16_t)qx, (std::int16_t)qy };
+		const XMFLOAT3 d = DecodeOctahedral(candidate);
+		const float dot = (d.x*v.x + d.y*v.y + d.z*v.z) / length;
+		if (dot > bestDot) {
+			bestDot = dot;
+			encoded[0] = candidate[0];
+			encoded[1] = candidate[1];
+		}
+	}
+}
+
+XMFLOAT3 VertexPacking::DecodeOctahedral(const std::int16_t encoded[2])
+{
+	// 与Common.hlsl中的DecodeOctahedral相同
+	float x = FromSnorm16(encoded[0]);
+	float y = FromSnorm16(encoded[1]);
+	const float z = 1.0f - fabsf(x) - fabsf(y);
+	const float t = fmaxf(-z, 0.0f);
+	x += (x >= 0.0f) ? -t : t;
+	y += (y >= 0.0f) ? -t : t;
+
+	const float length = sqrtf(x*x + y*y + z*z);
+	return XMFLOAT3(x / length, y / length, z / length);
+}
@@ -0,0 +1,77 @@
+﻿//***************************************************************************************
+// VertexPacking.h
+//
+// 顶点压缩: 把float顶点(例如GeometryGenerator::Vertex, 44字节)打包成20字节的PackedVertex.
+//   位置    在子网格包围盒内量化为3个UNORM16, 着色器用包围盒的Center/Extents还原
+//   法线/切线 八面体编码(octahedral)为2个SNORM16, 解码后为单位向量
+//   纹理坐标 半精度浮点(half)
+// 输入装配器直接读取这些格式(见PackedVertex的注释), 只有位置与八面体解码需要着色器里的几行代码.
+// 另有CPU端的解码与误差统计, 用于检查精度是否满足要求. 本文件不依赖D3D.
+//***************************************************************************************
+
+#pragma once
+
+#include <cstdint>
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+class VertexPacking
+{
+public:
+	/* 20字节的压缩顶点, 对应的输入布局:
+	*  POSITION  DXGI_FORMAT_R16G16B16A16_UNORM  偏移0,  w恒为0
+	*  NORMAL    DXGI_FORMAT_R16G16_SNORM        偏移8
+	*  TEXCOORD  DXGI_FORMAT_R16G16_FLOAT        偏移12
+	*  TANGENT   DXGI_FORMAT_R16G16_SNORM        偏移16 */
+	struct PackedVertex
+	{
+		std::uint16_t Position[4];
+		std::int16_t Normal[2];
+		std::uint16_t TexC[2];
+		std::int16_t TangentU[2];
+	};
+
+	/* 源顶点的布局: 各字段在顶点结构体中的字节偏移(offsetof), 没有的字段填-1
+	* 位置, 法线, 切线为float3, 纹理坐标为float2 */
+	struct Layout
+	{
+		int Stride = 0;
+		int PositionOffset = -1;
+		int NormalOffset = -1;
+		int TexCOffset = -1;
+		int TangentUOffset = -1;
+	};
+
+	/* MeasureError的结果; 角度误差以度为单位, 源向量长度为0(或非有限值)的顶点不计入 */
+	struct ErrorStats
+	{
+		float MaxPositionError = 0.0f;// 与模型同单位
+		float RmsPositionError = 0.0f;
+		float MaxNormalError = 0.0f;
+		float MaxTangentError = 0.0f;
+		float MaxTexCError = 0.0f;// 纹理坐标各分量的最大绝对误差
+	};
+
+public:
+	/* count个顶点位置的包围盒, 即量化位置所用的范围 */
+	static DirectX::BoundingBox ComputeBounds(const void* vertices, std::uint32_t count, const Layout& layout);
+
+	/* 把count个源顶点编码为packed[0, count); 位置按bounds量化, 超出bounds的部分被截断
+	* layout中没有的字段写0 */
+	static void Encode(const void* vertices, std::uint32_t count, const Layout& layout, const DirectX::BoundingBox& bounds,
+		PackedVertex* packed);
+
+	/* Encode的逆过程, 只写layout中有的字段 */
+	static void Decode(const PackedVertex* packed, std::uint32_t count, const DirectX::BoundingBox& bounds,
+		void* vertices, const Layout& layout);
+
+	/* 比较源顶点与其编码结果解码后的差别 */
+	static ErrorStats MeasureError(const void* vertices, std::uint32_t count, const Layout& layout, const DirectX::BoundingBox& bounds,
+		const PackedVertex* packed);
+
+	// 单个分量的编解码, 与GPU对相应DXGI格式的解释一致
+	static std::uint16_t FloatToHalf(float value);// 就近舍入到偶数, 超出范围得到无穷大
+	static float HalfToFloat(std::uint16_t value);
+	static void EncodeOctahedral(const DirectX::XMFLOAT3& v, std::int16_t encoded[2]);// v不必归一化
+	static DirectX::XMFLOAT3 DecodeOctahedral(const std::int16_t encoded[2]);
+};
@@ -1,10 +1,50 @@
 ﻿
 #include "d3dUtil.h"
+#include "AssetCache.h"
 #include <comdef.h>
 #include <fstream>
 
 using Microsoft::WRL::ComPtr;
 
+namespace
+{
+	bool gUseDefaultAssetCache = true;
+	AssetCache* gAssetCache = nullptr;
+
+	/* 着色器的缓存键: 预处理后的源码已展开全部#include与宏, 所以任何被包含的文件改动都会换键
+	* 预处理失败(例如文件缺失或语法错误)时返回false, 交给编译器报告错误 */
+	bool ShaderCacheKey(
+		const std::wstring& filename,
+		const D3D_SHADER_MACRO* defines,
+		const std::string& entrypoint,
+		const std::string& target,
+		UINT compileFlags,
+		AssetCache::Key& key)
+	{
+		MappedFile source;
+		if (!source.Open(filename))
+			return false;
+
+		// D3D_COMPILE_STANDARD_FILE_INCLUDE按窄字符的源文件名解析相对路径的#include
+		const std::string sourceName = WStringToAnsi(filename);
+		ComPtr<ID3DBlob> preprocessed;
+		ComPtr<ID3DBlob> errors;
+		if (FAILED(D3DPreprocess(source.Data(), source.Size(), sourceName.c_str(), defines,
+			D3D_COMPILE_STANDARD_FILE_INCLUDE, &preprocessed, &errors)))
+			return false;
+
+		AssetCache::Hasher hasher("hlsl/1");
+		hasher.Add(preprocessed->GetBufferPointer(), preprocessed->GetBufferSize());
+		for (const D3D_SHADER_MACRO* define = defines; define != nullptr && define->Name != nullptr; ++define) {
+			hasher.Add(define->Name);
+			hasher.Add(define->Definition != nullptr ? define->Definition : "");
+		}
+		hasher.Add(entrypoint).Add(target).Add((AssetCache::uint64)compileFlags).Add((AssetCache::uint64)D3D_COMPILER_VERSION);
+		key = hasher.Finish();
+		return true;
+	}
+}
+
 DxException::DxException(HRESULT hr, const std::wstring& functionName, const std::wstring& filename, int lineNumber) :
 	ErrorCode(hr),
 	FunctionName(functionName),
@@ -107,6 +147,22 @@ ComPtr<ID3DBlob> d3dUtil::CompileShader(
 	HRESULT hr = S_OK;
 
 	ComPtr<ID3DBlob> byteCode = nullptr;
+
+	// 先查磁盘缓存, 命中时直接拷出字节码
+	AssetCache* cache = GetAssetCache();
+	AssetCache::Key key = 0;
+	if (cache != nullptr && ShaderCacheKey(filename, defines, entrypoint, target, compileFlags, key)) {
+		MappedFile cached;
+		if (cache->Load(key, cached)) {
+			ThrowIfFailed(D3DCreateBlob(cached.Size(), &byteCode));
+			CopyMemory(byteCode->GetBufferPointer(), cached.Data(), cached.Size());
+			return byteCode;
+		}
+	}
+	else {
+		cache = nullptr;
+	}
+
 	ComPtr<ID3DBlob> errors;
 	hr = D3DCompileFromFile(filename.c_str(), defines, D3D_COMPILE_STANDARD_FILE_INCLUDE,
 		entrypoint.c_str(), target.c_str(), compileFlags, 0, &byteCode, &errors);
@@ -116,9 +172,28 @@ ComPtr<ID3DBlob> d3dUtil::CompileShader(
 
 	ThrowIfFailed(hr);
 
+	if (cache != nullptr)
+		cache->Store(key, byteCode->GetBufferPointer(), byteCode->GetBufferSize());
+
 	return byteCode;
 }
 
+AssetCache* d3dUtil::GetAssetCache()
+{
+	if (!gUseDefaultAssetCache)
+		return gAssetCache;
+
+	// 函数内的静态对象在首次调用时创建(线程安全), 程序退出时析构并写回索引
+	static AssetCache defaultCache("AssetCache");
+	return defaultCache.IsOpen() ? &defaultCache : nullptr;
+}
+
+void d3dUtil::SetAssetCache(AssetCache* cache)
+{
+	gUseDefaultAssetCache = false;
+	gAssetCache = cache;
+}
+
 std::wstring DxException::ToString()const
 {
 	// Get the string description of the error code.
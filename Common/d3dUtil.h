@@ -31,6 +31,9 @@
 
 extern const int gNumFrameResources;
 
+class MeshBvh;
+class AssetCache;
+
 inline void d3dSetDebugName(IDXGIObject* obj, const char* name)
 {
 	if (obj) {
@@ -57,6 +60,20 @@ inline std::wstring AnsiToWString(const std::string& str)
 	return std::wstring(buffer);
 }
 
+inline std::string WStringToAnsi(const std::wstring& str)
+{
+	// 先求出所需的字节数(含结尾0)再转换, 任意长度的路径都不会截断或越界; 转换失败时返回空串
+	const int size = WideCharToMultiByte(CP_ACP, 0, str.c_str(), -1, nullptr, 0, nullptr, nullptr);
+	if (size <= 1)
+		return std::string();
+
+	std::string result(size, '\0');
+	if (WideCharToMultiByte(CP_ACP, 0, str.c_str(), -1, &result[0], size, nullptr, nullptr) != size)
+		return std::string();
+	result.resize(size - 1);
+	return result;
+}
+
 /*
 #if defined(_DEBUG)
 	#ifndef Assert
@@ -130,12 +147,19 @@ public:
 	* 默认设为空指针
 	* 着色器入口点函数名
 	* 着色器类型及其版本
+	* 编译结果存进GetAssetCache()的磁盘缓存, 以预处理后的源码(已展开#include与宏), 入口, 目标, 编译标志与编译器版本为键,
+	* 之后的启动只做一次预处理就直接取回字节码; 改动任何被包含的文件都会换键, 重新编译
 	*/
 	static Microsoft::WRL::ComPtr<ID3DBlob> CompileShader(
 		const std::wstring& filename,
 		const D3D_SHADER_MACRO* defines,
 		const std::string& entrypoint,
 		const std::string& target);
+
+	/* 着色器, 网格等运行时生成结果共用的磁盘缓存, 默认是工作目录下的AssetCache目录(首次使用时创建, 退出时写回索引)
+	* 目录不可用时返回nullptr; SetAssetCache换成别的缓存, 传nullptr关闭缓存 */
+	static AssetCache* GetAssetCache();
+	static void SetAssetCache(AssetCache* cache);
 };
 
 class DxException
@@ -192,6 +216,10 @@ struct MeshGeometry
 	/// 使用下列无序map就可以定义subMeshGeometry几何体, 并允许单独地绘制出其中的子网格(即单个几何体)
 	std::unordered_map<std::string, SubmeshGeometry> DrawArgs;
 
+	/// 可选的三角形BVH(见MeshBvh.h), 由VertexBufferCPU/IndexBufferCPU建立一次, 供拾取等射线查询使用
+	/// 用shared_ptr是为了不强制每个包含本头文件的程序都链接MeshBvh.cpp
+	std::shared_ptr<MeshBvh> Bvh = nullptr;
+
 	/* 根据GPU维护的顶点数据, 构建出一个 vertex buffer view, 方便其设置到管线内*/
 	D3D12_VERTEX_BUFFER_VIEW VertexBufferView()const
 	{
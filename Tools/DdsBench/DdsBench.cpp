@@ -0,0 +1,336 @@
+﻿//***************************************************************************************
+// DdsBench.cpp
+//
+// DdsParser的离线性能与健壮性测试: 映射一个目录下的全部.dds文件(默认为仓库的Textures目录),
+// 反复解析头部并生成子资源表, 统计每个文件的解析耗时与吞吐量; 还可对输入做随机变异与截断,
+// 检查解析器不会越界, 且给出的每个子资源都落在文件之内.
+// 不创建窗口也不依赖D3D, 只用到DdsParser与MappedFile, 可在没有GPU的Linux CI上运行:
+//   g++ -std=c++14 -O2 -I<DirectX-Headers>/include/wsl/stubs -I<DirectX-Headers>/include/directx
+//       DdsBench.cpp ../../Common/DdsParser.cpp ../../Common/MappedFile.cpp -o DdsBench
+//
+// 用法:
+//   DdsBench [-dir ../../Textures] [-iterations N] [-maxsize N] [-fuzz N] [-format table|csv]
+//   -dir         要测的目录, 只看其中扩展名为.dds的文件, 不递归
+//   -iterations  计时时整个目录解析的遍数, 默认200, 取每遍耗时的中位数
+//   -maxsize     传给SkipMips的尺寸上限, 默认0即不跳过mip
+//   -fuzz        变异测试的次数, 默认0即不做; 以能解析的文件与几个内置的合成文件为种子
+//   -format      输出格式, 默认table
+// 先逐个文件输出解析结果与纹理描述, 再输出整个目录的解析耗时: 每个文件的纳秒数, 每秒文件数,
+// 以及每秒可描述的像素数据量(子资源表所覆盖的字节数, 解析本身不读像素).
+//***************************************************************************************
+
+#include "../../Common/DdsParser.h"
+#include "../../Common/MappedFile.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+namespace
+{
+	using uint32 = DdsParser::uint32;
+	using uint64 = DdsParser::uint64;
+	using Result = DdsParser::Result;
+
+	// 一个纹理最多的子资源数
+	const size_t MaxSubresources = (size_t)DdsParser::MaxMipLevels * DdsParser::MaxArraySize;
+
+	struct File
+	{
+		std::string Name;
+		std::unique_ptr<MappedFile> Map;
+	};
+
+	bool EndsWithDds(const std::string& name)
+	{
+		if (name.size() < 4)
+			return false;
+		std::string ext = name.substr(name.size() - 4);
+		for (char& c : ext)
+			c = (char)std::tolower((unsigned char)c);
+		return ext == ".dds";
+	}
+
+	// 目录下的.dds文件名, 按名字排序
+	std::vector<std::string> ListDds(const std::string& dir)
+	{
+		std::vector<std::string> names;
+#if defined(_WIN32)
+		WIN32_FIND_DATAA data;
+		HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &data);
+		if (find != INVALID_HANDLE_VALUE) {
+			do {
+				if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && EndsWithDds(data.cFileName))
+					names.push_back(data.cFileName);
+			} while (FindNextFileA(find, &data));
+			FindClose(find);
+		}
+#else
+		if (DIR* d = opendir(dir.c_str())) {
+			while (dirent* entry = readdir(d)) {
+				if (EndsWithDds(entry->d_name))
+					names.push_back(entry->d_name);
+			}
+			closedir(d);
+		}
+#endif
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+
+	const char* DimensionString(DdsParser::Dimension dim)
+	{
+		switch (dim) {
+		case DdsParser::Dimension::Texture1D: return "1D";
+		case DdsParser::Dimension::Texture2D: return "2D";
+		case DdsParser::Dimension::Texture3D: return "3D";
+		default: return "-";
+		}
+	}
+
+	/* 解析一个文件并生成子资源表, 返回子资源表覆盖的字节数; 失败时返回0 */
+	uint64 Parse(const std::uint8_t* data, size_t size, uint32 maxSize, DdsParser::Subresource* table, Result* result = nullptr)
+	{
+		DdsParser::Info info;
+		Result r = DdsParser::ParseHeader(data, size, info);
+		uint64 bytes = 0;
+		if (r == Result::Ok) {
+			const uint32 firstMip = DdsParser::SkipMips(info, maxSize);
+			if (firstMip < info.MipCount) {
+				r = DdsParser::GetSubresources(data, size, info, firstMip, table, MaxSubresources);
+				if (r == Result::Ok) {
+					const size_t count = (size_t)(info.MipCount - firstMip) * info.ArraySize;
+					for (size_t i = 0; i < count; ++i)
+						bytes += table[i].SlicePitch * table[i].Depth;
+				}
+			}
+		}
+		if (result)
+			*result = r;
+		return bytes;
+	}
+
+	/// 内置的合成DDS文件, 保证变异测试在没有可用纹理时(例如git-lfs未拉取)也有种子
+	std::vector<std::uint8_t> MakeDds(uint32 dim, uint32 width, uint32 height, uint32 depth, uint32 mipCount,
+		uint32 arraySize, DXGI_FORMAT format, bool cube)
+	{
+		const bool dx10 = (dim != 0);
+		std::vector<std::uint8_t> file(sizeof(uint32) + sizeof(DdsParser::Header) + (dx10 ? sizeof(DdsParser::HeaderDxt10) : 0));
+
+		DdsParser::Header header = {};
+		header.size = sizeof(DdsParser::Header);
+		header.flags = 0x1007 | (depth > 1 ? 0x00800000 : 0);// CAPS | HEIGHT | WIDTH | PIXELFORMAT [| DEPTH]
+		header.width = width;
+		header.height = height;
+		header.depth = depth;
+		header.mipMapCount = mipCount;
+		header.ddspf.size = sizeof(DdsParser::PixelFormat);
+		header.ddspf.flags = 0x4;// DDPF_FOURCC
+		uint32 slices = arraySize;
+		if (dx10) {
+			header.ddspf.fourCC = '0' << 24 | '1' << 16 | 'X' << 8 | 'D';
+			DdsParser::HeaderDxt10 ext = {};
+			ext.dxgiFormat = format;
+			ext.resourceDimension = dim;
+			ext.arraySize = arraySize;
+			ext.miscFlag = cube ? 0x4 : 0;
+			std::memcpy(&file[sizeof(uint32) + sizeof(header)], &ext, sizeof(ext));
+			if (cube)
+				slices *= 6;
+		}
+		else {
+			header.ddspf.fourCC = '1' << 24 | 'T' << 16 | 'X' << 8 | 'D';// BC1
+		}
+		const uint32 magic = DdsParser::Magic;
+		std::memcpy(&file[0], &magic, sizeof(magic));
+		std::memcpy(&file[sizeof(uint32)], &header, sizeof(header));
+
+		uint64 dataSize = 0;
+		for (uint32 i = 0; i < mipCount; ++i) {
+			uint64 numBytes = 0;
+			DdsParser::GetSurfaceInfo(std::max(1u, width >> i), std::max(1u, height >> i), format, &numBytes, nullptr, nullptr);
+			dataSize += numBytes * std::max(1u, depth >> i);
+		}
+		file.resize(file.size() + (size_t)(dataSize * slices), 0xcd);
+		return file;
+	}
+
+	/* 变异测试: 随机改写种子前200字节中的几个字节(头部所在), 有时再截断, 然后解析
+	* 成功时检查每个子资源都在输入之内, 并读一遍每个子资源的首尾字节; 返回发现的错误数 */
+	int Fuzz(const std::vector<std::vector<std::uint8_t>>& seeds, int iterations, int& parsed)
+	{
+		std::mt19937 rng(12345);
+		std::vector<DdsParser::Subresource> table(MaxSubresources);
+		int errors = 0;
+		parsed = 0;
+		volatile std::uint8_t sink = 0;
+		for (int it = 0; it < iterations; ++it) {
+			std::vector<std::uint8_t> input = seeds[it % seeds.size()];
+			const int edits = 1 + (int)(rng() % 6);
+			for (int k = 0; k < edits; ++k) {
+				const size_t pos = rng() % std::min<size_t>(input.size(), 200);
+				if (rng() % 3 == 0)
+					input[pos] = (std::uint8_t)rng();
+				else
+					input[pos] ^= (std::uint8_t)(1u << (rng() % 8));
+			}
+			if (rng() % 4 == 0)
+				input.resize(rng() % (input.size() + 1));
+
+			// 拷到恰好等长的堆内存里, 用AddressSanitizer编译时越界读会立刻报告
+			std::unique_ptr<std::uint8_t[]> exact(new std::uint8_t[input.size() + 1]);
+			std::memcpy(exact.get(), input.data(), input.size());
+			const std::uint8_t* data = exact.get();
+			const size_t size = input.size();
+
+			DdsParser::Info info;
+			if (DdsParser::ParseHeader(data, size, info) != Result::Ok)
+				continue;
+			++parsed;
+
+			const uint32 firstMip = (uint32)(rng() % info.MipCount);
+			if (DdsParser::GetSubresources(data, size, info, firstMip, table.data(), table.size()) != Result::Ok) {
+				std::fprintf(stderr, "fuzz %d: header parsed but subresources failed\n", it);
+				++errors;
+				continue;
+			}
+
+			const size_t count = (size_t)(info.MipCount - firstMip) * info.ArraySize;
+			for (size_t i = 0; i < count; ++i) {
+				const DdsParser::Subresource& sub = table[i];
+				const uint64 bytes = sub.SlicePitch * sub.Depth;
+				if (sub.Data != data + sub.Offset || sub.Offset < info.DataOffset || sub.Offset > size || bytes > size - sub.Offset) {
+					std::fprintf(stderr, "fuzz %d: subresource %zu out of bounds\n", it, i);
+					++errors;
+					break;
+				}
+				if (bytes > 0)
+					sink = sink + sub.Data[0] + sub.Data[bytes - 1];
+			}
+		}
+		return errors;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::string dir = "../../Textures";
+	int iterations = 200;
+	uint32 maxSize = 0;
+	int fuzzIterations = 0;
+	bool csv = false;
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (std::strcmp(argv[i], "-dir") == 0)
+			dir = argv[i + 1];
+		else if (std::strcmp(argv[i], "-iterations") == 0)
+			iterations = std::max(1, std::atoi(argv[i + 1]));
+		else if (std::strcmp(argv[i], "-maxsize") == 0)
+			maxSize = (uint32)std::max(0, std::atoi(argv[i + 1]));
+		else if (std::strcmp(argv[i], "-fuzz") == 0)
+			fuzzIterations = std::max(0, std::atoi(argv[i + 1]));
+		else if (std::strcmp(argv[i], "-format") == 0)
+			csv = std::strcmp(argv[i + 1], "csv") == 0;
+		else {
+			std::fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	/// 映射目录下的全部文件
+	std::vector<File> files;
+	for (const std::string& name : ListDds(dir)) {
+		File file;
+		file.Name = name;
+		file.Map.reset(new MappedFile);
+		if (!file.Map->Open(dir + "/" + name)) {
+			std::fprintf(stderr, "%s: cannot open (error %lu)\n", name.c_str(), file.Map->ErrorCode());
+			continue;
+		}
+		file.Map->Touch();
+		files.push_back(std::move(file));
+	}
+	if (files.empty() && fuzzIterations == 0) {
+		std::fprintf(stderr, "no .dds files in %s\n", dir.c_str());
+		return 1;
+	}
+
+	/// 逐个文件的解析结果
+	std::vector<DdsParser::Subresource> table(MaxSubresources);
+	std::vector<std::vector<std::uint8_t>> seeds;
+	if (csv)
+		std::printf("file,bytes,result,dimension,width,height,depth,mips,array,format,cube,data_bytes\n");
+	else
+		std::printf("%-28s %10s %-22s %4s %6s %6s %5s %4s %5s %6s %4s\n",
+			"file", "bytes", "result", "dim", "width", "height", "depth", "mips", "array", "format", "cube");
+
+	for (const File& file : files) {
+		DdsParser::Info info;
+		const Result result = DdsParser::ParseHeader(file.Map->Data(), file.Map->Size(), info);
+		const char* format = csv ? "%s,%zu,%s,%s,%u,%u,%u,%u,%u,%u,%d,%llu\n"
+			: "%-28s %10zu %-22s %4s %6u %6u %5u %4u %5u %6u %4d\n";
+		std::printf(format, file.Name.c_str(), file.Map->Size(), DdsParser::ResultString(result),
+			DimensionString(info.Dim), info.Width, info.Height, info.Depth, info.MipCount, info.ArraySize,
+			(uint32)info.Format, info.IsCubeMap ? 1 : 0, (unsigned long long)info.DataSize);
+
+		// 每次变异都要整份拷贝种子, 大文件只用于计时
+		if (result == Result::Ok && file.Map->Size() <= (256u << 10))
+			seeds.emplace_back(file.Map->Data(), file.Map->Data() + file.Map->Size());
+	}
+
+	/// 整个目录的解析耗时
+	if (!files.empty()) {
+		std::vector<double> times;
+		uint64 described = 0;
+		for (int it = 0; it < iterations; ++it) {
+			described = 0;
+			const auto start = std::chrono::steady_clock::now();
+			for (const File& file : files)
+				described += Parse(file.Map->Data(), file.Map->Size(), maxSize, table.data());
+			const auto stop = std::chrono::steady_clock::now();
+			times.push_back(std::chrono::duration<double>(stop - start).count());
+		}
+		std::sort(times.begin(), times.end());
+		const double seconds = times[times.size() / 2];
+
+		const double nsPerFile = seconds * 1e9 / files.size();
+		const double filesPerSecond = files.size() / seconds;
+		const double describedGBps = described / seconds / 1e9;
+		if (csv)
+			std::printf("\nfiles,iterations,ns_per_file,files_per_second,described_gb_per_second\n%zu,%d,%.1f,%.0f,%.2f\n",
+				files.size(), iterations, nsPerFile, filesPerSecond, describedGBps);
+		else
+			std::printf("\n%zu files, %d iterations: %.1f ns/file, %.0f files/s, %.2f GB/s of pixel data described\n",
+				files.size(), iterations, nsPerFile, filesPerSecond, describedGBps);
+	}
+
+	/// 变异测试
+	if (fuzzIterations > 0) {
+		seeds.push_back(MakeDds(0, 256, 128, 1, 9, 1, DXGI_FORMAT_BC1_UNORM, false));
+		seeds.push_back(MakeDds(3, 64, 64, 1, 7, 2, DXGI_FORMAT_BC7_UNORM, true));
+		seeds.push_back(MakeDds(3, 100, 60, 1, 7, 3, DXGI_FORMAT_R8G8B8A8_UNORM, false));
+		seeds.push_back(MakeDds(4, 32, 16, 8, 6, 1, DXGI_FORMAT_R16G16B16A16_FLOAT, false));
+		seeds.push_back(MakeDds(2, 1000, 1, 1, 10, 4, DXGI_FORMAT_R32_FLOAT, false));
+
+		int parsed = 0;
+		const int errors = Fuzz(seeds, fuzzIterations, parsed);
+		std::printf("\nfuzz: %d inputs from %zu seeds, %d parsed, %d errors\n", fuzzIterations, seeds.size(), parsed, errors);
+		if (errors > 0)
+			return 2;
+	}
+	return 0;
+}
@@ -0,0 +1,551 @@
+﻿//***************************************************************************************
+// GeometryBench.cpp
+//
+// GeometryGenerator的离线性能测试: 把书中原来的实现(逐个push_back, 细分时复制整个MeshData,
+// 每个三角形各造6个顶点)与现在的实现(闭式预分配, 中点表共享顶点, 按行并行)在同样的参数下比较.
+// 不创建窗口也不依赖D3D, 只用到GeometryGenerator, MeshOptimizer与ThreadPool, 可在没有GPU的Linux CI上运行:
+//   g++ -std=c++14 -O2 -pthread -I<DirectXMath>/Inc -I<DirectX-Headers>/include/wsl/stubs
+//       GeometryBench.cpp ../../Common/GeometryGenerator.cpp ../../Common/MeshOptimizer.cpp
+//       ../../Common/ThreadPool.cpp -o GeometryBench
+//
+// 用法:
+//   GeometryBench [-shapes geosphere,sphere,cylinder,grid] [-threads 1,2,...] [-repeat N] [-optimize 0|1] [-format table|csv]
+//   -shapes    要测的形状, 默认全部; 每种形状按内置的几档规模从小到大测
+//   -threads   新实现所用的线程数(含主线程), 默认从1开始每次翻倍直到硬件线程数
+//   -repeat    每种配置重复计时的次数, 取中位数, 默认3
+//   -optimize  是否另测一遍打开SetOptimize(true)时的耗时(旧实现没有这一步), 默认1; 大网格上重排很慢, 可用0跳过
+//   -format    输出格式, 默认table
+// 每行输出旧实现与新实现默认配置(各章节实际走的路径)的耗时, 顶点/索引数, 加速比, 两者几何是否一致
+// (逐三角形比较位置的最大误差), 以及打开MeshOptimizer后新实现的耗时与相对旧实现的加速比(小于1即更慢).
+//***************************************************************************************
+
+#include "../../Common/GeometryGenerator.h"
+#include "../../Common/ThreadPool.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	using MeshData = GeometryGenerator::MeshData;
+	using Vertex = GeometryGenerator::Vertex;
+	using uint32 = GeometryGenerator::uint32;
+
+	/// 书中原来的实现, 只去掉了细分次数的上限, 用作比较的基准
+	namespace Legacy
+	{
+		Vertex MidPoint(const Vertex& v0, const Vertex& v1)
+		{
+			XMVECTOR p0 = XMLoadFloat3(&v0.Position);
+			XMVECTOR p1 = XMLoadFloat3(&v1.Position);
+			XMVECTOR n0 = XMLoadFloat3(&v0.Normal);
+			XMVECTOR n1 = XMLoadFloat3(&v1.Normal);
+			XMVECTOR tan0 = XMLoadFloat3(&v0.TangentU);
+			XMVECTOR tan1 = XMLoadFloat3(&v1.TangentU);
+			XMVECTOR tex0 = XMLoadFloat2(&v0.TexC);
+			XMVECTOR tex1 = XMLoadFloat2(&v1.TexC);
+
+			XMVECTOR pos = 0.5f*(p0 + p1);
+			XMVECTOR normal = XMVector3Normalize(0.5f*(n0 + n1));
+			XMVECTOR tangent = XMVector3Normalize(0.5f*(tan0 + tan1));
+			XMVECTOR tex = 0.5f*(tex0 + tex1);
+
+			Vertex v;
+			XMStoreFloat3(&v.Position, pos);
+			XMStoreFloat3(&v.Normal, normal);
+			XMStoreFloat3(&v.TangentU, tangent);
+			XMStoreFloat2(&v.TexC, tex);
+			return v;
+		}
+
+		void Subdivide(MeshData& meshData)
+		{
+			MeshData inputCopy = meshData;
+
+			meshData.Vertices.resize(0);
+			meshData.Indices32.resize(0);
+
+			uint32 numTris = (uint32)inputCopy.Indices32.size()/3;
+			for (uint32 i = 0; i < numTris; ++i) {
+				Vertex v0 = inputCopy.Vertices[inputCopy.Indices32[i*3+0]];
+				Vertex v1 = inputCopy.Vertices[inputCopy.Indices32[i*3+1]];
+				Vertex v2 = inputCopy.Vertices[inputCopy.Indices32[i*3+2]];
+
+				Vertex m0 = MidPoint(v0, v1);
+				Vertex m1 = MidPoint(v1, v2);
+				Vertex m2 = MidPoint(v0, v2);
+
+				meshData.Vertices.push_back(v0);
+				meshData.Vertices.push_back(v1);
+				meshData.Vertices.push_back(v2);
+				meshData.Vertices.push_back(m0);
+				meshData.Vertices.push_back(m1);
+				meshData.Vertices.push_back(m2);
+
+				meshData.Indices32.push_back(i*6+0);
+				meshData.Indices32.push_back(i*6+3);
+				meshData.Indices32.push_back(i*6+5);
+
+				meshData.Indices32.push_back(i*6+3);
+				meshData.Indices32.push_back(i*6+4);
+				meshData.Indices32.push_back(i*6+5);
+
+				meshData.Indices32.push_back(i*6+5);
+				meshData.Indices32.push_back(i*6+4);
+				meshData.Indices32.push_back(i*6+2);
+
+				meshData.Indices32.push_back(i*6+3);
+				meshData.Indices32.push_back(i*6+1);
+				meshData.Indices32.push_back(i*6+4);
+			}
+		}
+
+		MeshData CreateGeosphere(float radius, uint32 numSubdivisions)
+		{
+			MeshData meshData;
+
+			const float X = 0.525731f;
+			const float Z = 0.850651f;
+			XMFLOAT3 pos[12] = {
+				XMFLOAT3(-X, 0.0f, Z),  XMFLOAT3(X, 0.0f, Z),
+				XMFLOAT3(-X, 0.0f, -Z), XMFLOAT3(X, 0.0f, -Z),
+				XMFLOAT3(0.0f, Z, X),   XMFLOAT3(0.0f, Z, -X),
+				XMFLOAT3(0.0f, -Z, X),  XMFLOAT3(0.0f, -Z, -X),
+				XMFLOAT3(Z, X, 0.0f),   XMFLOAT3(-Z, X, 0.0f),
+				XMFLOAT3(Z, -X, 0.0f),  XMFLOAT3(-Z, -X, 0.0f)
+			};
+			uint32 k[60] = {
+				1,4,0,  4,9,0,  4,5,9,  8,5,4,  1,8,4,
+				1,10,8, 10,3,8, 8,3,5,  3,2,5,  3,7,2,
+				3,10,7, 10,6,7, 6,11,7, 6,0,11, 6,1,0,
+				10,1,6, 11,0,9, 2,11,9, 5,2,9,  11,2,7
+			};
+
+			meshData.Vertices.resize(12);
+			meshData.Indices32.assign(&k[0], &k[60]);
+			for (uint32 i = 0; i < 12; ++i)
+				meshData.Vertices[i] = Vertex(pos[i], XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f), XMFLOAT2(0.0f, 0.0f));
+
+			for (uint32 i = 0; i < numSubdivisions; ++i)
+				Subdivide(meshData);
+
+			for (uint32 i = 0; i < meshData.Vertices.size(); ++i) {
+				XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&meshData.Vertices[i].Position));
+				XMVECTOR p = radius*n;
+				XMStoreFloat3(&meshData.Vertices[i].Position, p);
+				XMStoreFloat3(&meshData.Vertices[i].Normal, n);
+
+				float theta = atan2f(meshData.Vertices[i].Position.z, meshData.Vertices[i].Position.x);
+				if (theta < 0.0f)
+					theta += XM_2PI;
+				float phi = acosf(meshData.Vertices[i].Position.y / radius);
+
+				meshData.Vertices[i].TexC.x = theta/XM_2PI;
+				meshData.Vertices[i].TexC.y = phi/XM_PI;
+
+				meshData.Vertices[i].TangentU.x = -radius*sinf(phi)*sinf(theta);
+				meshData.Vertices[i].TangentU.y = 0.0f;
+				meshData.Vertices[i].TangentU.z = +radius*sinf(phi)*cosf(theta);
+
+				XMVECTOR T = XMLoadFloat3(&meshData.Vertices[i].TangentU);
+				XMStoreFloat3(&meshData.Vertices[i].TangentU, XMVector3Normalize(T));
+			}
+			return meshData;
+		}
+
+		MeshData CreateSphere(float radius, uint32 sliceCount, uint32 stackCount)
+		{
+			MeshData meshData;
+
+			Vertex topVertex(0.0f, +radius, 0.0f, 0.0f, +1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+			Vertex bottomVertex(0.0f, -radius, 0.0f, 0.0f, -1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f);
+			meshData.Vertices.push_back(topVertex);
+
+			float phiStep = XM_PI/stackCount;
+			float thetaStep = 2.0f*XM_PI/sliceCount;
+			for (uint32 i = 1; i <= stackCount-1; ++i) {
+				float phi = i*phiStep;
+				for (uint32 j = 0; j <= sliceCount; ++j) {
+					float theta = j*thetaStep;
+					Vertex v;
+					v.Position.x = radius*sinf(phi)*cosf(theta);
+					v.Position.y = radius*cosf(phi);
+					v.Position.z = radius*sinf(phi)*sinf(theta);
+
+					v.TangentU.x = -radius*sinf(phi)*sinf(theta);
+					v.TangentU.y = 0.0f;
+					v.TangentU.z = +radius*sinf(phi)*cosf(theta);
+
+					XMVECTOR T = XMLoadFloat3(&v.TangentU);
+					XMStoreFloat3(&v.TangentU, XMVector3Normalize(T));
+
+					XMVECTOR p = XMLoadFloat3(&v.Position);
+					XMStoreFloat3(&v.Normal, XMVector3Normalize(p));
+
+					v.TexC.x = theta / XM_2PI;
+					v.TexC.y = phi / XM_PI;
+					meshData.Vertices.push_back(v);
+				}
+			}
+			meshData.Vertices.push_back(bottomVertex);
+
+			for (uint32 i = 1; i <= sliceCount; ++i) {
+				meshData.Indices32.push_back(0);
+				meshData.Indices32.push_back(i+1);
+				meshData.Indices32.push_back(i);
+			}
+
+			uint32 baseIndex = 1;
+			uint32 ringVertexCount = sliceCount + 1;
+			for (uint32 i = 0; i < stackCount-2; ++i) {
+				for (uint32 j = 0; j < sliceCount; ++j) {
+					meshData.Indices32.push_back(baseIndex + i*ringVertexCount + j);
+					meshData.Indices32.push_back(baseIndex + i*ringVertexCount + j+1);
+					meshData.Indices32.push_back(baseIndex + (i+1)*ringVertexCount + j);
+
+					meshData.Indices32.push_back(baseIndex + (i+1)*ringVertexCount + j);
+					meshData.Indices32.push_back(baseIndex + i*ringVertexCount + j+1);
+					meshData.Indices32.push_back(baseIndex + (i+1)*ringVertexCount + j+1);
+				}
+			}
+
+			uint32 southPoleIndex = (uint32)meshData.Vertices.size()-1;
+			baseIndex = southPoleIndex - ringVertexCount;
+			for (uint32 i = 0; i < sliceCount; ++i) {
+				meshData.Indices32.push_back(southPoleIndex);
+				meshData.Indices32.push_back(baseIndex+i);
+				meshData.Indices32.push_back(baseIndex+i+1);
+			}
+			return meshData;
+		}
+
+		void BuildCylinderCap(float radius, float height, float y, float normalY, uint32 sliceCount, MeshData& meshData)
+		{
+			uint32 baseIndex = (uint32)meshData.Vertices.size();
+			float dTheta = 2.0f*XM_PI/sliceCount;
+			for (uint32 i = 0; i <= sliceCount; ++i) {
+				float x = radius*cosf(i*dTheta);
+				float z = radius*sinf(i*dTheta);
+				float u = x/height + 0.5f;
+				float v = z/height + 0.5f;
+				meshData.Vertices.push_back(Vertex(x, y, z, 0.0f, normalY, 0.0f, 1.0f, 0.0f, 0.0f, u, v));
+			}
+			meshData.Vertices.push_back(Vertex(0.0f, y, 0.0f, 0.0f, normalY, 0.0f, 1.0f, 0.0f, 0.0f, 0.5f, 0.5f));
+
+			uint32 centerIndex = (uint32)meshData.Vertices.size()-1;
+			for (uint32 i = 0; i < sliceCount; ++i) {
+				meshData.Indices32.push_back(centerIndex);
+				meshData.Indices32.push_back(baseIndex + ((normalY > 0.0f) ? i+1 : i));
+				meshData.Indices32.push_back(baseIndex + ((normalY > 0.0f) ? i : i+1));
+			}
+		}
+
+		MeshData CreateCylinder(float bottomRadius, float topRadius, float height, uint32 sliceCount, uint32 stackCount)
+		{
+			MeshData meshData;
+
+			float stackHeight = height / stackCount;
+			float radiusStep = (topRadius - bottomRadius) / stackCount;
+			uint32 ringCount = stackCount+1;
+			for (uint32 i = 0; i < ringCount; ++i) {
+				float y = -0.5f*height + i*stackHeight;
+				float r = bottomRadius + i*radiusStep;
+				float dTheta = 2.0f*XM_PI/sliceCount;
+				for (uint32 j = 0; j <= sliceCount; ++j) {
+					Vertex vertex;
+					float c = cosf(j*dTheta);
+					float s = sinf(j*dTheta);
+					vertex.Position = XMFLOAT3(r*c, y, r*s);
+					vertex.TexC.x = (float)j/sliceCount;
+					vertex.TexC.y = 1.0f - (float)i/stackCount;
+					vertex.TangentU = XMFLOAT3(-s, 0.0f, c);
+
+					float dr = bottomRadius-topRadius;
+					XMFLOAT3 bitangent(dr*c, -height, dr*s);
+					XMVECTOR T = XMLoadFloat3(&vertex.TangentU);
+					XMVECTOR B = XMLoadFloat3(&bitangent);
+					XMVECTOR N = XMVector3Normalize(XMVector3Cross(T, B));
+					XMStoreFloat3(&vertex.Normal, N);
+					meshData.Vertices.push_back(vertex);
+				}
+			}
+
+			uint32 ringVertexCount = sliceCount+1;
+			for (uint32 i = 0; i < stackCount; ++i) {
+				for (uint32 j = 0; j < sliceCount; ++j) {
+					meshData.Indices32.push_back(i*ringVertexCount + j);
+					meshData.Indices32.push_back((i+1)*ringVertexCount + j);
+					meshData.Indices32.push_back((i+1)*ringVertexCount + j+1);
+
+					meshData.Indices32.push_back(i*ringVertexCount + j);
+					meshData.Indices32.push_back((i+1)*ringVertexCount + j+1);
+					meshData.Indices32.push_back(i*ringVertexCount + j+1);
+				}
+			}
+
+			BuildCylinderCap(topRadius, height, 0.5f*height, 1.0f, sliceCount, meshData);
+			BuildCylinderCap(bottomRadius, height, -0.5f*height, -1.0f, sliceCount, meshData);
+			return meshData;
+		}
+
+		MeshData CreateGrid(float width, float depth, uint32 m, uint32 n)
+		{
+			MeshData meshData;
+
+			uint32 vertexCount = m*n;
+			uint32 faceCount = (m-1)*(n-1)*2;
+			float halfWidth = 0.5f*width;
+			float halfDepth = 0.5f*depth;
+			float dx = width / (n-1);
+			float dz = depth / (m-1);
+			float du = 1.0f / (n-1);
+			float dv = 1.0f / (m-1);
+
+			meshData.Vertices.resize(vertexCount);
+			for (uint32 i = 0; i < m; ++i) {
+				float z = halfDepth - i*dz;
+				for (uint32 j = 0; j < n; ++j) {
+					float x = -halfWidth + j*dx;
+					meshData.Vertices[i*n+j].Position = XMFLOAT3(x, 0.0f, z);
+					meshData.Vertices[i*n+j].Normal = XMFLOAT3(0.0f, 1.0f, 0.0f);
+					meshData.Vertices[i*n+j].TangentU = XMFLOAT3(1.0f, 0.0f, 0.0f);
+					meshData.Vertices[i*n+j].TexC.x = j*du;
+					meshData.Vertices[i*n+j].TexC.y = i*dv;
+				}
+			}
+
+			meshData.Indices32.resize(faceCount*3);
+			uint32 k = 0;
+			for (uint32 i = 0; i < m-1; ++i) {
+				for (uint32 j = 0; j < n-1; ++j) {
+					meshData.Indices32[k] = i*n+j;
+					meshData.Indices32[k+1] = i*n+j+1;
+					meshData.Indices32[k+2] = (i+1)*n+j;
+
+					meshData.Indices32[k+3] = (i+1)*n+j;
+					meshData.Indices32[k+4] = i*n+j+1;
+					meshData.Indices32[k+5] = (i+1)*n+j+1;
+					k += 6;
+				}
+			}
+			return meshData;
+		}
+	}
+
+	struct Case
+	{
+		std::string Shape;
+		std::string Params;
+		std::function<MeshData()> Old;
+		std::function<MeshData(GeometryGenerator&)> New;
+	};
+
+	std::vector<Case> BuildCases(const std::vector<std::string>& shapes)
+	{
+		std::vector<Case> cases;
+		auto wanted = [&shapes](const char* shape) {
+			return std::find(shapes.begin(), shapes.end(), shape) != shapes.end();
+		};
+
+		if (wanted("geosphere")) {
+			for (uint32 n = 5; n <= 7; ++n) {
+				cases.push_back({ "geosphere", "n=" + std::to_string(n),
+					[n]() { return Legacy::CreateGeosphere(1.0f, n); },
+					[n](GeometryGenerator& gen) { return gen.CreateGeosphere(1.0f, n); } });
+			}
+		}
+		if (wanted("sphere")) {
+			const uint32 sizes[] = { 256, 1024, 2048 };
+			for (uint32 slices : sizes) {
+				const uint32 stacks = slices / 2;
+				cases.push_back({ "sphere", std::to_string(slices) + "x" + std::to_string(stacks),
+					[=]() { return Legacy::CreateSphere(1.0f, slices, stacks); },
+					[=](GeometryGenerator& gen) { return gen.CreateSphere(1.0f, slices, stacks); } });
+			}
+		}
+		if (wanted("cylinder")) {
+			const uint32 sizes[] = { 256, 1024, 2048 };
+			for (uint32 slices : sizes) {
+				const uint32 stacks = slices / 2;
+				cases.push_back({ "cylinder", std::to_string(slices) + "x" + std::to_string(stacks),
+					[=]() { return Legacy::CreateCylinder(1.0f, 0.5f, 3.0f, slices, stacks); },
+					[=](GeometryGenerator& gen) { return gen.CreateCylinder(1.0f, 0.5f, 3.0f, slices, stacks); } });
+			}
+		}
+		if (wanted("grid")) {
+			const uint32 sizes[] = { 256, 1024, 2048 };
+			for (uint32 size : sizes) {
+				cases.push_back({ "grid", std::to_string(size) + "x" + std::to_string(size),
+					[=]() { return Legacy::CreateGrid(160.0f, 160.0f, size, size); },
+					[=](GeometryGenerator& gen) { return gen.CreateGrid(160.0f, 160.0f, size, size); } });
+			}
+		}
+		return cases;
+	}
+
+	/* 两份网格的几何差别: 按位置把三角形排序后逐个比较, 与顶点和三角形的顺序无关
+	* 三角形数不同时返回无穷大 */
+	float GeometryError(const MeshData& a, const MeshData& b)
+	{
+		if (a.Indices32.size() != b.Indices32.size())
+			return INFINITY;
+
+		// 每个三角形取3个顶点位置, 轮转到字典序最小的顶点开头(保持绕序), 再整体排序
+		auto collect = [](const MeshData& mesh) {
+			std::vector<std::array<float, 9>> tris(mesh.Indices32.size() / 3);
+			for (size_t t = 0; t < tris.size(); ++t) {
+				XMFLOAT3 p[3];
+				for (int k = 0; k < 3; ++k)
+					p[k] = mesh.Vertices[mesh.Indices32[3*t + k]].Position;
+				auto less = [](const XMFLOAT3& u, const XMFLOAT3& v) {
+					return (u.x != v.x) ? u.x < v.x : (u.y != v.y) ? u.y < v.y : u.z < v.z;
+				};
+				int first = 0;
+				for (int k = 1; k < 3; ++k)
+					if (less(p[k], p[first]))
+						first = k;
+				for (int k = 0; k < 3; ++k) {
+					const XMFLOAT3& q = p[(first + k) % 3];
+					tris[t][3*k + 0] = q.x;
+					tris[t][3*k + 1] = q.y;
+					tris[t][3*k + 2] = q.z;
+				}
+			}
+			std::sort(tris.begin(), tris.end());
+			return tris;
+		};
+
+		const auto ta = collect(a);
+		const auto tb = collect(b);
+		float error = 0.0f;
+		for (size_t t = 0; t < ta.size(); ++t)
+			for (int k = 0; k < 9; ++k)
+				error = std::max(error, std::fabs(ta[t][k] - tb[t][k]));
+		return error;
+	}
+
+	template<typename Func>
+	double MedianSeconds(int repeat, Func func)
+	{
+		std::vector<double> times;
+		for (int r = 0; r < repeat; ++r) {
+			const auto start = std::chrono::steady_clock::now();
+			func();
+			const auto stop = std::chrono::steady_clock::now();
+			times.push_back(std::chrono::duration<double>(stop - start).count());
+		}
+		std::sort(times.begin(), times.end());
+		return times[times.size() / 2];
+	}
+
+	// 按逗号拆分
+	std::vector<std::string> Split(const char* text)
+	{
+		std::vector<std::string> items;
+		std::string item;
+		for (const char* c = text; ; ++c) {
+			if (*c == ',' || *c == '\0') {
+				if (!item.empty())
+					items.push_back(item);
+				item.clear();
+				if (*c == '\0')
+					break;
+			}
+			else {
+				item += *c;
+			}
+		}
+		return items;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<std::string> shapes = { "geosphere", "sphere", "cylinder", "grid" };
+	std::vector<unsigned int> threadCounts;
+	int repeat = 3;
+	bool optimize = true;
+	bool csv = false;
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (std::strcmp(argv[i], "-shapes") == 0)
+			shapes = Split(argv[i + 1]);
+		else if (std::strcmp(argv[i], "-threads") == 0) {
+			for (const std::string& t : Split(argv[i + 1]))
+				threadCounts.push_back((unsigned int)std::max(1, std::atoi(t.c_str())));
+		}
+		else if (std::strcmp(argv[i], "-repeat") == 0)
+			repeat = std::max(1, std::atoi(argv[i + 1]));
+		else if (std::strcmp(argv[i], "-optimize") == 0)
+			optimize = std::atoi(argv[i + 1]) != 0;
+		else if (std::strcmp(argv[i], "-format") == 0)
+			csv = std::strcmp(argv[i + 1], "csv") == 0;
+		else {
+			std::fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (threadCounts.empty()) {
+		const unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+		for (unsigned int t = 1; t < hardware; t *= 2)
+			threadCounts.push_back(t);
+		threadCounts.push_back(hardware);
+	}
+
+	if (csv)
+		std::printf("shape,params,threads,old_ms,new_ms,speedup,old_vertices,new_vertices,indices,max_error,optimized_ms,optimized_speedup\n");
+	else
+		std::printf("%-10s %-10s %7s %10s %10s %8s %12s %12s %12s %10s %10s %8s\n",
+			"shape", "params", "threads", "old ms", "new ms", "speedup", "old verts", "new verts", "indices", "max error",
+			"opt ms", "opt spd");
+
+	for (const Case& c : BuildCases(shapes)) {
+		MeshData oldMesh;
+		const double oldSeconds = MedianSeconds(repeat, [&]() { oldMesh = c.Old(); });
+
+		for (unsigned int threads : threadCounts) {
+			ThreadPool pool(threads);
+
+			// 不改任何设置, 与各章节程序的调用方式相同
+			GeometryGenerator generator;
+			generator.SetThreadPool(&pool);
+
+			MeshData newMesh;
+			const double newSeconds = MedianSeconds(repeat, [&]() { newMesh = c.New(generator); });
+			const float error = GeometryError(oldMesh, newMesh);
+
+			const char* format = csv ? "%s,%s,%u,%.3f,%.3f,%.2f,%zu,%zu,%zu,%g,"
+				: "%-10s %-10s %7u %10.3f %10.3f %7.2fx %12zu %12zu %12zu %10.2g ";
+			std::printf(format, c.Shape.c_str(), c.Params.c_str(), threads,
+				oldSeconds * 1000.0, newSeconds * 1000.0, oldSeconds / newSeconds,
+				oldMesh.Vertices.size(), newMesh.Vertices.size(), newMesh.Indices32.size(), error);
+
+			if (optimize) {
+				GeometryGenerator optimizing;
+				optimizing.SetThreadPool(&pool);
+				optimizing.SetOptimize(true);
+				const double optimizedSeconds = MedianSeconds(repeat, [&]() { newMesh = c.New(optimizing); });
+				std::printf(csv ? "%.3f,%.2f\n" : "%10.3f %7.2fx\n", optimizedSeconds * 1000.0, oldSeconds / optimizedSeconds);
+			}
+			else if (csv) {
+				std::printf(",\n");
+			}
+			else {
+				std::printf("%10s %8s\n", "-", "-");
+			}
+		}
+	}
+	return 0;
+}
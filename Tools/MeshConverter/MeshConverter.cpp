@@ -0,0 +1,354 @@
+﻿//***************************************************************************************
+// MeshConverter.cpp
+//
+// 离线网格转换工具: 把书中 Models/*.txt 文本模型(skull.txt, car.txt)转成 .m3db 二进制缓存.
+// 用法:
+//   MeshConverter <input.txt> <output.m3db> [-layout PNT] [-uv sphere|zero] [-name skull] [-lods 0] [-optimize 1]
+//                 [-compress 0] [-split16 0]
+//   -layout  顶点布局, 须与目标程序的Vertex结构体一致(见MeshFile.h), 默认PNT
+//   -uv      纹理坐标生成方式: sphere为第16章的球面投影, zero为全0(法线贴图等章节), 默认zero
+//   -name    子网格名字, 即DrawArgs里的键, 默认取输入文件名
+//   -lods    额外生成的简化LOD级数, 默认0; 第k级的三角形数约为上一级的LodRatio倍,
+//            作为名为"<name>_lod<k>"的子网格写出, 与原网格共用顶点(见MeshSimplifier.h)
+//   -optimize 1(默认)时按顶点缓存, 过度绘制与取顶点顺序重排网格(见MeshOptimizer.h), 并打印优化前后的ACMR/ATVR等指标;
+//            各级LOD的三角形也分别重排. 0则保持文本文件中的顺序
+//   -compress 1时索引只存IndexPacking的压缩编码, 加载时解码(见MeshFile::ReadIndices), 默认0
+//   -split16 1时把引用了65536个以上顶点的子网格切成若干段, 使整个文件可用16位索引;
+//            第k段(k >= 1)作为名为"<name>#<k>"的子网格紧跟在原子网格之后, 读取方须逐段绘制. 默认0
+// 切线(U)与SsaoApp等程序一致: 取up与法线的叉积, 接近平行时改用z轴.
+//***************************************************************************************
+
+#include "../../Common/IndexPacking.h"
+#include "../../Common/MeshFile.h"
+#include "../../Common/MeshOptimizer.h"
+#include "../../Common/MeshSimplifier.h"
+#include <DirectXMath.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	// 相邻两级LOD的三角形数之比
+	const float LodRatio = 0.4f;
+
+	struct SourceVertex
+	{
+		XMFLOAT3 Pos;
+		XMFLOAT3 Normal;
+	};
+
+	/* 读取书中的文本模型格式
+	* VertexCount: n
+	* TriangleCount: m
+	* VertexList (pos, normal)
+	* { px py pz nx ny nz ... }
+	* TriangleList
+	* { i0 i1 i2 ... } */
+	bool LoadTextModel(const std::string& filename, std::vector<SourceVertex>& vertices, std::vector<std::uint32_t>& indices)
+	{
+		std::ifstream fin(filename);
+		if (!fin)
+			return false;
+
+		std::uint32_t vcount = 0;
+		std::uint32_t tcount = 0;
+		std::string ignore;
+
+		fin >> ignore >> vcount;
+		fin >> ignore >> tcount;
+		fin >> ignore >> ignore >> ignore >> ignore;
+
+		vertices.resize(vcount);
+		for (std::uint32_t i = 0; i < vcount; ++i) {
+			fin >> vertices[i].Pos.x >> vertices[i].Pos.y >> vertices[i].Pos.z;
+			fin >> vertices[i].Normal.x >> vertices[i].Normal.y >> vertices[i].Normal.z;
+		}
+
+		fin >> ignore;
+		fin >> ignore;
+		fin >> ignore;
+
+		indices.resize(3 * (size_t)tcount);
+		for (std::uint32_t i = 0; i < tcount; ++i)
+			fin >> indices[i * 3 + 0] >> indices[i * 3 + 1] >> indices[i * 3 + 2];
+
+		if (!fin)
+			return false;
+
+		for (std::uint32_t index : indices) {
+			if (index >= vcount)
+				return false;
+		}
+		return true;
+	}
+
+	XMFLOAT2 SphereTexC(const XMFLOAT3& pos)
+	{
+		XMFLOAT3 spherePos;
+		XMStoreFloat3(&spherePos, XMVector3Normalize(XMLoadFloat3(&pos)));
+
+		float theta = atan2f(spherePos.z, spherePos.x);
+		if (theta < 0.0f)
+			theta += XM_2PI;
+		float phi = acosf(spherePos.y);
+
+		return XMFLOAT2(theta / XM_2PI, phi / XM_PI);
+	}
+
+	XMFLOAT3 AnyTangent(const XMFLOAT3& normal)
+	{
+		XMVECTOR N = XMLoadFloat3(&normal);
+		XMVECTOR up = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+
+		XMFLOAT3 t;
+		if (fabsf(XMVectorGetX(XMVector3Dot(N, up))) < 1.0f - 0.001f) {
+			XMStoreFloat3(&t, XMVector3Normalize(XMVector3Cross(up, N)));
+		}
+		else {
+			up = XMVectorSet(0.0f, 0.0f, 1.0f, 0.0f);
+			XMStoreFloat3(&t, XMVector3Normalize(XMVector3Cross(N, up)));
+		}
+		return t;
+	}
+
+	std::string StemOf(const std::string& path)
+	{
+		size_t slash = path.find_last_of("/\\");
+		std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+		size_t dot = name.find_last_of('.');
+		return (dot == std::string::npos) ? name : name.substr(0, dot);
+	}
+
+	void PrintStats(const char* label, const std::vector<SourceVertex>& vertices, const std::vector<std::uint32_t>& indices, std::uint32_t stride)
+	{
+		MeshOptimizer::Source source;
+		source.Vertices = vertices.data();
+		source.VertexStride = sizeof(SourceVertex);
+		source.PositionOffset = offsetof(SourceVertex, Pos);
+		source.VertexCount = (std::uint32_t)vertices.size();
+
+		const std::uint32_t indexCount = (std::uint32_t)indices.size();
+		const MeshOptimizer::VertexCacheStats cache = MeshOptimizer::AnalyzeVertexCache(indices.data(), indexCount, source.VertexCount);
+		const MeshOptimizer::VertexFetchStats fetch = MeshOptimizer::AnalyzeVertexFetch(indices.data(), indexCount, source.VertexCount, stride);
+		const MeshOptimizer::OverdrawStats overdraw = MeshOptimizer::AnalyzeOverdraw(source, indices.data(), indexCount);
+
+		std::cout << label << ": ACMR " << cache.Acmr << ", ATVR " << cache.Atvr
+			<< ", overfetch " << fetch.Overfetch << ", overdraw " << overdraw.Overdraw << "\n";
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) {
+		std::cerr << "usage: MeshConverter <input.txt> <output.m3db> [-layout PNT] [-uv sphere|zero] [-name skull] [-lods 0] [-optimize 1]"
+			" [-compress 0] [-split16 0]\n";
+		return 1;
+	}
+
+	std::string input = argv[1];
+	std::string output = argv[2];
+	std::string layout = "PNT";
+	bool sphereUV = false;
+	std::string name = StemOf(input);
+	int lodCount = 0;
+	bool optimize = true;
+	bool compress = false;
+	bool split16 = false;
+
+	for (int i = 3; i + 1 < argc; i += 2) {
+		if (std::strcmp(argv[i], "-layout") == 0)
+			layout = argv[i + 1];
+		else if (std::strcmp(argv[i], "-uv") == 0)
+			sphereUV = std::strcmp(argv[i + 1], "sphere") == 0;
+		else if (std::strcmp(argv[i], "-name") == 0)
+			name = argv[i + 1];
+		else if (std::strcmp(argv[i], "-lods") == 0)
+			lodCount = std::max(0, std::atoi(argv[i + 1]));
+		else if (std::strcmp(argv[i], "-optimize") == 0)
+			optimize = std::atoi(argv[i + 1]) != 0;
+		else if (std::strcmp(argv[i], "-compress") == 0)
+			compress = std::atoi(argv[i + 1]) != 0;
+		else if (std::strcmp(argv[i], "-split16") == 0)
+			split16 = std::atoi(argv[i + 1]) != 0;
+	}
+
+	const std::uint32_t stride = MeshFile::LayoutStride(layout.c_str());
+	if (stride == 0 || layout.size() > MeshFile::MaxLayoutLength || layout[0] != 'P') {
+		std::cerr << "invalid layout '" << layout << "'\n";
+		return 1;
+	}
+	if (name.size() + (lodCount > 0 ? 6 : 0) + (split16 ? 4 : 0) >= sizeof(MeshFile::Submesh::Name)) {
+		std::cerr << "submesh name too long\n";
+		return 1;
+	}
+
+	std::vector<SourceVertex> source;
+	std::vector<std::uint32_t> indices;
+	if (!LoadTextModel(input, source, indices)) {
+		std::cerr << "failed to read " << input << "\n";
+		return 1;
+	}
+
+	// 先在源顶点上重排, 其后按布局交错写出时顶点已是取顶点友好的顺序
+	if (optimize) {
+		PrintStats("before", source, indices, stride);
+		MeshOptimizer::Optimize(source.data(), (std::uint32_t)source.size(), sizeof(SourceVertex), offsetof(SourceVertex, Pos),
+			indices.data(), (std::uint32_t)indices.size());
+		PrintStats("after ", source, indices, stride);
+	}
+
+	// 按布局把各属性交错写入顶点缓存, 同时求出包围盒
+	std::vector<std::uint8_t> vertices(source.size() * stride);
+	XMVECTOR vMin = XMVectorReplicate(+INFINITY);
+	XMVECTOR vMax = XMVectorReplicate(-INFINITY);
+	for (size_t i = 0; i < source.size(); ++i) {
+		std::uint8_t* dst = &vertices[i * stride];
+		for (char attribute : layout) {
+			switch (attribute) {
+			case 'P':
+				std::memcpy(dst, &source[i].Pos, sizeof(XMFLOAT3));
+				dst += sizeof(XMFLOAT3);
+				break;
+			case 'N':
+				std::memcpy(dst, &source[i].Normal, sizeof(XMFLOAT3));
+				dst += sizeof(XMFLOAT3);
+				break;
+			case 'T': {
+				XMFLOAT2 texC = sphereUV ? SphereTexC(source[i].Pos) : XMFLOAT2(0.0f, 0.0f);
+				std::memcpy(dst, &texC, sizeof(XMFLOAT2));
+				dst += sizeof(XMFLOAT2);
+				break;
+			}
+			case 'U': {
+				XMFLOAT3 tangent = AnyTangent(source[i].Normal);
+				std::memcpy(dst, &tangent, sizeof(XMFLOAT3));
+				dst += sizeof(XMFLOAT3);
+				break;
+			}
+			}
+		}
+
+		XMVECTOR P = XMLoadFloat3(&source[i].Pos);
+		vMin = XMVectorMin(vMin, P);
+		vMax = XMVectorMax(vMax, P);
+	}
+
+	XMFLOAT3 center, extents;
+	XMStoreFloat3(&center, 0.5f * (vMin + vMax));
+	XMStoreFloat3(&extents, 0.5f * (vMax - vMin));
+
+	MeshFile::Submesh submesh = {};
+	std::memcpy(submesh.Name, name.c_str(), name.size());// 长度已在上面检查过, 结尾0由{}初始化保证
+	submesh.IndexCount = (std::uint32_t)indices.size();
+	submesh.StartIndexLocation = 0;
+	submesh.BaseVertexLocation = 0;
+	submesh.Center[0] = center.x;   submesh.Center[1] = center.y;   submesh.Center[2] = center.z;
+	submesh.Extents[0] = extents.x; submesh.Extents[1] = extents.y; submesh.Extents[2] = extents.z;
+
+	std::vector<MeshFile::Submesh> submeshes = { submesh };
+
+	/// 各级LOD逐级由上一级简化而来, 索引依次接在原索引之后
+	MeshSimplifier::Source simplifierSource;
+	simplifierSource.Vertices = source.data();
+	simplifierSource.VertexStride = sizeof(SourceVertex);
+	simplifierSource.PositionOffset = 0;
+	simplifierSource.VertexCount = (std::uint32_t)source.size();
+
+	std::vector<std::uint32_t> previous(indices);
+	std::vector<std::uint32_t> lodIndices;
+	for (int lod = 1; lod <= lodCount; ++lod) {
+		const std::uint32_t target = (std::uint32_t)(previous.size() * LodRatio) / 3 * 3;
+		const float error = MeshSimplifier::Simplify(simplifierSource, previous.data(), (std::uint32_t)previous.size(),
+			target, FLT_MAX, lodIndices);
+
+		// 简化保留了上一级的三角形顺序, 但折叠后缓存局部性变差, 重新排一次; 顶点已在上面统一重排过
+		if (optimize) {
+			MeshOptimizer::Source optimizerSource;
+			optimizerSource.Vertices = source.data();
+			optimizerSource.VertexStride = sizeof(SourceVertex);
+			optimizerSource.PositionOffset = offsetof(SourceVertex, Pos);
+			optimizerSource.VertexCount = (std::uint32_t)source.size();
+
+			const std::uint32_t lodIndexCount = (std::uint32_t)lodIndices.size();
+			MeshOptimizer::OptimizeVertexCache(lodIndices.data(), lodIndexCount, optimizerSource.VertexCount, lodIndices.data());
+			MeshOptimizer::OptimizeOverdraw(optimizerSource, lodIndices.data(), lodIndexCount, lodIndices.data());
+		}
+
+		MeshFile::Submesh lodSubmesh = submesh;
+		const std::string lodName = name + "_lod" + std::to_string(lod);
+		std::memset(lodSubmesh.Name, 0, sizeof(lodSubmesh.Name));
+		std::memcpy(lodSubmesh.Name, lodName.c_str(), lodName.size());
+		lodSubmesh.IndexCount = (std::uint32_t)lodIndices.size();
+		lodSubmesh.StartIndexLocation = (std::uint32_t)indices.size();
+		submeshes.push_back(lodSubmesh);
+
+		std::cout << lodName << ": " << lodIndices.size() / 3 << " triangles, error " << error << "\n";
+		indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+		previous.swap(lodIndices);
+	}
+
+	/// 索引放不进16位时按需切分子网格; 各段与原子网格共用包围盒和顶点, 只有索引和BaseVertexLocation不同
+	std::vector<IndexPacking::Range> ranges(submeshes.size());
+	for (size_t s = 0; s < submeshes.size(); ++s) {
+		ranges[s].IndexCount = submeshes[s].IndexCount;
+		ranges[s].StartIndexLocation = submeshes[s].StartIndexLocation;
+		ranges[s].BaseVertexLocation = submeshes[s].BaseVertexLocation;
+	}
+
+	IndexPacking::Buffer indexBuffer;
+	if (!IndexPacking::Build(indices.data(), (std::uint32_t)indices.size(), ranges.data(), (std::uint32_t)ranges.size(),
+		(std::uint32_t)source.size(), split16, indexBuffer)) {
+		std::cerr << "index out of range in " << input << "\n";
+		return 1;
+	}
+
+	if (indexBuffer.Ranges.size() != submeshes.size()) {
+		std::vector<MeshFile::Submesh> parts;
+		const std::uint16_t* packed = reinterpret_cast<const std::uint16_t*>(indexBuffer.Data.data());
+		std::vector<std::uint32_t> partIndices(packed, packed + indexBuffer.IndexCount());
+		for (size_t s = 0; s < submeshes.size(); ++s) {
+			for (std::uint32_t k = 0; k < indexBuffer.RangeCount((std::uint32_t)s); ++k) {
+				const IndexPacking::Range& range = indexBuffer.Ranges[indexBuffer.FirstRange[s] + k];
+				MeshFile::Submesh part = submeshes[s];
+				if (k > 0) {
+					const std::string partName = std::string(submeshes[s].Name) + "#" + std::to_string(k);
+					std::memset(part.Name, 0, sizeof(part.Name));
+					std::memcpy(part.Name, partName.c_str(), std::min(partName.size(), sizeof(part.Name) - 1));
+				}
+				part.IndexCount = range.IndexCount;
+				part.StartIndexLocation = range.StartIndexLocation;
+				part.BaseVertexLocation = range.BaseVertexLocation;
+				parts.push_back(part);
+			}
+		}
+		std::cout << "split " << submeshes.size() << " submeshes into " << parts.size() << " for 16-bit indices\n";
+		submeshes.swap(parts);
+		indices.swap(partIndices);
+	}
+
+	if (!MeshFile::Write(output, layout.c_str(), stride, vertices.data(), (std::uint32_t)source.size(),
+		indices.data(), (std::uint32_t)indices.size(), submeshes, compress)) {
+		std::cerr << "failed to write " << output << "\n";
+		return 1;
+	}
+
+	std::cout << output << ": " << source.size() << " vertices, " << submesh.IndexCount / 3
+		<< " triangles, layout " << layout << ", " << (indexBuffer.Index16 ? 16 : 32) << "-bit indices";
+	if (compress) {
+		std::vector<std::uint8_t> encoded;
+		IndexPacking::Encode(indices.data(), (std::uint32_t)indices.size(), encoded);
+		std::cout << ", compressed to " << encoded.size() << " bytes (" << 3.0 * encoded.size() / indices.size() << " bytes/triangle)";
+	}
+	std::cout << "\n";
+	return 0;
+}
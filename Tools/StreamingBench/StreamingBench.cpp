@@ -0,0 +1,348 @@
+﻿//***************************************************************************************
+// StreamingBench.cpp
+//
+// TextureStreamer驻留策略的离线测试: 用只记账的假分配器(FakeBackend)代替D3D12, 模拟相机穿过一片摆满物体的场景,
+// 每个物体用一张自己的纹理. 假分配器为每次变化单独记录新建的"资源", 若干帧后随机地完成或失败,
+// 每帧检查策略的账目与分配器一致, 驻留不超出预算, 始终保留尾部mip; 最后相机静止一段时间, 检查驻留收敛且不再来回调入调出.
+// 不创建窗口也不依赖D3D, 可在没有GPU的Linux CI上运行:
+//   g++ -std=c++14 -O2 -I<DirectXMath>/Inc -I<DirectX-Headers>/include/wsl/stubs -I<DirectX-Headers>/include/directx
+//       StreamingBench.cpp ../../Common/TextureStreamer.cpp ../../Common/DdsParser.cpp -o StreamingBench
+//
+// 用法:
+//   StreamingBench [-textures 256] [-frames 2000] [-budget 16,64,256] [-latency 4] [-failrate 0] [-seed 1] [-format table|csv]
+//   -textures  纹理(物体)数, 边长在256~2048之间随机, 格式为BC1/BC3/BC7之一, 带完整mip链
+//   -frames    相机移动的帧数, 之后再静止settle帧(为frames / 4)
+//   -budget    预算(MB), 可给多个, 每个各跑一遍
+//   -latency   每次变化在1~latency帧后完成
+//   -failrate  变化失败的概率, 默认0
+//   -format    输出格式, 默认table
+// 每个预算输出一行: 调入/调出/失败次数, 调入的数据量, 已占用显存的峰值, 可见纹理平均欠缺的mip级数,
+// 静止后收敛所用的帧数, 以及检查出的错误数. 有错误时返回2.
+//***************************************************************************************
+
+#include "../../Common/TextureStreamer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+namespace
+{
+	using uint32 = TextureStreamer::uint32;
+	using uint64 = TextureStreamer::uint64;
+	using TextureId = TextureStreamer::TextureId;
+
+	const float ProjScaleY = 2.4142136f;// 1 / tan(45° / 2), 与书中程序的0.25 * Pi视场角一致
+	const float ViewportHeight = 720.0f;
+
+	/* 假分配器: 每个纹理有一个已驻留的块, 变化进行中时另有一个新块; 完成时释放其中一个 */
+	class FakeBackend : public TextureStreamer::Backend
+	{
+	public:
+		struct Change
+		{
+			TextureId Id;
+			uint32 FirstMip;
+			uint64 Bytes;
+			bool Eviction;
+			uint64 DueFrame;
+		};
+
+		FakeBackend(uint32 latency, double failRate, uint32 seed)
+			: mLatency(std::max(1u, latency)), mFailRate(failRate), mRandom(seed) {}
+
+		void Attach(TextureStreamer* streamer) { mStreamer = streamer; }
+
+		// Add之后由测试为纹理分配尾部mip的块
+		void AddTexture(TextureId id)
+		{
+			if (mResident.size() <= id) {
+				mResident.resize(id + 1, 0);
+				mResidentMip.resize(id + 1, 0);
+			}
+			mResidentMip[id] = mStreamer->GetState(id).TailMip;
+			mResident[id] = mStreamer->ResidentSize(id, mResidentMip[id]);
+			mAllocated += mResident[id];
+		}
+
+		bool BeginChange(TextureId id, uint32 firstMip)override
+		{
+			for (const Change& c : mChanges) {
+				if (c.Id == id) {
+					++mErrors;// 同一纹理同时只能有一个变化
+					std::fprintf(stderr, "texture %u: overlapping changes\n", id);
+				}
+			}
+			Change change;
+			change.Id = id;
+			change.FirstMip = firstMip;
+			change.Bytes = mStreamer->ResidentSize(id, firstMip);
+			change.Eviction = firstMip > mResidentMip[id];
+			change.DueFrame = mFrame + 1 + mRandom() % mLatency;
+			mChanges.push_back(change);
+			mAllocated += change.Bytes;
+			if (change.Eviction)
+				mEvictionBytes += change.Bytes;
+			return true;
+		}
+
+		// 完成到期的变化
+		void Tick()
+		{
+			++mFrame;
+			std::uniform_real_distribution<double> chance(0.0, 1.0);
+			for (size_t i = 0; i < mChanges.size();) {
+				const Change c = mChanges[i];
+				if (c.DueFrame > mFrame) {
+					++i;
+					continue;
+				}
+				const bool success = chance(mRandom) >= mFailRate;
+				if (success) {
+					mAllocated -= mResident[c.Id];
+					mResident[c.Id] = c.Bytes;
+					mResidentMip[c.Id] = c.FirstMip;
+				}
+				else {
+					mAllocated -= c.Bytes;
+				}
+				if (c.Eviction)
+					mEvictionBytes -= c.Bytes;
+				mStreamer->Complete(c.Id, c.FirstMip, success);
+				mChanges[i] = mChanges.back();
+				mChanges.pop_back();
+			}
+		}
+
+		uint64 Allocated()const { return mAllocated; }
+		uint64 EvictionBytes()const { return mEvictionBytes; }
+		uint32 ResidentMip(TextureId id)const { return mResidentMip[id]; }
+		int& Errors() { return mErrors; }
+
+	private:
+		TextureStreamer* mStreamer = nullptr;
+		uint32 mLatency;
+		double mFailRate;
+		std::mt19937 mRandom;
+		uint64 mFrame = 0;
+
+		std::vector<uint64> mResident;
+		std::vector<uint32> mResidentMip;
+		std::vector<Change> mChanges;
+		uint64 mAllocated = 0;
+		uint64 mEvictionBytes = 0;// 进行中的调出新建的块, 不受预算约束
+		int mErrors = 0;
+	};
+
+	struct Object
+	{
+		BoundingSphere Bounds;
+		float UvScale = 1.0f;
+		TextureId Texture = 0;
+	};
+
+	struct Result
+	{
+		TextureStreamer::Stats Stats;
+		double MeanDeficit = 0.0;	// 可见纹理平均欠缺的mip级数(按帧平均)
+		int SettleFrames = -1;		// 静止后驻留不再变化所用的帧数, -1为未收敛
+		int Errors = 0;
+	};
+
+	/* 相机在场景上方沿一条来回的折线飞行, 视线朝前下方; 返回第frame帧的位置 */
+	XMFLOAT3 CameraPosition(int frame, int frames, float extent)
+	{
+		const float t = (float)frame / std::max(1, frames);
+		const float x = extent * (0.1f + 0.8f * t);
+		const float z = extent * (0.5f + 0.4f * std::sin(t * 6.2831853f * 3.0f));
+		return XMFLOAT3(x, 4.0f, z);
+	}
+
+	Result Run(int textureCount, int frames, uint64 budget, uint32 latency, double failRate, uint32 seed)
+	{
+		FakeBackend backend(latency, failRate, seed);
+		TextureStreamer streamer(&backend);
+		backend.Attach(&streamer);
+		streamer.SetBudget(budget);
+
+		/// 在正方形区域内摆放物体, 每个物体一张纹理
+		std::mt19937 random(seed);
+		const int side = (int)std::ceil(std::sqrt((double)textureCount));
+		const float spacing = 12.0f;
+		const float extent = side * spacing;
+		const DXGI_FORMAT formats[] = { DXGI_FORMAT_BC1_UNORM, DXGI_FORMAT_BC3_UNORM, DXGI_FORMAT_BC7_UNORM };
+		std::vector<Object> objects;
+		for (int i = 0; i < textureCount; ++i) {
+			DdsParser::Info info;
+			info.Dim = DdsParser::Dimension::Texture2D;
+			info.Width = info.Height = 256u << (random() % 4);
+			info.Depth = 1;
+			info.ArraySize = 1;
+			info.MipCount = 1;
+			for (uint32 s = info.Width; s > 1; s >>= 1)
+				++info.MipCount;
+			info.Format = formats[random() % 3];
+
+			Object object;
+			object.Texture = streamer.Add(info);
+			object.Bounds.Center = XMFLOAT3((i % side + 0.5f) * spacing, 0.0f, (i / side + 0.5f) * spacing);
+			object.Bounds.Radius = 1.0f + (float)(random() % 5);
+			object.UvScale = (float)(1 + random() % 4);
+			objects.push_back(object);
+			backend.AddTexture(object.Texture);
+		}
+
+		Result result;
+		const int settle = std::max(10, frames / 4);
+		int lastChange = -1;
+		std::vector<uint32> previous(textureCount, 0);
+		double deficit = 0.0;
+		uint64 deficitSamples = 0;
+		uint64 tailBytes = 0;
+		for (int i = 0; i < textureCount; ++i)
+			tailBytes += streamer.ResidentSize((TextureId)i, streamer.GetState((TextureId)i).TailMip);
+
+		for (int frame = 0; frame < frames + settle; ++frame) {
+			backend.Tick();
+
+			const XMFLOAT3 eye = CameraPosition(std::min(frame, frames), frames, extent);
+			streamer.BeginFrame(eye, ProjScaleY, ViewportHeight);
+			// 只报告相机前方一定距离内的物体, 相当于视锥体剔除
+			for (const Object& object : objects) {
+				const float dx = object.Bounds.Center.x - eye.x;
+				const float dz = object.Bounds.Center.z - eye.z;
+				if (dx > -spacing && dx * dx + dz * dz < 150.0f * 150.0f)
+					streamer.ReportUsage(object.Texture, object.Bounds, object.UvScale);
+			}
+			streamer.Update();
+
+			/// 检查
+			if (backend.Allocated() != streamer.CommittedBytes()) {
+				++result.Errors;
+				std::fprintf(stderr, "frame %d: allocator has %llu bytes, streamer counts %llu\n", frame,
+					(unsigned long long)backend.Allocated(), (unsigned long long)streamer.CommittedBytes());
+			}
+			if (tailBytes <= budget && backend.Allocated() - backend.EvictionBytes() > budget) {
+				++result.Errors;
+				std::fprintf(stderr, "frame %d: %llu bytes committed over a budget of %llu\n", frame,
+					(unsigned long long)(backend.Allocated() - backend.EvictionBytes()), (unsigned long long)budget);
+			}
+
+			bool changed = false;
+			for (int i = 0; i < textureCount; ++i) {
+				const TextureStreamer::TextureState state = streamer.GetState((TextureId)i);
+				if (state.ResidentMip > state.TailMip || state.ResidentMip != backend.ResidentMip((TextureId)i)) {
+					++result.Errors;
+					std::fprintf(stderr, "frame %d: texture %d resident mip %u (tail %u, allocator %u)\n", frame, i,
+						state.ResidentMip, state.TailMip, backend.ResidentMip((TextureId)i));
+				}
+				if (state.RequiredMip < state.TailMip) {
+					deficit += (state.ResidentMip > state.RequiredMip) ? state.ResidentMip - state.RequiredMip : 0;
+					++deficitSamples;
+				}
+				changed |= state.ResidentMip != previous[i] || state.PendingMip != state.ResidentMip;
+				previous[i] = state.ResidentMip;
+			}
+			if (changed)
+				lastChange = frame;
+		}
+
+		result.Stats = streamer.GetStats();
+		result.MeanDeficit = deficitSamples ? deficit / deficitSamples : 0.0;
+		// 静止期间的最后一段仍在变化视为未收敛(来回调入调出)
+		if (lastChange < frames + settle - 10)
+			result.SettleFrames = std::max(0, lastChange - frames + 1);
+		else {
+			++result.Errors;
+			std::fprintf(stderr, "budget %llu: residency still changing %d frames after the camera stopped\n",
+				(unsigned long long)budget, settle);
+		}
+
+		// 预算充足时静止后每个纹理都应达到所需的mip
+		bool ample = true;
+		for (int i = 0; i < textureCount; ++i)
+			ample &= streamer.ResidentBytes() + streamer.ResidentSize((TextureId)i, 0) <= budget;
+		if (ample) {
+			for (int i = 0; i < textureCount; ++i) {
+				const TextureStreamer::TextureState state = streamer.GetState((TextureId)i);
+				if (state.ResidentMip > state.RequiredMip) {
+					++result.Errors;
+					std::fprintf(stderr, "texture %d: resident mip %u, required %u with ample budget\n", i,
+						state.ResidentMip, state.RequiredMip);
+				}
+			}
+		}
+
+		result.Errors += backend.Errors();
+		return result;
+	}
+
+	std::vector<uint64> ParseBudgets(const char* list)
+	{
+		std::vector<uint64> budgets;
+		for (const char* p = list; *p;) {
+			budgets.push_back((uint64)(std::max(0.0, std::atof(p)) * 1048576.0));
+			p = std::strchr(p, ',');
+			if (p == nullptr)
+				break;
+			++p;
+		}
+		return budgets;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int textures = 256;
+	int frames = 2000;
+	std::vector<uint64> budgets = { 16ull << 20, 64ull << 20, 256ull << 20 };
+	uint32 latency = 4;
+	double failRate = 0.0;
+	uint32 seed = 1;
+	bool csv = false;
+
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (std::strcmp(argv[i], "-textures") == 0)
+			textures = std::max(1, std::atoi(argv[i + 1]));
+		else if (std::strcmp(argv[i], "-frames") == 0)
+			frames = std::max(1, std::atoi(argv[i + 1]));
+		else if (std::strcmp(argv[i], "-budget") == 0)
+			budgets = ParseBudgets(argv[i + 1]);
+		else if (std::strcmp(argv[i], "-latency") == 0)
+			latency = (uint32)std::max(1, std::atoi(argv[i + 1]));
+		else if (std::strcmp(argv[i], "-failrate") == 0)
+			failRate = std::min(1.0, std::max(0.0, std::atof(argv[i + 1])));
+		else if (std::strcmp(argv[i], "-seed") == 0)
+			seed = (uint32)std::atoi(argv[i + 1]);
+		else if (std::strcmp(argv[i], "-format") == 0)
+			csv = std::strcmp(argv[i + 1], "csv") == 0;
+		else {
+			std::fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (csv)
+		std::printf("budget_mb,stream_ins,evictions,failures,streamed_mb,peak_mb,mean_deficit,settle_frames,errors\n");
+	else
+		std::printf("%9s %10s %10s %9s %12s %9s %13s %14s %7s\n", "budget MB", "stream-ins", "evictions", "failures",
+			"streamed MB", "peak MB", "mean deficit", "settle frames", "errors");
+
+	int errors = 0;
+	for (uint64 budget : budgets) {
+		const Result r = Run(textures, frames, budget, latency, failRate, seed);
+		const char* format = csv ? "%.0f,%llu,%llu,%llu,%.1f,%.1f,%.3f,%d,%d\n"
+			: "%9.0f %10llu %10llu %9llu %12.1f %9.1f %13.3f %14d %7d\n";
+		std::printf(format, budget / 1048576.0, (unsigned long long)r.Stats.StreamIns, (unsigned long long)r.Stats.Evictions,
+			(unsigned long long)r.Stats.Failures, r.Stats.BytesStreamedIn / 1048576.0, r.Stats.PeakCommitted / 1048576.0,
+			r.MeanDeficit, r.SettleFrames, r.Errors);
+		errors += r.Errors;
+	}
+	return errors > 0 ? 2 : 0;
+}
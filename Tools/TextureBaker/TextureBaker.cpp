@@ -0,0 +1,606 @@
+﻿//***************************************************************************************
+// TextureBaker.cpp
+//
+// 离线纹理烘焙工具: 把未压缩的BMP/DDS纹理(如tree0.bmp, white1x1.dds)生成完整的mip链并做块压缩,
+// 写出DDSTextureLoader可直接加载的DDS文件(总是带DX10扩展头), 并报告每个文件的大小与压缩误差.
+// mip由MipGenerator在线性空间中滤波(见MipGenerator.h), 块压缩由BlockCompressor完成(见BlockCompressor.h),
+// 两者都在线程池上按行并行. 不依赖D3D, 也可在Linux上编译:
+//   g++ -std=c++14 -O2 -msse4.1 -I<DirectX-Headers>/include/wsl/stubs -I<DirectX-Headers>/include/directx
+//       TextureBaker.cpp ../../Common/{AssetCache,DdsParser,MappedFile,MipGenerator,BlockCompressor,ThreadPool}.cpp -pthread -o TextureBaker
+//
+// 用法:
+//   TextureBaker [-format auto] [-srgb 0] [-mips 0] [-threads 0] [-out .] [-cache dir] [-report table] <input>...
+//   -format  auto|bc1|bc3|bc4|bc5|bc7|rgba, 默认auto: 文件名含_nmap或_norm的视为法线贴图用BC5,
+//            有不透明度小于255的像素用BC3, 其余用BC1; 宽高不是4的倍数时(D3D不允许)改写为未压缩的rgba.
+//            bc7与bc3大小相同, 误差更小(树叶纹理的PSNR约高1~3dB), 但编码慢数倍, 所以auto不选它
+//   -srgb    1时写出_SRGB格式, 默认0即与书中程序一致的UNORM格式; 两者的mip都按sRGB颜色做伽马正确的滤波
+//   -mips    最多生成的mip级数, 默认0即完整的mip链
+//   -threads 线程数, 默认0即每个硬件线程一个
+//   -out     输出目录, 默认当前目录; 输出文件名为输入文件名换成.dds扩展名, 不能与输入为同一文件
+//   -cache   烘焙缓存目录(见AssetCache.h), 默认不用; 输入内容与上述选项都没变的文件直接取回上次的结果, 不再压缩,
+//            报告中这些文件的PSNR一栏显示cached
+//   -report  table|csv, 默认table
+// 输入可以是24/32位BMP, 或R8G8B8A8/B8G8R8A8/B8G8R8X8格式的DDS(只取首级mip).
+// 法线贴图不做伽马转换, 每级mip重新归一化; BC5只存xy, 着色器须按z = sqrt(1 - x^2 - y^2)重建.
+// 报告中的PSNR为各级mip压缩前后(8位)的峰值信噪比, 只统计该格式保存的通道(BC1为RGB, BC4为R, BC5为RG).
+//***************************************************************************************
+
+#include "../../Common/AssetCache.h"
+#include "../../Common/BlockCompressor.h"
+#include "../../Common/DdsParser.h"
+#include "../../Common/MappedFile.h"
+#include "../../Common/MipGenerator.h"
+#include "../../Common/ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+	using uint8 = std::uint8_t;
+	using uint32 = std::uint32_t;
+	using uint64 = std::uint64_t;
+
+	enum class OutputFormat
+	{
+		Auto,
+		BC1,
+		BC3,
+		BC4,
+		BC5,
+		BC7,
+		RGBA
+	};
+
+	struct Image
+	{
+		uint32 Width = 0;
+		uint32 Height = 0;
+		std::vector<uint8> Pixels;// RGBA8, 无行间填充
+	};
+
+	inline uint32 ReadU16(const uint8* p)
+	{
+		return (uint32)p[0] | ((uint32)p[1] << 8);
+	}
+
+	inline uint32 ReadU32(const uint8* p)
+	{
+		return (uint32)p[0] | ((uint32)p[1] << 8) | ((uint32)p[2] << 16) | ((uint32)p[3] << 24);
+	}
+
+	// mask所选的位段扩展到8位; mask为0时返回fallback
+	inline uint8 ExtractChannel(uint32 value, uint32 mask, uint8 fallback)
+	{
+		if (mask == 0)
+			return fallback;
+		int shift = 0;
+		while (!(mask & (1u << shift)))
+			++shift;
+		const uint32 maxValue = mask >> shift;
+		return (uint8)(((value & mask) >> shift) * 255 / maxValue);
+	}
+
+	/* 24位或32位(BI_RGB / BI_BITFIELDS)的BMP; 支持自下而上与自上而下两种行序 */
+	bool LoadBmp(const uint8* data, size_t size, Image& image, std::string& error)
+	{
+		if (size < 54 || data[0] != 'B' || data[1] != 'M') {
+			error = "not a bmp file";
+			return false;
+		}
+		const uint32 pixelOffset = ReadU32(data + 10);
+		const uint32 infoSize = ReadU32(data + 14);
+		const int32_t width = (int32_t)ReadU32(data + 18);
+		const int32_t height = (int32_t)ReadU32(data + 22);
+		const uint32 bitCount = ReadU16(data + 28);
+		const uint32 compression = ReadU32(data + 30);
+		if (infoSize < 40 || width <= 0 || height == 0 || height == INT32_MIN ||
+			width > (int32_t)DdsParser::MaxTexture2DSize || std::abs(height) > (int32_t)DdsParser::MaxTexture2DSize) {
+			error = "bad bmp header";
+			return false;
+		}
+		if ((bitCount != 24 && bitCount != 32) || (compression != 0 && !(compression == 3 && bitCount == 32))) {
+			error = "unsupported bmp format (only 24/32-bit uncompressed)";
+			return false;
+		}
+
+		// BI_BITFIELDS的掩码在V4/V5头内, 或紧跟在40字节的头之后
+		uint32 masks[4] = { 0x00ff0000, 0x0000ff00, 0x000000ff, 0 };
+		if (compression == 3) {
+			if (size < 14 + 40 + 12) {
+				error = "truncated bmp";
+				return false;
+			}
+			for (int c = 0; c < 3; ++c)
+				masks[c] = ReadU32(data + 54 + 4 * c);
+			if (infoSize >= 56 && size >= 14 + 56)
+				masks[3] = ReadU32(data + 54 + 12);
+		}
+		else if (bitCount == 32) {
+			masks[3] = 0xff000000;
+		}
+
+		const bool topDown = height < 0;
+		image.Width = (uint32)width;
+		image.Height = (uint32)std::abs(height);
+		const size_t srcPitch = (((size_t)image.Width * bitCount + 31) / 32) * 4;
+		if (pixelOffset > size || srcPitch * image.Height > size - pixelOffset) {
+			error = "truncated bmp";
+			return false;
+		}
+
+		image.Pixels.resize((size_t)image.Width * image.Height * 4);
+		bool anyAlpha = false;
+		for (uint32 y = 0; y < image.Height; ++y) {
+			const uint8* src = data + pixelOffset + srcPitch * (topDown ? y : image.Height - 1 - y);
+			uint8* dst = &image.Pixels[(size_t)y * image.Width * 4];
+			for (uint32 x = 0; x < image.Width; ++x, dst += 4) {
+				if (bitCount == 24) {
+					dst[0] = src[3 * x + 2];
+					dst[1] = src[3 * x + 1];
+					dst[2] = src[3 * x + 0];
+					dst[3] = 255;
+				}
+				else {
+					const uint32 value = ReadU32(src + 4 * x);
+					for (int c = 0; c < 4; ++c)
+						dst[c] = ExtractChannel(value, masks[c], 255);
+					anyAlpha |= dst[3] != 0;
+				}
+			}
+		}
+
+		// 许多32位BMP的第4字节只是填充(全为0), 此时视为不透明
+		if (bitCount == 32 && !anyAlpha)
+			for (size_t i = 3; i < image.Pixels.size(); i += 4)
+				image.Pixels[i] = 255;
+		return true;
+	}
+
+	/* 8位RGBA/BGRA的二维DDS, 只取首级mip */
+	bool LoadDds(const uint8* data, size_t size, Image& image, std::string& error)
+	{
+		DdsParser::Info info;
+		DdsParser::Result result = DdsParser::ParseHeader(data, size, info);
+		if (result != DdsParser::Result::Ok) {
+			error = DdsParser::ResultString(result);
+			return false;
+		}
+		if (info.Dim != DdsParser::Dimension::Texture2D || info.ArraySize != 1 || info.IsCubeMap) {
+			error = "only single 2D textures are supported";
+			return false;
+		}
+
+		bool bgr = false;
+		bool opaque = false;
+		switch (info.Format) {
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+			break;
+		case DXGI_FORMAT_B8G8R8A8_UNORM:
+		case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+			bgr = true;
+			break;
+		case DXGI_FORMAT_B8G8R8X8_UNORM:
+		case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+			bgr = true;
+			opaque = true;
+			break;
+		default:
+			error = "unsupported dds format (only 8-bit RGBA/BGRA)";
+			return false;
+		}
+
+		std::vector<DdsParser::Subresource> table(info.SubresourceCount());
+		result = DdsParser::GetSubresources(data, size, info, 0, table.data(), table.size());
+		if (result != DdsParser::Result::Ok) {
+			error = DdsParser::ResultString(result);
+			return false;
+		}
+
+		const DdsParser::Subresource& top = table[0];
+		image.Width = top.Width;
+		image.Height = top.Height;
+		image.Pixels.resize((size_t)image.Width * image.Height * 4);
+		for (uint32 y = 0; y < image.Height; ++y) {
+			const uint8* src = top.Data + top.RowPitch * y;
+			uint8* dst = &image.Pixels[(size_t)y * image.Width * 4];
+			for (uint32 x = 0; x < image.Width; ++x, src += 4, dst += 4) {
+				dst[0] = bgr ? src[2] : src[0];
+				dst[1] = src[1];
+				dst[2] = bgr ? src[0] : src[2];
+				dst[3] = opaque ? 255 : src[3];
+			}
+		}
+		return true;
+	}
+
+	std::string ToLower(std::string s)
+	{
+		for (char& c : s)
+			c = (char)std::tolower((unsigned char)c);
+		return s;
+	}
+
+	// 去掉目录与扩展名
+	std::string BaseName(const std::string& path)
+	{
+		const size_t slash = path.find_last_of("/\\");
+		std::string name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+		const size_t dot = name.find_last_of('.');
+		return (dot == std::string::npos) ? name : name.substr(0, dot);
+	}
+
+	bool IsNormalMap(const std::string& path)
+	{
+		const std::string name = ToLower(BaseName(path));
+		return name.find("_nmap") != std::string::npos || name.find("_norm") != std::string::npos;
+	}
+
+	bool HasAlpha(const Image& image)
+	{
+		for (size_t i = 3; i < image.Pixels.size(); i += 4)
+			if (image.Pixels[i] != 255)
+				return true;
+		return false;
+	}
+
+	const char* FormatName(OutputFormat format)
+	{
+		switch (format) {
+		case OutputFormat::Auto: return "auto";
+		case OutputFormat::BC1: return "bc1";
+		case OutputFormat::BC3: return "bc3";
+		case OutputFormat::BC4: return "bc4";
+		case OutputFormat::BC5: return "bc5";
+		case OutputFormat::BC7: return "bc7";
+		case OutputFormat::RGBA: return "rgba";
+		}
+		return "?";
+	}
+
+	bool ParseFormat(const char* name, OutputFormat& format)
+	{
+		for (int f = (int)OutputFormat::Auto; f <= (int)OutputFormat::RGBA; ++f) {
+			if (std::strcmp(name, FormatName((OutputFormat)f)) == 0) {
+				format = (OutputFormat)f;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	DXGI_FORMAT ToDXGIFormat(OutputFormat format, bool srgb)
+	{
+		switch (format) {
+		case OutputFormat::BC1: return srgb ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM;
+		case OutputFormat::BC3: return srgb ? DXGI_FORMAT_BC3_UNORM_SRGB : DXGI_FORMAT_BC3_UNORM;
+		case OutputFormat::BC4: return DXGI_FORMAT_BC4_UNORM;
+		case OutputFormat::BC5: return DXGI_FORMAT_BC5_UNORM;
+		case OutputFormat::BC7: return srgb ? DXGI_FORMAT_BC7_UNORM_SRGB : DXGI_FORMAT_BC7_UNORM;
+		default: return srgb ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM;
+		}
+	}
+
+	BlockCompressor::Format ToBlockFormat(OutputFormat format)
+	{
+		switch (format) {
+		case OutputFormat::BC1: return BlockCompressor::Format::BC1;
+		case OutputFormat::BC3: return BlockCompressor::Format::BC3;
+		case OutputFormat::BC4: return BlockCompressor::Format::BC4;
+		case OutputFormat::BC5: return BlockCompressor::Format::BC5;
+		default: return BlockCompressor::Format::BC7;
+		}
+	}
+
+	// 格式保存的通道数, 按RGBA顺序取前几个参与PSNR
+	int StoredChannels(OutputFormat format)
+	{
+		switch (format) {
+		case OutputFormat::BC1: return 3;
+		case OutputFormat::BC4: return 1;
+		case OutputFormat::BC5: return 2;
+		default: return 4;
+		}
+	}
+
+	struct Report
+	{
+		std::string Name;
+		std::string Error;
+		uint32 Width = 0;
+		uint32 Height = 0;
+		uint32 Mips = 0;
+		OutputFormat Format = OutputFormat::Auto;
+		uint64 InputBytes = 0;
+		uint64 OutputBytes = 0;
+		double SquaredError = 0.0;
+		uint64 Samples = 0;
+		double Milliseconds = 0.0;
+		bool Cached = false;	// 结果取自烘焙缓存, 没有误差统计
+
+		// 无误差时为无穷大
+		double Psnr()const
+		{
+			if (Samples == 0 || SquaredError == 0.0)
+				return INFINITY;
+			return 10.0 * std::log10(255.0 * 255.0 * Samples / SquaredError);
+		}
+	};
+
+	bool WriteOutput(const std::string& outPath, const void* data, size_t size, Report& report)
+	{
+		std::FILE* out = std::fopen(outPath.c_str(), "wb");
+		if (out == nullptr) {
+			report.Error = "cannot create " + outPath;
+			return false;
+		}
+		const size_t written = std::fwrite(data, 1, size, out);
+		std::fclose(out);
+		if (written != size) {
+			report.Error = "cannot write " + outPath;
+			return false;
+		}
+		report.OutputBytes = size;
+		return true;
+	}
+
+	/* 由缓存的DDS填写报告; 缓存内容解析不了时返回false, 改为重新烘焙 */
+	bool ReadCached(const MappedFile& cached, Report& report)
+	{
+		DdsParser::Info info;
+		if (DdsParser::ParseHeader(cached.Data(), cached.Size(), info) != DdsParser::Result::Ok)
+			return false;
+		for (int f = (int)OutputFormat::BC1; f <= (int)OutputFormat::RGBA; ++f) {
+			if (ToDXGIFormat((OutputFormat)f, false) == info.Format || ToDXGIFormat((OutputFormat)f, true) == info.Format)
+				report.Format = (OutputFormat)f;
+		}
+		report.Width = info.Width;
+		report.Height = info.Height;
+		report.Mips = info.MipCount;
+		report.Cached = true;
+		return true;
+	}
+
+	/* 烘焙一个文件; 失败时report.Error非空. cache不为nullptr时先查缓存, 烘焙的结果也存进去 */
+	void Bake(const std::string& path, const std::string& outDir, OutputFormat requested, bool srgb, uint32 maxMips,
+		ThreadPool& pool, AssetCache* cache, Report& report)
+	{
+		report.Name = path;
+		const std::string outPath = outDir + "/" + BaseName(path) + ".dds";
+
+		MappedFile file;
+		if (!file.Open(path)) {
+			report.Error = "cannot open (error " + std::to_string(file.ErrorCode()) + ")";
+			return;
+		}
+		report.InputBytes = file.Size();
+
+		/// 缓存键: 输入内容与影响结果的全部选项; 编码器或mip滤波改动时须递增kind里的版本号
+		AssetCache::Key cacheKey = 0;
+		if (cache != nullptr) {
+			AssetCache::Hasher hasher("dds-bake/1");
+			hasher.Add(file.Data(), file.Size());
+			hasher.Add((uint64)requested).Add((uint64)srgb).Add((uint64)maxMips).Add((uint64)IsNormalMap(path));
+			cacheKey = hasher.Finish();
+
+			MappedFile cached;
+			if (cache->Load(cacheKey, cached) && ReadCached(cached, report)) {
+				WriteOutput(outPath, cached.Data(), cached.Size(), report);
+				return;
+			}
+		}
+
+		Image image;
+		const std::string ext = ToLower(path.substr(path.find_last_of('.') == std::string::npos ? path.size() : path.find_last_of('.')));
+		const bool loaded = (ext == ".dds") ? LoadDds(file.Data(), file.Size(), image, report.Error)
+			: LoadBmp(file.Data(), file.Size(), image, report.Error);
+		file.Close();
+		if (!loaded)
+			return;
+		report.Width = image.Width;
+		report.Height = image.Height;
+
+		const bool normalMap = IsNormalMap(path);
+		OutputFormat format = requested;
+		const bool blockAligned = (image.Width % 4 == 0) && (image.Height % 4 == 0);
+		if (format == OutputFormat::Auto) {
+			if (!blockAligned)
+				format = OutputFormat::RGBA;
+			else if (normalMap)
+				format = OutputFormat::BC5;
+			else
+				format = HasAlpha(image) ? OutputFormat::BC3 : OutputFormat::BC1;
+		}
+		else if (format != OutputFormat::RGBA && !blockAligned) {
+			report.Error = "block-compressed textures must be a multiple of 4 in width and height";
+			return;
+		}
+		report.Format = format;
+
+		const auto start = std::chrono::steady_clock::now();
+
+		/// 生成mip链
+		MipGenerator generator;
+		generator.SetThreadPool(&pool);
+		generator.SetSRGB(!normalMap);
+		generator.SetRenormalize(normalMap);
+		std::vector<MipGenerator::Level> levels;
+		generator.Generate(image.Pixels.data(), image.Width, image.Height, (size_t)image.Width * 4, levels, maxMips);
+		report.Mips = (uint32)levels.size();
+
+		DdsParser::Info info;
+		info.Dim = DdsParser::Dimension::Texture2D;
+		info.Width = image.Width;
+		info.Height = image.Height;
+		info.Depth = 1;
+		info.MipCount = report.Mips;
+		info.ArraySize = 1;
+		info.Format = ToDXGIFormat(format, srgb && !normalMap);
+
+		std::vector<uint8> output(DdsParser::HeaderSize);
+		if (DdsParser::WriteHeader(info, output.data(), output.size()) == 0) {
+			report.Error = "cannot write dds header";
+			return;
+		}
+
+		/// 逐级压缩, 再解码回来统计误差
+		const int channels = StoredChannels(format);
+		std::vector<uint8> rgba, decoded;
+		for (const MipGenerator::Level& level : levels) {
+			generator.ToRGBA8(level, rgba);
+			const size_t pitch = (size_t)level.Width * 4;
+			const size_t offset = output.size();
+			if (format == OutputFormat::RGBA) {
+				output.insert(output.end(), rgba.begin(), rgba.end());
+				continue;
+			}
+
+			const BlockCompressor::Format blockFormat = ToBlockFormat(format);
+			output.resize(offset + BlockCompressor::SurfaceSize(blockFormat, level.Width, level.Height));
+			BlockCompressor::Encode(blockFormat, rgba.data(), level.Width, level.Height, pitch, output.data() + offset, &pool);
+
+			decoded.resize(rgba.size());
+			BlockCompressor::Decode(blockFormat, output.data() + offset, level.Width, level.Height, decoded.data(), pitch, &pool);
+			for (size_t i = 0; i < rgba.size(); i += 4) {
+				for (int c = 0; c < channels; ++c) {
+					const double d = (double)rgba[i + c] - decoded[i + c];
+					report.SquaredError += d * d;
+				}
+			}
+			report.Samples += (uint64)level.Width * level.Height * channels;
+		}
+
+		const auto stop = std::chrono::steady_clock::now();
+		report.Milliseconds = std::chrono::duration<double, std::milli>(stop - start).count();
+
+		// 写出之前确认加载器能解析, 且数据恰好是完整的mip链
+		DdsParser::Info check;
+		if (DdsParser::ParseHeader(output.data(), output.size(), check) != DdsParser::Result::Ok ||
+			check.DataOffset + check.DataSize != output.size() || check.MipCount != info.MipCount) {
+			report.Error = "internal error: output does not parse";
+			return;
+		}
+
+		if (WriteOutput(outPath, output.data(), output.size(), report) && cache != nullptr)
+			cache->Store(cacheKey, output.data(), output.size());
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	OutputFormat format = OutputFormat::Auto;
+	bool srgb = false;
+	uint32 maxMips = 0;
+	unsigned int threads = 0;
+	std::string outDir = ".";
+	std::string cacheDir;
+	bool csv = false;
+	std::vector<std::string> inputs;
+
+	for (int i = 1; i < argc; ++i) {
+		if (argv[i][0] != '-') {
+			inputs.push_back(argv[i]);
+			continue;
+		}
+		if (i + 1 >= argc) {
+			std::fprintf(stderr, "missing value for %s\n", argv[i]);
+			return 1;
+		}
+		const char* value = argv[++i];
+		if (std::strcmp(argv[i - 1], "-format") == 0) {
+			if (!ParseFormat(value, format)) {
+				std::fprintf(stderr, "unknown format %s\n", value);
+				return 1;
+			}
+		}
+		else if (std::strcmp(argv[i - 1], "-srgb") == 0)
+			srgb = std::atoi(value) != 0;
+		else if (std::strcmp(argv[i - 1], "-mips") == 0)
+			maxMips = (uint32)std::max(0, std::atoi(value));
+		else if (std::strcmp(argv[i - 1], "-threads") == 0)
+			threads = (unsigned int)std::max(0, std::atoi(value));
+		else if (std::strcmp(argv[i - 1], "-out") == 0)
+			outDir = value;
+		else if (std::strcmp(argv[i - 1], "-cache") == 0)
+			cacheDir = value;
+		else if (std::strcmp(argv[i - 1], "-report") == 0)
+			csv = std::strcmp(value, "csv") == 0;
+		else {
+			std::fprintf(stderr, "unknown option %s\n", argv[i - 1]);
+			return 1;
+		}
+	}
+	if (inputs.empty()) {
+		std::fprintf(stderr, "usage: TextureBaker [-format auto|bc1|bc3|bc4|bc5|bc7|rgba] [-srgb 0|1] [-mips N] "
+			"[-threads N] [-out dir] [-cache dir] [-report table|csv] <input.bmp|input.dds>...\n");
+		return 1;
+	}
+
+	// 析构时写回缓存索引
+	std::unique_ptr<AssetCache> cache;
+	if (!cacheDir.empty()) {
+		cache.reset(new AssetCache(cacheDir));
+		if (!cache->IsOpen()) {
+			std::fprintf(stderr, "cannot open cache directory %s\n", cacheDir.c_str());
+			return 1;
+		}
+	}
+
+	std::unique_ptr<ThreadPool> ownPool;
+	if (threads > 0)
+		ownPool.reset(new ThreadPool(threads));
+	ThreadPool& pool = ownPool ? *ownPool : ThreadPool::Default();
+
+	if (csv)
+		std::printf("file,width,height,mips,format,input_bytes,output_bytes,ratio,psnr_db,ms,error\n");
+	else
+		std::printf("%-28s %6s %6s %4s %6s %10s %10s %6s %8s %8s\n",
+			"file", "width", "height", "mips", "format", "in bytes", "out bytes", "ratio", "psnr dB", "ms");
+
+	int failures = 0;
+	int cached = 0;
+	uint64 totalIn = 0, totalOut = 0;
+	for (const std::string& input : inputs) {
+		Report report;
+		Bake(input, outDir, format, srgb, maxMips, pool, cache.get(), report);
+
+		const std::string name = BaseName(input);
+		const double ratio = report.OutputBytes ? (double)report.InputBytes / report.OutputBytes : 0.0;
+		if (!report.Error.empty()) {
+			++failures;
+			if (csv)
+				std::printf("%s,,,,,%llu,,,,,%s\n", name.c_str(), (unsigned long long)report.InputBytes, report.Error.c_str());
+			else
+				std::printf("%-28s error: %s\n", name.c_str(), report.Error.c_str());
+			continue;
+		}
+
+		totalIn += report.InputBytes;
+		totalOut += report.OutputBytes;
+		cached += report.Cached ? 1 : 0;
+
+		// 取自缓存的结果没有误差统计
+		char psnr[32];
+		if (report.Cached)
+			std::snprintf(psnr, sizeof(psnr), "cached");
+		else
+			std::snprintf(psnr, sizeof(psnr), "%.2f", report.Psnr());
+		const char* rowFormat = csv ? "%s,%u,%u,%u,%s,%llu,%llu,%.2f,%s,%.1f,\n"
+			: "%-28s %6u %6u %4u %6s %10llu %10llu %6.2f %8s %8.1f\n";
+		std::printf(rowFormat, name.c_str(), report.Width, report.Height, report.Mips, FormatName(report.Format),
+			(unsigned long long)report.InputBytes, (unsigned long long)report.OutputBytes, ratio, psnr,
+			report.Milliseconds);
+	}
+
+	if (!csv && totalOut > 0)
+		std::printf("\n%zu files, %d failed, %d cached: %llu bytes -> %llu bytes\n", inputs.size(), failures, cached,
+			(unsigned long long)totalIn, (unsigned long long)totalOut);
+	return failures > 0 ? 2 : 0;
+}
@@ -0,0 +1,439 @@
+﻿//***************************************************************************************
+// WavesBench.cpp
+//
+// Waves求解器的离线性能测试: 按网格大小 x 扰动方式 x 算法 x 线程数扫描所有组合,
+// 输出每格点耗时(ns/cell), 吞吐(cells/s)与相对最少线程数的加速比/扩展效率.
+// 不创建窗口也不依赖D3D, 只用到Waves与ThreadPool, 可在没有GPU的Linux CI上运行:
+//   g++ -std=c++14 -O2 -pthread -I<DirectXMath>/Inc -I<DirectX-Headers>/include/wsl/stubs
+//       WavesBench.cpp ../../7_LandAndWaves/Waves.cpp ../../Common/ThreadPool.cpp -o WavesBench
+// (DirectXMath只需头文件; 非Windows平台要用DirectX-Headers里的sal.h桩)
+//
+// 用法:
+//   WavesBench [-sizes 256,512,...] [-threads 1,2,...] [-patterns rain,drop,...] [-modes fused,two-pass]
+//              [-activity on|off] [-steps N] [-repeat N] [-tile N] [-format table|csv|json] [-out file]
+//   -sizes     网格边长, 默认 256,512,1024,2048
+//   -threads   线程数(含主线程), 默认从1开始每次翻倍直到硬件线程数
+//   -patterns  扰动方式, 默认全部:
+//              calm  不扰动, 测空转开销
+//              drop  每64步在中心落一滴, 只有局部活跃
+//              rain  每步随机落一滴
+//              storm 每步随机落 边长/16 滴, 整个网格一直活跃
+//   -modes     fused(单遍算法) / two-pass(两遍算法), 默认两者都测
+//   -activity  是否开启活跃块跟踪, 默认on
+//   -steps     每次计时的步数, 默认按网格大小自动选取
+//   -repeat    每种配置重复计时的次数, 取中位数, 默认3
+//   -tile      单遍算法的列条带宽度, 默认用Waves的默认值
+//   -format    输出格式, 默认table
+//   -out       输出文件, 默认写到标准输出
+// ns/cell按网格全部内部格点计, 跳过的平静块也算在内, 因此能直接反映活跃块跟踪的收益;
+// updated为各步参与计算的块所占比例的平均值.
+//***************************************************************************************
+
+#include "../../7_LandAndWaves/Waves.h"
+#include "../../Common/ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const float TimeStep = 0.03f;
+
+	enum class Pattern
+	{
+		Calm,
+		Drop,
+		Rain,
+		Storm
+	};
+
+	enum class OutputFormat
+	{
+		Table,
+		Csv,
+		Json
+	};
+
+	const char* KernelName(Waves::Kernel kernel)
+	{
+		switch (kernel) {
+		case Waves::Kernel::SSE4: return "SSE4";
+		case Waves::Kernel::AVX2: return "AVX2";
+		case Waves::Kernel::NEON: return "NEON";
+		default: return "Scalar";
+		}
+	}
+
+	const char* PatternName(Pattern pattern)
+	{
+		switch (pattern) {
+		case Pattern::Calm: return "calm";
+		case Pattern::Drop: return "drop";
+		case Pattern::Rain: return "rain";
+		default: return "storm";
+		}
+	}
+
+	bool ParsePattern(const std::string& name, Pattern& pattern)
+	{
+		const Pattern all[] = { Pattern::Calm, Pattern::Drop, Pattern::Rain, Pattern::Storm };
+		for (Pattern p : all) {
+			if (name == PatternName(p)) {
+				pattern = p;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// 按逗号拆分
+	std::vector<std::string> Split(const char* text)
+	{
+		std::vector<std::string> items;
+		std::string item;
+		for (const char* c = text; ; ++c) {
+			if (*c == ',' || *c == '\0') {
+				if (!item.empty())
+					items.push_back(item);
+				item.clear();
+				if (*c == '\0')
+					break;
+			}
+			else {
+				item += *c;
+			}
+		}
+		return items;
+	}
+
+	std::string Number(const char* format, double value)
+	{
+		char text[64];
+		std::snprintf(text, sizeof(text), format, value);
+		return text;
+	}
+
+	struct Config
+	{
+		int Size = 0;
+		Pattern Wave = Pattern::Rain;
+		bool Fused = true;
+		unsigned int Threads = 1;
+	};
+
+	struct Sample
+	{
+		Config Setup;
+		int Steps = 0;
+		double NsPerCell = 0.0;
+		double CellsPerSecond = 0.0;
+		double UpdatedFraction = 0.0;
+		double Speedup = 1.0;	// 相对同一网格/扰动/算法下最少线程数的加速比
+		double Efficiency = 1.0;// 加速比 / 线程数之比
+	};
+
+	struct Options
+	{
+		std::vector<int> Sizes = { 256, 512, 1024, 2048 };
+		std::vector<unsigned int> Threads;
+		std::vector<Pattern> Patterns = { Pattern::Calm, Pattern::Drop, Pattern::Rain, Pattern::Storm };
+		std::vector<bool> Modes = { true, false };
+		bool Activity = true;
+		int Steps = 0;
+		int Repeat = 3;
+		int TileWidth = 0;
+		OutputFormat Output = OutputFormat::Table;
+		std::string Out;
+	};
+
+	// 按pattern扰动一步; 种子固定, 同一配置每次运行的波面完全相同
+	class Disturber
+	{
+	public:
+		Disturber(Waves& waves, Pattern pattern) : mWaves(waves), mPattern(pattern) {}
+
+		void Step()
+		{
+			const int size = mWaves.RowCount();
+			switch (mPattern) {
+			case Pattern::Calm:
+				break;
+			case Pattern::Drop:
+				if (mStep % 64 == 0)
+					mWaves.Disturb(size / 2, size / 2, 0.5f);
+				break;
+			case Pattern::Rain:
+				Random(size);
+				break;
+			case Pattern::Storm:
+				for (int k = 0; k < size / 16; ++k)
+					Random(size);
+				break;
+			}
+			++mStep;
+		}
+
+	private:
+		void Random(int size)
+		{
+			mSeed = mSeed * 1664525u + 1013904223u;
+			int i = 2 + (int)((mSeed >> 8) % (unsigned int)(size - 4));
+			int j = 2 + (int)((mSeed >> 20) % (unsigned int)(size - 4));
+			mWaves.Disturb(i, j, 0.5f);
+		}
+
+	private:
+		Waves& mWaves;
+		Pattern mPattern;
+		int mStep = 0;
+		unsigned int mSeed = 12345;
+	};
+
+	Sample Measure(const Config& config, const Options& options, ThreadPool& pool)
+	{
+		const int size = config.Size;
+		// 每次计时大约处理2^26个格点
+		const int steps = (options.Steps > 0) ? options.Steps : std::max(20, (1 << 26) / (size * size));
+		const int blockCount = ((size + Waves::ActivityBlockSize - 1) / Waves::ActivityBlockSize) *
+			((size + Waves::ActivityBlockSize - 1) / Waves::ActivityBlockSize);
+
+		std::vector<double> nsPerCell;
+		double updatedFraction = 0.0;
+		for (int r = 0; r < std::max(options.Repeat, 1); ++r) {
+			Waves waves(size, size, 1.0f, TimeStep, 4.0f, 0.2f);
+			waves.SetThreadPool(&pool);
+			waves.SetFusedUpdate(config.Fused);
+			waves.SetActivityTracking(options.Activity);
+			if (options.TileWidth > 0)
+				waves.SetTileWidth(options.TileWidth);
+
+			Disturber disturber(waves, config.Wave);
+			for (int s = 0; s < 10; ++s) {
+				disturber.Step();
+				waves.Update(TimeStep);
+			}
+
+			// 按实际执行的步数统计, 不依赖累加器的浮点误差
+			long long stepped = 0;
+			long long updatedBlocks = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (int s = 0; s < steps; ++s) {
+				disturber.Step();
+				waves.Update(TimeStep);
+				stepped += waves.LastSubstepCount();
+				updatedBlocks += (long long)waves.UpdatedBlockCount() * waves.LastSubstepCount();
+			}
+			auto stop = std::chrono::steady_clock::now();
+
+			const double cells = (double)(size - 2) * (size - 2) * std::max(stepped, 1LL);
+			const double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+			nsPerCell.push_back(ns / cells);
+			updatedFraction = (double)updatedBlocks / ((double)blockCount * std::max(stepped, 1LL));
+		}
+
+		std::sort(nsPerCell.begin(), nsPerCell.end());
+
+		Sample sample;
+		sample.Setup = config;
+		sample.Steps = steps;
+		sample.NsPerCell = nsPerCell[nsPerCell.size() / 2];
+		sample.CellsPerSecond = 1e9 / sample.NsPerCell;
+		sample.UpdatedFraction = updatedFraction;
+		return sample;
+	}
+
+	void WriteTable(std::ostream& out, const std::vector<Sample>& samples)
+	{
+		char line[256];
+		std::snprintf(line, sizeof(line), "%6s  %-6s  %-8s  %7s  %9s  %12s  %7s  %7s  %10s\n",
+			"grid", "wave", "mode", "threads", "ns/cell", "cells/s", "speedup", "eff", "updated");
+		out << line;
+		for (const Sample& s : samples) {
+			std::snprintf(line, sizeof(line), "%6d  %-6s  %-8s  %7u  %9.3f  %12.4g  %7.2f  %6.0f%%  %9.1f%%\n",
+				s.Setup.Size, PatternName(s.Setup.Wave), s.Setup.Fused ? "fused" : "two-pass", s.Setup.Threads,
+				s.NsPerCell, s.CellsPerSecond, s.Speedup, s.Efficiency * 100.0, s.UpdatedFraction * 100.0);
+			out << line;
+		}
+	}
+
+	void WriteCsv(std::ostream& out, const std::vector<Sample>& samples)
+	{
+		out << "grid,pattern,mode,threads,steps,ns_per_cell,cells_per_second,speedup,efficiency,updated_fraction\n";
+		for (const Sample& s : samples) {
+			out << s.Setup.Size << ',' << PatternName(s.Setup.Wave) << ',' << (s.Setup.Fused ? "fused" : "two-pass") << ','
+				<< s.Setup.Threads << ',' << s.Steps << ',' << Number("%.4f", s.NsPerCell) << ',' << Number("%.6g", s.CellsPerSecond) << ','
+				<< Number("%.4f", s.Speedup) << ',' << Number("%.4f", s.Efficiency) << ',' << Number("%.4f", s.UpdatedFraction) << '\n';
+		}
+	}
+
+	void WriteJson(std::ostream& out, const std::vector<Sample>& samples, const Options& options)
+	{
+		out << "{\n";
+		out << "  \"kernel\": \"" << KernelName(Waves::BestKernel()) << "\",\n";
+		out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+		out << "  \"activity_tracking\": " << (options.Activity ? "true" : "false") << ",\n";
+		out << "  \"results\": [\n";
+		for (size_t k = 0; k < samples.size(); ++k) {
+			const Sample& s = samples[k];
+			out << "    { \"grid\": " << s.Setup.Size
+				<< ", \"pattern\": \"" << PatternName(s.Setup.Wave) << "\""
+				<< ", \"mode\": \"" << (s.Setup.Fused ? "fused" : "two-pass") << "\""
+				<< ", \"threads\": " << s.Setup.Threads
+				<< ", \"steps\": " << s.Steps
+				<< ", \"ns_per_cell\": " << Number("%.4f", s.NsPerCell)
+				<< ", \"cells_per_second\": " << Number("%.6g", s.CellsPerSecond)
+				<< ", \"speedup\": " << Number("%.4f", s.Speedup)
+				<< ", \"efficiency\": " << Number("%.4f", s.Efficiency)
+				<< ", \"updated_fraction\": " << Number("%.4f", s.UpdatedFraction)
+				<< " }" << (k + 1 < samples.size() ? ",\n" : "\n");
+		}
+		out << "  ]\n";
+		out << "}\n";
+	}
+
+	bool ParseOptions(int argc, char* argv[], Options& options)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const char* name = argv[i];
+			if (i + 1 >= argc) {
+				std::fprintf(stderr, "missing value for %s\n", name);
+				return false;
+			}
+			const char* value = argv[++i];
+
+			if (std::strcmp(name, "-sizes") == 0) {
+				options.Sizes.clear();
+				for (const std::string& item : Split(value))
+					options.Sizes.push_back(std::max(8, std::atoi(item.c_str())));
+			}
+			else if (std::strcmp(name, "-threads") == 0) {
+				options.Threads.clear();
+				for (const std::string& item : Split(value))
+					options.Threads.push_back((unsigned int)std::max(1, std::atoi(item.c_str())));
+			}
+			else if (std::strcmp(name, "-patterns") == 0) {
+				options.Patterns.clear();
+				for (const std::string& item : Split(value)) {
+					Pattern pattern;
+					if (!ParsePattern(item, pattern)) {
+						std::fprintf(stderr, "unknown pattern: %s\n", item.c_str());
+						return false;
+					}
+					options.Patterns.push_back(pattern);
+				}
+			}
+			else if (std::strcmp(name, "-modes") == 0) {
+				options.Modes.clear();
+				for (const std::string& item : Split(value)) {
+					if (item != "fused" && item != "two-pass") {
+						std::fprintf(stderr, "unknown mode: %s\n", item.c_str());
+						return false;
+					}
+					options.Modes.push_back(item == "fused");
+				}
+			}
+			else if (std::strcmp(name, "-activity") == 0)
+				options.Activity = (std::strcmp(value, "off") != 0);
+			else if (std::strcmp(name, "-steps") == 0)
+				options.Steps = std::atoi(value);
+			else if (std::strcmp(name, "-repeat") == 0)
+				options.Repeat = std::atoi(value);
+			else if (std::strcmp(name, "-tile") == 0)
+				options.TileWidth = std::atoi(value);
+			else if (std::strcmp(name, "-format") == 0) {
+				if (std::strcmp(value, "csv") == 0)
+					options.Output = OutputFormat::Csv;
+				else if (std::strcmp(value, "json") == 0)
+					options.Output = OutputFormat::Json;
+				else
+					options.Output = OutputFormat::Table;
+			}
+			else if (std::strcmp(name, "-out") == 0)
+				options.Out = value;
+			else {
+				std::fprintf(stderr, "unknown option: %s\n", name);
+				return false;
+			}
+		}
+
+		if (options.Threads.empty()) {
+			const unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+			for (unsigned int t = 1; t < hardware; t *= 2)
+				options.Threads.push_back(t);
+			options.Threads.push_back(hardware);
+		}
+		return !options.Sizes.empty() && !options.Patterns.empty() && !options.Modes.empty();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+		return 1;
+
+	// 每种线程数各建一个线程池, 整个扫描过程中复用
+	std::vector<std::unique_ptr<ThreadPool>> pools;
+	for (unsigned int threads : options.Threads)
+		pools.push_back(std::make_unique<ThreadPool>(threads));
+
+	std::vector<Sample> samples;
+	for (int size : options.Sizes) {
+		for (Pattern pattern : options.Patterns) {
+			for (bool fused : options.Modes) {
+				const size_t first = samples.size();
+				for (size_t t = 0; t < pools.size(); ++t) {
+					Config config;
+					config.Size = size;
+					config.Wave = pattern;
+					config.Fused = fused;
+					config.Threads = pools[t]->ThreadCount();
+					samples.push_back(Measure(config, options, *pools[t]));
+
+					// 以本组第一个(线程数最少的)配置为基准
+					Sample& base = samples[first];
+					Sample& sample = samples.back();
+					sample.Speedup = base.NsPerCell / sample.NsPerCell;
+					sample.Efficiency = sample.Speedup * base.Setup.Threads / sample.Setup.Threads;
+
+					if (!options.Out.empty() || options.Output != OutputFormat::Table)
+						std::fprintf(stderr, "grid %d %s %s threads %u: %.3f ns/cell\n", size, PatternName(pattern),
+							fused ? "fused" : "two-pass", config.Threads, sample.NsPerCell);
+				}
+			}
+		}
+	}
+
+	std::ofstream file;
+	if (!options.Out.empty()) {
+		file.open(options.Out);
+		if (!file) {
+			std::fprintf(stderr, "cannot open %s\n", options.Out.c_str());
+			return 1;
+		}
+	}
+	std::ostream& out = options.Out.empty() ? std::cout : file;
+
+	switch (options.Output) {
+	case OutputFormat::Csv:
+		WriteCsv(out, samples);
+		break;
+	case OutputFormat::Json:
+		WriteJson(out, samples, options);
+		break;
+	default:
+		out << "kernel: " << KernelName(Waves::BestKernel()) << ", hardware threads: " << std::thread::hardware_concurrency()
+			<< ", activity tracking: " << (options.Activity ? "on" : "off") << "\n\n";
+		WriteTable(out, samples);
+		break;
+	}
+	return 0;
+}